@@ -0,0 +1,48 @@
+`timescale 1ns / 1ps
+
+/* Verilator top for src/cosim.cc: Hsa's ports, plus its
+ * latches brought out so they can be compared against the
+ * C++ model every cycle (reset is tied off, it is unused). */
+module HsaCosim #(parameter SIZE = 2, BIT_WIDTH = 16) (
+    input clk,
+    input en,
+    input wEn,
+    input hsa_mode,                                     // 0 = vector, 1 = matrix
+    input [BIT_WIDTH-1:0] weights [SIZE-1:0],
+    input [$clog2(SIZE)-1:0] weight_col_ix,
+    input [$clog2(SIZE)-1:0] weight_row_ix,
+    input [BIT_WIDTH-1:0] activation [SIZE-1:0],
+    input [$clog2(SIZE)-1:0] act_col_ix,
+    input [31:0] cycle_ctr,
+    output [BIT_WIDTH-1:0] result [SIZE-1:0],
+    output [BIT_WIDTH-1:0] psum_latches [SIZE-1:0][SIZE-1:0],   // Hsa left_latches
+    output [BIT_WIDTH-1:0] act_latches [SIZE-1:0][SIZE-1:0]     // Hsa top_latches
+);
+    wire [BIT_WIDTH-1:0] my_weights [SIZE-1:0][SIZE-1:0];
+
+    Hsa #(.SIZE(SIZE), .BIT_WIDTH(BIT_WIDTH)) dut(
+        .weights(weights),
+        .weight_col_ix(weight_col_ix),
+        .weight_row_ix(weight_row_ix),
+        .wEn(wEn),
+        .en(en),
+        .reset(1'b0),
+        .clk(clk),
+        .hsa_mode(hsa_mode),
+        .activation(activation),
+        .act_col_ix(act_col_ix),
+        .cycle_ctr(cycle_ctr),
+        .my_weights(my_weights),
+        .result(result)
+    );
+
+    genvar i, j;
+    generate
+        for (i = 0; i < SIZE; i = i + 1) begin : row
+            for (j = 0; j < SIZE; j = j + 1) begin : col
+                assign psum_latches[i][j] = dut.left_latches[i][j];
+                assign act_latches[i][j] = dut.top_latches[i][j];
+            end
+        end
+    endgenerate
+endmodule
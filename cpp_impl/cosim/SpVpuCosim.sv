@@ -0,0 +1,40 @@
+`timescale 1ns / 1ps
+
+/* Verilator top for src/cosim.cc: SpVpu's ports, plus its
+ * psum latches brought out (reset is tied off, it is unused). */
+module SpVpuCosim #(parameter SIZE = 4, BIT_WIDTH = 16) (
+    input clk,
+    input en,
+    input wEn,
+    input [BIT_WIDTH-1:0] weights [SIZE-1:0],
+    input weight_parity_tags [SIZE-1:0],
+    input [$clog2(SIZE)-1:0] weight_col_ix,
+    input [BIT_WIDTH-1:0] activation_even,
+    input [BIT_WIDTH-1:0] activation_odd,
+    input [$clog2(SIZE)-1:0] act_col_ix,
+    output [BIT_WIDTH-1:0] result [SIZE-1:0],
+    output [BIT_WIDTH-1:0] psum_latches [SIZE-1:0][SIZE/2-1:0]  // SpVpu left_latches
+);
+    SpVpu #(.SIZE(SIZE), .BIT_WIDTH(BIT_WIDTH)) dut(
+        .weights(weights),
+        .weight_parity_tags(weight_parity_tags),
+        .weight_col_ix(weight_col_ix),
+        .wEn(wEn),
+        .en(en),
+        .reset(1'b0),
+        .clk(clk),
+        .activation_even(activation_even),
+        .activation_odd(activation_odd),
+        .act_col_ix(act_col_ix),
+        .result(result)
+    );
+
+    genvar i, j;
+    generate
+        for (i = 0; i < SIZE; i = i + 1) begin : row
+            for (j = 0; j < SIZE/2; j = j + 1) begin : col
+                assign psum_latches[i][j] = dut.left_latches[i][j];
+            end
+        end
+    endgenerate
+endmodule
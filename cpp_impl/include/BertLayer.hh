@@ -0,0 +1,180 @@
+#ifndef __BERT_LAYER_HH__
+#define __BERT_LAYER_HH__
+
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "HsaGemm.hh"
+#include "MpuGemm.hh"
+#include "Matrix.hh"
+#include "Npy.hh"
+
+/*- BERT encoder layer workload *-/
+ * mac_t should be a mac_t_p<b>
+ *
+ * The six weight GEMMs of one BERT encoder layer,
+ * scheduled onto an NxN Hsa through HsaGemm:
+ *   Q/K/V projections   : X (Lx768)   * W (768x768)
+ *   attention output    : ctx (Lx768) * W (768x768)
+ *   FFN intermediate    : h (Lx768)   * W (768x3072)
+ *   FFN output          : a (Lx3072)  * W (3072x768)
+ * L being the sequence length, which picks MMM/MVM.
+ *
+ * Only the GEMMs run on the array. Softmax(QK^T)V,
+ * layernorm, residuals and GELU are not modelled, so
+ * each GEMM's input is chained from the previous result
+ * of the right shape (ctx := X, h := attention output,
+ * a := intermediate). Cycle counts only depend on shapes
+ * so this doesn't matter for capacity planning; if real
+ * FFN activations are available (get_bert_act.py) they
+ * can be passed in for the last GEMM instead.
+ */
+template <typename mac_t>
+struct BertLayerWeights
+{
+    /* All stored as in x out (KxN'), i.e. transposed
+     * with respect to torch's nn.Linear weight */
+    Matrix<mac_t> query, key, value, attention_output, intermediate, output;
+
+    static Matrix<mac_t> random_matrix(uint64_t rows, uint64_t cols, std::mt19937_64& rng)
+    {
+        Matrix<mac_t> ret(rows, cols);
+        for (mac_t& v : ret.data)
+            v.value = rng();
+        return ret;
+    }
+
+    static BertLayerWeights random(uint64_t hidden = 768, uint64_t inter = 3072,
+            uint64_t seed = 0)
+    {
+        std::mt19937_64 rng(seed);
+        BertLayerWeights w;
+        w.query            = random_matrix(hidden, hidden, rng);
+        w.key              = random_matrix(hidden, hidden, rng);
+        w.value            = random_matrix(hidden, hidden, rng);
+        w.attention_output = random_matrix(hidden, hidden, rng);
+        w.intermediate     = random_matrix(hidden, inter, rng);
+        w.output           = random_matrix(inter, hidden, rng);
+        return w;
+    }
+
+    /* Loads <dir>/<name>.npy for each of query, key, value,
+     * attention_output, intermediate and output, in nn.Linear
+     * (out x in) layout as get_bert.py saves them. Anything
+     * missing keeps its random BERT-base shaped stand-in.
+     * Returns the names that were actually loaded.
+     * */
+    std::vector<std::string> load(const std::string& dir)
+    {
+        std::vector<std::string> loaded;
+        std::pair<const char *, Matrix<mac_t> *> files[] = {
+            {"query", &query}, {"key", &key}, {"value", &value},
+            {"attention_output", &attention_output},
+            {"intermediate", &intermediate}, {"output", &output}
+        };
+        for (auto& [name, mat] : files)
+        {
+            std::string path = dir + "/" + name + ".npy";
+            if (!std::filesystem::exists(path)) continue;
+            *mat = load_linear(path);
+            loaded.push_back(name);
+        }
+        return loaded;
+    }
+
+    static Matrix<mac_t> load_linear(const std::string& path)
+    {
+        return to_matrix<mac_t>(load_npy(path)).transposed();
+    }
+};
+
+struct BertLayerReport
+{
+    std::vector<GemmStats> gemms;
+    uint64_t cycles;
+    uint64_t macs;
+    uint64_t writebacks;
+    double utilization;
+};
+
+template <typename mac_t, uint64_t N>
+class BertLayer
+{
+private:
+    BertLayerWeights<mac_t> weights;
+
+public:
+    /* Result tensors, valid after run() with simulate on */
+    Matrix<mac_t> Q, K, V, attention_output, intermediate, output;
+
+    BertLayer(const BertLayerWeights<mac_t>& weights_p) : weights(weights_p) {}
+
+    /* X is the LxHidden layer input, ffn_acts optionally the
+     * LxInter input of the FFN output GEMM (nullptr = chain).
+     * simulate = false only computes the schedule analytically,
+     * which is what to use for full-size sweeps. threads > 1
+     * pipelines each GEMM's tiles (see HsaGemm::run()) of
+     * the tiled flow, flow picks how the GEMMs are fed to
+     * the array (see HsaGemm.hh), output_stationary running
+ * them on an NxN Mpu instead (MpuGemm.hh).
+     * */
+    BertLayerReport run(const Matrix<mac_t>& X, const Matrix<mac_t> *ffn_acts = nullptr,
+            bool simulate = true, uint64_t threads = 1, GemmFlow flow = GemmFlow::tiled)
+    {
+        typedef HsaGemm<mac_t, N> gemm_t;
+        bool MVM_enable = gemm_t::choose_MVM(X.rows);
+
+        struct Step
+        {
+            const char *name;
+            const Matrix<mac_t> *in;
+            const Matrix<mac_t> *w;
+            Matrix<mac_t> *out;
+        };
+        Step steps[] = {
+            {"query",            &X,                &weights.query,            &Q},
+            {"key",              &X,                &weights.key,              &K},
+            {"value",            &X,                &weights.value,            &V},
+            {"attention_output", &X,                &weights.attention_output, &attention_output},
+            {"intermediate",     &attention_output, &weights.intermediate,     &intermediate},
+            {"output",           ffn_acts ? ffn_acts : &intermediate, &weights.output, &output},
+        };
+
+        BertLayerReport report;
+        report.cycles = 0;
+        report.macs = 0;
+        report.writebacks = 0;
+        for (Step& st : steps)
+        {
+            if (simulate && (st.in->cols != st.w->rows || st.in->rows != X.rows))
+                throw std::runtime_error(std::string("bert: shape mismatch on ") + st.name);
+            GemmStats s;
+            if (flow == GemmFlow::output_stationary)
+                s = simulate ? MpuGemm<mac_t, N>::run(st.name, *st.in, *st.w, *st.out)
+                             : MpuGemm<mac_t, N>::analyse(st.name, X.rows, st.w->rows, st.w->cols);
+            else if (!simulate)
+                s = gemm_t::analyse(st.name, X.rows, st.w->rows, st.w->cols, MVM_enable, flow);
+            else if (flow == GemmFlow::chained)
+                s = gemm_t::run_chained(st.name, *st.in, *st.w, *st.out, MVM_enable);
+            else if (flow == GemmFlow::resident)
+                s = gemm_t::run_resident(st.name, *st.in, *st.w, *st.out, MVM_enable);
+            else if (flow == GemmFlow::streamed)
+                s = gemm_t::stream(st.name, *st.in, *st.w, *st.out, MVM_enable);
+            else
+                s = gemm_t::run(st.name, *st.in, *st.w, *st.out, MVM_enable, threads);
+            report.cycles += s.cycles;
+            report.macs += s.macs;
+            report.writebacks += s.writebacks;
+            report.gemms.push_back(s);
+        }
+        report.utilization = report.cycles ?
+            (double)report.macs / (double)(N * N * report.cycles) : 0.0;
+        return report;
+    }
+};
+
+#endif
@@ -0,0 +1,227 @@
+#ifndef __BULK_FRAME_HH__
+#define __BULK_FRAME_HH__
+
+#include <cstdint>
+#include <vector>
+
+#include "LinkCodec.hh"
+
+/*- Bulk transfer frames *-/
+ * The legacy dataframe (see UartHost.hh) spends 32 bits
+ * on every 16 bit value. A bulk frame carries a whole
+ * request (or result) instead:
+ *
+ *   byte 0       0xB5 (msb set, so a legacy receiver
+ *                never mistakes it for a dataframe)
+ *   byte 1       kind (0 request, 1 result) | vector_mode << 4
+ *                | codec flags (BULK_PAIR_WEIGHTS, BULK_RLE_VALUES)
+ *   byte 2       bits per element
+ *   byte 3       version (2)
+ *   bytes 4-5    n     (u16)
+ *   bytes 6-7    cols  (u16) of acts/result: 1 (MVM) or n
+ *   bytes 8-11   tile id (u32), echoed back in the result
+ *   bytes 12-15  payload size in bytes (u32)
+ *   payload      request: weights n x n, then acts n x cols
+ *                result:  result n x cols
+ *                row major, sram indexing ([y][x]), packed
+ *                back to back at `bits` bits, LSB first,
+ *                or through the codecs (LinkCodec.hh):
+ *                weights pair packed, acts/results zero
+ *                run length
+ *   2 bytes      CRC-16/CCITT of header + payload
+ *   padding      zeros up to a multiple of 4 bytes, so the
+ *                frame still fills whole receiver words
+ *
+ * All multi-byte fields are little endian, and the whole
+ * thing is a plain byte stream in both directions.
+ *
+ * Negotiation (host side in UartHost, board side in
+ * FpgaEmulator): after the 1st ack the host sends
+ * BULK_HELLO instead of the legacy magic. A bulk capable
+ * board answers BULK_ACK and expects a bulk request (NAK
+ * on a bad checksum), and later loops over the bulk result
+ * instead of per-element frames. A legacy board just keeps
+ * waiting for its magic, so on no answer the host sends
+ * the legacy magic and frames as before.
+ *
+ * The header and CRC make a bulk result bigger than the
+ * 4 bytes a value of the legacy result frames for the
+ * smallest tiles (MVM up to n = 8, MMM at n = 2), so
+ * those stay on the legacy result frames even in bulk
+ * mode (bulk_result_pays()). Both ends decide from the
+ * request's shape alone, so they always agree.
+ */
+constexpr uint8_t BULK_START = 0xB5;
+constexpr uint8_t BULK_VERSION = 2;
+constexpr uint32_t BULK_HELLO = 0xda221db5;
+constexpr uint32_t BULK_ACK = 0xB5B5B5B5;
+constexpr uint32_t BULK_NAK = 0xEEEEEEEE;
+constexpr uint64_t BULK_HEADER_BYTES = 16;
+
+/* Codec flags, in the upper bits of byte 1 */
+constexpr uint8_t BULK_PAIR_WEIGHTS = 0x20;
+constexpr uint8_t BULK_RLE_VALUES = 0x40;
+
+enum BulkKind
+{
+    BULK_REQUEST = 0,
+    BULK_RESULT = 1
+};
+
+struct BulkHeader
+{
+    BulkKind kind = BULK_REQUEST;
+    bool vector_mode = true;
+    uint64_t bits = 16;
+    uint64_t n = 0;
+    uint64_t cols = 0;
+    uint32_t tile_id = 0;
+    uint8_t codec = 0;      // allowed (encode) / used (decode)
+};
+
+enum BulkStatus
+{
+    BULK_OK,
+    BULK_SHORT,     // looks fine so far, need more bytes
+    BULK_BAD        // not a bulk frame / bad checksum
+};
+
+inline uint16_t crc16_ccitt(const uint8_t *buf, uint64_t len, uint16_t crc = 0xFFFF)
+{
+    for (uint64_t i = 0; i < len; i++)
+    {
+        crc ^= (uint16_t)buf[i] << 8;
+        for (int b = 0; b < 8; b++)
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+inline uint64_t bulk_elems(const BulkHeader& h)
+{
+    return (h.kind == BULK_REQUEST ? h.n*h.n : 0) + h.n*h.cols;
+}
+
+inline uint64_t bulk_pad(uint64_t payload)
+{
+    return (BULK_HEADER_BYTES + payload + 2 + 3) & ~(uint64_t)3;
+}
+
+/* Whole frame, padding included, without any codec
+ * (so the most a frame for h can take) */
+inline uint64_t bulk_frame_bytes(const BulkHeader& h)
+{
+    return bulk_pad((bulk_elems(h)*h.bits + 7) / 8);
+}
+
+/* Whether an n x cols result goes back as a bulk frame
+ * (16 bit values, no codec) rather than legacy frames */
+inline bool bulk_result_pays(uint64_t n, uint64_t cols)
+{
+    BulkHeader h;
+    h.kind = BULK_RESULT;
+    h.n = n;
+    h.cols = cols;
+    return bulk_frame_bytes(h) < 4*n*cols;
+}
+
+/* out must hold bulk_frame_bytes(h), elems bulk_elems(h)
+ * values (truncated to h.bits). h.codec says which codecs
+ * may be used, each is only used where it fits and saves
+ * bits. Returns the frame size. */
+inline uint64_t bulk_encode(const BulkHeader& h, const uint64_t *elems, uint8_t *out)
+{
+    uint64_t nw = h.kind == BULK_REQUEST ? h.n*h.n : 0;
+    uint64_t nv = h.n*h.cols;
+    const uint64_t *vals = elems + nw;
+    uint8_t codec = 0;
+    if ((h.codec & BULK_PAIR_WEIGHTS) && nw && pair_packable(elems, h.n, h.n, h.bits) &&
+            pair_packed_bits(h.n, h.n, h.bits) < nw*h.bits)
+        codec |= BULK_PAIR_WEIGHTS;
+    if ((h.codec & BULK_RLE_VALUES) && rle_bits(vals, nv, h.bits) < nv*h.bits)
+        codec |= BULK_RLE_VALUES;
+
+    BitWriter w(out + BULK_HEADER_BYTES);
+    if (codec & BULK_PAIR_WEIGHTS)
+        put_pair_packed(w, elems, h.n, h.n, h.bits);
+    else
+        put_raw(w, elems, nw, h.bits);
+    if (codec & BULK_RLE_VALUES)
+        put_rle(w, vals, nv, h.bits);
+    else
+        put_raw(w, vals, nv, h.bits);
+    uint8_t *p = w.finish();
+    uint64_t payload = p - out - BULK_HEADER_BYTES;
+
+    uint8_t *q = out;
+    *q++ = BULK_START;
+    *q++ = (uint8_t)(h.kind | (h.vector_mode ? 0x10 : 0) | codec);
+    *q++ = (uint8_t)h.bits;
+    *q++ = BULK_VERSION;
+    *q++ = (uint8_t)h.n;
+    *q++ = (uint8_t)(h.n >> 8);
+    *q++ = (uint8_t)h.cols;
+    *q++ = (uint8_t)(h.cols >> 8);
+    for (int i = 0; i < 4; i++)
+        *q++ = (uint8_t)(h.tile_id >> (8*i));
+    for (int i = 0; i < 4; i++)
+        *q++ = (uint8_t)(payload >> (8*i));
+
+    uint16_t crc = crc16_ccitt(out, p - out);
+    *p++ = (uint8_t)crc;
+    *p++ = (uint8_t)(crc >> 8);
+    uint64_t len = bulk_pad(payload);
+    while ((uint64_t)(p - out) < len)
+        *p++ = 0;
+    return len;
+}
+
+/* Decodes a frame starting at in[0]. On BULK_OK, h (with
+ * the codecs actually used) and elems are filled and
+ * consumed is the frame size. */
+inline BulkStatus bulk_decode(const uint8_t *in, uint64_t len, BulkHeader& h,
+        std::vector<uint64_t>& elems, uint64_t& consumed)
+{
+    if (len < 1) return BULK_SHORT;
+    if (in[0] != BULK_START) return BULK_BAD;
+    if (len < BULK_HEADER_BYTES) return BULK_SHORT;
+    if ((in[1] & 0x0f) > BULK_RESULT || in[3] != BULK_VERSION || in[2] == 0 || in[2] > 64)
+        return BULK_BAD;
+    h.kind = (BulkKind)(in[1] & 0x0f);
+    h.vector_mode = in[1] & 0x10;
+    h.codec = in[1] & (BULK_PAIR_WEIGHTS | BULK_RLE_VALUES);
+    h.bits = in[2];
+    h.n = in[4] | (uint64_t)in[5] << 8;
+    h.cols = in[6] | (uint64_t)in[7] << 8;
+    h.tile_id = 0;
+    uint64_t payload = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        h.tile_id |= (uint32_t)in[8+i] << (8*i);
+        payload |= (uint64_t)in[12+i] << (8*i);
+    }
+    if (h.n == 0 || h.n > 128 || (h.cols != 1 && h.cols != h.n) ||
+            payload > (bulk_elems(h)*h.bits + 7) / 8)
+        return BULK_BAD;
+
+    uint64_t frame = bulk_pad(payload);
+    if (len < frame) return BULK_SHORT;
+    uint64_t body = BULK_HEADER_BYTES + payload;
+    uint16_t crc = in[body] | (uint16_t)in[body+1] << 8;
+    if (crc16_ccitt(in, body) != crc)
+        return BULK_BAD;
+
+    uint64_t nw = h.kind == BULK_REQUEST ? h.n*h.n : 0;
+    elems.assign(bulk_elems(h), 0);
+    BitReader r(in + BULK_HEADER_BYTES, payload);
+    bool ok = h.codec & BULK_PAIR_WEIGHTS ? nw && h.n % 2 == 0 && get_pair_packed(r, elems.data(), h.n, h.n, h.bits)
+                                          : get_raw(r, elems.data(), nw, h.bits);
+    ok = ok && (h.codec & BULK_RLE_VALUES ? get_rle(r, elems.data() + nw, h.n*h.cols, h.bits)
+                                          : get_raw(r, elems.data() + nw, h.n*h.cols, h.bits));
+    if (!ok)
+        return BULK_BAD;
+    consumed = frame;
+    return BULK_OK;
+}
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef __CHECKPOINT_HH__
+#define __CHECKPOINT_HH__
+
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "mac_t.hh"
+
+/*- Unit checkpoints *-/
+ * Binary snapshot of the complete state of a unit
+ * (counter, latches, MAC weights/accumulators, srams
+ * and result), so a run can be stopped and resumed,
+ * or forked from a mid-run state.
+ *
+ * Layout (all integers little endian):
+ *   magic    "ECE552CK"
+ *   u32      version
+ *   u8 + ..  unit tag (length, chars), e.g. "hsa"
+ *   u64      N
+ *   u8       mac_t bit width
+ *   fields   in the order the unit's save_state()
+ *            writes them; a mac_t takes ceil(bits/8)
+ *            bytes, a bool one byte, a uint64_t eight.
+ *
+ * Version 1 snapshots also had each unit's bool
+ * enabled[][] right after the counter, which the units
+ * now look up in their EnableSchedule; they still
+ * restore (version() tells load_state() to skip it).
+ * Version 3 added hsa/mpuhsa weight residency (Hsa.hh)
+ * after their operands, older ones restore as not
+ * resident. Version 4 added their psum-in port after
+ * that, older ones restore with it closed. Version 5
+ * added mpu's K streaming (Mpu.hh) after its operands,
+ * older ones restore as not streaming. Version 6 added
+ * whether hsa/mpuhsa's psums came from chain(), older
+ * ones restore them as load_psums()ed.
+ *
+ * Restoring checks the tag, N and bit width, so a
+ * snapshot can only go back into the same kind of
+ * unit, and throws std::runtime_error otherwise (or
+ * on a truncated file).
+ */
+class CheckpointWriter
+{
+private:
+    std::ostream& os;
+
+    void bytes(uint64_t v, uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; i++)
+            os.put((char)(v >> (8*i)));
+    }
+public:
+    static constexpr const char *MAGIC = "ECE552CK";
+    static constexpr uint32_t VERSION = 6;
+
+    CheckpointWriter(std::ostream& os_p) : os(os_p) {}
+
+    template <typename mac_t>
+    void begin(const std::string& unit, uint64_t N)
+    {
+        os.write(MAGIC, 8);
+        bytes(VERSION, 4);
+        bytes(unit.size(), 1);
+        os.write(unit.data(), unit.size());
+        bytes(N, 8);
+        bytes(mac_t::BITS, 1);
+    }
+
+    void put(uint64_t v) { bytes(v, 8); }
+    void put(bool v) { bytes(v ? 1 : 0, 1); }
+
+    template <uint8_t BitWidth>
+    void put(const mac_t_p<BitWidth>& v)
+    {
+        bytes(v.value, (BitWidth + 7) / 8);
+    }
+
+    template <typename A, typename B>
+    void put(const std::pair<A, B>& v)
+    {
+        put(v.first);
+        put(v.second);
+    }
+
+    /* Anything with its own save_state(), i.e. the MACs */
+    template <typename T>
+    auto put(const T& v) -> decltype(v.save_state(*this))
+    {
+        v.save_state(*this);
+    }
+
+    /* Arrays (of arrays) element by element, row major */
+    template <typename T, uint64_t n>
+    void put(const T (&arr)[n])
+    {
+        for (uint64_t i = 0; i < n; i++)
+            put(arr[i]);
+    }
+
+    bool good()
+    {
+        return (bool)os;
+    }
+};
+
+class CheckpointReader
+{
+private:
+    std::istream& is;
+    uint64_t ver = CheckpointWriter::VERSION;
+
+    uint64_t bytes(uint64_t n)
+    {
+        uint64_t v = 0;
+        for (uint64_t i = 0; i < n; i++)
+        {
+            int c = is.get();
+            if (c == EOF)
+                throw std::runtime_error("checkpoint: truncated snapshot");
+            v |= (uint64_t)(uint8_t)c << (8*i);
+        }
+        return v;
+    }
+public:
+    CheckpointReader(std::istream& is_p) : is(is_p) {}
+
+    template <typename mac_t>
+    void begin(const std::string& unit, uint64_t N)
+    {
+        char magic[8];
+        if (!is.read(magic, 8) || std::string(magic, 8) != CheckpointWriter::MAGIC)
+            throw std::runtime_error("checkpoint: not a checkpoint");
+        ver = bytes(4);
+        if (ver < 1 || ver > CheckpointWriter::VERSION)
+            throw std::runtime_error("checkpoint: unsupported version " + std::to_string(ver));
+        std::string tag(bytes(1), '\0');
+        if (!is.read(tag.data(), tag.size()))
+            throw std::runtime_error("checkpoint: truncated snapshot");
+        uint64_t n = bytes(8), bits = bytes(1);
+        if (tag != unit || n != N || bits != mac_t::BITS)
+            throw std::runtime_error("checkpoint: snapshot of " + tag + " N=" + std::to_string(n) +
+                    " bits=" + std::to_string(bits) + ", restoring into " + unit + " N=" +
+                    std::to_string(N) + " bits=" + std::to_string(mac_t::BITS));
+    }
+
+    /* Of the snapshot being read */
+    uint64_t version() const { return ver; }
+
+    /* Reads a T and drops it, for fields older versions had */
+    template <typename T>
+    void skip()
+    {
+        T v;
+        get(v);
+    }
+
+    void get(uint64_t& v) { v = bytes(8); }
+    void get(bool& v) { v = bytes(1) != 0; }
+
+    template <uint8_t BitWidth>
+    void get(mac_t_p<BitWidth>& v)
+    {
+        v.value = bytes((BitWidth + 7) / 8);
+    }
+
+    template <typename A, typename B>
+    void get(std::pair<A, B>& v)
+    {
+        get(v.first);
+        get(v.second);
+    }
+
+    template <typename T>
+    auto get(T& v) -> decltype(v.load_state(*this))
+    {
+        v.load_state(*this);
+    }
+
+    template <typename T, uint64_t n>
+    void get(T (&arr)[n])
+    {
+        for (uint64_t i = 0; i < n; i++)
+            get(arr[i]);
+    }
+};
+
+/* File helpers, unit_t being any unit with save_state()/load_state() */
+template <typename unit_t>
+void save_checkpoint(const std::string& path, unit_t& unit)
+{
+    std::ofstream f(path, std::ios::binary);
+    CheckpointWriter ck(f);
+    unit.save_state(ck);
+    if (!ck.good())
+        throw std::runtime_error("checkpoint: unable to write " + path);
+}
+
+template <typename unit_t>
+void load_checkpoint(const std::string& path, unit_t& unit)
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f)
+        throw std::runtime_error("checkpoint: unable to open " + path);
+    CheckpointReader ck(f);
+    unit.load_state(ck);
+}
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef __DRAIN_STAGE_HH__
+#define __DRAIN_STAGE_HH__
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+#include "Checkpoint.hh"
+
+/*- Output drain of the weight stationary arrays *-/
+ * mac_t should be a mac_t_p<b>
+ *
+ * Collects the MMM outputs of an RxC Hsa/MpuHsa leaving
+ * its bottom row. PE(R-1, j) is enabled in cycles
+ * R-1+j .. R-1+j+C-1, its s-th output being the psum of
+ * the s-th streamed acts row, and the array streams the
+ * acts rows last first (acts_sram is shifted right and
+ * read from col C-1). So the output seen at cycle t in
+ * col j is result[C-1-s][j], s = t-(R-1+j), and it is
+ * written straight there, no reordering afterwards.
+ *
+ * Row r is complete once col C-1 delivered it, at cycle
+ * R+2C-3-r, so rows drain C-1 first, one per cycle from
+ * cycle R+C-2 on. The row callback (if set) gets each
+ * row as soon as it is complete, from inside clock(),
+ * so a consumer can start on it while the rest drains.
+ */
+template <typename mac_t, uint64_t R, uint64_t C>
+class DrainStage
+{
+public:
+    typedef std::function<void(uint64_t row, const mac_t *values)> row_callback;
+
+private:
+    mac_t result[C][C];
+    row_callback on_row;
+
+public:
+    DrainStage()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        for (uint64_t i = 0; i < C; i++)
+            for (uint64_t j = 0; j < C; j++)
+                result[i][j] = mac_t::ZERO;
+    }
+
+    void set_row_callback(row_callback cb)
+    {
+        on_row = std::move(cb);
+    }
+
+    /* psum leaving PE(R-1, j) at the given cycle (the
+     * counter before it is incremented) */
+    void capture(uint64_t cycle, uint64_t j, const mac_t& psum)
+    {
+        uint64_t row = C-1 - (cycle - (R-1+j));
+        result[row][j] = psum;
+        if (j == C-1 && on_row)
+            on_row(row, result[row]);
+    }
+
+    const mac_t *row(uint64_t i) const
+    {
+        return result[i];
+    }
+
+    void get(mac_t out[][C]) const
+    {
+        for (uint64_t i = 0; i < C; i++)
+            memcpy(out[i], result[i], C*sizeof(mac_t));
+    }
+
+    /* Same layout as the plain result array the units
+     * used to checkpoint */
+    void save_state(CheckpointWriter& ck) const
+    {
+        ck.put(result);
+    }
+
+    void load_state(CheckpointReader& ck)
+    {
+        ck.get(result);
+    }
+};
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef __ENABLE_SCHEDULE_HH__
+#define __ENABLE_SCHEDULE_HH__
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+/*- Per cycle enable schedules *-/
+ * Every unit enables PE(i, j) over one known window of
+ * cycles (its pe_window()). An EnableSchedule turns the
+ * windows of an RxC array into one bitmask per row per
+ * cycle (ceil(C/64) words, bit j set when PE(i, j) is
+ * enabled), built once per unit shape and mode: the
+ * units keep theirs in a function static.
+ *
+ * clock() then only visits the set bits instead of
+ * testing every PE, and a unit's enabled() debug view
+ * (to_string()) is just a lookup of the cycle it last
+ * clocked.
+ *
+ * The PE-cycle counts also give a unit's utilization
+ * without simulating it, e.g. for the cluster
+ * scheduler summing up tiles over several arrays.
+ */
+struct PeWindow
+{
+    uint64_t first, last;               // enabled in cycles [first, last)
+};
+
+/* Windows of an RxC array, in PE id (i*C + j) order */
+template <typename window_fn>
+std::vector<PeWindow> pe_windows(uint64_t R, uint64_t C, window_fn window)
+{
+    std::vector<PeWindow> ret;
+    ret.reserve(R * C);
+    for (uint64_t i = 0; i < R; i++)
+        for (uint64_t j = 0; j < C; j++)
+            ret.push_back(window(i, j));
+    return ret;
+}
+
+class EnableSchedule
+{
+private:
+    uint64_t R, C, words;
+    uint64_t len = 0;                   // first cycle nothing is enabled any more
+    std::vector<uint64_t> masks;        // [cycle][row][word], cycle len all clear
+    std::vector<uint64_t> counts;       // PEs enabled per cycle
+    uint64_t total = 0;
+
+public:
+    EnableSchedule(uint64_t R, uint64_t C, const std::vector<PeWindow>& windows)
+        : R(R), C(C), words((C + 63) / 64)
+    {
+        if (windows.size() != R * C)
+            throw std::runtime_error("schedule: needs one window per PE");
+        for (const PeWindow& w : windows)
+            if (w.first < w.last)
+                len = std::max(len, w.last);
+
+        masks.assign((len + 1) * R * words, 0);
+        counts.assign(len, 0);
+        for (uint64_t i = 0; i < R; i++)
+            for (uint64_t j = 0; j < C; j++)
+            {
+                const PeWindow& w = windows[i * C + j];
+                for (uint64_t t = w.first; t < w.last; t++)
+                {
+                    masks[(t * R + i) * words + j / 64] |= 1ULL << (j % 64);
+                    counts[t]++;
+                    total++;
+                }
+            }
+    }
+
+    uint64_t rows() const { return R; }
+    uint64_t cols() const { return C; }
+
+    /* Cycles until the last PE has been disabled */
+    uint64_t length() const { return len; }
+
+    /* Mask words of row i in cycle t, all clear from
+     * length() on */
+    const uint64_t *row(uint64_t t, uint64_t i) const
+    {
+        return &masks[(std::min(t, len) * R + i) * words];
+    }
+
+    bool enabled(uint64_t t, uint64_t i, uint64_t j) const
+    {
+        return row(t, i)[j / 64] >> (j % 64) & 1;
+    }
+
+    /* PEs enabled in cycle t */
+    uint64_t active(uint64_t t) const
+    {
+        return t < len ? counts[t] : 0;
+    }
+
+    /* Enabled PE-cycles over the whole schedule */
+    uint64_t pe_cycles() const { return total; }
+
+    /* pe_cycles() / (R*C*cycles), cycles = 0 meaning
+     * length() */
+    double utilization(uint64_t cycles = 0) const
+    {
+        if (!cycles)
+            cycles = len;
+        return cycles ? (double)total / ((double)(R * C) * (double)cycles) : 0.0;
+    }
+
+    /* f(i, j) for each PE enabled in cycle t, in PE id
+     * order (the order the units' clock() loops had) */
+    template <typename fn_t>
+    void for_each(uint64_t t, fn_t f) const
+    {
+        if (t >= len)
+            return;
+        for (uint64_t i = 0; i < R; i++)
+        {
+            const uint64_t *m = row(t, i);
+            for (uint64_t w = 0; w < words; w++)
+                for (uint64_t bits = m[w]; bits; bits &= bits - 1)
+                    f(i, w * 64 + std::countr_zero(bits));
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef __EVENT_KERNEL_HH__
+#define __EVENT_KERNEL_HH__
+
+#include <cstdint>
+#include <vector>
+
+#include "EnableSchedule.hh"
+
+/*- Event driven scheduling of the PEs *-/
+ * Every unit enables PE(i, j) over one known window of
+ * cycles (its pe_window(), see EnableSchedule.hh), so
+ * instead of stepping through every cycle this keeps a
+ * timing wheel of when each PE switches on and off and
+ * hands the unit only the PEs enabled in the current
+ * cycle (clock_pes()).
+ * Cycles with nothing enabled are skipped in one go
+ * (skip_cycles()), once the PEs that just switched off
+ * have been retired.
+ *
+ * PEs are identified as i*C + j. active() is kept in
+ * ascending order, i.e. the order clock() visits them
+ * in, so the units see exactly the same sequence of
+ * updates (and end up in exactly the same state) as
+ * with the cycle stepped clock().
+ *
+ * The wheel is sized to the latest event, so a slot
+ * only ever holds events of a single cycle.
+ */
+class EventKernel
+{
+private:
+    uint64_t t;
+    uint64_t mask;                      // wheel size - 1
+    std::vector<PeWindow> windows;
+    std::vector<std::vector<uint32_t>> wheel;
+    uint64_t pending = 0;               // events still in the wheel
+    std::vector<uint32_t> active_pes, retired_pes;
+
+    void schedule(uint64_t at, uint32_t pe);
+    void fire(uint64_t at);
+
+public:
+    /* Starts at cycle now (a restored unit's counter) */
+    EventKernel(const std::vector<PeWindow>& windows, uint64_t now);
+
+    uint64_t now() const { return t; }
+
+    /* PEs enabled in cycle now() */
+    const std::vector<uint32_t>& active() const { return active_pes; }
+
+    /* PEs enabled in now()-1 but not in now() */
+    const std::vector<uint32_t>& retired() const { return retired_pes; }
+
+    /* Nothing to evaluate or retire in cycle now() */
+    bool idle() const { return active_pes.empty() && retired_pes.empty(); }
+
+    /* First cycle after now() where a PE switches, ~0
+     * if none does any more */
+    uint64_t next_event() const;
+
+    /* Moves to cycle to (> now()), which must not be past
+     * next_event() */
+    void advance(uint64_t to);
+};
+
+#endif
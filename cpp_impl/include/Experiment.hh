@@ -0,0 +1,82 @@
+#ifndef __EXPERIMENT_HH__
+#define __EXPERIMENT_HH__
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Json.hh"
+#include "MemoryModel.hh"
+#include "UnitRunner.hh"
+
+/*- Config driven experiments *-/
+ * One experiment = one unit run. A config file is either
+ * a single experiment object, or
+ *   { "defaults": {...}, "experiments": [{...}, ...] }
+ * where each experiment is merged on top of the defaults
+ * (and command line options on top of both).
+ *
+ * Keys (all optional):
+ *   "name"    : string, used for {name} in output paths
+ *   "unit"    : mpu | mpuhsa | hsa | vpu | vpuhsa | spvpu
+ *   "n"       : array size (must be pre-instantiated)
+ *   "cols"    : array cols for a rectangular hsa/mpuhsa,
+ *               0 or absent = n (see UnitRunner.hh)
+ *   "bits"    : mac_t bit width
+ *   "mode"    : "mmm" | "mvm" (only matters for hsa)
+ *   "acts", "weights" :
+ *               "random" | "zeros" | "ones" | path to .npy |
+ *               inline [[...], ...] (or [...] for a vector,
+ *               a 1-d .npy is one too), which have to be
+ *               exactly the unit's operand shape
+ *   "cycles"  : clock budget, 0 = until the unit is ready
+ *   "seed"    : for "random" operands
+ *   "restore" : path to a unit checkpoint to start from
+ *               (operands are then taken from it)
+ *   "checkpoint", "checkpoint_at" :
+ *               snapshot the unit to this path after that
+ *               many cycles (0 or absent = at the end)
+ *   "memory"  : {"banks", "ports", "width", "bank_words",
+ *                "backing_words", "backing_latency"}, runs
+ *               the unit behind a MemoryModel (absent =
+ *               free sram reads), see MemoryModel.hh
+ *   "kernel"  : "cycle" (default) | "event", the latter
+ *               skipping idle cycles and PEs (EventKernel.hh)
+ *   "outputs" : list of sinks,
+ *               "stdout" | "csv:PATH" | "npy:PATH" | "trace:PATH"
+ *               (PATH "-" is stdout, csv appends one line per run)
+ */
+struct ExperimentConfig
+{
+    std::string name;
+    std::string unit = "hsa";
+    uint64_t n = 2;
+    uint64_t cols = 0;
+    uint64_t bits = 8;
+    std::string mode = "mmm";
+    Json acts, weights;
+    uint64_t cycles = 0;
+    uint64_t seed = 0;
+    std::string restore;
+    std::string checkpoint;
+    uint64_t checkpoint_at = 0;
+    std::optional<MemoryConfig> memory;
+    std::string kernel = "cycle";
+    std::vector<std::string> outputs;
+};
+
+/* Overlays the keys present in j on top of base */
+ExperimentConfig parse_experiment(const Json& j, const ExperimentConfig& base);
+
+/* Expands a config file (see above), applying overrides
+ * (usually built from the command line) to every entry */
+std::vector<ExperimentConfig> load_experiments(const Json& config, const Json& overrides);
+
+/* Builds the UnitRun (loads/generates operands) */
+UnitRun make_run(const ExperimentConfig& cfg);
+
+/* Runs it and writes every sink, throws on bad configs */
+UnitResult run_experiment(const ExperimentConfig& cfg);
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef __FPGA_EMULATOR_HH__
+#define __FPGA_EMULATOR_HH__
+
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "Matrix.hh"
+#include "UnitRunner.hh"
+
+/*- FPGA board emulator *-/
+ * Plays the board side of the UART protocol (see
+ * UartHost.hh) behind a pty, so host software can be
+ * run and load tested without a Nexys attached.
+ *
+ * The protocol side follows the wrappers:
+ * - SerialReceiver: bytes are assembled little endian
+ *   into 32 bit frames, with drop_byte reading 5 bytes
+ *   and keeping the first 4
+ * - opmode 00: drop bytes until ADBEEFDE, then expect
+ *   a clean DEADBEEF, answer 0C0C0C0C
+ * - opmode 01: wait for magic DA221D06, then fill the
+ *   weight/act srams until every entry was written,
+ *   answer 1C1C1C1C
+ * - opmode 10: compute (here, through the C++ model)
+ * - opmode 11: every 2003 clk_uart ticks send DEADBEEF
+ *   until the host's 0C0C0C0C, then loop over the
+ *   results until its 1C1C1C1C, which resets the board
+ * - FFFFFFFF resets from any opmode, FEFEFEFE/FDFDFDFD
+ *   switch hsa to MMM/MVM (Hsa_Wrapper.sv) and reset
+ *
+ * Results are computed by the unit model with a 16 bit
+ * mac_t (BIT_WIDTH of the wrappers):
+ *   hsa mvm / spvpu : result[y] = sum_x W[y][x] * a[x]
+ *   hsa mmm         : result[y][x] = sum_k W[y][k] * A[x][k]
+ * with W[y][x] the weight frame (x, y), a[y] the act
+ * frame y and A[y][x] the act frame (x, y), i.e. exactly
+ * what SAUnit.rand_test checks against. spvpu gets the
+ * dense weights and column merges them like UnitRunner.
+ *
+ * With bulk on, BULK_HELLO in place of the magic is
+ * answered with BULK_ACK, and the request is then taken
+ * as one bulk frame (BulkFrame.hh, NAK on a bad checksum)
+ * and the results looped over as one bulk frame as well
+ * (zero run length coded if that's shorter, unless
+ * compress is off), where that beats the legacy result
+ * frames (bulk_result_pays()). Requests may use any codec.
+ * Control words aren't looked for inside a frame, a
+ * reset only gets through once the frame is done (or
+ * NAKed).
+ *
+ * Result (and aligner) frames go out one per transmission
+ * counter period (word_ticks) as on the board, throttled
+ * or not, so a host sees the same few KB/s of them. With
+ * throttle on, bytes also go in and out no faster than
+ * the configured baud rate (8E1, 11 bits a byte).
+ */
+struct EmulatorConfig
+{
+    std::string unit = "hsa";   // hsa | spvpu
+    uint64_t n = 8;
+    bool vector_mode = true;    // hsa only, spvpu is always MVM
+    uint64_t baudrate = 921600;
+    bool throttle = false;
+    double clk_uart = 14.7541e6;    // Hz, clk_wiz_0 CLKOUT2
+    uint64_t word_ticks = 2003;     // clk_uart ticks per transmitted frame
+    bool bulk = true;           // answer bulk frame negotiation
+    bool compress = true;       // code bulk results where it saves bytes
+    bool verbose = false;
+};
+
+class FpgaEmulator
+{
+private:
+    typedef std::chrono::steady_clock steady;
+
+    EmulatorConfig cfg;
+    unit_fn fn;
+    int master, slave;
+    std::string slave_name;
+
+    /* SerialReceiver */
+    uint32_t rx_frame;
+    uint64_t rx_bytes;
+    bool drop_byte, drop_after;
+
+    /* Wrapper FSM */
+    uint64_t operating_mode;
+    bool misal_fsm, got_magic, send_aligner;
+    Matrix<wide_t> weights_sram, acts_sram;
+    std::vector<bool> weights_filled, acts_filled;
+    Matrix<wide_t> result;
+    uint64_t result_ix;
+    steady::time_point next_word;
+
+    /* Bulk frames */
+    bool bulk_mode;
+    bool bulk_results;          // this result as a bulk frame
+    uint32_t tile_id;
+    std::vector<uint8_t> bulk_rx, bulk_tx;
+    std::vector<uint64_t> elems;
+
+    /* Throttled byte queues */
+    std::deque<uint8_t> rx_queue, tx_queue;
+    steady::time_point rx_due, tx_due;
+
+    void internal_reset();
+    void on_byte(uint8_t b);
+    void on_frame(uint32_t frame);
+    void on_bulk_word(uint32_t frame);
+    void compute();
+    void send_word(uint32_t word);
+    void transmit(steady::time_point now);
+    double byte_time() const;
+public:
+    /* Opens the pty, throws std::runtime_error on failure */
+    FpgaEmulator(const EmulatorConfig& cfg_p);
+    ~FpgaEmulator();
+    FpgaEmulator(const FpgaEmulator&) = delete;
+    FpgaEmulator& operator=(const FpgaEmulator&) = delete;
+
+    /* Path host drivers should open, e.g. /dev/pts/3 */
+    const std::string& port() const { return slave_name; }
+
+    /* One turn of the event loop, waiting at most timeout_s */
+    void step(double timeout_s);
+    /* step() until *stop goes true (or forever) */
+    void serve(const volatile std::sig_atomic_t *stop = nullptr);
+
+    /* Counters, mostly for the verbose log */
+    uint64_t requests = 0;
+    uint64_t frames_in = 0, frames_out = 0;
+};
+
+#endif
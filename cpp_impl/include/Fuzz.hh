@@ -0,0 +1,97 @@
+#ifndef __FUZZ_HH__
+#define __FUZZ_HH__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Matrix.hh"
+#include "UnitRunner.hh"
+
+/*- Differential fuzzing of the units *-/
+ * The units compute the same products through different
+ * dataflows (and collect their results differently: Mac
+ * accumulators for mpu, the DrainStage for mpuhsa and
+ * hsa, down_latches for vpuhsa), so every case is run
+ * through all the units of its mode and each result is
+ * checked against reference_matmul, wrapped to the case's
+ * bit width like the units wrap:
+ *   mmm : mpu, mpuhsa, hsa          acts * weights
+ *   mvm : hsa, vpu, vpuhsa          weights * v
+ * Each unit also runs once more on the event driven kernel
+ * (EventKernel.hh), which has to give the same result in
+ * the same number of cycles.
+ *
+ * A case is (mode, n, bits) plus operands drawn from a
+ * pattern per operand: random, zeros, ones, max (every bit
+ * set), small (0..3), sparse (~1/8 nonzero random), onehot
+ * (a single max entry). Case `id` under `seed` always
+ * makes the same operands, whatever the thread count, so
+ * (seed, id) is enough to replay one.
+ *
+ * A failing case is shrunk greedily against the unit that
+ * failed it: first to the smallest pre-instantiated n that
+ * still fails (top-left tile of the operands), then entry
+ * by entry to 0, 1 or half its value, until nothing more
+ * can go and it still fails.
+ */
+struct FuzzConfig
+{
+    std::vector<std::string> units = {"mpu", "mpuhsa", "hsa", "vpu", "vpuhsa"};
+    std::vector<uint64_t> n = {2, 4, 8, 16};
+    std::vector<uint64_t> bits = {8, 16, 32};
+    std::vector<std::string> modes = {"mmm", "mvm"};
+    uint64_t cases = 1000000;
+    double seconds = 0;                 // stop after this long, 0 = run every case
+    uint64_t seed = 0;
+    uint64_t threads = 0;               // 0 = all cores
+    uint64_t max_failures = 1;          // stop once this many cases failed
+    bool shrink = true;
+};
+
+struct FuzzCase
+{
+    uint64_t id = 0;
+    bool MVM_enable = false;
+    uint64_t n = 0, bits = 0;
+    std::string acts_pattern, weights_pattern;
+    Matrix<wide_t> acts, weights;       // NxN, acts Nx1 for mvm
+};
+
+struct FuzzFailure
+{
+    std::string unit;
+    FuzzCase original;
+    FuzzCase shrunk;                    // == original when not shrinking
+    Matrix<wide_t> expected, got;       // for shrunk
+    uint64_t shrink_steps = 0;
+};
+
+struct FuzzReport
+{
+    uint64_t cases = 0;                 // cases run (each through every unit of its mode)
+    uint64_t unit_runs = 0;
+    double seconds = 0;
+    std::vector<FuzzFailure> failures;
+};
+
+/* Operands for case id, the (mode, n, bits) target being
+ * picked round robin out of those with any unit to run */
+FuzzCase make_fuzz_case(const FuzzConfig& cfg, uint64_t id);
+
+/* Wrapped to c.bits */
+Matrix<wide_t> fuzz_reference(const FuzzCase& c);
+
+/* True if unit agrees with expected on c (got is filled
+ * either way). Throws std::runtime_error if the unit isn't
+ * pre-instantiated for that n and bits. */
+bool fuzz_check(const FuzzCase& c, const std::string& unit, const Matrix<wide_t>& expected, Matrix<wide_t>& got);
+
+FuzzCase shrink_fuzz_case(const FuzzCase& c, const std::string& unit, uint64_t& steps);
+
+FuzzReport run_fuzz(const FuzzConfig& cfg);
+
+/* main command line that replays the case on unit */
+std::string fuzz_repro(const FuzzCase& c, const std::string& unit);
+
+#endif
@@ -1,15 +1,27 @@
 #ifndef __HSA_HH__
 #define __HSA_HH__ 
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include "Checkpoint.hh"
+#include "DrainStage.hh"
+#include "SystolicArray.hh"
 #include "WsMac.hh"
 
 /*- FULL HSA UNIT *-/
  * mac_t should be a mac_t_p<b>
  *
- * HSA shaped specified a priori: NxN
+ * HSA shaped specified a priori: RxC (R rows, C cols,
+ * C = R by default)
  *
  * Full implementation in header to avoid nttp
  *
@@ -30,12 +42,20 @@
  * tranposition of acts matrix, throughout the code
  * below is in fact the last row).
  *
+ * Shapes: weights are RxC, one per PE. Acts are CxR,
+ * MMM streams its C rows through the array (so row i
+ * of the array sees col i of acts), giving a CxC
+ * result. MVM takes v (length C) and gives W*v, of
+ * length R.
+ *
  * The HSA in MMM mode works as follows:
  * - Weights are stationary in each MAC (why we use WsMac)
  * - activation flow left to right
  * - partial sums flow top to bottom
- * - results are collected at the end, but they
- *   arrive in a disorderly fashion.
+ * - results leave the bottom row skewed (col j
+ *   starting j cycles late, acts rows last first),
+ *   the DrainStage writes each one straight to its
+ *   (row, col) and hands out rows as they complete.
  *
  * The HSA in MVM mode works as follows:
  * - Weights are stationary in each MAC (why we use WsMac)
@@ -48,150 +68,493 @@
  * flipped from VpuHsa, so that we can avoid
  * having to transpose weights matrix (since
  * it must be the same data for MVM and MMM modes)
+ *
+ * Weights can also be made resident: load_weights()
+ * puts them into the PEs' weight registers once
+ * (charged weight_load_latency cycles, shifted in from
+ * the top a row per cycle), after which any number of
+ * acts tiles run against them through load_acts(),
+ * without copying the weights again or constructing a
+ * new unit. get_counter() is still per tile,
+ * get_total_cycles() everything since the weights
+ * went in, their load included.
+ *
+ * The top row's (MMM) or first col's (MVM) psum
+ * input is a port too: load_psums() seeds it, so
+ * out = acts * weights + psums (MMM, psums CxC, row r
+ * entering col j along with acts row r) or
+ * W*v + psums (MVM, psums[i][0] into row i), instead
+ * of starting from zero. chain() uses it to run K
+ * tiles back to back, each one's result going into
+ * the next one's psums without leaving the array, so
+ * a K split only writes its result back once instead
+ * of once per K tile. Chained psums are one-shot: the
+ * next plain load_acts() closes the port again, while
+ * load_psums()ed ones stay until loaded again.
+ *
+ * HsaStream.hh is the same dataflow taking its acts
+ * one vector per cycle from the caller instead, for
+ * any number of them (clock_stream(), reading
+ * stream_sram instead of acts_sram).
+ *
+ * HsaDataflow is the dataflow policy of the
+ * SystolicArray (see SystolicArray.hh), MpuHsa reuses it
+ * fixed to MMM mode.
  */
-template <typename mac_t, uint64_t N>
-class Hsa
+template <typename mac_t, uint64_t R, uint64_t C, typename pe_t>
+class HsaDataflow : public DataflowBase
 {
-private:
-    uint64_t counter;
-    bool enabled[N][N];
-    mac_t top_values[N]; // only used for debug
-    mac_t left_values[N]; // only used for debug
-
-    mac_t acts_sram[N][N], weights_sram[N][N];
-    mac_t init_acts_sram[N][N], init_weights_sram[N][N];
-    WsMac<mac_t> mac_units[N][N]; 
+protected:
+    typedef std::pair<mac_t, mac_t> output_t;
+    static constexpr bool has_MVM = true;
+    static constexpr uint64_t enabled_cols = C;
+
+    mac_t top_values[C]; // only used for debug
+    mac_t left_values[R]; // only used for debug
+
+    mac_t acts_sram[R][C], weights_sram[R][C];
+    mac_t init_acts_sram[R][C], init_weights_sram[R][C];
     /* right_latches
      * - MMM: for left-right streaming of acts
      * - MVM: unused
      */
-    mac_t right_latches[N][N];
+    mac_t right_latches[R][C];
     /* down_latches
      * - MMM/MVM: for top-down streaming of psums
      */  
-    mac_t down_latches[N][N];
-    mac_t result[N][N];
-public:
-    Hsa(mac_t acts_sram_p[N][N], mac_t weights_sram_p[N][N],
-            bool MVM_enable)
+    mac_t down_latches[R][C];
+    DrainStage<mac_t, R, C> drain;     // MMM results, see DrainStage.hh
+
+    /* Weight residency (load_weights()) */
+    bool weights_resident = false;      // PEs hold the weights, nothing rewrites them
+    uint64_t weight_cycles = 0;         // charged for loading them
+    uint64_t past_cycles = 0;           // clock()s of the tiles before this one
+
+    /* psum-in port (load_psums()), in get_result()'s
+     * layout. psum_sram is the MMM copy being streamed,
+     * psum_sram[j][C-1] entering col j next */
+    bool psums_enable = false;
+    bool psums_chained = false;         // from chain(), closed by the next load_acts()
+    mac_t init_psums[std::max(R, C)][C];
+    mac_t psum_sram[C][C];
+
+    /* HsaStream's skew (clock_stream()): stream_sram[k][d]
+     * is value k of the vector pushed d cycles ago, row
+     * (MMM) or col (MVM) k takes stream_sram[k][k]. Not
+     * part of an Hsa's state, HsaStream checkpoints it */
+    mac_t stream_sram[std::max(R, C)][std::max(R, C)];
+
+    /* Square arrays keep the plain tag, so their
+     * snapshots stay compatible */
+    static std::string checkpoint_tag()
+    {
+        return R == C ? std::string("hsa") : std::format("hsa{}x{}", R, C);
+    }
+
+    /* Number of clock() calls until the last PE has
+     * been disabled, i.e. when the 'ready' signal goes up:
+     * - MMM: PE(R-1,C-1) active in cycles R+C-2 .. R+2C-3
+     *   (3N-2 for a square array)
+     * - MVM: one column per cycle
+     * */
+    static constexpr uint64_t latency(bool MVM_enable)
     {
-        /* Acts needs to be transposed for this dataflow style */
-        for (uint64_t i = 0; i < N; i++)
-            for (uint64_t j = 0; j < N; j++)
-                init_acts_sram[i][j] = acts_sram_p[j][i];
-        for (uint64_t i = 0; i < N; i++)
-            memcpy(init_weights_sram[i], weights_sram_p[i], N*sizeof(mac_t)); 
-        
-        reset(MVM_enable);
+        return MVM_enable ? C : R + 2*C - 2;
     }
 
-    void reset(bool MVM_enable)
+    /* MMM mode:
+     *    start after i+j, disable after i+j+C-1, by then passed
+     *    all values through it (ix 0,..C-1)
+     * MVM mode:
+     *    enable col-wise, when we broadcast (i.e. cycle i => enable col i)
+     * */
+    static constexpr PeWindow pe_window(uint64_t i, uint64_t j, bool MVM_enable)
     {
-        for (uint64_t i = 0; i < N; i++)
-            memcpy(acts_sram[i], init_acts_sram[i], N*sizeof(mac_t)); 
-        for (uint64_t i = 0; i < N; i++)
-            memcpy(weights_sram[i], init_weights_sram[i], N*sizeof(mac_t));  
-        for (uint64_t i = 0; i < N; i++)
-            for (uint64_t j = 0; j < N; j++)
+        return MVM_enable ? PeWindow{j, j+1} : PeWindow{i+j, i+j+C};
+    }
+
+    void reset_state(bool MVM_enable)
+    {
+        for (uint64_t i = 0; i < R; i++)
+            memcpy(acts_sram[i], init_acts_sram[i], C*sizeof(mac_t)); 
+        /* Resident weights are already in place */
+        if (!weights_resident)
+            for (uint64_t i = 0; i < R; i++)
+                memcpy(weights_sram[i], init_weights_sram[i], C*sizeof(mac_t));  
+        for (uint64_t i = 0; i < R; i++)
+            for (uint64_t j = 0; j < C; j++)
             {
                 down_latches [i][j] = mac_t::ZERO;
                 right_latches[i][j] = mac_t::ZERO;
             }
-        counter = 0;
-        for (uint64_t i = 0; i < N; i++)
-            top_values[i] = MVM_enable ? acts_sram[N-1][i] : mac_t::ZERO;
-        for (uint64_t j = 0; j < N; j++) 
-            left_values[j] = MVM_enable ? mac_t::ZERO : acts_sram[j][N-1];
+        drain.reset();
+        if (psums_enable)
+            for (uint64_t j = 0; j < C; j++)
+                for (uint64_t k = 0; k < C; k++)
+                    psum_sram[j][k] = init_psums[k][j];
+        for (uint64_t j = 0; j < C; j++)
+            top_values[j] = MVM_enable ? acts_sram[R-1][j] : psum_top(j);
+        for (uint64_t i = 0; i < R; i++) 
+            left_values[i] = MVM_enable ? mac_t::ZERO : acts_sram[i][C-1];
     }
 
-    /* MVM_enable = false => MMM mode
-     * MVM_enable = true  => MVM mode
-     */
-    void clock(bool MVM_enable)
+    /* Next psum into the top of col j (MMM) */
+    mac_t psum_top(uint64_t j) const
     {
-        std::pair<mac_t, mac_t> outputs[N][N];
-        for (uint64_t i = 0; i < N; i++)
-            for (uint64_t j = 0; j < N; j++)
+        return psums_enable ? psum_sram[j][C-1] : mac_t::ZERO;
+    }
+
+    /* Body of clock() for an enabled PE, returns
+     * what it latches */
+    output_t eval_pe(pe_t& pe, auto i, auto j, auto MVM_enable)
+    {
+        constexpr bool streamed = is_stream_mode<decltype(MVM_enable)>;
+        mac_t input_left_MMM_a, input_top_MMM_cin;
+        mac_t input_left_MVM_cin, input_broad_MVM_a;
+            
+        input_top_MMM_cin = i == 0 ? psum_top(j) : down_latches[i-1][j];
+        input_left_MMM_a = j != 0 ? right_latches[i][j-1]
+                         : streamed ? stream_sram[i][i] : acts_sram[i][C-1];
+
+        input_left_MVM_cin = j != 0 ? right_latches[i][j-1]
+                           : psums_enable ? init_psums[i][0] : mac_t::ZERO;
+        input_broad_MVM_a = streamed ? stream_sram[j][j] : acts_sram[R-1][j];
+
+        /* Weight-stationary */
+        mac_t input_weight =  weights_sram[i][j];
+
+        /* I don't simulate the weight initialisation
+         * into each PE (which should occur over multiple
+         * cycles, and ideally be pipelined during the MMM
+         * mode, since MVM mode re-uses these weights
+         * However, due to blocking this may not be true,
+         * and weight initialisation need be pipelined in MVM
+         * mode too (not too difficult)
+         * Resident weights (load_weights()) are the
+         * exception, they're in the PEs already.
+         **/
+        output_t out = pe.clock(
+            MVM_enable ? input_broad_MVM_a : input_left_MMM_a,
+            input_weight,
+            MVM_enable ? input_left_MVM_cin : input_top_MMM_cin,
+            true,
+            !weights_resident
+        );
+        /* HsaStream has nothing to shift, and no debug
+         * values */
+        if constexpr (streamed)
+            return out;
+
+        /* simulate the acts 'streaming' from the left
+         * we only have to do this for MMM mode, since in
+         * MVM mode we broadcast act values appropriately
+         * */
+        /* shift the column to the right (for this row only),
+         * once per cycle, i.e. only when the first PE of the
+         * row consumed a value. Doing this for every enabled
+         * PE in the row skipped acts for N > 2.
+         * */
+        if (!MVM_enable && j == 0)
+            for (int k = C-1; k > 0; k--)
+                acts_sram[i][k] = acts_sram[i][k-1];
+        /* Same for the psums entering the top of each
+         * col, once per cycle of the top PE */
+        if (!MVM_enable && i == 0 && psums_enable)
+            for (int k = C-1; k > 0; k--)
+                psum_sram[j][k] = psum_sram[j][k-1];
+
+        top_values[j] = MVM_enable ?  acts_sram[R-1][j] : psum_top(j);
+        left_values[i] = MVM_enable ? mac_t::ZERO : acts_sram[i][C-1];  
+        return out;
+    }
+
+    /* t: the cycle, before the counter moves on */
+    void latch_pe(auto i, auto j, const output_t& out, auto MVM_enable, uint64_t t)
+    {
+        /* Output order opposite for MVM right latches,
+         * Down latches unused for MVM
+         */
+        right_latches[i][j] = MVM_enable ? out.second : out.first;
+        down_latches[i][j] = out.second;
+        /* Last row => Output generated
+         * only for MMM mode as MVM stores
+         * output in latches (and the drain
+         * only knows the MMM skew). HsaStream
+         * gathers its own outputs.
+         * */
+        if constexpr (!is_stream_mode<decltype(MVM_enable)>)
+            if (i == R - 1 && !MVM_enable)
+                drain.capture(t, j, down_latches[i][j]);
+    }
+
+    void save_operands(CheckpointWriter& ck) const
+    {
+        ck.put(top_values);
+        ck.put(left_values);
+        ck.put(acts_sram);
+        ck.put(weights_sram);
+        ck.put(init_acts_sram);
+        ck.put(init_weights_sram);
+        ck.put(weights_resident);
+        ck.put(weight_cycles);
+        ck.put(past_cycles);
+        ck.put(psums_enable);
+        ck.put(init_psums);
+        ck.put(psum_sram);
+        ck.put(psums_chained);
+    }
+
+    void load_operands(CheckpointReader& ck)
+    {
+        ck.get(top_values);
+        ck.get(left_values);
+        ck.get(acts_sram);
+        ck.get(weights_sram);
+        ck.get(init_acts_sram);
+        ck.get(init_weights_sram);
+        weights_resident = false;
+        weight_cycles = past_cycles = 0;
+        if (ck.version() >= 3)
+        {
+            ck.get(weights_resident);
+            ck.get(weight_cycles);
+            ck.get(past_cycles);
+        }
+        psums_enable = psums_chained = false;
+        if (ck.version() >= 4)
+        {
+            ck.get(psums_enable);
+            ck.get(init_psums);
+            ck.get(psum_sram);
+        }
+        if (ck.version() >= 6)
+            ck.get(psums_chained);
+    }
+
+    void save_latches(CheckpointWriter& ck) const
+    {
+        ck.put(right_latches);
+        ck.put(down_latches);
+        drain.save_state(ck);
+    }
+
+    void load_latches(CheckpointReader& ck)
+    {
+        ck.get(right_latches);
+        ck.get(down_latches);
+        drain.load_state(ck);
+    }
+
+    /* Acts needs to be transposed for this dataflow style */
+    void init(mac_t acts_sram_p[C][R], mac_t weights_sram_p[R][C])
+    {
+        init_acts(acts_sram_p);
+        for (uint64_t i = 0; i < R; i++)
+            memcpy(init_weights_sram[i], weights_sram_p[i], C*sizeof(mac_t)); 
+    }
+
+    void init_acts(mac_t acts_sram_p[C][R])
+    {
+        for (uint64_t i = 0; i < R; i++)
+            for (uint64_t j = 0; j < C; j++)
+                init_acts_sram[i][j] = acts_sram_p ? acts_sram_p[j][i] : mac_t::ZERO;
+    }
+
+    /* nullptr closes the port (psums of zero) */
+    void init_psums_sram(const mac_t psums_p[][C], uint64_t rows)
+    {
+        psums_enable = psums_p != nullptr;
+        psums_chained = false;
+        for (uint64_t i = 0; i < std::max(R, C); i++)
+            for (uint64_t j = 0; j < C; j++)
+                init_psums[i][j] = psums_p && i < rows ? psums_p[i][j] : mac_t::ZERO;
+        for (uint64_t j = 0; j < C; j++)
+            for (uint64_t k = 0; k < C; k++)
+                psum_sram[j][k] = mac_t::ZERO;
+    }
+
+    /* chain(): the finished tile's result is in
+     * init_psums already, swap in the next K tile's
+     * weights (see Hsa::chain()) */
+    void chain_weights(pe_t (&pes)[R][C], mac_t weights_sram_p[R][C])
+    {
+        psums_enable = psums_chained = true;
+        if (weights_resident)
+            resident_weights(pes, weights_sram_p);
+        else
+            for (uint64_t i = 0; i < R; i++)
+                memcpy(init_weights_sram[i], weights_sram_p[i], C*sizeof(mac_t));
+    }
+
+    /* Into the PEs' registers (and weights_sram, which
+     * the PEs then never read again) */
+    void resident_weights(pe_t (&pes)[R][C], mac_t weights_sram_p[R][C])
+    {
+        for (uint64_t i = 0; i < R; i++)
+            for (uint64_t j = 0; j < C; j++)
             {
-                /* MMM mode:
-                 *    start after i+j, disable after i+j+N-1, by then passed 
-                 *    all values through it (ix 0,..N-1)                       
-                 * MVM mode:
-                 *    enable col-wise, when we broadcast (i.e. cycle i => enable col i)
-                 * */
-                bool enable = MVM_enable ? counter == j : (i+j)<=counter && counter < (i+j+N);
-
-                enabled[i][j] = enable;
-                if (!enable) continue;
-
-                mac_t input_left_MMM_a, input_top_MMM_cin;
-                mac_t input_left_MVM_cin, input_broad_MVM_a;
-                    
-                input_top_MMM_cin = i == 0 ? mac_t::ZERO : down_latches[i-1][j];
-                input_left_MMM_a = j == 0 ? acts_sram[i][N-1] : right_latches[i][j-1];
-
-                input_left_MVM_cin = j == 0 ? mac_t::ZERO : right_latches[i][j-1];
-                input_broad_MVM_a = acts_sram[N-1][j];
-
-                /* Weight-stationary */
-                mac_t input_weight =  weights_sram[i][j];
-
-                /* I don't simulate the weight initialisation
-                 * into each PE (which should occur over multiple
-                 * cycles, and ideally be pipelined during the MMM
-                 * mode, since MVM mode re-uses these weights
-                 * However, due to blocking this may not be true,
-                 * and weight initialisation need be pipelined in MVM
-                 * mode too (not too difficult)
-                 **/
-                outputs[i][j] = mac_units[i][j].clock(
-                    MVM_enable ? input_broad_MVM_a : input_left_MMM_a,
-                    input_weight,
-                    MVM_enable ? input_left_MVM_cin : input_top_MMM_cin,
-                    enable,
-                    true
-                );
-
-                /* simulate the acts 'streaming' from the left
-                 * we only have to do this for MMM mode, since in
-                 * MVM mode we broadcast act values appropriately
-                 * */
-                /* shift the column to the right (for this row only): */
-                if (!MVM_enable && enable)
-                    for (int k = N-1; k > 0; k--)
-                        acts_sram[i][k] = acts_sram[i][k-1];
-
-                top_values[i] = MVM_enable ?  acts_sram[N-1][i] : mac_t::ZERO;
-                left_values[i] = MVM_enable ? mac_t::ZERO : acts_sram[i][N-1];  
+                init_weights_sram[i][j] = weights_sram[i][j] = weights_sram_p[i][j];
+                pes[i][j].set_weight(weights_sram_p[i][j]);
             }
+        weights_resident = true;
+        weight_cycles += weight_load_latency;
+    }
 
-        /* Update latch values, after so no weirdness 
-         * Could probably figure out a loop order to
-         * do this above, but this works fine.
-         * Only right to latch if enabled */
-        for (uint64_t i = 0; i < N; i++)
-            for (uint64_t j = 0; j < N; j++)
-                if (enabled[i][j])
-                {
-                    /* Output order opposite for MVM right latches,
-                     * Down latches unused for MVM
-                     */
-                    right_latches[i][j] = MVM_enable ? outputs[i][j].second : outputs[i][j].first;
-                    down_latches[i][j] = outputs[i][j].second;
-                    /* Last row => Output generated
-                     * only for MMM mode as MVM stores
-                     * output in latches (although, again
-                     * it does not matter...)
-                     * */
-                    if (i == N - 1)
-                    {
-                        /* shift the row down (for this column only): */
-                        for (int k = N-1; k > 0; k--)
-                            result[k][j] = result[k-1][j]; 
-                        result[0][j] = down_latches[i][j];
-                    }
-                }
-        counter++;
+    /* PE(i, j) in the MMM to_string() */
+    PeText mmm_text(uint64_t i, uint64_t j, bool enabled) const
+    {
+        return {
+            !enabled ? "Disabled" : "W="+std::to_string(weights_sram[i][j].value),
+            std::to_string(right_latches[i][j].value),
+            std::to_string(down_latches[i][j].value)
+        };
+    }
+
+public:
+    /* Resident weights shift in a row per cycle */
+    static constexpr uint64_t weight_load_latency = R;
+
+    /* MMM only: called with each result row as soon as it
+     * has drained (rows C-1 down to 0), see DrainStage.hh */
+    void set_row_callback(typename DrainStage<mac_t, R, C>::row_callback cb)
+    {
+        drain.set_row_callback(std::move(cb));
+    }
+
+    void print_result_values()
+    {
+        for (uint64_t i = 0; i < C; i++)
+        {
+            for (uint64_t j = 0; j < C; j++)
+                std::cout << "| " << drain.row(i)[j].value << " ";
+            std::cout << "|" << std::endl;
+        }
+    }
+};
+
+template <typename mac_t, uint64_t R, uint64_t C = R>
+class Hsa : public SystolicArray<mac_t, R, C, HsaDataflow, WsMac<mac_t>>
+{
+private:
+    typedef SystolicArray<mac_t, R, C, HsaDataflow, WsMac<mac_t>> base_t;
+    using base_t::top_values;
+    using base_t::left_values;
+    using base_t::weights_sram;
+    using base_t::right_latches;
+    using base_t::down_latches;
+    using base_t::drain;
+
+    /* load_acts() minus closing a chain's psums */
+    void next_tile(mac_t acts_sram_p[C][R], bool MVM_enable)
+    {
+        this->past_cycles += this->counter;
+        this->init_acts(acts_sram_p);
+        this->reset(MVM_enable);
+    }
+
+public:
+    Hsa(mac_t acts_sram_p[C][R], mac_t weights_sram_p[R][C],
+            bool MVM_enable)
+    {
+        this->init(acts_sram_p, weights_sram_p);
+        this->init_psums_sram(nullptr, 0);
+        this->reset(MVM_enable);
+    }
+
+    /* Same, seeding the psum-in port (see load_psums()) */
+    Hsa(mac_t acts_sram_p[C][R], mac_t weights_sram_p[R][C],
+            const mac_t psums_p[][C], bool MVM_enable)
+    {
+        this->init(acts_sram_p, weights_sram_p);
+        this->init_psums_sram(psums_p, MVM_enable ? R : C);
+        this->reset(MVM_enable);
+    }
+
+    /* Resident weights, acts come per tile from load_acts() */
+    explicit Hsa(mac_t weights_sram_p[R][C])
+    {
+        this->init_acts(nullptr);
+        this->init_psums_sram(nullptr, 0);
+        load_weights(weights_sram_p);
+        this->reset();
+    }
+
+    /* Makes the weights resident (see above), for every
+     * tile from the next load_acts() on */
+    void load_weights(mac_t weights_sram_p[R][C])
+    {
+        this->resident_weights(this->mac_units, weights_sram_p);
+    }
+
+    /* Next tile: new acts against the weights in place,
+     * counter, latches and result cleared (and the psums
+     * of a chain() that has ended, see above) */
+    void load_acts(mac_t acts_sram_p[C][R], bool MVM_enable)
+    {
+        if (this->psums_chained)
+            this->init_psums_sram(nullptr, 0);
+        next_tile(acts_sram_p, MVM_enable);
+    }
+
+    /* psums into the psum-in port (see above), in
+     * get_result()'s layout: MMM CxC, MVM psums[i][0]
+     * for the R rows. nullptr closes it again (zeros).
+     * The port keeps them for every tile from the next
+     * reset() or load_acts() on, until loaded again
+     * (chain()ed psums don't last, see above) */
+    void load_psums(const mac_t psums_p[][C], bool MVM_enable)
+    {
+        this->init_psums_sram(psums_p, MVM_enable ? R : C);
+    }
+
+    /* Next K tile, once ready(): this tile's result goes
+     * into the psum-in port, acts and weights are the
+     * next K slice (a resident Hsa reloading its weights,
+     * charged as for load_weights()). Once the last K
+     * tile is ready get_result() has the whole sum */
+    void chain(mac_t acts_sram_p[C][R], mac_t weights_sram_p[R][C], bool MVM_enable)
+    {
+        if (!this->ready(MVM_enable))
+            throw std::runtime_error("hsa: chain() before the tile is ready");
+        get_result(this->init_psums, MVM_enable);
+        this->chain_weights(this->mac_units, weights_sram_p);
+        next_tile(acts_sram_p, MVM_enable);
+    }
+
+    uint64_t get_weight_cycles()
+    {
+        return this->weight_cycles;
+    }
+
+    uint64_t get_total_cycles()
+    {
+        return this->weight_cycles + this->past_cycles + this->counter;
+    }
+
+    /* Only meaningful once ready():
+     * - MMM: out = acts * weights (CxC, out needs C rows)
+     * - MVM: out[i][0] = (weights * v)_i, v being the
+     *   last col of acts (out needs R rows). Rest of out
+     *   is left untouched.
+     * */
+    void get_result(mac_t out[][C], bool MVM_enable)
+    {
+        if (MVM_enable)
+            for (uint64_t i = 0; i < R; i++)
+                out[i][0] = right_latches[i][C-1];
+        else
+            drain.get(out);
+    }
+
+    /* Latch contents, e.g. for lockstep comparison against
+     * the RTL (src/cosim.cc) */
+    void get_latches(mac_t right[R][C], mac_t down[R][C])
+    {
+        for (uint64_t i = 0; i < R; i++)
+        {
+            memcpy(right[i], right_latches[i], C*sizeof(mac_t));
+            memcpy(down[i], down_latches[i], C*sizeof(mac_t));
+        }
     }
 
     std::string to_string_MMM()
@@ -206,54 +569,11 @@ public:
          * -------------------------------------
          * |    pla    |-----|     pla   | --- |
          * ===================================== 
-         * Could figure out the prealloc size... but I don't want to.
-         * So I use cpp string (and inefficiently)
          * */
-        std::string top_rows[N], bot_rows[N];
-        std::string toptop_row;
-        uint64_t max_row_width = 0;
-        for (uint64_t i = 0; i < N; i++)
-        {
-            std::string top_row, bot_row;
-            for (uint64_t j = 0; j < N; j++)
-            {
-                mac_t pla, ala;
-                pla = down_latches[i][j];
-                ala = right_latches[i][j];
-                std::string w_str, ala_str, pla_str;
-                ala_str = std::to_string(ala.value);
-                pla_str = std::to_string(pla.value);
-                w_str = !enabled[i][j] ? "Disabled" : "W="+std::to_string(weights_sram[i][j].value);
-                uint64_t wwidth = w_str.length();
-                uint64_t bwidth = pla_str.length();
-                uint64_t twidth = std::max(std::max(wwidth, bwidth), 8LLU) + 2;
-                std::string pw_str = std::vformat("{:^"+std::to_string(twidth)+"}", std::make_format_args(w_str));
-                std::string ppla_str = std::vformat("{:^"+std::to_string(twidth)+"}", std::make_format_args(pla_str));
-                top_row += "| " + pw_str + " | " + ala_str + " ";
-                bot_row += "| " + ppla_str + " |" + std::string(ala_str.length()+2, '-');
-                if (i == 0)
-                {
-                    std::string toptop_str = std::to_string(top_values[j].value) + "↓";
-                    std::string ptoptop_str = std::vformat("{:^"+std::to_string(twidth)+"}", std::make_format_args(toptop_str));
-                    toptop_row += "  " + ptoptop_str + "   " + std::string(ala_str.length(), ' ') + " ";
-                }
-            }
-            top_rows[i] = top_row;
-            bot_rows[i] = bot_row;
-            max_row_width = top_row.length() > max_row_width ? top_row.length() : max_row_width;
-        }
-        std::string ret;
-        uint64_t max_l_width = 0;
-        for (uint64_t i = 0; i < N; i++)
-            max_l_width = std::max(max_l_width, (uint64_t)std::to_string(left_values[i].value).length());
-        max_l_width += 5;
-        std::string lsep = std::string(max_l_width, ' ');
-        std::string sep = lsep+std::string(max_row_width+1, '=');
-        ret += lsep+toptop_row + "\n" + sep + "\n";
-        for (uint64_t i = 0; i < N; i++)
-            ret += " " + std::to_string(left_values[i].value) + " -> " + top_rows[i] + "|\n" + \
-                    lsep + bot_rows[i] + "|\n" + sep + "\n";
-        return ret;
+        return this->grid_string(
+            [&](uint64_t i, uint64_t j) { return this->mmm_text(i, j, this->enabled(i, j, false)); },
+            [&](uint64_t j) { return std::to_string(top_values[j].value); },
+            [&](uint64_t i) { return std::to_string(left_values[i].value); });
     }
 
     std::string to_string_MVM()
@@ -267,13 +587,13 @@ public:
          * Could figure out the prealloc size... but I don't want to.
          * So I use cpp string (and inefficiently)
          * */
-        std::string top_rows[N], bot_rows[N];
+        std::string top_rows[R], bot_rows[R];
         std::string toptop_row;
         uint64_t max_row_width = 0;
-        for (uint64_t i = 0; i < N; i++)
+        for (uint64_t i = 0; i < R; i++)
         {
             std::string top_row, bot_row;
-            for (uint64_t j = 0; j < N; j++)
+            for (uint64_t j = 0; j < C; j++)
             {
                 mac_t pla;//, ala;
                 pla = down_latches[i][j];
@@ -283,10 +603,10 @@ public:
                 // ala_str = std::to_string(ala.value);
                 ala_str = "";
                 pla_str = std::to_string(pla.value);
-                w_str = !enabled[i][j] ? "Disabled" : "W="+std::to_string(weights_sram[i][j].value);
+                w_str = !this->enabled(i, j, true) ? "Disabled" : "W="+std::to_string(weights_sram[i][j].value);
                 uint64_t wwidth = w_str.length();
                 uint64_t bwidth = pla_str.length();
-                uint64_t twidth = std::max(std::max(wwidth, bwidth), 8LLU) + 2;
+                uint64_t twidth = std::max(std::max(wwidth, bwidth), (uint64_t)8) + 2;
                 std::string pw_str = std::vformat("{:^"+std::to_string(twidth)+"}", std::make_format_args(w_str));
                 std::string ppla_str = std::vformat("{:^"+std::to_string(twidth)+"}", std::make_format_args(pla_str));
                 top_row += "| " + pw_str + " | " + pla_str + " ";
@@ -304,26 +624,16 @@ public:
         }
         std::string ret;
         uint64_t max_l_width = 0;
-        for (uint64_t i = 0; i < N; i++)
+        for (uint64_t i = 0; i < R; i++)
             max_l_width = std::max(max_l_width, (uint64_t)std::to_string(left_values[i].value).length());
         max_l_width += 5;
         std::string lsep = std::string(max_l_width, ' ');
         std::string sep = lsep+std::string(max_row_width+1, '=');
         ret += lsep+toptop_row + "\n" + sep + "\n";
-        for (uint64_t i = 0; i < N; i++)
+        for (uint64_t i = 0; i < R; i++)
             ret += " " + std::to_string(left_values[i].value) + " -> " + top_rows[i] + "|\n";
                     // lsep + bot_rows[i] + "|\n" + sep + "\n";
         return ret;
     }
-
-    void print_result_values()
-    {
-        for (int i = 0; i < N; i++)
-        {
-            for (int j = 0; j < N; j++)
-                std::cout << "| " << result[i][j].value << " ";
-            std::cout << "|" << std::endl;
-        }
-    }
 };
-#endif 
+#endif
@@ -0,0 +1,340 @@
+#ifndef __HSA_CLUSTER_HH__
+#define __HSA_CLUSTER_HH__
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <format>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "HsaGemm.hh"
+#include "Matrix.hh"
+
+/*- Multi-array cluster *-/
+ * mac_t should be a mac_t_p<b>
+ *
+ * K independent RxC Hsa arrays (HsaGemm tiles, see
+ * there for the tile shapes) fed from one shared
+ * activation/weight buffer, which moves buffer_words
+ * words a cycle for all of them together.
+ *
+ * The GEMM is cut into tasks, either
+ *   M/N split : one task per output block (m0, n0),
+ *               running all its K tiles back to back,
+ *               so weights are replicated across the
+ *               arrays working on the same n0
+ *   K split   : one task per tile (m0, k0, n0), every
+ *               K tile of a block past the first being
+ *               reduced into it through the buffer
+ *               (read + write of the block)
+ * All tasks start on array 0's deque (ordered so that
+ * consecutive tasks reuse the weight block where they
+ * can). Each array takes from the front of its own
+ * deque and, once empty, steals the back half of the
+ * fullest one, so the other arrays cut their runs out
+ * of it as they come up, and steal again from whoever
+ * is behind once the shape (ragged edges, fewer tasks
+ * than arrays) or buffer stalls leave them idle.
+ *
+ * Per tile an array loads the acts tile and, unless it
+ * already holds that weight block, the weights, then
+ * computes for Hsa::latency() cycles; a finished task
+ * writes its block back. Buffer requests are served in
+ * order, an array waiting while another one transfers
+ * (stall). Loads are not overlapped with compute.
+ *
+ * schedule() only needs the shape (cycle counts don't
+ * depend on the values, and the PE-cycles come from the
+ * Hsa's EnableSchedule), run() then also does every
+ * tile cycle by cycle in each array's order, on one Hsa
+ * per array with resident weights (Hsa::load_weights())
+ * reloaded only when the tile needs another block, and
+ * checks that the tiles took the cycles, and found their
+ * weights resident as often as, the schedule assumed.
+ */
+struct ClusterConfig
+{
+    uint64_t arrays = 4;
+    bool MVM_enable = false;
+    bool split_k = false;               // false = M/N split
+    double buffer_words = 16;           // shared buffer, words per cycle
+};
+
+struct ClusterArrayStats
+{
+    uint64_t tasks = 0, tiles = 0, stolen = 0;  // stolen: times it stole
+    uint64_t compute = 0;               // cycles computing
+    uint64_t transfer = 0;              // cycles moving data through the buffer
+    uint64_t stall = 0;                 // cycles waiting for the buffer
+    uint64_t finish = 0;                // cycle its last task was done
+};
+
+struct ClusterStats
+{
+    std::string name;
+    uint64_t M, K, N;                   // (MxK) * (KxN)
+    uint64_t arrays, pes;
+    bool MVM_enable, split_k;
+    uint64_t tasks, tiles, steals;
+    uint64_t makespan;
+    uint64_t buffer_words;              // moved through the shared buffer
+    uint64_t weight_loads_saved;        // tiles that found their weights resident
+    double macs;                        // useful MACs, M*K*N
+    double utilization;                 // macs / (pes * makespan)
+    double pe_utilization;              // enabled PE-cycles / (pes * makespan)
+    double macs_per_cycle;
+    double balance;                     // mean / max busy cycles over the arrays
+    std::vector<ClusterArrayStats> per_array;
+};
+
+template <typename mac_t, uint64_t R, uint64_t C = R>
+class HsaCluster
+{
+private:
+    typedef HsaGemm<mac_t, R, C> gemm_t;
+
+    struct Task
+    {
+        uint64_t m0, n0;
+        uint64_t k_first, k_last;       // K tile indices, inclusive
+    };
+
+    static uint64_t ceil_div(uint64_t a, uint64_t b)
+    {
+        return (a + b - 1) / b;
+    }
+
+    static std::vector<Task> make_tasks(uint64_t M, uint64_t K, uint64_t Np, const ClusterConfig& cfg)
+    {
+        bool mvm = cfg.MVM_enable;
+        uint64_t mt = ceil_div(M, gemm_t::m_step(mvm));
+        uint64_t kt = ceil_div(K, gemm_t::k_step(mvm));
+        uint64_t nt = ceil_div(Np, gemm_t::n_step(mvm));
+        std::vector<Task> ret;
+        /* n0 outermost (then k0 for a K split) so an array
+         * running its run in order keeps its weights */
+        for (uint64_t n = 0; n < nt; n++)
+            if (cfg.split_k)
+            {
+                for (uint64_t k = 0; k < kt; k++)
+                    for (uint64_t m = 0; m < mt; m++)
+                        ret.push_back({m * gemm_t::m_step(mvm), n * gemm_t::n_step(mvm), k, k});
+            }
+            else
+                for (uint64_t m = 0; m < mt; m++)
+                    ret.push_back({m * gemm_t::m_step(mvm), n * gemm_t::n_step(mvm), 0, kt - 1});
+        return ret;
+    }
+
+    /* order[a] = tasks in the order array a ran them */
+    static ClusterStats simulate(const ClusterConfig& cfg, const std::string& name, uint64_t M,
+            uint64_t K, uint64_t Np, std::vector<std::vector<Task>> *order)
+    {
+        if (!cfg.arrays)
+            throw std::runtime_error("cluster: needs at least one array");
+        if (cfg.buffer_words <= 0)
+            throw std::runtime_error("cluster: buffer_words must be positive");
+        bool mvm = cfg.MVM_enable;
+        std::vector<Task> tasks = make_tasks(M, K, Np, cfg);
+
+        ClusterStats s;
+        s.name = name;
+        s.M = M;
+        s.K = K;
+        s.N = Np;
+        s.arrays = cfg.arrays;
+        s.pes = cfg.arrays * R * C;
+        s.MVM_enable = mvm;
+        s.split_k = cfg.split_k;
+        s.tasks = tasks.size();
+        s.tiles = gemm_t::tiles(M, K, Np, mvm);
+        s.steals = 0;
+        s.buffer_words = 0;
+        s.weight_loads_saved = 0;
+        s.per_array.assign(cfg.arrays, ClusterArrayStats());
+        if (order)
+            order->assign(cfg.arrays, {});
+
+        const uint64_t acts_words = mvm ? C : C * R;
+        const uint64_t weight_words = R * C;
+        const uint64_t out_words = mvm ? R : C * C;
+        const uint64_t latency = Hsa<mac_t, R, C>::latency(mvm);
+
+        struct ArrayState
+        {
+            std::deque<uint64_t> queue;
+            uint64_t t = 0;
+            int64_t cur = -1;           // task being run
+            uint64_t k = 0;             // its next K tile
+            uint64_t wk = ~0ULL, wn = ~0ULL;    // resident weight block
+            bool writeback = false;     // cur's tiles are done, its block isn't written
+            bool done = false;
+        };
+        std::vector<ArrayState> arr(cfg.arrays);
+        for (uint64_t i = 0; i < tasks.size(); i++)
+            arr[0].queue.push_back(i);
+
+        uint64_t buffer_free = 0;
+        auto transfer = [&](uint64_t a, uint64_t words)
+        {
+            ArrayState& st = arr[a];
+            ClusterArrayStats& as = s.per_array[a];
+            uint64_t dur = (uint64_t)std::ceil((double)words / cfg.buffer_words);
+            uint64_t start = std::max(st.t, buffer_free);
+            as.stall += start - st.t;
+            as.transfer += dur;
+            st.t = start + dur;
+            buffer_free = st.t;
+            s.buffer_words += words;
+        };
+
+        while (true)
+        {
+            /* Earliest array that isn't done, one tile (or
+             * write back) at a time so buffer requests go out
+             * in time order */
+            int64_t a = -1;
+            for (uint64_t i = 0; i < cfg.arrays; i++)
+                if (!arr[i].done && (a < 0 || arr[i].t < arr[a].t))
+                    a = i;
+            if (a < 0) break;
+            ArrayState& st = arr[a];
+            ClusterArrayStats& as = s.per_array[a];
+
+            if (st.writeback)
+            {
+                /* Reducing into the block for any K tile but
+                 * the first */
+                const Task& task = tasks[st.cur];
+                transfer(a, cfg.split_k && task.k_first ? 2 * out_words : out_words);
+                as.tasks++;
+                st.cur = -1;
+                st.writeback = false;
+                continue;
+            }
+
+            if (st.cur < 0)
+            {
+                if (st.queue.empty())
+                {
+                    int64_t victim = -1;
+                    for (uint64_t i = 0; i < cfg.arrays; i++)
+                        if (!arr[i].queue.empty() && (victim < 0 || arr[i].queue.size() > arr[victim].queue.size()))
+                            victim = i;
+                    if (victim < 0)
+                    {
+                        st.done = true;
+                        as.finish = st.t;
+                        continue;
+                    }
+                    /* Back half, in order, so the run keeps its
+                     * weight reuse */
+                    std::deque<uint64_t>& vq = arr[victim].queue;
+                    uint64_t n = (vq.size() + 1) / 2;
+                    st.queue.assign(vq.end() - n, vq.end());
+                    vq.erase(vq.end() - n, vq.end());
+                    as.stolen++;
+                    s.steals++;
+                }
+                st.cur = st.queue.front();
+                st.queue.pop_front();
+                st.k = tasks[st.cur].k_first;
+                if (order)
+                    (*order)[a].push_back(tasks[st.cur]);
+            }
+
+            const Task& task = tasks[st.cur];
+            bool resident = st.wk == st.k && st.wn == task.n0;
+            s.weight_loads_saved += resident;
+            transfer(a, acts_words + (resident ? 0 : weight_words));
+            st.wk = st.k;
+            st.wn = task.n0;
+            st.t += latency;
+            as.compute += latency;
+            as.tiles++;
+
+            st.writeback = ++st.k > task.k_last;
+        }
+
+        s.makespan = 0;
+        double busy_sum = 0, busy_max = 0;
+        for (const ClusterArrayStats& as : s.per_array)
+        {
+            s.makespan = std::max(s.makespan, as.finish);
+            double busy = (double)(as.compute + as.transfer + as.stall);
+            busy_sum += busy;
+            busy_max = std::max(busy_max, busy);
+        }
+        s.macs = (double)M * (double)K * (double)Np;
+        s.utilization = s.makespan ? s.macs / ((double)s.pes * (double)s.makespan) : 0.0;
+        double pe_cycles = (double)s.tiles * (double)Hsa<mac_t, R, C>::schedule(mvm).pe_cycles();
+        s.pe_utilization = s.makespan ? pe_cycles / ((double)s.pes * (double)s.makespan) : 0.0;
+        s.macs_per_cycle = s.makespan ? s.macs / (double)s.makespan : 0.0;
+        s.balance = busy_max > 0 ? busy_sum / (double)cfg.arrays / busy_max : 1.0;
+        return s;
+    }
+
+public:
+    static ClusterStats schedule(const ClusterConfig& cfg, const std::string& name, uint64_t M,
+            uint64_t K, uint64_t Np)
+    {
+        return simulate(cfg, name, M, K, Np, nullptr);
+    }
+
+    /* Cm is resized to MxN' */
+    static ClusterStats run(const ClusterConfig& cfg, const std::string& name, const Matrix<mac_t>& A,
+            const Matrix<mac_t>& W, Matrix<mac_t>& Cm)
+    {
+        std::vector<std::vector<Task>> order;
+        ClusterStats s = simulate(cfg, name, A.rows, A.cols, W.cols, &order);
+        Cm = Matrix<mac_t>(A.rows, W.cols);
+        bool mvm = cfg.MVM_enable;
+        auto tile = std::make_unique<typename gemm_t::Tile>();
+        auto result = std::make_unique<typename gemm_t::TileResult>();
+        uint64_t saved = 0;
+        for (uint64_t a = 0; a < order.size(); a++)
+        {
+            std::unique_ptr<Hsa<mac_t, R, C>> hsa;
+            uint64_t wk = ~0ULL, wn = ~0ULL;
+            for (const Task& t : order[a])
+                for (uint64_t k = t.k_first; k <= t.k_last; k++)
+                {
+                    uint64_t k0 = k * gemm_t::k_step(mvm);
+                    if (hsa && wk == k && wn == t.n0)
+                        saved++;
+                    else
+                    {
+                        gemm_t::load_weights(W, k0, t.n0, mvm, tile->weights);
+                        if (hsa)
+                            hsa->load_weights(tile->weights);
+                        else
+                            hsa = std::make_unique<Hsa<mac_t, R, C>>(tile->weights);
+                        wk = k;
+                        wn = t.n0;
+                    }
+                    gemm_t::load_acts(A, t.m0, k0, mvm, tile->acts);
+                    hsa->load_acts(tile->acts, mvm);
+                    result->m0 = t.m0;
+                    result->n0 = t.n0;
+                    gemm_t::finish_tile(*hsa, mvm, *result);
+                    gemm_t::add_tile(*result, Cm, mvm);
+                }
+            /* Weight loads go through the buffer in the
+             * schedule, compute is the tiles alone */
+            uint64_t cycles = hsa ? hsa->get_total_cycles() - hsa->get_weight_cycles() : 0;
+            if (cycles != s.per_array[a].compute)
+                throw std::runtime_error(std::format("cluster: array {} took {} cycles, scheduled for {}",
+                            a, cycles, s.per_array[a].compute));
+        }
+        if (saved != s.weight_loads_saved)
+            throw std::runtime_error(std::format("cluster: {} tiles found their weights resident, "
+                        "scheduled for {}", saved, s.weight_loads_saved));
+        return s;
+    }
+};
+
+#endif
@@ -0,0 +1,490 @@
+#ifndef __HSA_GEMM_HH__
+#define __HSA_GEMM_HH__
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Hsa.hh"
+#include "HsaStream.hh"
+#include "Matrix.hh"
+#include "Pipeline.hh"
+
+/*- GEMM tiler on top of the HSA unit *-/
+ * mac_t should be a mac_t_p<b>
+ *
+ * Computes C = A * W (A: MxK acts, W: KxN' weights)
+ * of any shape by cutting it into tiles and running
+ * each one through a fresh Hsa<mac_t, R, C> (C = R
+ * for a square array). Tiles are zero padded at the
+ * edges.
+ *
+ * MMM mode: one tile = C rows of A against one RxC
+ *   block of W (K step R, N' step C), R+2C-2 cycles.
+ * MVM mode: one tile = a single row of A against one
+ *   CxR block of W (K step C, N' step R), C cycles.
+ *   Hsa's MVM computes W*v (psums flow along the rows),
+ *   so the W block is fed in transposed to get v*W out
+ *   instead.
+ *
+ * Partial products along K are summed up on the host,
+ * as the write-back would have to be on the FPGA (MMM
+ * rows as soon as the array drains them).
+ * Tiles run back to back with no overlap, and weight
+ * loading is not charged (same as Hsa itself).
+ *
+ * run_chained() keeps the K sum in the array instead:
+ * the tiles along K of one (m0, n0) go through the
+ * same Hsa back to back, each one chain()ed on to the
+ * last (its result entering the next through the
+ * psum-in port), so only the last one's result is
+ * written back. Same tiles and cycles as run(), a
+ * ceil(K / k_step) times smaller write-back.
+ *
+ * The other two flows go weight block by weight block
+ * (N' and K outside M), loading each block once:
+ *   run_resident() : one Hsa with resident weights
+ *                    (Hsa::load_weights()) runs all the
+ *                    acts tiles of a block, the weight
+ *                    load (R cycles a block) being charged
+ *   stream()       : per block every row of A goes into
+ *                    an HsaStream back to back, one per
+ *                    cycle, read straight out of A, so a
+ *                    block costs M + depth - 1 cycles
+ *                    (depth being R+C-1 for MMM, C for
+ *                    MVM) rather than a full Hsa latency
+ *                    per C rows (MMM) or per row (MVM)
+ */
+enum class GemmFlow
+{
+    tiled,                      // run()
+    chained,                    // run_chained()
+    resident,                   // run_resident()
+    streamed,                   // stream()
+    output_stationary           // on an Mpu instead, see MpuGemm.hh
+};
+
+struct GemmStats
+{
+    std::string name;
+    uint64_t M, K, N;           // logical GEMM shape, (MxK) * (KxN)
+    bool MVM_enable;
+    uint64_t tiles;
+    uint64_t weight_loads;      // weight blocks put into the array
+    uint64_t writebacks;        // result values written back (tile padding included)
+    uint64_t cycles;
+    uint64_t macs;              // useful MACs only, i.e. M*K*N
+    double utilization;         // macs / (PEs * cycles)
+};
+
+template <typename mac_t, uint64_t R, uint64_t C = R>
+class HsaGemm
+{
+private:
+    static uint64_t ceil_div(uint64_t a, uint64_t b)
+    {
+        return (a + b - 1) / b;
+    }
+
+public:
+    /* Cycles to do an MxK * KxN' GEMM in the given mode */
+    static uint64_t tiles(uint64_t M, uint64_t K, uint64_t Np, bool MVM_enable)
+    {
+        if (MVM_enable)
+            return M * ceil_div(K, C) * ceil_div(Np, R);
+        return ceil_div(M, C) * ceil_div(K, R) * ceil_div(Np, C);
+    }
+
+    static uint64_t estimate_cycles(uint64_t M, uint64_t K, uint64_t Np, bool MVM_enable)
+    {
+        return tiles(M, K, Np, MVM_enable) * Hsa<mac_t, R, C>::latency(MVM_enable);
+    }
+
+    /* Pick the mode by sequence length: MVM pays C cycles
+     * per row, MMM pays R+2C-2 per C rows, so MVM only wins
+     * for very short sequences (M <= 2 for any square N > 1).
+     * Compared on a K x N' that both modes tile exactly.
+     * */
+    static bool choose_MVM(uint64_t M)
+    {
+        return estimate_cycles(M, R*C, R*C, true) < estimate_cycles(M, R*C, R*C, false);
+    }
+
+    static uint64_t blocks(uint64_t K, uint64_t Np, bool MVM_enable)
+    {
+        return ceil_div(K, k_step(MVM_enable)) * ceil_div(Np, n_step(MVM_enable));
+    }
+
+    /* run_resident(): the same tiles, plus one weight load
+     * per block */
+    static uint64_t estimate_resident_cycles(uint64_t M, uint64_t K, uint64_t Np, bool MVM_enable)
+    {
+        return estimate_cycles(M, K, Np, MVM_enable)
+            + blocks(K, Np, MVM_enable) * Hsa<mac_t, R, C>::weight_load_latency;
+    }
+
+    /* stream(): one weight block after the other, each
+     * taking M pushes plus the time for the last one to
+     * come out */
+    static uint64_t estimate_stream_cycles(uint64_t M, uint64_t K, uint64_t Np, bool MVM_enable)
+    {
+        uint64_t depth = MVM_enable ? C : R + C - 1;
+        return M ? blocks(K, Np, MVM_enable) * (M + depth - 1) : 0;
+    }
+
+    /* For a streamed flow tiles are the weight blocks */
+    static GemmStats analyse(const std::string& name, uint64_t M, uint64_t K,
+            uint64_t Np, bool MVM_enable, GemmFlow flow = GemmFlow::tiled)
+    {
+        GemmStats s;
+        s.name = name;
+        s.M = M;
+        s.K = K;
+        s.N = Np;
+        s.MVM_enable = MVM_enable;
+        s.tiles = flow == GemmFlow::streamed ? blocks(K, Np, MVM_enable) : tiles(M, K, Np, MVM_enable);
+        s.weight_loads = flow == GemmFlow::tiled || flow == GemmFlow::chained ?
+            s.tiles : blocks(K, Np, MVM_enable);
+        /* A tile writes back m_step x n_step values, a
+         * streamed block n_step per row of A */
+        if (flow == GemmFlow::streamed)
+            s.writebacks = M * s.tiles * n_step(MVM_enable);
+        else if (flow == GemmFlow::chained)
+            s.writebacks = s.tiles / std::max<uint64_t>(ceil_div(K, k_step(MVM_enable)), 1) * m_step(MVM_enable) * n_step(MVM_enable);
+        else
+            s.writebacks = s.tiles * m_step(MVM_enable) * n_step(MVM_enable);
+        if (flow == GemmFlow::resident)
+            s.cycles = estimate_resident_cycles(M, K, Np, MVM_enable);
+        else if (flow == GemmFlow::streamed)
+            s.cycles = estimate_stream_cycles(M, K, Np, MVM_enable);
+        else
+            s.cycles = estimate_cycles(M, K, Np, MVM_enable);
+        s.macs = M * K * Np;
+        s.utilization = s.cycles ? (double)s.macs / (double)(R * C * s.cycles) : 0.0;
+        return s;
+    }
+
+    /* Tile steps along M, K and N' */
+    static constexpr uint64_t m_step(bool MVM_enable) { return MVM_enable ? 1 : C; }
+    static constexpr uint64_t k_step(bool MVM_enable) { return MVM_enable ? C : R; }
+    static constexpr uint64_t n_step(bool MVM_enable) { return MVM_enable ? R : C; }
+
+    /* One tile's operands, as Hsa takes them: acts CxR,
+     * weights RxC */
+    struct Tile
+    {
+        uint64_t m0, k0, n0;
+        mac_t acts[C][R], weights[R][C];
+    };
+
+    /* What a tile adds into the result: out[i][j] to
+     * (m0 + i, n0 + j) for MMM (CxC), out[i][0] to
+     * (m0, n0 + i) for MVM (R long) */
+    struct TileResult
+    {
+        uint64_t m0, n0;
+        uint64_t cycles;
+        mac_t out[std::max(R, C)][C];
+    };
+
+    static void load_tile(const Matrix<mac_t>& A, const Matrix<mac_t>& W, uint64_t m0, uint64_t k0,
+            uint64_t n0, bool MVM_enable, Tile& t)
+    {
+        t.m0 = m0;
+        t.k0 = k0;
+        t.n0 = n0;
+        load_acts(A, m0, k0, MVM_enable, t.acts);
+        load_weights(W, k0, n0, MVM_enable, t.weights);
+    }
+
+    /* The CxR acts tile at (m0, k0) */
+    static void load_acts(const Matrix<mac_t>& A, uint64_t m0, uint64_t k0, bool MVM_enable,
+            mac_t acts[C][R])
+    {
+        for (uint64_t i = 0; i < C; i++)
+            for (uint64_t j = 0; j < R; j++)
+                acts[i][j] = mac_t::ZERO;
+        if (MVM_enable)
+        {
+            /* Vector goes in the last col of acts */
+            for (uint64_t i = 0; i < C; i++)
+                if (k0 + i < A.cols)
+                    acts[i][R-1] = A.at(m0, k0 + i);
+        }
+        else
+        {
+            for (uint64_t i = 0; i < C; i++)
+                for (uint64_t j = 0; j < R; j++)
+                    if (m0 + i < A.rows && k0 + j < A.cols)
+                        acts[i][j] = A.at(m0 + i, k0 + j);
+        }
+    }
+
+    /* The RxC weight block at (k0, n0), transposed for MVM */
+    static void load_weights(const Matrix<mac_t>& W, uint64_t k0, uint64_t n0, bool MVM_enable,
+            mac_t weights[R][C])
+    {
+        for (uint64_t i = 0; i < R; i++)
+            for (uint64_t j = 0; j < C; j++)
+            {
+                uint64_t k = k0 + (MVM_enable ? j : i), n = n0 + (MVM_enable ? i : j);
+                weights[i][j] = k < W.rows && n < W.cols ? W.at(k, n) : mac_t::ZERO;
+            }
+    }
+
+    /* Runs t through a fresh Hsa until it is ready */
+    static void simulate_tile(Tile& t, bool MVM_enable, TileResult& r)
+    {
+        r.m0 = t.m0;
+        r.n0 = t.n0;
+        /* Large N blows the stack otherwise */
+        auto hsa = std::make_unique<Hsa<mac_t, R, C>>(t.acts, t.weights, MVM_enable);
+        finish_tile(*hsa, MVM_enable, r);
+    }
+
+    /* Clocks hsa's current tile until ready, into r */
+    static void finish_tile(Hsa<mac_t, R, C>& hsa, bool MVM_enable, TileResult& r)
+    {
+        /* MMM rows come out as they drain */
+        if (!MVM_enable)
+            hsa.set_row_callback([&](uint64_t i, const mac_t *row)
+            {
+                for (uint64_t j = 0; j < C; j++)
+                    r.out[i][j] = row[j];
+            });
+        while (!hsa.ready(MVM_enable))
+            hsa.clock(MVM_enable);
+        if (MVM_enable)
+            hsa.get_result(r.out, MVM_enable);
+        r.cycles = hsa.get_counter();
+    }
+
+    /* Partial products along K just add up */
+    static void add_tile(const TileResult& r, Matrix<mac_t>& Cm, bool MVM_enable)
+    {
+        if (MVM_enable)
+        {
+            for (uint64_t i = 0; i < R; i++)
+                if (r.n0 + i < Cm.cols)
+                    Cm.at(r.m0, r.n0 + i).value += r.out[i][0].value;
+            return;
+        }
+        for (uint64_t i = 0; i < C; i++)
+            for (uint64_t j = 0; j < C; j++)
+                if (r.m0 + i < Cm.rows && r.n0 + j < Cm.cols)
+                    Cm.at(r.m0 + i, r.n0 + j).value += r.out[i][j].value;
+    }
+
+    /* Runs the tile at (m0, k0, n0) through a fresh Hsa
+     * and adds its partial product into Cm (MxN').
+     * Returns the clock() calls until it was ready. */
+    static uint64_t run_tile(const Matrix<mac_t>& A, const Matrix<mac_t>& W, Matrix<mac_t>& Cm,
+            uint64_t m0, uint64_t k0, uint64_t n0, bool MVM_enable)
+    {
+        auto t = std::make_unique<Tile>();
+        auto r = std::make_unique<TileResult>();
+        load_tile(A, W, m0, k0, n0, MVM_enable, *t);
+        simulate_tile(*t, MVM_enable, *r);
+        add_tile(*r, Cm, MVM_enable);
+        return r->cycles;
+    }
+
+    /* Runs every tile cycle by cycle, Cm is resized to MxN'.
+     * Returned cycle count is the sum of clock() calls
+     * until each tile was ready (so matches analyse()).
+     *
+     * With threads > 1 the tiles are pipelined: this
+     * thread cuts them out of A and W, `threads` workers
+     * simulate them and one more adds them into Cm, all
+     * connected by bounded queues (Pipeline.hh). Tiles
+     * (and their results) are recycled through a free
+     * list, so only a few per worker ever exist.
+     * Wrapping adds commute, so Cm comes out the same
+     * whatever order the tiles finish in.
+     * */
+    static GemmStats run(const std::string& name, const Matrix<mac_t>& A,
+            const Matrix<mac_t>& W, Matrix<mac_t>& Cm, bool MVM_enable, uint64_t threads = 1)
+    {
+        GemmStats s = analyse(name, A.rows, A.cols, W.cols, MVM_enable);
+        Cm = Matrix<mac_t>(A.rows, W.cols);
+        s.cycles = 0;
+        if (threads <= 1)
+        {
+            for (uint64_t m0 = 0; m0 < A.rows; m0 += m_step(MVM_enable))
+                for (uint64_t n0 = 0; n0 < W.cols; n0 += n_step(MVM_enable))
+                    for (uint64_t k0 = 0; k0 < A.cols; k0 += k_step(MVM_enable))
+                        s.cycles += run_tile(A, W, Cm, m0, k0, n0, MVM_enable);
+            s.utilization = s.cycles ? (double)s.macs / (double)(R * C * s.cycles) : 0.0;
+            return s;
+        }
+
+        struct Job
+        {
+            std::unique_ptr<Tile> tile;
+            std::unique_ptr<TileResult> result;
+        };
+        uint64_t depth = 4 * threads;
+        MpmcQueue<Job> free_jobs(depth), tiles(depth), done(depth, threads);
+        for (uint64_t i = 0; i < depth; i++)
+            free_jobs.push({std::make_unique<Tile>(), std::make_unique<TileResult>()});
+
+        std::vector<std::thread> stages;
+        for (uint64_t w = 0; w < threads; w++)
+            stages.emplace_back([&]()
+            {
+                Job j;
+                while (tiles.pop(j))
+                {
+                    simulate_tile(*j.tile, MVM_enable, *j.result);
+                    done.push(std::move(j));
+                }
+                done.close();
+            });
+        stages.emplace_back([&]()
+        {
+            Job j;
+            while (done.pop(j))
+            {
+                add_tile(*j.result, Cm, MVM_enable);
+                s.cycles += j.result->cycles;
+                free_jobs.push(std::move(j));
+            }
+        });
+
+        Job j;
+        for (uint64_t m0 = 0; m0 < A.rows; m0 += m_step(MVM_enable))
+            for (uint64_t n0 = 0; n0 < W.cols; n0 += n_step(MVM_enable))
+                for (uint64_t k0 = 0; k0 < A.cols; k0 += k_step(MVM_enable))
+                {
+                    free_jobs.pop(j);
+                    load_tile(A, W, m0, k0, n0, MVM_enable, *j.tile);
+                    tiles.push(std::move(j));
+                }
+        tiles.close();
+        for (std::thread& t : stages)
+            t.join();
+        s.utilization = s.cycles ? (double)s.macs / (double)(R * C * s.cycles) : 0.0;
+        return s;
+    }
+
+    /* Same tiles as run(), the K tiles of each output
+     * tile chained through one Hsa's psum-in port (see
+     * above), Cm is resized to MxN' */
+    static GemmStats run_chained(const std::string& name, const Matrix<mac_t>& A,
+            const Matrix<mac_t>& W, Matrix<mac_t>& Cm, bool MVM_enable)
+    {
+        GemmStats s = analyse(name, A.rows, A.cols, W.cols, MVM_enable, GemmFlow::chained);
+        Cm = Matrix<mac_t>(A.rows, W.cols);
+        s.cycles = 0;
+        auto t = std::make_unique<Tile>();
+        auto r = std::make_unique<TileResult>();
+        for (uint64_t m0 = 0; m0 < A.rows; m0 += m_step(MVM_enable))
+            for (uint64_t n0 = 0; n0 < W.cols; n0 += n_step(MVM_enable))
+            {
+                std::unique_ptr<Hsa<mac_t, R, C>> hsa;
+                for (uint64_t k0 = 0; k0 < A.cols; k0 += k_step(MVM_enable))
+                {
+                    load_tile(A, W, m0, k0, n0, MVM_enable, *t);
+                    if (hsa)
+                        hsa->chain(t->acts, t->weights, MVM_enable);
+                    else
+                        hsa = std::make_unique<Hsa<mac_t, R, C>>(t->acts, t->weights, MVM_enable);
+                    while (!hsa->ready(MVM_enable))
+                        hsa->clock(MVM_enable);
+                }
+                if (!hsa)
+                    continue;
+                r->m0 = m0;
+                r->n0 = n0;
+                hsa->get_result(r->out, MVM_enable);
+                add_tile(*r, Cm, MVM_enable);
+                s.cycles += hsa->get_total_cycles();
+            }
+        s.utilization = s.cycles ? (double)s.macs / (double)(R * C * s.cycles) : 0.0;
+        return s;
+    }
+
+    /* Same tiles as run(), on one Hsa with resident weights
+     * (see above), Cm is resized to MxN'. cycles include
+     * the weight loads */
+    static GemmStats run_resident(const std::string& name, const Matrix<mac_t>& A,
+            const Matrix<mac_t>& W, Matrix<mac_t>& Cm, bool MVM_enable)
+    {
+        GemmStats s = analyse(name, A.rows, A.cols, W.cols, MVM_enable, GemmFlow::resident);
+        Cm = Matrix<mac_t>(A.rows, W.cols);
+        s.cycles = 0;
+        auto t = std::make_unique<Tile>();
+        auto r = std::make_unique<TileResult>();
+        std::unique_ptr<Hsa<mac_t, R, C>> hsa;
+        for (uint64_t n0 = 0; n0 < W.cols; n0 += n_step(MVM_enable))
+            for (uint64_t k0 = 0; k0 < A.cols; k0 += k_step(MVM_enable))
+            {
+                load_weights(W, k0, n0, MVM_enable, t->weights);
+                if (hsa)
+                    hsa->load_weights(t->weights);
+                else
+                    hsa = std::make_unique<Hsa<mac_t, R, C>>(t->weights);
+                for (uint64_t m0 = 0; m0 < A.rows; m0 += m_step(MVM_enable))
+                {
+                    load_acts(A, m0, k0, MVM_enable, t->acts);
+                    hsa->load_acts(t->acts, MVM_enable);
+                    r->m0 = m0;
+                    r->n0 = n0;
+                    finish_tile(*hsa, MVM_enable, *r);
+                    add_tile(*r, Cm, MVM_enable);
+                }
+            }
+        if (hsa)
+            s.cycles = hsa->get_total_cycles();
+        s.utilization = s.cycles ? (double)s.macs / (double)(R * C * s.cycles) : 0.0;
+        return s;
+    }
+
+    /* Same as run() through one HsaStream per weight block
+     * (see above), Cm is resized to MxN'. Rows of A are
+     * pushed from A itself, only a K slice running off its
+     * edge is copied (zero padded) */
+    static GemmStats stream(const std::string& name, const Matrix<mac_t>& A,
+            const Matrix<mac_t>& W, Matrix<mac_t>& Cm, bool MVM_enable)
+    {
+        typedef HsaStream<mac_t, R, C> stream_t;
+        GemmStats s = analyse(name, A.rows, A.cols, W.cols, MVM_enable, GemmFlow::streamed);
+        Cm = Matrix<mac_t>(A.rows, W.cols);
+        s.cycles = 0;
+        auto weights = std::make_unique<mac_t[][C]>(R);
+        std::vector<mac_t> padded;
+        for (uint64_t n0 = 0; n0 < W.cols; n0 += n_step(MVM_enable))
+            for (uint64_t k0 = 0; k0 < A.cols; k0 += k_step(MVM_enable))
+            {
+                load_weights(W, k0, n0, MVM_enable, weights.get());
+                auto hs = std::make_unique<stream_t>(weights.get(), MVM_enable);
+                uint64_t width = hs->in_width();
+                hs->set_output_callback([&](uint64_t m, const mac_t *out)
+                {
+                    for (uint64_t j = 0; j < hs->out_width() && n0 + j < W.cols; j++)
+                        Cm.at(m, n0 + j).value += out[j].value;
+                });
+                padded.assign(width, mac_t::ZERO);
+                for (uint64_t m = 0; m < A.rows; m++)
+                {
+                    if (k0 + width <= A.cols)
+                    {
+                        hs->push(&A.at(m, k0));
+                        continue;
+                    }
+                    for (uint64_t k = 0; k < width; k++)
+                        padded[k] = k0 + k < A.cols ? A.at(m, k0 + k) : mac_t::ZERO;
+                    hs->push(padded.data());
+                }
+                hs->flush();
+                s.cycles += hs->get_counter();
+            }
+        s.utilization = s.cycles ? (double)s.macs / (double)(R * C * s.cycles) : 0.0;
+        return s;
+    }
+};
+
+#endif
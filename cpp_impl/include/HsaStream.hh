@@ -0,0 +1,243 @@
+#ifndef __HSA_STREAM_HH__
+#define __HSA_STREAM_HH__
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <format>
+#include <functional>
+#include <span>
+#include <stdexcept>
+#include <string>
+
+#include "Checkpoint.hh"
+#include "Hsa.hh"
+#include "SystolicArray.hh"
+#include "WsMac.hh"
+
+/*- Streaming HSA *-/
+ * mac_t should be a mac_t_p<b>
+ *
+ * Hsa's dataflow (see Hsa.hh) fed one activation vector
+ * per cycle instead of a preloaded acts matrix: the
+ * weights go into the PEs once, at construction, then
+ * every push() is one clock cycle taking one vector
+ * straight from the caller, and every result comes out
+ * through the output callback as soon as it has drained.
+ * There is no acts matrix and no bound on how many vectors
+ * go through, so the streamed dimension is unbounded.
+ *
+ *   MMM : in = one row a of A (R values, a[k] entering
+ *         array row k), out = a * W (C values). a[k]
+ *         reaches row k k cycles late (the input skew),
+ *         psums flow down, out[j] leaves the bottom row
+ *         at col j.
+ *   MVM : in = one vector v (C values, v[j] broadcast to
+ *         col j), out = W * v (R values). v[j] is
+ *         broadcast j cycles late, psums flow right,
+ *         all of out leaves the last col at once.
+ *
+ * The input pushed in cycle t comes out at the end of
+ * cycle t + depth() - 1. Cycles are exactly Hsa's:
+ * pushing acts rows C-1 .. 0 (Hsa streams them last
+ * first) and then flush()ing takes latency() clock()s
+ * and gives the same rows in the same cycles. Pushes
+ * and bubbles (cycles without input) can be mixed
+ * freely, outputs are numbered by push.
+ *
+ * It is Hsa's HsaDataflow on the SystolicArray engine
+ * (unrolled for the small arrays like Hsa's clock()),
+ * clocked through clock_stream() instead of the
+ * schedule: every PE every cycle (a stream has no idle
+ * PEs once it is full), the input skew held in the
+ * dataflow's stream_sram. save_state()/load_state()
+ * snapshot it mid-stream (tag "hsastream"), the output
+ * callback is the only thing a restore keeps.
+ */
+template <typename mac_t, uint64_t R, uint64_t C, typename pe_t>
+class HsaStreamDataflow : public HsaDataflow<mac_t, R, C, pe_t>
+{
+protected:
+    typedef HsaDataflow<mac_t, R, C, pe_t> hsa_t;
+
+    static std::string checkpoint_tag()
+    {
+        return R == C ? std::string("hsastream") : std::format("hsastream{}x{}", R, C);
+    }
+
+    void save_operands(CheckpointWriter& ck) const
+    {
+        hsa_t::save_operands(ck);
+        ck.put(this->stream_sram);
+    }
+
+    void load_operands(CheckpointReader& ck)
+    {
+        hsa_t::load_operands(ck);
+        ck.get(this->stream_sram);
+    }
+};
+
+template <typename mac_t, uint64_t R, uint64_t C = R>
+class HsaStream : private SystolicArray<mac_t, R, C, HsaStreamDataflow, WsMac<mac_t>>
+{
+public:
+    /* index: which push (0 based) it is the result of */
+    typedef std::function<void(uint64_t index, const mac_t *values)> output_callback;
+
+private:
+    typedef SystolicArray<mac_t, R, C, HsaStreamDataflow, WsMac<mac_t>> base_t;
+    using base_t::right_latches;
+    using base_t::down_latches;
+    using base_t::stream_sram;
+
+    /* Pushes of the last L cycles, to know which push
+     * each output belongs to */
+    static constexpr uint64_t L = std::bit_ceil(R + C);
+    static constexpr uint64_t W = std::max(R, C);
+
+    bool MVM_enable;
+    bool in_valid[L];                   // pushed, not a bubble
+    uint64_t in_index[L];
+    mac_t out_rows[C][W];               // MMM rows still draining, by index % C
+    output_callback on_output;
+    uint64_t pushed = 0, drained = 0;
+
+    void cycle(const mac_t *in)
+    {
+        uint64_t t = this->counter;
+        in_valid[t % L] = in != nullptr;
+        in_index[t % L] = pushed;
+        if (in)
+            pushed++;
+        /* Value k is taken k cycles late */
+        for (uint64_t k = 0; k < W; k++)
+        {
+            for (uint64_t d = k; d > 0; d--)
+                stream_sram[k][d] = stream_sram[k][d-1];
+            stream_sram[k][0] = in && k < in_width() ? in[k] : mac_t::ZERO;
+        }
+
+        this->clock_stream(MVM_enable);
+
+        if (MVM_enable)
+        {
+            if (t >= C-1 && in_valid[(t - (C-1)) % L])
+            {
+                for (uint64_t i = 0; i < R; i++)
+                    out_rows[0][i] = right_latches[i][C-1];
+                deliver(in_index[(t - (C-1)) % L], out_rows[0]);
+            }
+        }
+        else
+            for (uint64_t j = 0; j < C; j++)
+            {
+                /* col j is j cycles behind col 0 */
+                if (t < R-1 + j || !in_valid[(t - (R-1+j)) % L])
+                    continue;
+                uint64_t index = in_index[(t - (R-1+j)) % L];
+                out_rows[index % C][j] = down_latches[R-1][j];
+                if (j == C-1)
+                    deliver(index, out_rows[index % C]);
+            }
+        this->counter++;
+    }
+
+    void deliver(uint64_t index, const mac_t *values)
+    {
+        drained++;
+        if (on_output)
+            on_output(index, values);
+    }
+
+public:
+    /* weights RxC, as for Hsa */
+    HsaStream(mac_t weights[R][C], bool MVM_enable_p) : MVM_enable(MVM_enable_p)
+    {
+        this->init_acts(nullptr);
+        this->init_psums_sram(nullptr, 0);
+        /* Into the PEs once, as for a resident Hsa */
+        this->resident_weights(this->mac_units, weights);
+        for (uint64_t k = 0; k < W; k++)
+            for (uint64_t d = 0; d < W; d++)
+                stream_sram[k][d] = mac_t::ZERO;
+        for (uint64_t c = 0; c < L; c++)
+        {
+            in_valid[c] = false;
+            in_index[c] = 0;
+        }
+        this->reset(MVM_enable);
+    }
+
+    void set_output_callback(output_callback cb)
+    {
+        on_output = std::move(cb);
+    }
+
+    /* Values per input and per output */
+    uint64_t in_width() const { return MVM_enable ? C : R; }
+    uint64_t out_width() const { return MVM_enable ? R : C; }
+
+    /* Cycles from a push to its output */
+    uint64_t depth() const { return MVM_enable ? C : R + C - 1; }
+
+    /* One cycle, in holding in_width() values */
+    void push(const mac_t *in)
+    {
+        cycle(in);
+    }
+
+    /* One cycle per in_width() values */
+    void push(std::span<const mac_t> in)
+    {
+        if (in.size() % in_width())
+            throw std::runtime_error("hsa stream: input is not a whole number of vectors");
+        for (uint64_t k = 0; k < in.size(); k += in_width())
+            cycle(in.data() + k);
+    }
+
+    /* One cycle with no input */
+    void bubble()
+    {
+        cycle(nullptr);
+    }
+
+    /* Bubbles until everything pushed has come out */
+    void flush()
+    {
+        while (drained < pushed)
+            cycle(nullptr);
+    }
+
+    uint64_t get_counter() const { return this->counter; }
+    uint64_t get_pushed() const { return pushed; }
+    uint64_t get_drained() const { return drained; }
+
+    using base_t::checkpoint_tag;
+
+    /* The array's state (see SystolicArray.hh), then
+     * the stream's own */
+    void save_state(CheckpointWriter& ck) const
+    {
+        base_t::save_state(ck);
+        ck.put(MVM_enable);
+        ck.put(in_valid);
+        ck.put(in_index);
+        ck.put(out_rows);
+        ck.put(pushed);
+        ck.put(drained);
+    }
+
+    void load_state(CheckpointReader& ck)
+    {
+        base_t::load_state(ck);
+        ck.get(MVM_enable);
+        ck.get(in_valid);
+        ck.get(in_index);
+        ck.get(out_rows);
+        ck.get(pushed);
+        ck.get(drained);
+    }
+};
+
+#endif
@@ -0,0 +1,266 @@
+#ifndef __JSON_HH__
+#define __JSON_HH__
+
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*- Minimal JSON reader *-/
+ * Enough for experiment config files: objects, arrays,
+ * strings (with the usual escapes, no \u), numbers,
+ * true/false/null. No external deps on purpose, the
+ * simulator is supposed to build on a bare toolchain.
+ *
+ * Numbers keep the literal they were written as, so
+ * as_uint() reads integers exactly (all 64 bits, not
+ * through a double). Values remember the key they were
+ * found under, which conversion errors name.
+ */
+struct Json
+{
+    enum Type { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT };
+
+    Type type = NUL;
+    bool b = false;
+    double num = 0;
+    std::string str;                    // STRING: the value, NUMBER: the literal
+    std::string key;                    // where it was found, for errors
+    std::vector<Json> arr;
+    std::map<std::string, Json> obj;
+
+    bool is_null() const   { return type == NUL; }
+    bool is_array() const  { return type == ARRAY; }
+    bool is_object() const { return type == OBJECT; }
+    bool is_string() const { return type == STRING; }
+    bool is_number() const { return type == NUMBER; }
+
+    bool has(const std::string& key) const
+    {
+        return type == OBJECT && obj.count(key);
+    }
+
+    const Json& operator[](const std::string& key) const
+    {
+        static const Json null_value;
+        if (!has(key)) return null_value;
+        return obj.find(key)->second;
+    }
+
+    std::string as_string(const std::string& dflt = "") const
+    {
+        if (type == STRING) return str;
+        if (type == NUMBER)
+        {
+            std::ostringstream ss;
+            ss << num;
+            return ss.str();
+        }
+        return dflt;
+    }
+
+    double as_number(double dflt = 0) const
+    {
+        if (type == NUMBER) return num;
+        if (type == BOOL) return b;
+        if (type != STRING) return dflt;
+        const char *begin = str.c_str();
+        char *end = nullptr;
+        double ret = std::strtod(begin, &end);
+        if (str.empty() || end != begin + str.size())
+            bad_value("a number");
+        return ret;
+    }
+
+    uint64_t as_uint(uint64_t dflt = 0) const
+    {
+        if (type == NUL) return dflt;
+        if (type == BOOL) return b;
+        if (type != NUMBER && type != STRING)
+            bad_value("an unsigned integer");
+        uint64_t ret = 0;
+        auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), ret);
+        if (ec == std::errc::result_out_of_range)
+            bad_value("an unsigned integer below 2^64");
+        if (ec == std::errc() && end == str.data() + str.size())
+            return ret;
+        /* Integral literals like 1e3 or 2.0 */
+        char *num_end = nullptr;
+        double v = std::strtod(str.c_str(), &num_end);
+        if (str.empty() || num_end != str.c_str() + str.size() || v < 0 || v >= 18446744073709551616.0 || v != (double)(uint64_t)v)
+            bad_value("an unsigned integer");
+        return (uint64_t)v;
+    }
+
+    bool as_bool(bool dflt = false) const
+    {
+        if (type == BOOL) return b;
+        if (type == NUMBER) return num != 0;
+        if (type == STRING) return str == "true" || str == "1";
+        return dflt;
+    }
+
+    static Json parse(const std::string& text)
+    {
+        uint64_t pos = 0;
+        Json ret = parse_value(text, pos);
+        skip_ws(text, pos);
+        if (pos != text.size())
+            fail(text, pos, "trailing characters");
+        return ret;
+    }
+
+    static Json parse_file(const std::string& path)
+    {
+        std::ifstream f(path);
+        if (!f)
+            throw std::runtime_error("json: unable to open " + path);
+        std::stringstream ss;
+        ss << f.rdbuf();
+        return parse(ss.str());
+    }
+
+private:
+    [[noreturn]] void bad_value(const std::string& expected) const
+    {
+        std::string text = type == NUMBER || type == STRING ? "'" + str + "'" : "this value";
+        throw std::runtime_error("json: " + (key.empty() ? "" : key + ": ") + text +
+                " is not " + expected);
+    }
+
+    /* Names v (and what's inside an array) after key */
+    static void set_key(Json& v, const std::string& key)
+    {
+        v.key = key;
+        for (uint64_t i = 0; i < v.arr.size(); i++)
+            set_key(v.arr[i], key + "[" + std::to_string(i) + "]");
+    }
+
+    [[noreturn]] static void fail(const std::string& text, uint64_t pos, const std::string& what)
+    {
+        uint64_t line = 1;
+        for (uint64_t i = 0; i < pos && i < text.size(); i++)
+            if (text[i] == '\n') line++;
+        throw std::runtime_error("json: " + what + " on line " + std::to_string(line));
+    }
+
+    static void skip_ws(const std::string& t, uint64_t& p)
+    {
+        while (p < t.size())
+        {
+            if (isspace((unsigned char)t[p])) p++;
+            /* allow // comments, handy in hand-written configs */
+            else if (t[p] == '/' && p + 1 < t.size() && t[p+1] == '/')
+                while (p < t.size() && t[p] != '\n') p++;
+            else break;
+        }
+    }
+
+    static std::string parse_string(const std::string& t, uint64_t& p)
+    {
+        std::string ret;
+        p++;    // opening quote
+        while (p < t.size() && t[p] != '"')
+        {
+            char c = t[p++];
+            if (c == '\\' && p < t.size())
+            {
+                char e = t[p++];
+                switch (e)
+                {
+                    case 'n': ret += '\n'; break;
+                    case 't': ret += '\t'; break;
+                    case 'r': ret += '\r'; break;
+                    default:  ret += e;    break;
+                }
+            }
+            else
+                ret += c;
+        }
+        if (p >= t.size())
+            fail(t, p, "unterminated string");
+        p++;    // closing quote
+        return ret;
+    }
+
+    static Json parse_value(const std::string& t, uint64_t& p)
+    {
+        skip_ws(t, p);
+        if (p >= t.size())
+            fail(t, p, "unexpected end of input");
+        Json v;
+        char c = t[p];
+        if (c == '{')
+        {
+            v.type = OBJECT;
+            p++;
+            skip_ws(t, p);
+            if (p < t.size() && t[p] == '}') { p++; return v; }
+            while (true)
+            {
+                skip_ws(t, p);
+                if (p >= t.size() || t[p] != '"')
+                    fail(t, p, "expected key");
+                std::string key = parse_string(t, p);
+                skip_ws(t, p);
+                if (p >= t.size() || t[p] != ':')
+                    fail(t, p, "expected ':'");
+                p++;
+                Json& child = v.obj[key] = parse_value(t, p);
+                set_key(child, key);
+                skip_ws(t, p);
+                if (p < t.size() && t[p] == ',') { p++; continue; }
+                if (p < t.size() && t[p] == '}') { p++; break; }
+                fail(t, p, "expected ',' or '}'");
+            }
+        }
+        else if (c == '[')
+        {
+            v.type = ARRAY;
+            p++;
+            skip_ws(t, p);
+            if (p < t.size() && t[p] == ']') { p++; return v; }
+            while (true)
+            {
+                v.arr.push_back(parse_value(t, p));
+                skip_ws(t, p);
+                if (p < t.size() && t[p] == ',') { p++; continue; }
+                if (p < t.size() && t[p] == ']') { p++; break; }
+                fail(t, p, "expected ',' or ']'");
+            }
+        }
+        else if (c == '"')
+        {
+            v.type = STRING;
+            v.str = parse_string(t, p);
+        }
+        else if (t.compare(p, 4, "true") == 0)  { v.type = BOOL; v.b = true;  p += 4; }
+        else if (t.compare(p, 5, "false") == 0) { v.type = BOOL; v.b = false; p += 5; }
+        else if (t.compare(p, 4, "null") == 0)  { v.type = NUL; p += 4; }
+        else
+        {
+            uint64_t e = p;
+            while (e < t.size() && (isdigit((unsigned char)t[e]) || t[e] == '-' || t[e] == '+' ||
+                        t[e] == '.' || t[e] == 'e' || t[e] == 'E'))
+                e++;
+            if (e == p)
+                fail(t, p, std::string("unexpected '") + c + "'");
+            v.type = NUMBER;
+            v.str = t.substr(p, e - p);
+            char *end = nullptr;
+            v.num = std::strtod(v.str.c_str(), &end);
+            if (end != v.str.c_str() + v.str.size())
+                fail(t, p, "malformed number '" + v.str + "'");
+            p = e;
+        }
+        return v;
+    }
+};
+
+#endif
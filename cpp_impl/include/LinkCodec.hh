@@ -0,0 +1,209 @@
+#ifndef __LINK_CODEC_HH__
+#define __LINK_CODEC_HH__
+
+#include <algorithm>
+#include <cstdint>
+
+/*- Payload codecs for the host link *-/
+ * Bit level (de)coders used by the bulk frames
+ * (BulkFrame.hh). Everything is packed LSB first.
+ *
+ * Pair packed weights (2:4): the weight rows are split
+ * into column pairs (2j, 2j+1), and a pair with at most
+ * one non zero is sent as that value plus a 1 bit tag,
+ * its column parity. This is exactly what SpVpu keeps
+ * in weight_tags_sram after column merging, so a 2:4
+ * pruned tile goes at (bits+1)/2 bits a weight, and the
+ * board can load it into the merged srams as is. Only
+ * usable if every pair of the tile fits (and n is even).
+ *
+ * Zero run length: a 16 bit token count, then tokens of
+ * a 4 bit run r and a value v, meaning r zeros then v.
+ * Runs of more than 15 zeros are split with (15, 0)
+ * tokens, trailing zeros aren't sent at all (the element
+ * count is known from the header).
+ */
+constexpr uint64_t RLE_RUN_BITS = 4;
+constexpr uint64_t RLE_MAX_RUN = (1 << RLE_RUN_BITS) - 1;
+constexpr uint64_t RLE_COUNT_BITS = 16;
+
+inline uint64_t bit_mask(uint64_t bits)
+{
+    return bits >= 64 ? ~0ULL : (1ULL << bits) - 1;
+}
+
+class BitWriter
+{
+private:
+    uint8_t *p;
+    uint64_t acc, acc_bits;
+public:
+    BitWriter(uint8_t *out) : p(out), acc(0), acc_bits(0) {}
+
+    void put(uint64_t v, uint64_t bits)
+    {
+        v &= bit_mask(bits);
+        for (uint64_t done = 0; done < bits; )
+        {
+            uint64_t take = std::min<uint64_t>(bits - done, 8 - acc_bits);
+            acc |= ((v >> done) & bit_mask(take)) << acc_bits;
+            acc_bits += take;
+            done += take;
+            if (acc_bits == 8)
+            {
+                *p++ = (uint8_t)acc;
+                acc = acc_bits = 0;
+            }
+        }
+    }
+
+    /* Flushes a partial byte, returns the end */
+    uint8_t *finish()
+    {
+        if (acc_bits)
+            *p++ = (uint8_t)acc;
+        acc = acc_bits = 0;
+        return p;
+    }
+};
+
+class BitReader
+{
+private:
+    const uint8_t *p;
+    uint64_t len_bits, bit;
+public:
+    BitReader(const uint8_t *in, uint64_t len) : p(in), len_bits(8*len), bit(0) {}
+
+    /* false once past the end, v is then garbage */
+    bool get(uint64_t& v, uint64_t bits)
+    {
+        if (bit + bits > len_bits)
+            return false;
+        v = 0;
+        for (uint64_t done = 0; done < bits; )
+        {
+            uint64_t off = bit % 8;
+            uint64_t take = std::min<uint64_t>(bits - done, 8 - off);
+            v |= (uint64_t)((p[bit / 8] >> off) & bit_mask(take)) << done;
+            bit += take;
+            done += take;
+        }
+        return true;
+    }
+};
+
+/* Raw: count values at bits each */
+inline void put_raw(BitWriter& w, const uint64_t *v, uint64_t count, uint64_t bits)
+{
+    for (uint64_t i = 0; i < count; i++)
+        w.put(v[i], bits);
+}
+
+inline bool get_raw(BitReader& r, uint64_t *v, uint64_t count, uint64_t bits)
+{
+    for (uint64_t i = 0; i < count; i++)
+        if (!r.get(v[i], bits))
+            return false;
+    return true;
+}
+
+/* Pair packing, w is rows x cols row major */
+inline bool pair_packable(const uint64_t *w, uint64_t rows, uint64_t cols, uint64_t bits)
+{
+    if (cols % 2)
+        return false;
+    uint64_t m = bit_mask(bits);
+    for (uint64_t i = 0; i < rows*cols; i += 2)
+        if ((w[i] & m) && (w[i+1] & m))
+            return false;
+    return true;
+}
+
+inline uint64_t pair_packed_bits(uint64_t rows, uint64_t cols, uint64_t bits)
+{
+    return rows * (cols / 2) * (bits + 1);
+}
+
+inline void put_pair_packed(BitWriter& wr, const uint64_t *w, uint64_t rows, uint64_t cols, uint64_t bits)
+{
+    uint64_t m = bit_mask(bits);
+    for (uint64_t i = 0; i < rows*cols; i += 2)
+    {
+        bool odd = (w[i+1] & m) != 0;
+        wr.put(w[i + odd], bits);
+        wr.put(odd, 1);
+    }
+}
+
+inline bool get_pair_packed(BitReader& rd, uint64_t *w, uint64_t rows, uint64_t cols, uint64_t bits)
+{
+    for (uint64_t i = 0; i < rows*cols; i += 2)
+    {
+        uint64_t v, odd;
+        if (!rd.get(v, bits) || !rd.get(odd, 1))
+            return false;
+        w[i + odd] = v;
+        w[i + !odd] = 0;
+    }
+    return true;
+}
+
+/* Zero run length */
+template <typename token_fn>
+void rle_tokens(const uint64_t *v, uint64_t count, uint64_t bits, token_fn token)
+{
+    uint64_t m = bit_mask(bits), run = 0;
+    for (uint64_t i = 0; i < count; i++)
+    {
+        if (!(v[i] & m))
+        {
+            run++;
+            continue;
+        }
+        for (; run > RLE_MAX_RUN; run -= RLE_MAX_RUN + 1)
+            token(RLE_MAX_RUN, 0);
+        token(run, v[i]);
+        run = 0;
+    }
+}
+
+/* UINT64_MAX if it doesn't fit the token count */
+inline uint64_t rle_bits(const uint64_t *v, uint64_t count, uint64_t bits)
+{
+    uint64_t tokens = 0;
+    rle_tokens(v, count, bits, [&](uint64_t, uint64_t) { tokens++; });
+    if (tokens > bit_mask(RLE_COUNT_BITS))
+        return UINT64_MAX;
+    return RLE_COUNT_BITS + tokens * (RLE_RUN_BITS + bits);
+}
+
+inline void put_rle(BitWriter& w, const uint64_t *v, uint64_t count, uint64_t bits)
+{
+    uint64_t tokens = 0;
+    rle_tokens(v, count, bits, [&](uint64_t, uint64_t) { tokens++; });
+    w.put(tokens, RLE_COUNT_BITS);
+    rle_tokens(v, count, bits, [&](uint64_t run, uint64_t val) {
+        w.put(run, RLE_RUN_BITS);
+        w.put(val, bits);
+    });
+}
+
+inline bool get_rle(BitReader& r, uint64_t *v, uint64_t count, uint64_t bits)
+{
+    uint64_t tokens, i = 0;
+    if (!r.get(tokens, RLE_COUNT_BITS))
+        return false;
+    std::fill(v, v + count, 0);
+    for (uint64_t t = 0; t < tokens; t++)
+    {
+        uint64_t run, val;
+        if (!r.get(run, RLE_RUN_BITS) || !r.get(val, bits) || i + run >= count)
+            return false;
+        i += run;
+        v[i++] = val;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef __LINK_MODEL_HH__
+#define __LINK_MODEL_HH__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*- Host link timing model *-/
+ * Estimates one request over the UART (see UartHost.hh
+ * for the protocol) to tell link bound configs from
+ * compute bound ones before building a bitstream.
+ *
+ * Phases of a request, as seen from the host:
+ *   sync     : sync burst out until the 0C ack is in
+ *   payload  : (bulk hello/ack,) magic + dataframes or
+ *              the bulk frame, until the board has it all
+ *   compute  : the unit's cycles at clk100, taken from the
+ *              C++ model of the unit (UnitRunner)
+ *   readback : board's sync loop (one word per transmission
+ *              counter period), the host's 0C, then the
+ *              results (dataframes one per period, or the
+ *              bulk frame at line rate) until the last one
+ *              is in
+ * plus host_latency every time the host reacts to the
+ * board (poll wakeup, or the latency timer of a USB serial
+ * bridge, which is easily 1-16 ms).
+ *
+ * estimate_link() is closed form, assuming the board's
+ * receiver aligns on the 6th sync word. simulate_link()
+ * plays `requests` back to back requests as events on the
+ * two wire directions, byte by byte into a model of the
+ * SerialReceiver (drop_byte alignment included), so it
+ * also catches the trailing acks of the previous request
+ * upsetting alignment, sync bursts that are too short and
+ * the resends they cause, and the quantisation of the
+ * transmission counter.
+ *
+ * Roofline: the link moves baudrate / bits_per_byte bytes
+ * a second, the array does macs / compute seconds, and a
+ * request size gets min(peak, intensity * link) MAC/s with
+ * intensity = macs / bytes moved.
+ */
+struct LinkConfig
+{
+    uint64_t baudrate = 921600;
+    uint64_t bits_per_byte = 11;        // 8E1: start + 8 + parity + stop
+    double clk100 = 100e6;              // unit clock, Hz
+    double clk_uart = 14.7541e6;        // wrapper clock, Hz
+    uint64_t word_ticks = 2003;         // clk_uart ticks per transmitted frame
+    uint64_t sync_words = 8;            // host sync burst
+    uint64_t ack_repeats = 5;           // host acks go out this many times
+    double host_latency = 0;            // s, host reaction to board traffic
+    double resend_margin = 0.02;        // s, see UartHost
+    bool bulk = false;                  // bulk frames (BulkFrame.hh), uncompressed
+};
+
+struct LinkRequest
+{
+    std::string unit = "hsa";
+    uint64_t n = 8;
+    bool vector_mode = true;
+};
+
+struct LinkBreakdown
+{
+    double sync = 0, payload = 0, compute = 0, readback = 0;
+    double latency = 0;         // host starts -> host has every result
+    double period = 0;          // start to start, back to back requests
+    uint64_t tx_bytes = 0, rx_bytes = 0;
+    uint64_t compute_cycles = 0;
+    uint64_t sync_resends = 0;
+    double macs = 0;
+
+    /* Roofline */
+    double peak_macs_per_s = 0;     // array alone
+    double intensity = 0;           // MACs per byte on the wire
+    double bound_macs_per_s = 0;    // min(peak, intensity * link)
+    bool link_bound = false;
+};
+
+/* Unit cycles for one request, throws std::runtime_error
+ * if that (unit, n) isn't pre-instantiated at 16 bits */
+uint64_t link_compute_cycles(const LinkRequest& req);
+
+LinkBreakdown estimate_link(const LinkConfig& cfg, const LinkRequest& req);
+
+/* Averages over `requests` back to back requests (the
+ * first one starts from an idle, reset board) */
+LinkBreakdown simulate_link(const LinkConfig& cfg, const LinkRequest& req, uint64_t requests = 4);
+
+#endif
@@ -4,6 +4,8 @@
 #include <cstdint>
 #include <utility>
 
+#include "Checkpoint.hh"
+
 /*- Mac unit -*/
 /*
  * mac_t should be a mac_t_p<b>
@@ -33,6 +35,19 @@ public:
     {
         return value;
     }
+    /* Accumulator back to zero, for the next output */
+    void clear()
+    {
+        value = mac_t::ZERO;
+    }
+    void save_state(CheckpointWriter& ck) const
+    {
+        ck.put(value);
+    }
+    void load_state(CheckpointReader& ck)
+    {
+        ck.get(value);
+    }
 };
 
 
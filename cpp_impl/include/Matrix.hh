@@ -0,0 +1,66 @@
+#ifndef __MATRIX_HH__
+#define __MATRIX_HH__
+
+#include <cstdint>
+#include <vector>
+
+/*- Matrix (host-side tensor) *-/
+ * mac_t should be a mac_t_p<b>
+ *
+ * Row-major, heap allocated, arbitrary shape.
+ * The units themselves only ever see fixed NxN
+ * tiles, this is what the workload code (tiling,
+ * loading from .npy, reference checks) uses to
+ * hold full layer-sized operands and results.
+ */
+template <typename mac_t>
+struct Matrix
+{
+    uint64_t rows, cols;
+    std::vector<mac_t> data;
+
+    Matrix() : rows(0), cols(0) {}
+    Matrix(uint64_t rows_p, uint64_t cols_p)
+        : rows(rows_p), cols(cols_p), data(rows_p*cols_p, mac_t::ZERO) {}
+
+    mac_t& at(uint64_t i, uint64_t j) { return data[i*cols + j]; }
+    const mac_t& at(uint64_t i, uint64_t j) const { return data[i*cols + j]; }
+
+    Matrix<mac_t> transposed() const
+    {
+        Matrix<mac_t> ret(cols, rows);
+        for (uint64_t i = 0; i < rows; i++)
+            for (uint64_t j = 0; j < cols; j++)
+                ret.at(j, i) = at(i, j);
+        return ret;
+    }
+
+    bool operator==(const Matrix<mac_t>& o) const
+    {
+        if (rows != o.rows || cols != o.cols) return false;
+        for (uint64_t i = 0; i < rows*cols; i++)
+            if (data[i].value != o.data[i].value) return false;
+        return true;
+    }
+};
+
+/* Plain triple loop, C = A * B. Wraps the same way the
+ * MAC units do (everything is done in the mac_t bitfield),
+ * so it can be compared exactly against simulator output.
+ * */
+template <typename mac_t>
+Matrix<mac_t> reference_matmul(const Matrix<mac_t>& A, const Matrix<mac_t>& B)
+{
+    Matrix<mac_t> C(A.rows, B.cols);
+    for (uint64_t i = 0; i < A.rows; i++)
+        for (uint64_t k = 0; k < A.cols; k++)
+        {
+            uint64_t a = A.at(i, k).value;
+            if (a == 0) continue;
+            for (uint64_t j = 0; j < B.cols; j++)
+                C.at(i, j).value += a * B.at(k, j).value;
+        }
+    return C;
+}
+
+#endif
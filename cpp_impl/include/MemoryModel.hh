@@ -0,0 +1,113 @@
+#ifndef __MEMORY_MODEL_HH__
+#define __MEMORY_MODEL_HH__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Json.hh"
+
+/*- Operand memory model *-/
+ * The units read acts_sram/weights_sram for free (as
+ * many ports as they like, everything already on chip).
+ * This puts a banked sram in front of them instead,
+ * filled from a DRAM/host backing store:
+ *
+ *   banks         : acts get the lower half of them, weights
+ *                   the upper one, each operand's words being
+ *                   interleaved across its own banks
+ *   ports, width  : every port of a bank reads one line of
+ *                   `width` consecutive (in that bank) words
+ *                   a cycle, so a cycle needing more lines of
+ *                   one bank than it has ports takes longer
+ *   bank_words    : capacity of one bank, the whole tile
+ *                   (acts + weights) has to fit
+ *   backing_words : words per cycle the backing store writes
+ *                   into the srams, 0 = operands preloaded
+ *   backing_latency : cycles before the first one lands
+ *
+ * Each operand is laid out lane-interleaved,
+ * addr = seq * lanes + lane, the lanes being
+ * whatever the unit reads side by side in one cycle (the
+ * array rows for acts, the PEs of a weight row/column/
+ * diagonal), so with as many banks per operand as lanes
+ * every lane has its own bank, like one BRAM per row on the FPGA. The backing
+ * store fills words in the order the unit first needs
+ * them.
+ *
+ * A unit cycle only runs once all its operands have
+ * landed and the banks have served them, the wait being
+ * a stall. Weight stationary PEs read their weight once,
+ * the first cycle they are enabled.
+ */
+struct MemoryConfig
+{
+    uint64_t banks = 32;
+    uint64_t ports = 1;                 // read ports per bank
+    uint64_t width = 1;                 // words per port read
+    uint64_t bank_words = 1024;
+    double backing_words = 0;           // words/cycle, 0 = preloaded
+    uint64_t backing_latency = 0;
+};
+
+struct MemoryStats
+{
+    uint64_t words = 0;                 // operand words of the tile
+    uint64_t reads = 0;                 // sram word reads
+    uint64_t bank_stalls = 0;           // cycles lost to bank/port conflicts
+    uint64_t backing_stalls = 0;        // cycles waiting on the backing store
+    uint64_t fill_cycles = 0;           // cycles to bring the whole tile in
+    std::string bound = "compute";      // compute | bank | backing, larger stall source
+};
+
+struct OperandRead
+{
+    bool weights;
+    uint64_t lane, seq;
+};
+
+/* Accepts the MemoryConfig field names, missing keys keep
+ * their defaults */
+MemoryConfig parse_memory_config(const Json& j);
+
+/* e.g. "32b1p1w bw4" (banks, ports, width, backing words/cycle) */
+std::string memory_label(const MemoryConfig& cfg);
+
+/* Whether one tile (acts + weights) fits in the banks */
+bool memory_fits(const MemoryConfig& cfg, const std::string& unit, uint64_t R, uint64_t C, bool MVM_enable);
+
+/* Operand reads unit (RxC, C == R for the square units)
+ * does in its cycle t (0 based) */
+std::vector<OperandRead> operand_reads(const std::string& unit, uint64_t R, uint64_t C,
+        bool MVM_enable, uint64_t t);
+
+class MemoryModel
+{
+private:
+    MemoryConfig cfg;
+    std::string unit;
+    uint64_t R, C;
+    bool MVM_enable;
+    uint64_t acts_lanes, acts_words, weights_lanes, weights_words;
+    std::vector<uint64_t> arrival;      // per address, first cycle it can be read
+    uint64_t now = 0;                   // cycles elapsed, stalls included
+    MemoryStats s;
+
+    uint64_t address(const OperandRead& r) const;
+
+public:
+    /* latency: cycles the unit runs for, used to order the fill.
+     * Throws if the tile doesn't fit */
+    MemoryModel(const MemoryConfig& cfg, const std::string& unit, uint64_t R, uint64_t C,
+            bool MVM_enable, uint64_t latency);
+
+    /* Cycles to wait before the unit can do its cycle t */
+    uint64_t stall(uint64_t t);
+
+    /* Cycles without any reads, which never stall */
+    void idle(uint64_t cycles) { now += cycles; }
+
+    const MemoryStats& stats() const { return s; }
+};
+
+#endif
@@ -5,8 +5,13 @@
 #include <string>
 #include <format>
 #include <cstring>
+#include <iostream>
+#include <utility>
+#include <vector>
 
+#include "Checkpoint.hh"
 #include "Mac.hh"
+#include "SystolicArray.hh"
 
 /*- Matrix Processing Unit *-/
  * mac_t should be a mac_t_p<b>
@@ -18,24 +23,260 @@
  * instantiation due to nttp
  *
  * Performs the matrix multiplication ACTS * WEIGHTS
+ *
+ * Output stationary: acts flow left to right, weights
+ * top to bottom, each Mac keeping its own sum. MpuDataflow
+ * is the dataflow policy of the SystolicArray (see
+ * SystolicArray.hh).
+ *
+ * Constructed from NxN acts and weights it runs one
+ * NxN slice of K, as above. For any other K the unit
+ * can be streamed instead: every push() is one cycle
+ * taking a col of acts (a[i] = A[i][k] into row i) and
+ * a row of weights (w[j] = W[k][j] into col j), row i
+ * and col j seeing them i and j cycles late (the srams
+ * hold the skew), and every PE is clocked every cycle
+ * (the engine's clock_stream(), idle ones only add
+ * zeros). K values take K pushes, flush() then lets
+ * the last one reach PE(N-1,N-1) (2N-2 cycles), and
+ * drain() hands out the sums and clears the Macs for
+ * the next output tile, charged drain_latency cycles
+ * (the accumulators shifting out a row per cycle).
+ * Pushing K = N values last first
+ * gives exactly the cycles of the constructed unit.
+ * reset() starts the constructed tile over, with the
+ * sums and all the cycle counts back at zero.
  */
 
-template <typename mac_t, uint64_t N>
-class Mpu
+template <typename mac_t, uint64_t N, uint64_t C, typename pe_t>
+class MpuDataflow : public DataflowBase
 {
-private:
-    uint64_t counter;
-    bool enabled[N][N]; // only used for debug
+protected:
+    typedef std::pair<mac_t, mac_t> output_t;
+    static constexpr uint64_t enabled_cols = N;
+    /* Disabled PEs latch zeros, idle ones already hold
+     * them, so only the ones enabled last cycle clear */
+    static constexpr bool clears_retired = true;
+
     mac_t top_values[N]; // only used for debug
     mac_t left_values[N]; // only used for debug
                           //
     mac_t acts_sram[N][N], weights_sram[N][N];
     mac_t init_acts_sram[N][N], init_weights_sram[N][N];
-    Mac<mac_t> mac_units[N][N];
     mac_t right_latches[N][N]; // stored at each output  (acts)
     mac_t down_latches[N][N]; // stored at each output (weight)
 
+    /* K streaming (push()), the srams then hold the last
+     * N pushes: acts_sram[i][d] / weights_sram[d][j] the
+     * values pushed d cycles ago */
+    bool streaming = false;
+    uint64_t flush_left = 0;            // cycles until the last push has reached PE(N-1,N-1)
+    uint64_t stream_cycles = 0;         // push()es and bubbles
+    uint64_t drain_cycles = 0;          // charged by drain()
+
+    static std::string checkpoint_tag()
+    {
+        return "mpu";
+    }
+
+    /* PE(N-1,N-1) is the last to be disabled, after cycle 3N-3 */
+    static constexpr uint64_t latency(bool)
+    {
+        return 3*N - 2;
+    }
+
+    /* start after i+j, disable after i+j+N-1, by then
+     * passed all values through it (ix 0,..N-1) */
+    static constexpr PeWindow pe_window(uint64_t i, uint64_t j, bool)
+    {
+        return {i+j, i+j+N};
+    }
+
+    /* Sums start from zero again */
+    void reset_pe(pe_t& pe)
+    {
+        pe.clear();
+    }
+
+    void reset_state(bool)
+    {
+        streaming = false;
+        flush_left = stream_cycles = drain_cycles = 0;
+        for (uint64_t i = 0; i < N; i++)
+            memcpy(acts_sram[i], init_acts_sram[i], N*sizeof(mac_t)); 
+        for (uint64_t i = 0; i < N; i++)
+            memcpy(weights_sram[i], init_weights_sram[i], N*sizeof(mac_t));  
+        /* clock_pes() and the clears_retired clock()s rely on
+         * idle PEs holding zeros */
+        for (uint64_t i = 0; i < N; i++)
+            for (uint64_t j = 0; j < N; j++)
+            {
+                right_latches[i][j] = mac_t::ZERO;
+                down_latches[i][j] = mac_t::ZERO;
+            }
+        for (uint64_t i = 0; i < N; i++)
+            top_values[i] = weights_sram[N-1][i];
+        for (uint64_t j = 0; j < N; j++) 
+            left_values[j] = acts_sram[j][N-1];
+    }
+
+    /* Body of clock() for an enabled PE, returns what
+     * it latches (a disabled one latches zeros) */
+    output_t eval_pe(pe_t& pe, auto i, auto j, auto mode)
+    {
+        /* Pushed (clock_stream()), row i takes the acts
+         * pushed i cycles ago and col j the weights pushed
+         * j cycles ago, Mpu::stream_cycle() shifts them */
+        constexpr bool streamed = is_stream_mode<decltype(mode)>;
+        mac_t input_left =  j == 0 ? acts_sram[i][streamed ? i : N-1] : right_latches[i][j-1];
+        mac_t input_top =   i == 0 ? weights_sram[streamed ? j : N-1][j] : down_latches[i-1][j];
+
+        output_t out = pe.clock(input_left, input_top, true);
+        if constexpr (streamed)
+            return out;
+
+        /* simulate the 'streaming', once per cycle for each
+         * row/column, i.e. only at the edge PEs which are the
+         * ones actually reading from the srams */
+        /* shift the column to the right (for this row only): */
+        if (j == 0)
+            for (int k = N-1; k > 0; k--)
+                acts_sram[i][k] = acts_sram[i][k-1];
+        /* shift the row down (for this column only): */
+        if (i == 0)
+            for (int k = N-1; k > 0; k--)
+                weights_sram[k][j] = weights_sram[k-1][j];
+        return out;
+    }
+
+    void latch_pe(auto i, auto j, const output_t& out, auto, uint64_t)
+    {
+        right_latches[i][j] = out.first;
+        down_latches[i][j]  = out.second;
+    }
+
+    void retire_pe(auto i, auto j)
+    {
+        right_latches[i][j] = mac_t::ZERO;
+        down_latches[i][j] = mac_t::ZERO;
+    }
+
+    /* Every debug value ends up on the last row/col's
+     * edge, pushed ones are what each row/col just took */
+    void end_cycle(auto mode)
+    {
+        for (uint64_t i = 0; i < N; i++)
+            if constexpr (is_stream_mode<decltype(mode)>)
+            {
+                top_values[i] = weights_sram[i][i];
+                left_values[i] = acts_sram[i][i];
+            }
+            else
+            {
+                top_values[i] = weights_sram[N-1][N-1];
+                left_values[i] = acts_sram[N-1][N-1];
+            }
+    }
+
+    void save_operands(CheckpointWriter& ck) const
+    {
+        ck.put(top_values);
+        ck.put(left_values);
+        ck.put(acts_sram);
+        ck.put(weights_sram);
+        ck.put(init_acts_sram);
+        ck.put(init_weights_sram);
+        ck.put(streaming);
+        ck.put(flush_left);
+        ck.put(stream_cycles);
+        ck.put(drain_cycles);
+    }
+
+    void load_operands(CheckpointReader& ck)
+    {
+        ck.get(top_values);
+        ck.get(left_values);
+        ck.get(acts_sram);
+        ck.get(weights_sram);
+        ck.get(init_acts_sram);
+        ck.get(init_weights_sram);
+        streaming = false;
+        flush_left = stream_cycles = drain_cycles = 0;
+        if (ck.version() >= 5)
+        {
+            ck.get(streaming);
+            ck.get(flush_left);
+            ck.get(stream_cycles);
+            ck.get(drain_cycles);
+        }
+    }
+
+    void save_latches(CheckpointWriter& ck) const
+    {
+        ck.put(right_latches);
+        ck.put(down_latches);
+    }
+
+    void load_latches(CheckpointReader& ck)
+    {
+        ck.get(right_latches);
+        ck.get(down_latches);
+    }
+};
+
+template <typename mac_t, uint64_t N>
+class Mpu : public SystolicArray<mac_t, N, N, MpuDataflow, Mac<mac_t>>
+{
+private:
+    typedef SystolicArray<mac_t, N, N, MpuDataflow, Mac<mac_t>> base_t;
+    using base_t::top_values;
+    using base_t::left_values;
+    using base_t::acts_sram;
+    using base_t::weights_sram;
+    using base_t::init_acts_sram;
+    using base_t::init_weights_sram;
+    using base_t::right_latches;
+    using base_t::down_latches;
+    using base_t::mac_units;
+
+    /* One streamed cycle, a/w nullptr for a bubble */
+    void stream_cycle(const mac_t *a, const mac_t *w)
+    {
+        if (!this->streaming)
+        {
+            /* Out of the constructed tile's schedule, into
+             * an empty pipeline (the Macs keep their sums) */
+            for (uint64_t i = 0; i < N; i++)
+                for (uint64_t j = 0; j < N; j++)
+                {
+                    acts_sram[i][j] = weights_sram[i][j] = mac_t::ZERO;
+                    right_latches[i][j] = down_latches[i][j] = mac_t::ZERO;
+                }
+            this->streaming = true;
+        }
+        for (uint64_t i = 0; i < N; i++)
+        {
+            for (uint64_t d = N-1; d > 0; d--)
+            {
+                acts_sram[i][d] = acts_sram[i][d-1];
+                weights_sram[d][i] = weights_sram[d-1][i];
+            }
+            acts_sram[i][0] = a ? a[i] : mac_t::ZERO;
+            weights_sram[0][i] = w ? w[i] : mac_t::ZERO;
+        }
+        this->clock_stream();
+
+        if (a || w)
+            this->flush_left = 2*N - 2;
+        else if (this->flush_left)
+            this->flush_left--;
+        this->stream_cycles++;
+    }
+
 public:
+    /* Accumulators shift out a row per cycle */
+    static constexpr uint64_t drain_latency = N;
+
     void print_mac_values()
     {
         for (int i = 0; i < N; i++)
@@ -69,62 +310,76 @@ public:
             memcpy(init_acts_sram[i], acts_sram_p[i], N*sizeof(mac_t)); 
         for (uint64_t i = 0; i < N; i++)
             memcpy(init_weights_sram[i], weights_sram_p[i], N*sizeof(mac_t)); 
-        reset();
+        this->reset();
     }
 
-    void reset()
+    /* For streaming: no tile, everything zero */
+    Mpu()
     {
         for (uint64_t i = 0; i < N; i++)
-            memcpy(acts_sram[i], init_acts_sram[i], N*sizeof(mac_t)); 
-        for (uint64_t i = 0; i < N; i++)
-            memcpy(weights_sram[i], init_weights_sram[i], N*sizeof(mac_t));  
-        counter = 0;
-        for (uint64_t i = 0; i < N; i++)
-            top_values[i] = weights_sram[N-1][i];
-        for (uint64_t j = 0; j < N; j++) 
-            left_values[j] = acts_sram[j][N-1];
+            for (uint64_t j = 0; j < N; j++)
+                init_acts_sram[i][j] = init_weights_sram[i][j] = mac_t::ZERO;
+        this->reset();
+    }
+
+    /* One cycle of K streaming (see above): a is a col of
+     * acts, w a row of weights, N values each */
+    void push(const mac_t *a, const mac_t *w)
+    {
+        stream_cycle(a, w);
+    }
+
+    /* One cycle with nothing entering */
+    void bubble()
+    {
+        stream_cycle(nullptr, nullptr);
+    }
+
+    /* Bubbles until everything pushed is in the sums */
+    void flush()
+    {
+        while (this->flush_left)
+            stream_cycle(nullptr, nullptr);
     }
 
-    void clock()
+    /* flush(), then out = the sums, which are cleared
+     * for the next output tile */
+    void drain(mac_t out[N][N])
     {
-        std::pair<mac_t, mac_t> outputs[N][N];
+        flush();
         for (uint64_t i = 0; i < N; i++)
             for (uint64_t j = 0; j < N; j++)
             {
-                mac_t input_left =  j == 0 ? acts_sram[i][N-1] : right_latches[i][j-1];
-                mac_t input_top =   i == 0 ? weights_sram[N-1][j] : down_latches[i-1][j];
-                
-                /* start after i+j, disable after i+j+N-1, by then passed 
-                 * all values through it (ix 0,..N-1)                       
-                 * */
-                bool enable = (i+j)<=counter && counter < (i+j+N);
-                enabled[i][j] = enable;
-
-                outputs[i][j] = mac_units[i][j].clock(input_left, input_top, enable);
-
-                /* simulate the 'streaming' */
-                if (enable)
-                {
-                    /* shift the column to the right (for this row only): */
-                    for (int k = N-1; k > 0; k--)
-                        acts_sram[i][k] = acts_sram[i][k-1];
-                    /* shift the row down (for this column only): */
-                    for (int k = N-1; k > 0; k--)
-                        weights_sram[k][j] = weights_sram[k-1][j];
-                }
-
-                top_values[i] = weights_sram[N-1][j];
-                left_values[j] = acts_sram[i][N-1]; 
+                out[i][j] = mac_units[i][j].get_mac();
+                mac_units[i][j].clear();
             }
-        /* update latch values */
+        this->drain_cycles += drain_latency;
+    }
+
+    uint64_t get_stream_cycles()
+    {
+        return this->stream_cycles;
+    }
+
+    uint64_t get_drain_cycles()
+    {
+        return this->drain_cycles;
+    }
+
+    /* Constructed tile's clock()s, streamed cycles and
+     * drains */
+    uint64_t get_total_cycles()
+    {
+        return this->counter + this->stream_cycles + this->drain_cycles;
+    }
+
+    /* The accumulators themselves, out = acts * weights
+     * once ready() */
+    void get_mac_values(mac_t out[N][N])
+    {
         for (uint64_t i = 0; i < N; i++)
             for (uint64_t j = 0; j < N; j++)
-            {
-                std::pair<mac_t, mac_t> output = outputs[i][j];
-                right_latches[i][j] = output.first;
-                down_latches[i][j]  = output.second;
-            }
-        counter++;
+                out[i][j] = mac_units[i][j].get_mac();
     }
 
     std::string to_string()
@@ -139,54 +394,17 @@ public:
          * -------------------------------------
          * |    wla    |-----|     wla   | --- |
          * ===================================== 
-         * Could figure out the prealloc size... but I don't want to.
-         * So I use cpp string (and inefficiently)
          * */
-        std::string top_rows[N], bot_rows[N];
-        std::string toptop_row;
-        uint64_t max_row_width = 0;
-        for (uint64_t i = 0; i < N; i++)
-        {
-            std::string top_row, bot_row;
-            for (uint64_t j = 0; j < N; j++)
-            {
-                mac_t wla, ala;
-                wla = down_latches[i][j];
-                ala = right_latches[i][j];
-                std::string psum_str, ala_str, wla_str, cla_str, ocla_str;
-                ala_str = std::to_string(ala.value);
-                wla_str = std::to_string(wla.value);
-                psum_str = !enabled[i][j] ? "Disabled" : std::to_string(mac_units[i][j].get_mac().value);
-                uint64_t pwidth = psum_str.length();
-                uint64_t bwidth = wla_str.length();
-                uint64_t twidth = std::max(std::max(pwidth, bwidth), 8LLU) + 2;
-                std::string ppsum_str = std::vformat("{:^"+std::to_string(twidth)+"}", std::make_format_args(psum_str));
-                std::string pwla_str = std::vformat("{:^"+std::to_string(twidth)+"}", std::make_format_args(wla_str));
-                top_row += "| " + ppsum_str + " | " + ala_str + " ";
-                bot_row += "| " + pwla_str + " |" + std::string(ala_str.length()+2, '-');
-                if (i == 0)
-                {
-                    std::string toptop_str = std::to_string(top_values[j].value) + "↓";
-                    std::string ptoptop_str = std::vformat("{:^"+std::to_string(twidth)+"}", std::make_format_args(toptop_str));
-                    toptop_row += "  " + ptoptop_str + "   " + std::string(ala_str.length(), ' ') + " ";
-                }
-            }
-            top_rows[i] = top_row;
-            bot_rows[i] = bot_row;
-            max_row_width = top_row.length() > max_row_width ? top_row.length() : max_row_width;
-        }
-        std::string ret;
-        uint64_t max_l_width = 0;
-        for (uint64_t i = 0; i < N; i++)
-            max_l_width = std::max(max_l_width, (uint64_t)std::to_string(left_values[i].value).length());
-        max_l_width += 5;
-        std::string lsep = std::string(max_l_width, ' ');
-        std::string sep = lsep+std::string(max_row_width+1, '=');
-        ret += lsep+toptop_row + "\n" + sep + "\n";
-        for (uint64_t i = 0; i < N; i++)
-            ret += " " + std::to_string(left_values[i].value) + " -> " + top_rows[i] + "|\n" + \
-                    lsep + bot_rows[i] + "|\n" + sep + "\n";
-        return ret;
+        return this->grid_string(
+            [&](uint64_t i, uint64_t j) {
+                return PeText{
+                    !this->streaming && !this->enabled(i, j) ? "Disabled" : std::to_string(mac_units[i][j].get_mac().value),
+                    std::to_string(right_latches[i][j].value),
+                    std::to_string(down_latches[i][j].value)
+                };
+            },
+            [&](uint64_t j) { return std::to_string(top_values[j].value); },
+            [&](uint64_t i) { return std::to_string(left_values[i].value); });
     }
 };
 
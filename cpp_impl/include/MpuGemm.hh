@@ -0,0 +1,105 @@
+#ifndef __MPU_GEMM_HH__
+#define __MPU_GEMM_HH__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "HsaGemm.hh"
+#include "Matrix.hh"
+#include "Mpu.hh"
+
+/*- GEMM tiler on top of the output stationary MPU *-/
+ * mac_t should be a mac_t_p<b>
+ *
+ * Computes C = A * W (A: MxK acts, W: KxN' weights)
+ * on one Mpu<mac_t, N>, as the output stationary
+ * counterpart of HsaGemm: one tile is an NxN block of
+ * C, zero padded at the M and N' edges, and the whole
+ * of K is streamed through it (Mpu::push(), a col of
+ * A and a row of W per cycle) before it is drained.
+ * K is never cut, so the sum along it stays in the
+ * Macs and every tile is written back exactly once.
+ *
+ * A tile costs K pushes, 2N-2 cycles of flush and the
+ * drain (Mpu::drain_latency), with no overlap between
+ * tiles. Nothing is loaded into the PEs, so there are
+ * no weight loads to count (weight_loads = 0) and no
+ * MVM mode.
+ */
+template <typename mac_t, uint64_t N>
+class MpuGemm
+{
+private:
+    static uint64_t ceil_div(uint64_t a, uint64_t b)
+    {
+        return (a + b - 1) / b;
+    }
+
+public:
+    static uint64_t tiles(uint64_t M, uint64_t Np)
+    {
+        return ceil_div(M, N) * ceil_div(Np, N);
+    }
+
+    static uint64_t tile_cycles(uint64_t K)
+    {
+        return K + (K ? 2*N - 2 : 0) + Mpu<mac_t, N>::drain_latency;
+    }
+
+    static uint64_t estimate_cycles(uint64_t M, uint64_t K, uint64_t Np)
+    {
+        return tiles(M, Np) * tile_cycles(K);
+    }
+
+    static GemmStats analyse(const std::string& name, uint64_t M, uint64_t K, uint64_t Np)
+    {
+        GemmStats s;
+        s.name = name;
+        s.M = M;
+        s.K = K;
+        s.N = Np;
+        s.MVM_enable = false;
+        s.tiles = tiles(M, Np);
+        s.weight_loads = 0;
+        s.writebacks = s.tiles * N * N;
+        s.cycles = estimate_cycles(M, K, Np);
+        s.macs = M * K * Np;
+        s.utilization = s.cycles ? (double)s.macs / (double)(N * N * s.cycles) : 0.0;
+        return s;
+    }
+
+    /* Streams every tile cycle by cycle, Cm is resized to
+     * MxN'. Returned cycle count is the Mpu's total (so
+     * matches analyse()) */
+    static GemmStats run(const std::string& name, const Matrix<mac_t>& A,
+            const Matrix<mac_t>& W, Matrix<mac_t>& Cm)
+    {
+        GemmStats s = analyse(name, A.rows, A.cols, W.cols);
+        Cm = Matrix<mac_t>(A.rows, W.cols);
+        auto mpu = std::make_unique<Mpu<mac_t, N>>();
+        mac_t a[N], w[N], out[N][N];
+        for (uint64_t m0 = 0; m0 < A.rows; m0 += N)
+            for (uint64_t n0 = 0; n0 < W.cols; n0 += N)
+            {
+                for (uint64_t k = 0; k < A.cols; k++)
+                {
+                    for (uint64_t i = 0; i < N; i++)
+                    {
+                        a[i] = m0 + i < A.rows ? A.at(m0 + i, k) : mac_t::ZERO;
+                        w[i] = n0 + i < W.cols ? W.at(k, n0 + i) : mac_t::ZERO;
+                    }
+                    mpu->push(a, w);
+                }
+                mpu->drain(out);
+                for (uint64_t i = 0; i < N && m0 + i < A.rows; i++)
+                    for (uint64_t j = 0; j < N && n0 + j < W.cols; j++)
+                        Cm.at(m0 + i, n0 + j) = out[i][j];
+            }
+        s.cycles = mpu->get_total_cycles();
+        s.utilization = s.cycles ? (double)s.macs / (double)(N * N * s.cycles) : 0.0;
+        return s;
+    }
+};
+
+#endif
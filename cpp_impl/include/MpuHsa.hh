@@ -2,14 +2,20 @@
 #define __MPUHSA_HH__ 
 
 #include <cstdint>
-#include <cstdlib>
+#include <format>
+#include <stdexcept>
+#include <string>
 
+#include "DrainStage.hh"
+#include "Hsa.hh"
+#include "SystolicArray.hh"
 #include "WsMac.hh"
 
 /*- Matrix Processing Unit -- HSA Dataflow Style *-/
  * mac_t should be a mac_t_p<b>
  *
- * MPU shaped specified a priori: NxN
+ * MPU shaped specified a priori: RxC (R rows, C cols,
+ * C = R by default)
  *
  * Full implementation in header to avoid nttp
  *
@@ -22,116 +28,117 @@
  * - activation flow left to right
  * - partial sums flow top to bottom
  * 
- * Then results are collected at the end (store in
- * some result array)
+ * Results are collected as they leave the bottom row,
+ * each written straight to its (row, col) by the
+ * DrainStage, which can also hand out rows as they
+ * complete.
+ *
+ * Shapes: weights are RxC, acts are CxR (its C rows are
+ * streamed through, row i of the array seeing col i of
+ * acts), the result is CxC. See Hsa.hh.
+ *
+ * Hence the dataflow is Hsa's MMM one (HsaDataflow),
+ * only without the mode and with its own checkpoint tag,
+ * resident weights (load_weights(), load_acts()) and
+ * the psum-in port (load_psums(), chain()) included.
  */
-template <typename mac_t, uint64_t N>
-class MpuHsa
+template <typename mac_t, uint64_t R, uint64_t C, typename pe_t>
+class MpuHsaDataflow : public HsaDataflow<mac_t, R, C, pe_t>
+{
+protected:
+    static constexpr bool has_MVM = false;
+
+    /* Square arrays keep the plain tag, so their
+     * snapshots stay compatible */
+    static std::string checkpoint_tag()
+    {
+        return R == C ? std::string("mpuhsa") : std::format("mpuhsa{}x{}", R, C);
+    }
+};
+
+template <typename mac_t, uint64_t R, uint64_t C = R>
+class MpuHsa : public SystolicArray<mac_t, R, C, MpuHsaDataflow, WsMac<mac_t>>
 {
 private:
-    uint64_t counter;
-    bool enabled[N][N];
-    mac_t top_values[N]; // only used for debug
-    mac_t left_values[N]; // only used for debug
-
-    mac_t acts_sram[N][N], weights_sram[N][N];
-    mac_t init_acts_sram[N][N], init_weights_sram[N][N];
-    WsMac<mac_t> mac_units[N][N]; 
-    mac_t right_latches[N][N];  // for left-right streaming of acts
-    mac_t down_latches[N][N];  // for top-down streaming of psums
-       
-    mac_t result[N][N];
+    typedef SystolicArray<mac_t, R, C, MpuHsaDataflow, WsMac<mac_t>> base_t;
+    using base_t::top_values;
+    using base_t::left_values;
+    using base_t::drain;
+
+    /* load_acts() minus closing a chain's psums */
+    void next_tile(mac_t acts_sram_p[C][R])
+    {
+        this->past_cycles += this->counter;
+        this->init_acts(acts_sram_p);
+        this->reset();
+    }
+
 public:
-    MpuHsa(mac_t acts_sram_p[N][N], mac_t weights_sram_p[N][N])
+    MpuHsa(mac_t acts_sram_p[C][R], mac_t weights_sram_p[R][C])
+    {
+        this->init(acts_sram_p, weights_sram_p);
+        this->init_psums_sram(nullptr, 0);
+        this->reset();
+    }
+
+    /* Same, seeding the psum-in port (CxC, see Hsa.hh) */
+    MpuHsa(mac_t acts_sram_p[C][R], mac_t weights_sram_p[R][C], const mac_t psums_p[C][C])
+    {
+        this->init(acts_sram_p, weights_sram_p);
+        this->init_psums_sram(psums_p, C);
+        this->reset();
+    }
+
+    /* Resident weights, see Hsa.hh */
+    explicit MpuHsa(mac_t weights_sram_p[R][C])
     {
-        /* Acts needs to be transposed for this dataflow style */
-        for (uint64_t i = 0; i < N; i++)
-            for (uint64_t j = 0; j < N; j++)
-                init_acts_sram[i][j] = acts_sram_p[j][i];
-        for (uint64_t i = 0; i < N; i++)
-            memcpy(init_weights_sram[i], weights_sram_p[i], N*sizeof(mac_t)); 
-        
-        reset();
+        this->init_acts(nullptr);
+        this->init_psums_sram(nullptr, 0);
+        load_weights(weights_sram_p);
+        this->reset();
     }
 
-    void reset()
+    void load_weights(mac_t weights_sram_p[R][C])
     {
-        for (uint64_t i = 0; i < N; i++)
-            memcpy(acts_sram[i], init_acts_sram[i], N*sizeof(mac_t)); 
-        for (uint64_t i = 0; i < N; i++)
-            memcpy(weights_sram[i], init_weights_sram[i], N*sizeof(mac_t));  
-        counter = 0;
-        for (uint64_t i = 0; i < N; i++)
-            top_values[i] = mac_t::ZERO;
-        for (uint64_t j = 0; j < N; j++) 
-            left_values[j] = acts_sram[j][N-1];
+        this->resident_weights(this->mac_units, weights_sram_p);
     }
 
-    void clock()
+    void load_acts(mac_t acts_sram_p[C][R])
     {
-        std::pair<mac_t, mac_t> outputs[N][N];
-        for (uint64_t i = 0; i < N; i++)
-            for (uint64_t j = 0; j < N; j++)
-            {
-                 /* start after i+j, disable after i+j+N-1, by then passed 
-                 * all values through it (ix 0,..N-1)                       
-                 * */
-                bool enable = (i+j)<=counter && counter < (i+j+N);
-                enabled[i][j] = enable;
-                if (!enable) continue;
-
-                mac_t input_left_a, input_top_cin;
-                    
-                input_top_cin = i == 0 ? mac_t::ZERO : down_latches[i-1][j];
-                input_left_a = j == 0 ? acts_sram[i][N-1] : right_latches[i][j-1];
-
-                /* Weight-stationary */
-                mac_t input_weight =  weights_sram[i][j];
-
-                /* I don't simulate the weight initialisation
-                 * into each PE (which should occur over multiple
-                 * cycles, and ideally be pipelined with the own
-                 * MPU operation...)
-                 **/
-                outputs[i][j] = mac_units[i][j].clock(
-                    input_left_a,
-                    input_weight,
-                    input_top_cin,
-                    enable,
-                    true
-                );
-
-                /* simulate the acts 'streaming' from the left */
-                if (enable)
-                    /* shift the column to the right (for this row only): */
-                    for (int k = N-1; k > 0; k--)
-                        acts_sram[i][k] = acts_sram[i][k-1];
-
-                /* Top values always gets 0, cin starts at 0*/
-                top_values[i] = mac_t::ZERO;
-                left_values[j] = acts_sram[i][N-1];  
-            }
-
-        /* Update latch values, after so no weirdness 
-         * Could probably figure out a loop order to
-         * do this above, but this works fine.
-         * Only right to latch if enabled */
-        for (uint64_t i = 0; i < N; i++)
-            for (uint64_t j = 0; j < N; j++)
-                if (enabled[i][j])
-                {
-                    right_latches[i][j] = outputs[i][j].first;
-                    down_latches[i][j] = outputs[i][j].second;
-                    /* Last row => Output generated */
-                    if (i == N - 1)
-                    {
-                        /* shift the row down (for this column only): */
-                        for (int k = N-1; k > 0; k--)
-                            result[k][j] = result[k-1][j]; 
-                        result[0][j] = down_latches[i][j];
-                    }
-                }
-        counter++;
+        if (this->psums_chained)
+            this->init_psums_sram(nullptr, 0);
+        next_tile(acts_sram_p);
+    }
+
+    /* psum-in port and K tile chaining, see Hsa.hh */
+    void load_psums(const mac_t psums_p[C][C])
+    {
+        this->init_psums_sram(psums_p, C);
+    }
+
+    void chain(mac_t acts_sram_p[C][R], mac_t weights_sram_p[R][C])
+    {
+        if (!this->ready())
+            throw std::runtime_error("mpuhsa: chain() before the tile is ready");
+        get_result(this->init_psums);
+        this->chain_weights(this->mac_units, weights_sram_p);
+        next_tile(acts_sram_p);
+    }
+
+    uint64_t get_weight_cycles()
+    {
+        return this->weight_cycles;
+    }
+
+    uint64_t get_total_cycles()
+    {
+        return this->weight_cycles + this->past_cycles + this->counter;
+    }
+
+    /* out = acts * weights (CxC), only meaningful once ready() */
+    void get_result(mac_t out[C][C])
+    {
+        drain.get(out);
     }
 
     std::string to_string()
@@ -146,63 +153,11 @@ public:
          * -------------------------------------
          * |    pla    |-----|     pla   | --- |
          * ===================================== 
-         * Could figure out the prealloc size... but I don't want to.
-         * So I use cpp string (and inefficiently)
          * */
-        std::string top_rows[N], bot_rows[N];
-        std::string toptop_row;
-        uint64_t max_row_width = 0;
-        for (uint64_t i = 0; i < N; i++)
-        {
-            std::string top_row, bot_row;
-            for (uint64_t j = 0; j < N; j++)
-            {
-                mac_t pla, ala;
-                pla = down_latches[i][j];
-                ala = right_latches[i][j];
-                std::string w_str, ala_str, pla_str;
-                ala_str = std::to_string(ala.value);
-                pla_str = std::to_string(pla.value);
-                w_str = !enabled[i][j] ? "Disabled" : "W="+std::to_string(weights_sram[i][j].value);
-                uint64_t wwidth = w_str.length();
-                uint64_t bwidth = pla_str.length();
-                uint64_t twidth = std::max(std::max(wwidth, bwidth), 8LLU) + 2;
-                std::string pw_str = std::vformat("{:^"+std::to_string(twidth)+"}", std::make_format_args(w_str));
-                std::string ppla_str = std::vformat("{:^"+std::to_string(twidth)+"}", std::make_format_args(pla_str));
-                top_row += "| " + pw_str + " | " + ala_str + " ";
-                bot_row += "| " + ppla_str + " |" + std::string(ala_str.length()+2, '-');
-                if (i == 0)
-                {
-                    std::string toptop_str = std::to_string(top_values[j].value) + "↓";
-                    std::string ptoptop_str = std::vformat("{:^"+std::to_string(twidth)+"}", std::make_format_args(toptop_str));
-                    toptop_row += "  " + ptoptop_str + "   " + std::string(ala_str.length(), ' ') + " ";
-                }
-            }
-            top_rows[i] = top_row;
-            bot_rows[i] = bot_row;
-            max_row_width = top_row.length() > max_row_width ? top_row.length() : max_row_width;
-        }
-        std::string ret;
-        uint64_t max_l_width = 0;
-        for (uint64_t i = 0; i < N; i++)
-            max_l_width = std::max(max_l_width, (uint64_t)std::to_string(left_values[i].value).length());
-        max_l_width += 5;
-        std::string lsep = std::string(max_l_width, ' ');
-        std::string sep = lsep+std::string(max_row_width+1, '=');
-        ret += lsep+toptop_row + "\n" + sep + "\n";
-        for (uint64_t i = 0; i < N; i++)
-            ret += " " + std::to_string(left_values[i].value) + " -> " + top_rows[i] + "|\n" + \
-                    lsep + bot_rows[i] + "|\n" + sep + "\n";
-        return ret;
-    }
-    void print_result_values()
-    {
-        for (int i = 0; i < N; i++)
-        {
-            for (int j = 0; j < N; j++)
-                std::cout << "| " << result[i][j].value << " ";
-            std::cout << "|" << std::endl;
-        }
+        return this->grid_string(
+            [&](uint64_t i, uint64_t j) { return this->mmm_text(i, j, this->enabled(i, j)); },
+            [&](uint64_t j) { return std::to_string(top_values[j].value); },
+            [&](uint64_t i) { return std::to_string(left_values[i].value); });
     }
 };
 #endif
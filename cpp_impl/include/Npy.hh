@@ -0,0 +1,165 @@
+#ifndef __NPY_HH__
+#define __NPY_HH__
+
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Matrix.hh"
+
+/*- .npy loader *-/
+ * Just enough of the numpy file format to read what
+ * the accuracy_computation scripts write out
+ * (np.save of int16 weights and float32 activations),
+ * little-endian, C order only.
+ *
+ * Everything is read into doubles, then quantised
+ * into mac_t by to_matrix(). Negative values wrap
+ * into the mac_t bitfield (two's complement), which
+ * is exactly what happens on the FPGA too.
+ */
+struct NpyArray
+{
+    std::vector<uint64_t> shape;
+    std::vector<double> data;
+
+    uint64_t size() const
+    {
+        uint64_t n = 1;
+        for (uint64_t d : shape) n *= d;
+        return n;
+    }
+};
+
+inline NpyArray load_npy(const std::string& path)
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f)
+        throw std::runtime_error("npy: unable to open " + path);
+
+    char magic[6];
+    uint8_t version[2];
+    f.read(magic, 6);
+    f.read((char *)version, 2);
+    if (!f || memcmp(magic, "\x93NUMPY", 6) != 0)
+        throw std::runtime_error("npy: bad magic in " + path);
+
+    uint32_t header_len = 0;
+    if (version[0] == 1)
+    {
+        uint8_t hl[2];
+        f.read((char *)hl, 2);
+        header_len = hl[0] | (hl[1] << 8);
+    }
+    else
+    {
+        uint8_t hl[4];
+        f.read((char *)hl, 4);
+        header_len = hl[0] | (hl[1] << 8) | (hl[2] << 16) | ((uint32_t)hl[3] << 24);
+    }
+    std::string header(header_len, '\0');
+    f.read(header.data(), header_len);
+
+    /* Header is a python dict literal, e.g.
+     * {'descr': '<f4', 'fortran_order': False, 'shape': (1, 9, 3072), }
+     * */
+    uint64_t dpos = header.find("'descr'");
+    uint64_t q0 = header.find('\'', header.find(':', dpos));
+    uint64_t q1 = header.find('\'', q0 + 1);
+    std::string descr = header.substr(q0 + 1, q1 - q0 - 1);
+    if (header.find("'fortran_order': True") != std::string::npos)
+        throw std::runtime_error("npy: fortran order not supported (" + path + ")");
+
+    NpyArray ret;
+    uint64_t s0 = header.find('(', header.find("'shape'"));
+    uint64_t s1 = header.find(')', s0);
+    std::string dims = header.substr(s0 + 1, s1 - s0 - 1);
+    for (uint64_t p = 0; p < dims.size(); )
+    {
+        while (p < dims.size() && !isdigit(dims[p])) p++;
+        if (p >= dims.size()) break;
+        uint64_t e = p;
+        while (e < dims.size() && isdigit(dims[e])) e++;
+        ret.shape.push_back(std::stoull(dims.substr(p, e - p)));
+        p = e;
+    }
+
+    if (descr.size() < 3 || descr[0] == '>')
+        throw std::runtime_error("npy: unsupported dtype " + descr + " (" + path + ")");
+    char kind = descr[1];
+    uint64_t width = std::stoull(descr.substr(2));
+    uint64_t n = ret.size();
+
+    std::vector<uint8_t> raw(n * width);
+    f.read((char *)raw.data(), raw.size());
+    if (!f)
+        throw std::runtime_error("npy: truncated data in " + path);
+
+    ret.data.resize(n);
+    for (uint64_t i = 0; i < n; i++)
+    {
+        const uint8_t *p = &raw[i * width];
+        double v;
+        if (kind == 'f' && width == 4)      { float x;   memcpy(&x, p, 4); v = x; }
+        else if (kind == 'f' && width == 8) { double x;  memcpy(&x, p, 8); v = x; }
+        else if (kind == 'i' && width == 1) { int8_t x;  memcpy(&x, p, 1); v = x; }
+        else if (kind == 'i' && width == 2) { int16_t x; memcpy(&x, p, 2); v = x; }
+        else if (kind == 'i' && width == 4) { int32_t x; memcpy(&x, p, 4); v = x; }
+        else if (kind == 'i' && width == 8) { int64_t x; memcpy(&x, p, 8); v = (double)x; }
+        else if ((kind == 'u' || kind == 'b') && width == 1) { v = p[0]; }
+        else if (kind == 'u' && width == 2) { uint16_t x; memcpy(&x, p, 2); v = x; }
+        else if (kind == 'u' && width == 4) { uint32_t x; memcpy(&x, p, 4); v = x; }
+        else if (kind == 'u' && width == 8) { uint64_t x; memcpy(&x, p, 8); v = (double)x; }
+        else throw std::runtime_error("npy: unsupported dtype " + descr + " (" + path + ")");
+        ret.data[i] = v;
+    }
+    return ret;
+}
+
+/* Flattens all leading dims into rows, i.e. (1, 9, 3072)
+ * becomes a 9x3072 matrix. Values are multiplied by scale
+ * and rounded (scale = 1 for integer data, something like
+ * 2^8 to keep some fractional bits of float activations).
+ * */
+template <typename mac_t>
+Matrix<mac_t> to_matrix(const NpyArray& arr, double scale = 1.0)
+{
+    uint64_t cols = arr.shape.empty() ? 1 : arr.shape.back();
+    uint64_t rows = cols ? arr.size() / cols : 0;
+    Matrix<mac_t> ret(rows, cols);
+    for (uint64_t i = 0; i < rows*cols; i++)
+        ret.data[i].value = (uint64_t)(int64_t)std::llround(arr.data[i] * scale);
+    return ret;
+}
+
+/* Writes a matrix back out as <u8 (the raw bitfield
+ * values), so results can be inspected with numpy. */
+template <typename mac_t>
+void save_npy(const std::string& path, const Matrix<mac_t>& mat)
+{
+    std::ofstream f(path, std::ios::binary);
+    if (!f)
+        throw std::runtime_error("npy: unable to open " + path);
+    std::string header = "{'descr': '<u8', 'fortran_order': False, 'shape': (" +
+        std::to_string(mat.rows) + ", " + std::to_string(mat.cols) + "), }";
+    /* magic + version + len + header + '\n' padded to 64 bytes */
+    while ((10 + header.size() + 1) % 64) header += ' ';
+    header += '\n';
+    uint16_t header_len = header.size();
+    f.write("\x93NUMPY\x01\x00", 8);
+    f.put(header_len & 0xff);
+    f.put(header_len >> 8);
+    f.write(header.data(), header.size());
+    for (const mac_t& v : mat.data)
+    {
+        uint64_t x = v.value;
+        f.write((const char *)&x, 8);
+    }
+}
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef __PIPELINE_HH__
+#define __PIPELINE_HH__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*- Bounded lock-free queues *-/
+ * What connects the stages of a pipeline (sweeps, see
+ * Sweep.cc, and HsaGemm::run()):
+ *   SpscQueue : one producer thread, one consumer thread,
+ *               a ring indexed by two counters
+ *   MpmcQueue : any number of either, a ring of slots
+ *               each carrying a sequence number that says
+ *               whose turn it is (D. Vyukov's bounded
+ *               MPMC queue)
+ * Neither takes a lock, and both only hold `capacity`
+ * items (rounded up to a power of 2).
+ *
+ * push() on a full queue waits for room, which is the
+ * backpressure: a stage running ahead of its consumer
+ * stalls instead of buffering the whole workload.
+ * pop() waits for an item, and returns false once the
+ * queue is closed and drained. A producer calls close()
+ * when it is done; an MpmcQueue made for `producers`
+ * producers only closes once all of them have.
+ *
+ * Waiting spins for a bit, then yields, then sleeps, so
+ * a stage idling on an empty queue doesn't take a core
+ * away from the ones doing the work.
+ */
+class Backoff
+{
+private:
+    uint64_t n = 0;
+
+public:
+    void wait()
+    {
+        if (n >= 256)
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        else if (n >= 64)
+            std::this_thread::yield();
+        n++;
+    }
+};
+
+inline uint64_t queue_capacity(uint64_t capacity)
+{
+    uint64_t size = 1;
+    while (size < capacity)
+        size <<= 1;
+    return size;
+}
+
+template <typename T>
+class SpscQueue
+{
+private:
+    std::vector<T> slots;
+    uint64_t mask;
+    alignas(64) std::atomic<uint64_t> head = 0;     // next to pop
+    uint64_t tail_seen = 0;                         // consumer's copy of tail
+    alignas(64) std::atomic<uint64_t> tail = 0;     // next to push
+    uint64_t head_seen = 0;                         // producer's copy of head
+    alignas(64) std::atomic<bool> closed = false;
+
+public:
+    explicit SpscQueue(uint64_t capacity)
+        : slots(queue_capacity(capacity)), mask(slots.size() - 1) {}
+
+    /* Moves v in, unless the queue is full */
+    bool try_push(T& v)
+    {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        if (t - head_seen == slots.size())
+        {
+            head_seen = head.load(std::memory_order_acquire);
+            if (t - head_seen == slots.size())
+                return false;
+        }
+        slots[t & mask] = std::move(v);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    void push(T v)
+    {
+        Backoff b;
+        while (!try_push(v))
+            b.wait();
+    }
+
+    bool try_pop(T& v)
+    {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        if (h == tail_seen)
+        {
+            tail_seen = tail.load(std::memory_order_acquire);
+            if (h == tail_seen)
+                return false;
+        }
+        v = std::move(slots[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& v)
+    {
+        Backoff b;
+        while (!try_pop(v))
+        {
+            /* Everything pushed before close() is visible
+             * once closed is */
+            if (closed.load(std::memory_order_acquire))
+                return try_pop(v);
+            b.wait();
+        }
+        return true;
+    }
+
+    void close()
+    {
+        closed.store(true, std::memory_order_release);
+    }
+};
+
+template <typename T>
+class MpmcQueue
+{
+private:
+    struct Slot
+    {
+        std::atomic<uint64_t> seq;
+        T value;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    uint64_t mask;
+    alignas(64) std::atomic<uint64_t> head = 0;
+    alignas(64) std::atomic<uint64_t> tail = 0;
+    alignas(64) std::atomic<uint64_t> producers;
+
+public:
+    MpmcQueue(uint64_t capacity, uint64_t producers_p = 1)
+        : slots(new Slot[queue_capacity(capacity)]), mask(queue_capacity(capacity) - 1),
+          producers(producers_p)
+    {
+        for (uint64_t i = 0; i <= mask; i++)
+            slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    /* A slot is free for the push at pos when its seq is
+     * pos, and full for the pop at pos when it is pos+1
+     * (the pop then hands it to the push one lap later) */
+    bool try_push(T& v)
+    {
+        uint64_t pos = tail.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Slot& s = slots[pos & mask];
+            int64_t dif = (int64_t)(s.seq.load(std::memory_order_acquire) - pos);
+            if (dif == 0)
+            {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    s.value = std::move(v);
+                    s.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (dif < 0)
+                return false;
+            else
+                pos = tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    void push(T v)
+    {
+        Backoff b;
+        while (!try_push(v))
+            b.wait();
+    }
+
+    bool try_pop(T& v)
+    {
+        uint64_t pos = head.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Slot& s = slots[pos & mask];
+            int64_t dif = (int64_t)(s.seq.load(std::memory_order_acquire) - (pos + 1));
+            if (dif == 0)
+            {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    v = std::move(s.value);
+                    s.seq.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (dif < 0)
+                return false;
+            else
+                pos = head.load(std::memory_order_relaxed);
+        }
+    }
+
+    bool pop(T& v)
+    {
+        Backoff b;
+        while (!try_pop(v))
+        {
+            if (producers.load(std::memory_order_acquire) == 0)
+                return try_pop(v);
+            b.wait();
+        }
+        return true;
+    }
+
+    /* Once per producer */
+    void close()
+    {
+        producers.fetch_sub(1, std::memory_order_acq_rel);
+    }
+};
+
+#endif
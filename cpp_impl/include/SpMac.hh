@@ -1,6 +1,10 @@
 #ifndef __SP_MAC_HH__
 #define __SP_MAC_HH__
 
+#include <cstdint>
+
+#include "Checkpoint.hh"
+
 /*- Sparse Multiply-ACcumulate *-/
  * Desc: TODO
  */
@@ -45,6 +49,17 @@ public:
         weight = w;
         weight_ix = ix;
     }
+
+    void save_state(CheckpointWriter& ck) const
+    {
+        ck.put(weight);
+        ck.put(weight_ix);
+    }
+    void load_state(CheckpointReader& ck)
+    {
+        ck.get(weight);
+        ck.get(weight_ix);
+    }
 };
 
 #endif
@@ -1,45 +1,71 @@
-#ifndef __SP_MPU_HH__
-#define __SP_MPU_HH__
+#ifndef __SP_VPU_HH__
+#define __SP_VPU_HH__
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Checkpoint.hh"
+#include "SpMac.hh"
+#include "SystolicArray.hh"
 
 /*- Sparse Vector Processing Unit *-/
- * Desc: TODO
+ * mac_t should be a mac_t_p<b>
+ *
+ * VPU shaped specified a priori: NxN, but only
+ * N x N/2 MACs since weights are column merged
+ * (see SpVpu.txt): the weights passed in must
+ * already be packed into the first N/2 columns,
+ * and the tags hold the original column index of
+ * each packed weight (only its parity is used).
+ *
+ * Computes (packed weights) * acts, psums flow left
+ * to right, one packed column per cycle.
+ *
+ * SpVpuDataflow is the dataflow policy of the
+ * SystolicArray (see SystolicArray.hh), instantiated
+ * with N rows and N/2 PE cols.
  */
-template <typename mac_t, uint64_t N>
-class SpVpu
+template <typename mac_t, uint64_t N, uint64_t C, typename pe_t>
+class SpVpuDataflow : public DataflowBase
 {
-private:
-    uint64_t counter;
-    bool enabled[N][N];
-    
+protected:
+    typedef mac_t output_t;
+    static constexpr uint64_t enabled_cols = N;
+
     std::pair<mac_t, mac_t> top_values[N]; // only used for debug, represent nothing (Cin==0 for top)
     mac_t left_values[N]; // only used for debug, represent broadcast
 
     mac_t acts_sram[N], weights_sram[N][N];
     uint64_t weight_tags_sram[N][N];
     mac_t init_acts_sram[N], init_weights_sram[N][N];
-    uint64_t PN = N >> 1;       // By packing/double pump only need half columns
-    SpMac<mac_t> mac_units[N][N>>1]; 
-    mac_t right_latches[N][N];  // for left-right streaming of psums
-                        
+    uint64_t init_weight_tags_sram[N][N];
+    mac_t right_latches[N][N];  // for left-right streaming of psums, only the first C = N/2 cols used
 
-public:
-    SpVpu(mac_t acts_sram_p[N], mac_t weights_sram_p[N][N], uint64_t weight_tags_sram_p[N][N])
+    static std::string checkpoint_tag()
     {
-        for (uint64_t i = 0; i < N; i++)
-            init_acts_sram[i] = acts_sram_p[i];
-        /* Weights need NOT be transposed for this dataflow style
-         * since we broadcast columnwise
-         * */
-        for (uint64_t i = 0; i < N; i++)
-        {
-            memcpy(init_weights_sram[i],  weights_sram_p[i], N*sizeof(mac_t));
-            memcpy(init_weight_tags_sram[i],  weight_tags_sram_p[i], N*sizeof(uint64_t));
-        }
+        return "spvpu";
+    }
+
+    /* One packed column per cycle */
+    static constexpr uint64_t latency(bool)
+    {
+        return C;
+    }
 
-        reset();
+    /* We operate a packed column at a time, so in cycle
+     * 1, column 1 enabled (double pump), cycle 2 column
+     * 2... PEs are N x N/2 */
+    static constexpr PeWindow pe_window(uint64_t, uint64_t j, bool)
+    {
+        return {j, j+1};
     }
 
-    void reset()
+    void reset_state(bool)
     {
         for (uint64_t i = 0; i < N; i++)
             acts_sram[i] =  init_acts_sram[i];
@@ -47,86 +73,152 @@ public:
         {
             memcpy(weights_sram[i], init_weights_sram[i], N*sizeof(mac_t));  
             memcpy(weight_tags_sram[i], init_weight_tags_sram[i], N*sizeof(uint64_t));   
+            for (uint64_t j = 0; j < N; j++)
+                right_latches[i][j] = mac_t::ZERO;
         }
-        counter = 0;
         for (uint64_t i = 0; i < N; i++)
             top_values[i] = std::make_pair(mac_t::ZERO, mac_t::ZERO);
         for (uint64_t j = 0; j < N; j++) 
             left_values[j] = acts_sram[j];
     }
 
-    void clock()
+    /* Every row has idle PEs (recall packing and
+     * double pump along x), so all left values clear */
+    void begin_cycle(auto)
     {
-        mac_t outputs[N][N];
         for (uint64_t i = 0; i < N; i++)
-            for (uint64_t j = 0; j < PN; j++)  // recall packing and double pump along x
-            {
-                /* We operate a packed column at a time,
-                 * so in cycle 1, column 1 enabled (double pump)
-                 * cycle 2 column 2...
-                 * */
-                bool enable = counter==j;
-                enabled[i][j] = enable;
-                if (!enable)
-                {
-                    left_values[i] = mac_t::ZERO;
-                    continue;
-                }
+            left_values[i] = mac_t::ZERO;
+    }
 
-                /* The same activation inputs (a[2*j], a[2*j+1] - double pump)
-                 * should be broadcast to all the
-                 * macs (we broadcast column wise,
-                 * but this is fine because we skip
-                 * non-enabled macs above and we enable
-                 * column-wise
-                 * */
-                mac_t input_broad_a1, input_broad_a2, input_left_cin;
-                    
-                input_left_cin = j == 0 ? mac_t::ZERO : right_latches[i][j-1];
-                input_broad_a1 = acts_sram[2*j];
-                input_broad_a2 = acts_sram[2*j + 1];
-
-                /* Weight-stationary */
-                mac_t input_weight =  weights_sram[i][j];
-
-                /* I don't simulate the weight initialisation
-                 * into each PE (which should occur over multiple
-                 * cycles, and ideally be pipelined with the own
-                 * VPU operation - which is way easier in MVM
-                 * mode than MMM)
-                 **/
-                /* 'Fake' initialisation here - in reality should
-                 * be done only once
-                 */
-                mac_units[i][j].set_weights(
-                        weights_sram[i][j],
-                        weight_tags_sram[i][j]
-                );
-                outputs[i][j] = mac_units[i][j].clock(
-                    input_broad_a1,
-                    input_broad_a2,
-                    input_left_cin,
-                    enable
-                );
-
-                /* Left values always gets 0, cin starts at 0*/
-                left_values[i] = mac_t::ZERO;
-                top_values[j] = std::make_pair(acts_sram[2*j], acts_sram[2*j+1]);  
-            }
+    /* Body of clock() for an enabled PE, returns
+     * what it latches */
+    output_t eval_pe(pe_t& pe, auto i, auto j, auto)
+    {
+        /* The same activation inputs (a[2*j], a[2*j+1] - double pump)
+         * should be broadcast to all the
+         * macs (we broadcast column wise,
+         * but this is fine because we skip
+         * non-enabled macs above and we enable
+         * column-wise
+         * */
+        mac_t input_broad_a1, input_broad_a2, input_left_cin;
+            
+        input_left_cin = j == 0 ? mac_t::ZERO : right_latches[i][j-1];
+        input_broad_a1 = acts_sram[2*j];
+        input_broad_a2 = acts_sram[2*j + 1];
+
+        /* I don't simulate the weight initialisation
+         * into each PE (which should occur over multiple
+         * cycles, and ideally be pipelined with the own
+         * VPU operation - which is way easier in MVM
+         * mode than MMM)
+         **/
+        /* 'Fake' initialisation here - in reality should
+         * be done only once
+         */
+        pe.set_weight(
+                weights_sram[i][j],
+                weight_tags_sram[i][j]
+        );
+        mac_t out = pe.clock(
+            input_broad_a1,
+            input_broad_a2,
+            input_left_cin,
+            true
+        );
+
+        /* Left values always gets 0, cin starts at 0*/
+        left_values[i] = mac_t::ZERO;
+        top_values[j] = std::make_pair(acts_sram[2*j], acts_sram[2*j+1]);  
+        return out;
+    }
+
+    void latch_pe(auto i, auto j, const output_t& out, auto, uint64_t)
+    {
+        /* results latched right
+         **/
+        right_latches[i][j] = out;
+    }
+
+    void save_operands(CheckpointWriter& ck) const
+    {
+        ck.put(top_values);
+        ck.put(left_values);
+        ck.put(acts_sram);
+        ck.put(weights_sram);
+        ck.put(weight_tags_sram);
+        ck.put(init_acts_sram);
+        ck.put(init_weights_sram);
+        ck.put(init_weight_tags_sram);
+    }
 
-        /* Update latch values, after so no weirdness 
-         * Could probably figure out a loop order to
-         * do this above, but this works fine.
-         * Only right to latch if enabled */
+    void load_operands(CheckpointReader& ck)
+    {
+        ck.get(top_values);
+        ck.get(left_values);
+        ck.get(acts_sram);
+        ck.get(weights_sram);
+        ck.get(weight_tags_sram);
+        ck.get(init_acts_sram);
+        ck.get(init_weights_sram);
+        ck.get(init_weight_tags_sram);
+    }
+
+    void save_latches(CheckpointWriter& ck) const
+    {
+        ck.put(right_latches);
+    }
+
+    void load_latches(CheckpointReader& ck)
+    {
+        ck.get(right_latches);
+    }
+};
+
+template <typename mac_t, uint64_t N>
+class SpVpu : public SystolicArray<mac_t, N, (N>>1), SpVpuDataflow, SpMac<mac_t>>
+{
+private:
+    typedef SystolicArray<mac_t, N, (N>>1), SpVpuDataflow, SpMac<mac_t>> base_t;
+    using base_t::top_values;
+    using base_t::left_values;
+    using base_t::weights_sram;
+    using base_t::weight_tags_sram;
+    using base_t::init_acts_sram;
+    using base_t::init_weights_sram;
+    using base_t::init_weight_tags_sram;
+    using base_t::right_latches;
+    static constexpr uint64_t PN = N >> 1;     // By packing/double pump only need half columns
+
+public:
+    SpVpu(mac_t acts_sram_p[N], mac_t weights_sram_p[N][N], uint64_t weight_tags_sram_p[N][N])
+    {
         for (uint64_t i = 0; i < N; i++)
-            for (uint64_t j = 0; j < PN; j++)
-                if (enabled[i][j])
-                {
-                    /* results latched right
-                     **/
-                    right_latches[i][j] = outputs[i][j];
-                }
-        counter++;
+            init_acts_sram[i] = acts_sram_p[i];
+        /* Weights need NOT be transposed for this dataflow style
+         * since we broadcast columnwise
+         * */
+        for (uint64_t i = 0; i < N; i++)
+        {
+            memcpy(init_weights_sram[i],  weights_sram_p[i], N*sizeof(mac_t));
+            memcpy(init_weight_tags_sram[i],  weight_tags_sram_p[i], N*sizeof(uint64_t));
+        }
+
+        this->reset();
+    }
+
+    /* out = packed weights * acts, only meaningful once ready() */
+    void get_result(mac_t out[N])
+    {
+        for (uint64_t i = 0; i < N; i++)
+            out[i] = right_latches[i][PN-1];
+    }
+
+    /* Psum latches, only the first N/2 columns are used */
+    void get_latches(mac_t right[N][N])
+    {
+        for (uint64_t i = 0; i < N; i++)
+            memcpy(right[i], right_latches[i], N*sizeof(mac_t));
     }
 
     std::string to_string()
@@ -149,24 +241,25 @@ public:
             for (uint64_t j = 0; j < PN; j++)
             {
                 mac_t pla;//, ala;
-                pla = down_latches[i][j];
+                pla = right_latches[i][j];
                 // ala = right_latches[i][j];
                 std::string w_str, ala_str, pla_str;
                 /* Quick and dirty */
                 // ala_str = std::to_string(ala.value);
                 ala_str = "";
                 pla_str = std::to_string(pla.value);
-                w_str = !enabled[i][j] ? "Disabled" : "W="+std::to_string(weights_sram[i][j].value)+",ix="+std::to_string(j);
+                w_str = !this->enabled(i, j) ? "Disabled" : "W="+std::to_string(weights_sram[i][j].value)+",ix="+std::to_string(weight_tags_sram[i][j]);
                 uint64_t wwidth = w_str.length();
                 uint64_t bwidth = pla_str.length();
-                uint64_t twidth = std::max(std::max(wwidth, bwidth), 8LLU) + 2;
+                uint64_t twidth = std::max(std::max(wwidth, bwidth), (uint64_t)8) + 2;
                 std::string pw_str = std::vformat("{:^"+std::to_string(wwidth)+"}", std::make_format_args(w_str));
                 std::string ppla_str = std::vformat("{:^"+std::to_string(bwidth)+"}", std::make_format_args(pla_str));
                 top_row += "| " + pw_str + " | " + ppla_str + " ";
                 // bot_row += "| " + ppla_str + " |" + std::string(ala_str.length()+2, '-');
                 if (i == 0)
                 {
-                    std::string toptop_str = std::to_string(top_values[j].value) + "↓";
+                    std::string toptop_str = std::to_string(top_values[j].first.value) + "," +
+                        std::to_string(top_values[j].second.value) + "↓";
                     std::string ptoptop_str = std::vformat("{:^"+std::to_string(twidth)+"}", std::make_format_args(toptop_str));
                     toptop_row += "  " + ptoptop_str + "   " + std::string(ala_str.length(), ' ') + " ";
                 }
@@ -183,11 +276,11 @@ public:
         // std::string lsep = std::string(max_l_width, ' ');
         // std::string sep = lsep+std::string(max_row_width+1, '=');
         std::string sep = " "+std::string(max_row_width+1, '=');
-        ret += lsep+toptop_row + "\n" + sep + "\n";
+        ret += " "+toptop_row + "\n" + sep + "\n";
         for (uint64_t i = 0; i < N; i++)
-            ret += " " + top_rows[i] + "|\n" + sep + "\n"
-            // ret += " " + std::to_string(left_values[i].value) + " -> " + top_rows[i] + "|\n" + \
-                    lsep + bot_rows[i] + "|\n" + sep + "\n";
+            ret += " " + top_rows[i] + "|\n" + sep + "\n";
+            // ret += " " + std::to_string(left_values[i].value) + " -> " + top_rows[i] + "|\n" +
+            //         lsep + bot_rows[i] + "|\n" + sep + "\n";
         return ret;
     }
  
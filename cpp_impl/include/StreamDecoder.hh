@@ -0,0 +1,127 @@
+#ifndef __STREAM_DECODER_HH__
+#define __STREAM_DECODER_HH__
+
+#include <cstdint>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "Matrix.hh"
+#include "UnitRunner.hh"
+
+/*- Result stream scanning and decoding *-/
+ * Host side of the fpga -> host byte stream (words
+ * arrive MSB first, see UartHost.hh).
+ *
+ * scan_words() looks for any of a few words anywhere in
+ * a buffer: with SSE2 it compares 16 bytes at a time
+ * against each word's first byte and only checks the
+ * full word at the hits, otherwise it slides a 32 bit
+ * window one byte at a time (which is still a single
+ * compare per byte and word, unlike SAUnit rotating a
+ * list).
+ *
+ * ResultDecoder turns word aligned result dataframes
+ * straight into a preallocated result matrix, keeping
+ * a bitmap of the entries seen plus a count of the
+ * missing ones, so completion is O(1) per word instead
+ * of scanning for holes.
+ */
+
+inline uint32_t load_be32(const uint8_t *b)
+{
+    return (uint32_t)b[0] << 24 | (uint32_t)b[1] << 16 | (uint32_t)b[2] << 8 | b[3];
+}
+
+/* Offset of the first of words in buf (which tells which
+ * one), len if none. A match needs all 4 bytes in buf. */
+inline uint64_t scan_words(const uint8_t *buf, uint64_t len, const uint32_t *words, int count, int& which)
+{
+    uint64_t i = 0;
+#ifdef __SSE2__
+    __m128i first[4];
+    int nfirst = count < 4 ? count : 4;
+    for (int k = 0; k < nfirst; k++)
+        first[k] = _mm_set1_epi8((char)(words[k] >> 24));
+    for (; count <= 4 && i + 16 + 3 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        uint32_t hits = 0;
+        for (int k = 0; k < nfirst; k++)
+            hits |= (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, first[k]));
+        for (; hits; hits &= hits - 1)
+        {
+            uint64_t at = i + __builtin_ctz(hits);
+            uint32_t w = load_be32(buf + at);
+            for (int k = 0; k < count; k++)
+                if (w == words[k])
+                {
+                    which = k;
+                    return at;
+                }
+        }
+    }
+#endif
+    if (i + 4 > len)
+        return len;
+    uint32_t w = (uint32_t)buf[i] << 16 | (uint32_t)buf[i+1] << 8 | buf[i+2];
+    for (i += 3; i < len; i++)
+    {
+        w = w << 8 | buf[i];
+        for (int k = 0; k < count; k++)
+            if (w == words[k])
+            {
+                which = k;
+                return i - 3;
+            }
+    }
+    return len;
+}
+
+class ResultDecoder
+{
+private:
+    Matrix<wide_t> *out = nullptr;
+    uint64_t cols = 0;
+    std::vector<uint64_t> seen;
+    uint64_t left = 0;
+public:
+    /* result must already be rows x cols, it's filled in
+     * place. The bitmap is reused across requests. */
+    void start(Matrix<wide_t>& result)
+    {
+        out = &result;
+        cols = result.cols;
+        seen.assign((result.data.size() + 63) / 64, 0);
+        left = result.data.size();
+    }
+
+    /* Decodes whole words from p, stopping early once every
+     * entry was seen. Returns the bytes consumed. */
+    uint64_t feed(const uint8_t *p, uint64_t len)
+    {
+        uint64_t rows = out->rows, i = 0;
+        wide_t *data = out->data.data();
+        for (; i + 4 <= len && left; i += 4)
+        {
+            uint32_t n = load_be32(p + i);
+            uint64_t x = (n >> 23) & 0x7f, y = (n >> 16) & 0x7f;
+            /* leftover syncs have the msb set */
+            if ((n >> 31) | (y >= rows) | (x >= cols))
+                continue;
+            uint64_t ix = y*cols + x;
+            uint64_t bit = 1ULL << (ix % 64);
+            data[ix].value = n & 0xffff;
+            left -= !(seen[ix / 64] & bit);
+            seen[ix / 64] |= bit;
+        }
+        return i;
+    }
+
+    uint64_t missing() const { return left; }
+    bool done() const { return left == 0; }
+};
+
+#endif
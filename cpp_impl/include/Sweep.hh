@@ -0,0 +1,125 @@
+#ifndef __SWEEP_HH__
+#define __SWEEP_HH__
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Json.hh"
+#include "MemoryModel.hh"
+
+/*- Design space sweep *-/
+ * Expands a grid of
+ *   n        : array size (rows)
+ *   cols     : array cols, for rectangular hsa/mpuhsa
+ *              arrays (absent = square only, the other
+ *              units are always square)
+ *   op_bits  : operand width (operands are drawn in [0, 2^op_bits))
+ *   acc_bits : mac_t width, i.e. the accumulator/psum width
+ *   unit     : dataflow (mpu = output stationary, mpuhsa/hsa =
+ *              weight stationary, vpu/vpuhsa, spvpu = sparse)
+ *   mode     : mmm/mvm, only expanded for hsa
+ *   memory   : MemoryConfig objects (MemoryModel.hh), absent
+ *              = free sram reads
+ * and evaluates every point through the pre-instantiated
+ * units (UnitRunner.hh). run_sweep() pipelines it: drawing
+ * the operands, simulating (on `threads` workers), checking
+ * against the reference and collecting/writing the results
+ * are separate stages connected by bounded queues
+ * (Pipeline.hh), so the workers never wait on the rest.
+ *
+ * Per point, averaged over `trials` random tiles:
+ *   cycles      : clock() calls for one tile, plus memory stalls
+ *   stalls      : the memory stalls alone, and what they were
+ *                 mostly on (bound: compute, bank or backing,
+ *                 the latter two being bandwidth bound)
+ *   utilization : MACs done / (PEs * cycles)
+ *   energy      : relative units, see estimate_energy()
+ *   cycles_per_mac, energy_per_mac
+ *               : the two above over the MACs of the tile,
+ *                 which grows with n and cols, so points of
+ *                 different array sizes compare on the same
+ *                 amount of work (what the frontier uses)
+ *   error       : mean |sim - exact| / |exact| against an
+ *                 unbounded 64 bit dense reference, so it
+ *                 captures accumulator overflow and, for
+ *                 spvpu, the 2:1 column merging
+ *
+ * Results are appended to the csv as each point finishes
+ * (one flushed line each), so an interrupted sweep keeps
+ * everything done so far, and resume skips those points.
+ */
+struct SweepPoint
+{
+    uint64_t id;
+    std::string unit;
+    std::string mode;
+    uint64_t n, cols, op_bits, acc_bits;
+    std::optional<MemoryConfig> memory;
+    std::string memory_label = "-";     // "-" = free sram reads
+};
+
+struct SweepResult
+{
+    SweepPoint point;
+    uint64_t cycles;
+    uint64_t pes;
+    double macs;
+    double utilization;
+    double energy;
+    double cycles_per_mac;
+    double energy_per_mac;
+    double error;
+    uint64_t stalls;
+    std::string bound;
+};
+
+struct SweepConfig
+{
+    std::vector<uint64_t> n = {2, 4, 8};
+    std::vector<uint64_t> cols;         // empty = cols == n
+    std::vector<uint64_t> op_bits = {8};
+    std::vector<uint64_t> acc_bits = {16, 32};
+    std::vector<std::string> units = {"mpu", "mpuhsa", "hsa", "spvpu"};
+    std::vector<std::string> modes = {"mmm", "mvm"};
+    std::vector<MemoryConfig> memories; // empty = free sram reads
+    uint64_t trials = 8;
+    uint64_t seed = 0;
+    uint64_t threads = 0;               // simulation workers, 0 = all cores
+    std::string output = "sweep.csv";
+    std::string pareto_output;          // empty = stdout only
+    bool resume = false;
+    bool event_driven = false;          // "kernel": "event", see EventKernel.hh
+};
+
+SweepConfig parse_sweep_config(const Json& j);
+
+/* Points that are not pre-instantiated, with op_bits
+ * wider than the accumulator, or whose tile doesn't fit
+ * in the memory, are dropped */
+std::vector<SweepPoint> expand_grid(const SweepConfig& cfg);
+
+SweepResult evaluate_point(const SweepPoint& p, uint64_t trials, uint64_t seed, bool event_driven = false);
+
+/* Relative energy: a MAC costs op_bits^2 (multiplier) plus
+ * acc_bits (adder + psum latch), idle PEs still leak 5% of a
+ * full 8x8 bit MAC per cycle. Only meaningful to compare
+ * points against each other. */
+double estimate_energy(const SweepPoint& p, double macs, uint64_t pes, uint64_t cycles);
+
+/* Non-dominated points, minimising cycles and energy per
+ * MAC and error */
+std::vector<SweepResult> pareto_frontier(const std::vector<SweepResult>& results);
+
+/* Runs the whole grid, streaming results to cfg.output,
+ * returns everything (including resumed points) */
+std::vector<SweepResult> run_sweep(const SweepConfig& cfg);
+
+/* cycles_per_mac and energy_per_mac from the rest */
+void normalise_result(SweepResult& r);
+
+std::string sweep_csv_header();
+std::string sweep_csv_line(const SweepResult& r);
+
+#endif
@@ -0,0 +1,385 @@
+#ifndef __SYSTOLIC_ARRAY_HH__
+#define __SYSTOLIC_ARRAY_HH__
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <format>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Checkpoint.hh"
+#include "EnableSchedule.hh"
+#include "Unroll.hh"
+
+/*- Systolic array engine *-/
+ * mac_t should be a mac_t_p<b>
+ *
+ * Everything the units (Mpu, MpuHsa, Hsa, Vpu, VpuHsa,
+ * SpVpu) share: the cycle counter, an RxC grid of PEs,
+ * their enable schedule and the three ways of clocking
+ * it (cycle stepped loops over the schedule bitmasks,
+ * the unrolled clock()s of Unroll.hh, and clock_pes()
+ * for the EventKernel), plus the checkpoint framing.
+ *
+ * A unit is this engine instantiated with two policies:
+ *   pe_t      : the PE model (WsMac, Mac, SpMac), the
+ *               engine only stores and checkpoints them
+ *   Dataflow  : Dataflow<mac_t, R, C, pe_t>, the engine's
+ *               base, holding the unit's srams, latches
+ *               and debug values, and what one PE does in
+ *               a cycle
+ * and the unit class itself only adds its constructor,
+ * results and to_string(). Everything is resolved at
+ * compile time, there are no virtual calls.
+ *
+ * A Dataflow provides (see DataflowBase for defaults):
+ *   output_t                   what an enabled PE latches
+ *   has_MVM                    takes an MVM_enable mode
+ *   enabled_cols               cols of the enabled[][]
+ *                              version 1 checkpoints had
+ *   checkpoint_tag()
+ *   latency(mode)              cycles until ready
+ *   pe_window(i, j, mode)      cycles PE(i, j) is enabled
+ *   reset_state(mode)
+ *   reset_pe(pe)               what reset() does to a PE,
+ *                              nothing by default
+ *   eval_pe(pe, i, j, mode)    an enabled PE's cycle, only
+ *                              reading its own PE and the
+ *                              latches of PE(i, j-1) and
+ *                              PE(i-1, j)
+ *   latch_pe(i, j, out, mode, t)
+ *   begin_cycle(mode), end_cycle(mode)
+ *   clears_retired, retire_pe(i, j)
+ *                              PEs disabled this cycle
+ *                              latching zeros
+ *   save/load_operands(ck), save/load_latches(ck)
+ *                              state before and after the
+ *                              PEs in a checkpoint
+ * i, j and mode may be std::integral_constants (from the
+ * unrolled clock()s), which folds edge checks and
+ * addressing away.
+ *
+ * Since a PE only reads the up/left latches, walking the
+ * array last PE first lets every PE latch straight away
+ * (its readers have already been evaluated), which is
+ * what the unrolled clock()s do.
+ *
+ * Units fed a vector per cycle (Mpu's push(), HsaStream)
+ * run clock_stream() instead: no schedule, every PE is
+ * clocked every cycle (a full stream has no idle PEs,
+ * so there's nothing for the EventKernel to skip), last
+ * PE first. Its mode is a StreamMode, which is the plain
+ * mode to dataflows that don't care, the others tell it
+ * apart with is_stream_mode to take their inputs from
+ * wherever the unit put this cycle's vector.
+ */
+template <bool MVM_enable>
+struct StreamMode : std::bool_constant<MVM_enable> {};
+
+template <typename mode_t>
+constexpr bool is_stream_mode = false;
+
+template <bool MVM_enable>
+constexpr bool is_stream_mode<StreamMode<MVM_enable>> = true;
+
+class DataflowBase
+{
+protected:
+    static constexpr bool has_MVM = false;
+    static constexpr bool clears_retired = false;
+
+    void reset_pe(auto&) {}
+    void begin_cycle(auto) {}
+    void end_cycle(auto) {}
+    void retire_pe(auto, auto) {}
+};
+
+/* One PE's strings in the common to_string() layout */
+struct PeText
+{
+    std::string top, side, bottom;
+};
+
+template <typename mac_t, uint64_t R, uint64_t C,
+         template <typename, uint64_t, uint64_t, typename> class Dataflow, typename pe_t>
+class SystolicArray : public Dataflow<mac_t, R, C, pe_t>
+{
+protected:
+    typedef Dataflow<mac_t, R, C, pe_t> dataflow_t;
+    typedef typename dataflow_t::output_t output_t;
+    static constexpr bool has_MVM = dataflow_t::has_MVM;
+
+    uint64_t counter = 0;
+    pe_t mac_units[R][C];
+    std::vector<output_t> pe_outputs;   // clock()/clock_pes() scratch
+
+    /* clock() of the small arrays (see Unroll.hh): cycle
+     * t of the schedule only evaluates the PEs whose
+     * (compile time) window contains t. t == latency()
+     * stands for every later cycle, where nothing is
+     * enabled any more */
+    template <bool MVM_enable, uint64_t t>
+    void clock_cycle()
+    {
+        constexpr std::bool_constant<MVM_enable> mode;
+        this->begin_cycle(mode);
+        unroll_down<R>([&](auto i) {
+            unroll_down<C>([&](auto j) {
+                constexpr PeWindow w = dataflow_t::pe_window(i, j, MVM_enable);
+                if constexpr (w.first <= t && t < w.last)
+                    this->latch_pe(i, j, this->eval_pe(mac_units[i][j], i, j, mode), mode, counter);
+                else if constexpr (dataflow_t::clears_retired && w.first < w.last && t == w.last)
+                    this->retire_pe(i, j);
+            });
+        });
+        this->end_cycle(mode);
+        counter++;
+    }
+
+    template <bool MVM_enable>
+    void clock_streamed()
+    {
+        constexpr StreamMode<MVM_enable> mode;
+        this->begin_cycle(mode);
+        if constexpr (R*C <= UNROLL_MAX_PES)
+            unroll_down<R>([&](auto i) {
+                unroll_down<C>([&](auto j) {
+                    this->latch_pe(i, j, this->eval_pe(mac_units[i][j], i, j, mode), mode, counter);
+                });
+            });
+        else
+            for (uint64_t i = R; i-- > 0; )
+                for (uint64_t j = C; j-- > 0; )
+                    this->latch_pe(i, j, this->eval_pe(mac_units[i][j], i, j, mode), mode, counter);
+        this->end_cycle(mode);
+    }
+
+    template <bool MVM_enable>
+    void clock_unrolled()
+    {
+        static constexpr uint64_t T = latency(MVM_enable);
+        static constexpr auto cycles = unroll_table<T + 1>([](auto t) {
+            return &SystolicArray::clock_cycle<MVM_enable, decltype(t)::value>;
+        });
+        (this->*cycles[std::min(counter, T)])();
+    }
+
+    /* The common to_string() layout (Mpu, MpuHsa, Hsa in
+     * MMM mode, VpuHsa): per PE cell.top over cell.bottom
+     * with cell.side to its right, top(j) above the
+     * array and left(i) on its left */
+    template <typename cell_fn, typename top_fn, typename left_fn>
+    static std::string grid_string(cell_fn cell, top_fn top, left_fn left)
+    {
+        std::string top_rows[R], bot_rows[R];
+        std::string toptop_row;
+        uint64_t max_row_width = 0;
+        for (uint64_t i = 0; i < R; i++)
+        {
+            std::string top_row, bot_row;
+            for (uint64_t j = 0; j < C; j++)
+            {
+                PeText t = cell(i, j);
+                uint64_t twidth = std::max(std::max(t.top.length(), t.bottom.length()), (uint64_t)8) + 2;
+                std::string ptop_str = std::vformat("{:^"+std::to_string(twidth)+"}", std::make_format_args(t.top));
+                std::string pbot_str = std::vformat("{:^"+std::to_string(twidth)+"}", std::make_format_args(t.bottom));
+                top_row += "| " + ptop_str + " | " + t.side + " ";
+                bot_row += "| " + pbot_str + " |" + std::string(t.side.length()+2, '-');
+                if (i == 0)
+                {
+                    std::string toptop_str = top(j) + "↓";
+                    std::string ptoptop_str = std::vformat("{:^"+std::to_string(twidth)+"}", std::make_format_args(toptop_str));
+                    toptop_row += "  " + ptoptop_str + "   " + std::string(t.side.length(), ' ') + " ";
+                }
+            }
+            top_rows[i] = top_row;
+            bot_rows[i] = bot_row;
+            max_row_width = top_row.length() > max_row_width ? top_row.length() : max_row_width;
+        }
+        std::string ret;
+        uint64_t max_l_width = 0;
+        for (uint64_t i = 0; i < R; i++)
+            max_l_width = std::max(max_l_width, (uint64_t)left(i).length());
+        max_l_width += 5;
+        std::string lsep = std::string(max_l_width, ' ');
+        std::string sep = lsep+std::string(max_row_width+1, '=');
+        ret += lsep+toptop_row + "\n" + sep + "\n";
+        for (uint64_t i = 0; i < R; i++)
+            ret += " " + left(i) + " -> " + top_rows[i] + "|\n" + \
+                    lsep + bot_rows[i] + "|\n" + sep + "\n";
+        return ret;
+    }
+
+public:
+    /* Units without an MVM mode ignore MVM_enable
+     * everywhere below */
+    void reset(bool MVM_enable = false)
+    {
+        counter = 0;
+        for (uint64_t i = 0; i < R; i++)
+            for (uint64_t j = 0; j < C; j++)
+                this->reset_pe(mac_units[i][j]);
+        this->reset_state(has_MVM && MVM_enable);
+    }
+
+    static constexpr uint64_t latency(bool MVM_enable = false)
+    {
+        return dataflow_t::latency(has_MVM && MVM_enable);
+    }
+
+    bool ready(bool MVM_enable = false)
+    {
+        return counter >= latency(MVM_enable);
+    }
+
+    uint64_t get_counter()
+    {
+        return counter;
+    }
+
+    static std::string checkpoint_tag()
+    {
+        return dataflow_t::checkpoint_tag();
+    }
+
+    /* Complete state, see Checkpoint.hh. Restoring
+     * replaces everything set up by the constructor */
+    void save_state(CheckpointWriter& ck) const
+    {
+        ck.begin<mac_t>(checkpoint_tag(), R);
+        ck.put(counter);
+        this->save_operands(ck);
+        ck.put(mac_units);
+        this->save_latches(ck);
+    }
+
+    void load_state(CheckpointReader& ck)
+    {
+        ck.begin<mac_t>(checkpoint_tag(), R);
+        ck.get(counter);
+        if (ck.version() < 2)
+            ck.skip<bool[R][dataflow_t::enabled_cols]>();
+        this->load_operands(ck);
+        ck.get(mac_units);
+        this->load_latches(ck);
+    }
+
+    static constexpr PeWindow pe_window(uint64_t i, uint64_t j, bool MVM_enable = false)
+    {
+        return dataflow_t::pe_window(i, j, has_MVM && MVM_enable);
+    }
+
+    /* For the EventKernel */
+    static std::vector<PeWindow> windows(bool MVM_enable = false)
+    {
+        return pe_windows(R, C, [&](uint64_t i, uint64_t j) {
+            return pe_window(i, j, MVM_enable);
+        });
+    }
+
+    /* pe_window()s as bitmasks, built once per shape and
+     * mode (see EnableSchedule.hh) */
+    static const EnableSchedule& schedule(bool MVM_enable = false)
+    {
+        if (has_MVM && MVM_enable)
+        {
+            static const EnableSchedule mvm(R, C, windows(true));
+            return mvm;
+        }
+        static const EnableSchedule s(R, C, windows(false));
+        return s;
+    }
+
+    /* Whether PE(i, j) was enabled in the last cycle clocked */
+    bool enabled(uint64_t i, uint64_t j, bool MVM_enable = false) const
+    {
+        return counter && schedule(MVM_enable).enabled(counter - 1, i, j);
+    }
+
+    void clock(bool MVM_enable = false)
+    {
+        MVM_enable = has_MVM && MVM_enable;
+        if constexpr (R*C <= UNROLL_MAX_PES)
+        {
+            if constexpr (has_MVM)
+                if (MVM_enable)
+                {
+                    clock_unrolled<true>();
+                    return;
+                }
+            clock_unrolled<false>();
+            return;
+        }
+        const EnableSchedule& s = schedule(MVM_enable);
+        this->begin_cycle(MVM_enable);
+        pe_outputs.clear();
+        s.for_each(counter, [&](uint64_t i, uint64_t j) {
+            pe_outputs.push_back(this->eval_pe(mac_units[i][j], i, j, MVM_enable));
+        });
+        /* Only the PEs enabled last cycle can be retiring
+         * (after the reads, their neighbours still see
+         * last cycle's latches) */
+        if constexpr (dataflow_t::clears_retired)
+            if (counter)
+                for (uint64_t i = 0; i < R; i++)
+                {
+                    const uint64_t *last = s.row(counter - 1, i), *now = s.row(counter, i);
+                    for (uint64_t w = 0; w < (C + 63) / 64; w++)
+                        for (uint64_t bits = last[w] & ~now[w]; bits; bits &= bits - 1)
+                            this->retire_pe(i, w * 64 + std::countr_zero(bits));
+                }
+
+        /* Update latch values, after so no weirdness */
+        uint64_t k = 0;
+        s.for_each(counter, [&](uint64_t i, uint64_t j) {
+            this->latch_pe(i, j, pe_outputs[k++], MVM_enable, counter);
+        });
+        this->end_cycle(MVM_enable);
+        counter++;
+    }
+
+    /* Same cycle as clock(), only visiting the PEs
+     * enabled in it (ids i*C + j, see EventKernel.hh) */
+    void clock_pes(const std::vector<uint32_t>& active, const std::vector<uint32_t>& retired,
+            bool MVM_enable = false)
+    {
+        MVM_enable = has_MVM && MVM_enable;
+        this->begin_cycle(MVM_enable);
+        pe_outputs.resize(active.size());
+        for (uint64_t k = 0; k < active.size(); k++)
+            pe_outputs[k] = this->eval_pe(mac_units[active[k] / C][active[k] % C],
+                    active[k] / C, active[k] % C, MVM_enable);
+        if constexpr (dataflow_t::clears_retired)
+            for (uint32_t p : retired)
+                this->retire_pe(p / C, p % C);
+        for (uint64_t k = 0; k < active.size(); k++)
+            this->latch_pe(active[k] / C, active[k] % C, pe_outputs[k], MVM_enable, counter);
+        this->end_cycle(MVM_enable);
+        counter++;
+    }
+
+    /* One streamed cycle (see above), the unit puts its
+     * inputs in place first. The counter is the unit's
+     * to move, a stream isn't on the schedule */
+    void clock_stream(bool MVM_enable = false)
+    {
+        if constexpr (has_MVM)
+            if (MVM_enable)
+            {
+                clock_streamed<true>();
+                return;
+            }
+        clock_streamed<false>();
+    }
+
+    /* Cycles with no PE enabled (and none just disabled)
+     * only move the counter */
+    void skip_cycles(uint64_t cycles)
+    {
+        counter += cycles;
+    }
+};
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef __UART_HOST_HH__
+#define __UART_HOST_HH__
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "BulkFrame.hh"
+#include "Matrix.hh"
+#include "StreamDecoder.hh"
+#include "UnitRunner.hh"
+
+/*- Host driver for the FPGA UART protocol *-/
+ * Same wire protocol as uart_comms/utility.py (SAUnit),
+ * 8E1 at 921600 baud by default:
+ *
+ *   host -> fpga   deadbeef x4 (little endian) until 0C0C0C0C
+ *   fpga -> host   0C0C0C0C
+ *   host -> fpga   magic da221d06, then the weight and act
+ *                  dataframes (resent on timeout) until 1C1C1C1C
+ *   fpga -> host   1C1C1C1C, computes, then deadbeef until 0C
+ *   host -> fpga   0C0C0C0C
+ *   fpga -> host   result dataframes
+ *   host -> fpga   1C1C1C1C once every result arrived
+ *
+ * (acks are sent 5 times, and a failed request resets
+ * the board with FFFFFFFF)
+ *
+ * With bulk on, the first request negotiates bulk frames
+ * (BulkFrame.hh) in place of the magic + dataframes and
+ * the per-element results (but for the small tiles whose
+ * results are cheaper as dataframes, see BulkFrame.hh),
+ * falling back to the above for
+ * the rest of the session if the board doesn't answer.
+ * With compress on as well, bulk requests go through the
+ * payload codecs where they save bytes (2:4 pruned
+ * weights pair packed, zero run length acts), and the
+ * responses count the bytes sent against the plain bulk
+ * frame size.
+ *
+ * Dataframes are 32 bit words,
+ *   [31] msb (0 = data)  [30] weight  [29:23] x_ix
+ *   [22:16] y_ix  [15:0] data
+ * sent little endian, received big endian (that's just
+ * how the transmitter shifts them out).
+ *
+ * Unlike SAUnit, the port is non-blocking and everything
+ * waits on poll() instead of sleeping, frames are packed
+ * into two preallocated buffers, and run_batch() packs
+ * request i+1 into the spare buffer while request i is
+ * on the wire, sending its sync as soon as i is acked.
+ * The resend timeout is the wire time of the payload
+ * plus resend_margin, instead of a flat 100 ms. Reading
+ * back goes through StreamDecoder.hh (SIMD sync search,
+ * results decoded in place with a bitmap).
+ */
+struct UartRequest
+{
+    bool vector_mode = true;
+    /* Indexed like SAUnit: weights.at(x, y) goes to weights_sram[y][x],
+     * acts is NxN (acts.at(x, y)), or Nx1 in vector mode */
+    Matrix<wide_t> acts, weights;
+    uint32_t tile_id = 0;       // echoed back by bulk results
+};
+
+struct UartResponse
+{
+    bool ok = false;
+    Matrix<wide_t> result;      // result.at(y, x), Nx1 in vector mode
+    uint64_t resends = 0;
+    bool bulk = false;          // went over bulk frames
+    /* Link accounting: payload frame bytes sent (once) and
+     * one copy of the results, against the same without
+     * codecs (the legacy dataframes if not bulk) */
+    uint64_t tx_bytes = 0, tx_raw_bytes = 0;
+    uint64_t rx_bytes = 0, rx_raw_bytes = 0;
+    double fpga_seconds = 0;    // payload acked -> first result traffic
+    double host_seconds = 0;    // whole request, handshakes included
+};
+
+class UartHost
+{
+private:
+    int fd;
+    std::string port;
+    uint64_t N, baudrate;
+
+    /* Double buffered tx frames (see run_batch) */
+    std::vector<uint8_t> tx_buf[2];
+    uint64_t tx_len[2];
+
+    /* rx bytes not consumed yet are [rx_begin, rx_end) */
+    std::vector<uint8_t> rx_buf;
+    uint64_t rx_begin, rx_end;
+
+    int bulk_state;                 // -1 not negotiated yet, 0 legacy board, 1 bulk
+    std::vector<uint64_t> elems;    // bulk (de)coding scratch
+    ResultDecoder decoder;
+
+    void write_all(const uint8_t *buf, uint64_t len);
+    bool fill_rx(double timeout_s);
+    int find_words(const uint32_t *words, int count, double timeout_s);
+    bool find_word(uint32_t word, double timeout_s);
+    uint64_t pack(const UartRequest& req, uint8_t *out);
+    BulkHeader bulk_header(const UartRequest& req) const;
+    uint64_t pack_bulk(const UartRequest& req, uint8_t *out);
+    double wire_time(uint64_t bytes);
+    bool send_payload(const UartRequest& req, uint64_t slot, UartResponse& resp);
+    bool read_results(const UartRequest& req, UartResponse& resp);
+    bool read_bulk_results(const UartRequest& req, UartResponse& resp);
+public:
+    static constexpr uint32_t SYNC = 0xdeadbeef;
+    static constexpr uint32_t MAGIC = 0xda221d06;
+    static constexpr uint32_t ACK1 = 0x0C0C0C0C;
+    static constexpr uint32_t ACK2 = 0x1C1C1C1C;
+    static constexpr uint32_t RESET = 0xFFFFFFFF;
+    /* As decoded by Hsa_Wrapper.sv (hsa_mode = 1 is the MMM
+     * path there), utility.py has these the other way round */
+    static constexpr uint32_t TO_MATRIX = 0xFEFEFEFE;
+    static constexpr uint32_t TO_VECTOR = 0xFDFDFDFD;
+
+    uint64_t max_resends = 5;
+    double resend_margin = 0.02;    // s, on top of the payload wire time
+    double timeout = 1.0;           // s, giving up on a silent fpga
+    bool verbose = false;
+    bool bulk = true;               // try to negotiate bulk frames
+    uint64_t bits = 16;             // bulk payload width (BIT_WIDTH)
+    bool compress = true;           // use the bulk payload codecs
+
+    /* Throws std::runtime_error if the port can't be opened/configured */
+    UartHost(const std::string& port_p, uint64_t N_p = 8, uint64_t baudrate_p = 921600);
+    ~UartHost();
+    UartHost(const UartHost&) = delete;
+    UartHost& operator=(const UartHost&) = delete;
+
+    /* Drops anything buffered, and with fpga also resets the board */
+    void reset(bool fpga = false);
+    /* The board resets itself on a mode switch */
+    void switch_mode(bool vector_mode);
+
+    UartResponse run(const UartRequest& req);
+    std::vector<UartResponse> run_batch(const std::vector<UartRequest>& reqs);
+
+    static uint32_t build_dataframe(bool msb, bool weight, uint64_t x_ix, uint64_t y_ix, uint64_t data);
+};
+
+#endif
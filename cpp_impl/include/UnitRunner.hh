@@ -0,0 +1,90 @@
+#ifndef __UNIT_RUNNER_HH__
+#define __UNIT_RUNNER_HH__
+
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "mac_t.hh"
+#include "Matrix.hh"
+#include "MemoryModel.hh"
+
+/*- Runtime dispatch onto the unit templates *-/
+ * Every unit is a template on <mac_t, N>, so picking
+ * one at runtime means going through a table of
+ * pre-instantiated (unit, N, bits) combinations,
+ * built in lib/UnitRunner.cc. Operands and results
+ * cross that boundary as 64 bit values (wide_t), and
+ * are truncated to the unit's mac_t on the way in,
+ * exactly like writing them into the srams would.
+ *
+ * Units and what they compute (A = acts, W = weights,
+ * v = column 0 of acts):
+ *   mpu            : A * W   (output stationary)
+ *   mpuhsa         : A * W   (weight stationary)
+ *   hsa   (mmm)    : A * W
+ *   hsa   (mvm)    : W * v
+ *   vpu            : W * v
+ *   vpuhsa         : W * v
+ *   spvpu          : W' * v, W' being W column merged
+ *                    2:1 (larger of each even/odd pair
+ *                    kept, as in accuracy_computation)
+ * MMM results are NxN, MVM ones Nx1.
+ *
+ * hsa and mpuhsa are also instantiated as rectangular
+ * RxC arrays (UnitKey.C != N): weights are then RxC,
+ * acts CxR (C rows streamed) or Cx1 for MVM, and the
+ * results CxC (MMM) or Rx1 (MVM). See Hsa.hh.
+ *
+ * With a memory config the unit is fed through a
+ * MemoryModel, cycles then include the memory stalls.
+ */
+typedef mac_t_p<64> wide_t;
+
+struct UnitRun
+{
+    std::string unit;
+    bool MVM_enable = false;        // only hsa has both modes
+    Matrix<wide_t> acts, weights;   // both NxN (acts may be Nx1 for MVM units)
+    uint64_t cycles = 0;            // clock() budget, 0 = until ready
+    std::ostream *trace = nullptr;  // per-cycle to_string() dump
+    std::string restore_path;       // start from this snapshot (Checkpoint.hh)
+    std::string checkpoint_path;    // snapshot the unit here...
+    uint64_t checkpoint_at = 0;     // ...after this many cycles (within the run, else
+                                    // it throws), 0 = at the end
+    std::optional<MemoryConfig> memory;     // unset = free sram reads
+    bool event_driven = false;      // EventKernel.hh, same results and cycles
+};
+
+struct UnitResult
+{
+    Matrix<wide_t> result;
+    uint64_t cycles;                // clock() calls made, plus stalls
+    uint64_t latency;               // cycles the unit needs to be ready
+    bool ready;
+    uint64_t stall_cycles = 0;
+    MemoryStats memory;             // only filled in with a memory config
+};
+
+typedef UnitResult (*unit_fn)(const UnitRun&);
+
+struct UnitKey
+{
+    std::string unit;
+    uint64_t N;                     // rows
+    uint64_t bits;
+    uint64_t C;                     // cols, == N for square arrays
+};
+
+/* nullptr if that combination was not pre-instantiated */
+unit_fn find_unit(const std::string& unit, uint64_t N, uint64_t bits);
+unit_fn find_unit(const std::string& unit, uint64_t R, uint64_t C, uint64_t bits);
+std::vector<UnitKey> available_units();
+
+/* Fixed mode units report their own mode, hsa is the
+ * only one where the request decides */
+bool unit_is_MVM(const std::string& unit, bool MVM_enable);
+
+#endif
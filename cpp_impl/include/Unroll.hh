@@ -0,0 +1,60 @@
+#ifndef __UNROLL_HH__
+#define __UNROLL_HH__
+
+#include <array>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+/*- Compile time unrolling *-/
+ * unroll<N>(f) calls f(std::integral_constant<uint64_t, I>{})
+ * for I = 0 .. N-1, in order. Inside f the index converts to
+ * a constant expression, so e.g. a PE's enable window, its
+ * edge (i == 0, j == 0) checks and its latch addresses all
+ * fold away, and the whole array update becomes straight
+ * line code the compiler can keep in registers.
+ *
+ * unroll_down<N>(f) is the same from N-1 down to 0.
+ *
+ * unroll_table<N>(f) is {f(0), .., f(N-1)} the same way,
+ * evaluated at compile time when f allows it. The units
+ * use it for a table of clock() bodies, one per cycle of
+ * their enable schedule, each one only containing the PEs
+ * enabled in that cycle: no enable checks are left at run
+ * time, just one indirect call a cycle.
+ *
+ * Arrays of up to UNROLL_MAX_PES PEs (the 2x2, 4x4 and 8x8
+ * FPGA builds) get unrolled clock()s, bigger ones keep the
+ * loops, which would only blow up code size and compile
+ * times.
+ */
+constexpr uint64_t UNROLL_MAX_PES = 64;
+
+template <uint64_t N, typename fn_t>
+inline void unroll(fn_t&& f)
+{
+    [&]<uint64_t... I>(std::integer_sequence<uint64_t, I...>)
+    {
+        (f(std::integral_constant<uint64_t, I>{}), ...);
+    }(std::make_integer_sequence<uint64_t, N>{});
+}
+
+template <uint64_t N, typename fn_t>
+inline void unroll_down(fn_t&& f)
+{
+    [&]<uint64_t... I>(std::integer_sequence<uint64_t, I...>)
+    {
+        (f(std::integral_constant<uint64_t, N-1-I>{}), ...);
+    }(std::make_integer_sequence<uint64_t, N>{});
+}
+
+template <uint64_t N, typename fn_t>
+constexpr auto unroll_table(fn_t f)
+{
+    return [&]<uint64_t... I>(std::integer_sequence<uint64_t, I...>)
+    {
+        return std::array{f(std::integral_constant<uint64_t, I>{})...};
+    }(std::make_integer_sequence<uint64_t, N>{});
+}
+
+#endif
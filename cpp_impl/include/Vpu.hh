@@ -3,7 +3,15 @@
 
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include "Checkpoint.hh"
+#include "SystolicArray.hh"
 #include "WsMac.hh"
 
 /*- Vector Processing Unit *-/
@@ -16,33 +24,142 @@
  * instantiation due to non-template type params (nttp)
  *
  * Performs the vector multiplication 
+ *
+ * Acts flow top to bottom, psums left to right, one
+ * anti-diagonal of PEs a cycle. VpuDataflow is the
+ * dataflow policy of the SystolicArray (see
+ * SystolicArray.hh).
  */
-template <typename mac_t, uint64_t N>
-class Vpu
+template <typename mac_t, uint64_t N, uint64_t C, typename pe_t>
+class VpuDataflow : public DataflowBase
 {
-    private:
-        uint64_t counter;
-        bool enabled[N][N];
- 
+    protected:
+        typedef std::pair<mac_t, mac_t> output_t;
+        static constexpr uint64_t enabled_cols = N;
+
         mac_t acts_sram[N], weights_sram[N][N];
         mac_t init_acts_sram[N][N], init_weights_sram[N][N];
-        WsMac<mac_t> vmac_units[N][N]; 
         mac_t right_latches[N][N];  // for left-right streaming of psums
         mac_t down_latches[N][N];  // for top-down streaming of acts
-    public:
-        Vpu(mac_t acts_sram_p[N], mac_t weights_sram_p[N][N])
+
+        static std::string checkpoint_tag()
         {
-            memcpy(init_acts_sram, acts_sram_p, N*sizeof(mac_t)); 
-            for (uint64_t i = 0; i < N; i++)
-                memcpy(init_weights_sram[i], weights_sram_p[i], N*sizeof(mac_t)); 
-            reset();
+            return "vpu";
+        }
+
+        /* PE(N-1,N-1) fires on the last anti-diagonal, cycle 2N-2 */
+        static constexpr uint64_t latency(bool)
+        {
+            return 2*N - 1;
+        }
+
+        /* No pipelining for now, so each vmac only
+         * active for 1 cycle... In pipelining case,
+         * the next vector to be multiplied begins
+         * streaming behind this one. */
+        static constexpr PeWindow pe_window(uint64_t i, uint64_t j, bool)
+        {
+            return {i+j, i+j+1};
         }
-        void reset()
+
+        void reset_state(bool)
         {
             memcpy(acts_sram, init_acts_sram, N*sizeof(mac_t)); 
             for (uint64_t i = 0; i < N; i++)
                 memcpy(weights_sram[i], init_weights_sram[i], N*sizeof(mac_t));  
-            counter = 0;
+            for (uint64_t i = 0; i < N; i++)
+                for (uint64_t j = 0; j < N; j++)
+                {
+                    down_latches [i][j] = mac_t::ZERO;
+                    right_latches[i][j] = mac_t::ZERO;
+                }
+        }
+
+        /* Body of clock() for an enabled PE, returns
+         * what it latches */
+        output_t eval_pe(pe_t& pe, auto i, auto j, auto)
+        {
+            mac_t input_top_a, input_left_cin;
+                
+            input_left_cin = j == 0 ? mac_t::ZERO : right_latches[i][j-1];
+            input_top_a = i == 0 ? acts_sram[j] : down_latches[i-1][j];
+
+            /* Weight-stationary */
+            mac_t input_top =  weights_sram[i][j];
+
+            /* I don't simulate the staggered reading,
+             * but since vmac units store the read,
+             * only one value from each weight row has
+             * to be read at once at most (each weight
+             * row should be in separate sram). Here,
+             * just imagine we have infty read ports
+             * (MemoryModel.hh charges the real ones,
+             * when UnitRunner is given a memory config)
+             * */
+            return pe.clock(
+                input_top_a,
+                input_top,
+                input_left_cin,
+                true,
+                true
+            );
+        }
+
+        void latch_pe(auto i, auto j, const output_t& out, auto, uint64_t)
+        {
+            down_latches[i][j] = out.first;
+            right_latches[i][j] = out.second;
+        }
+
+        void save_operands(CheckpointWriter& ck) const
+        {
+            ck.put(acts_sram);
+            ck.put(weights_sram);
+            ck.put(init_acts_sram);
+            ck.put(init_weights_sram);
+        }
+
+        void load_operands(CheckpointReader& ck)
+        {
+            ck.get(acts_sram);
+            ck.get(weights_sram);
+            ck.get(init_acts_sram);
+            ck.get(init_weights_sram);
+        }
+
+        void save_latches(CheckpointWriter& ck) const
+        {
+            ck.put(right_latches);
+            ck.put(down_latches);
+        }
+
+        void load_latches(CheckpointReader& ck)
+        {
+            ck.get(right_latches);
+            ck.get(down_latches);
+        }
+};
+
+template <typename mac_t, uint64_t N>
+class Vpu : public SystolicArray<mac_t, N, N, VpuDataflow, WsMac<mac_t>>
+{
+    private:
+        typedef SystolicArray<mac_t, N, N, VpuDataflow, WsMac<mac_t>> base_t;
+        using base_t::acts_sram;
+        using base_t::weights_sram;
+        using base_t::init_acts_sram;
+        using base_t::init_weights_sram;
+        using base_t::right_latches;
+        using base_t::down_latches;
+        using base_t::mac_units;
+
+    public:
+        Vpu(mac_t acts_sram_p[N], mac_t weights_sram_p[N][N])
+        {
+            memcpy(init_acts_sram, acts_sram_p, N*sizeof(mac_t)); 
+            for (uint64_t i = 0; i < N; i++)
+                memcpy(init_weights_sram[i], weights_sram_p[i], N*sizeof(mac_t)); 
+            this->reset();
         }
 
         void print_mac_values()
@@ -50,64 +167,12 @@ class Vpu
             for (int i = 0; i < N; i++)
             {
                 for (int j = 0; j < N; j++)
-                    std::cout << "| " << vmac_units[i][j].get_mac().value << " ";
+                    std::cout << "| " << mac_units[i][j].get_mac().value << " ";
                 std::cout << "|" << std::endl;
             }
         }
-       
-        void clock()
-        {
-            std::pair<mac_t, mac_t> outputs[N][N];
-            for (uint64_t i = 0; i < N; i++)
-                for (uint64_t j = 0; j < N; j++)
-                {
-                    /* No pipelining for now,
-                     * so each vmac only active for
-                     * 1 cycle... In pipelining case,
-                     * the next vector to be multiplied
-                     * begins streaming behind this one.
-                     */
-                    bool enable = (i+j)==counter;
-                    enabled[i][j] = enable;
-                    if (!enable) continue;
-                    mac_t input_top_a, input_left_cin;
-                        
-                    input_left_cin = j == 0 ? mac_t::ZERO : right_latches[i][j-1];
-                    input_top_a = i == 0 ? acts_sram[j] : down_latches[i-1][j];
-
-                    /* Weight-stationary */
-                    mac_t input_top =  weights_sram[i][j];
-
-                    /* I don't simulate the staggered reading,
-                     * but since vmac units store the read,
-                     * only one value from each weight row has
-                     * to be read at once at most (each weight
-                     * row should be in separate sram). Here,
-                     * just imagine we have infty read ports
-                     * */
-                    outputs[i][j] = vmac_units[i][j].clock(
-                        input_top_a,
-                        input_top,
-                        input_left_cin,
-                        enable,
-                        true
-                    );
-                }
 
-            /* Update latch values, after so no weirdness 
-             * Could probably figure out a loop order to
-             * do this above, but this works fine.
-             * Only right to latch if enabled */
-            for (uint64_t i = 0; i < N; i++)
-                for (uint64_t j = 0; j < N; j++)
-                    if (enabled[i][j])
-                    {
-                        down_latches[i][j] = outputs[i][j].first;
-                        right_latches[i][j] = outputs[i][j].second;
-                    }
-            counter++;
-        }
-        std::string to_string()
+    std::string to_string()
         {
             /* Format (ala = acts latch):
              *
@@ -133,7 +198,7 @@ class Vpu
                     std::string psum_str, ala_str, w_str;
                     ala_str = std::to_string(psum.value);
                     w_str   = std::to_string(weights_sram[i][j].value) + "↓";
-                    psum_str = !enabled[i][j] ? "Disabled" :
+                    psum_str = !this->enabled(i, j) ? "Disabled" :
                         //std::to_string(vmac_units[i][j].get_mac().value);
                         std::format("{}x{}+{}",
                             std::to_string(ala.value),
@@ -143,7 +208,7 @@ class Vpu
                     w_str += "," + std::to_string(ala.value);
                     uint64_t pwidth = psum_str.length();
                     uint64_t bwidth = w_str.length();
-                    uint64_t twidth = std::max(std::max(pwidth, bwidth), 8LLU) + 2;
+                    uint64_t twidth = std::max(std::max(pwidth, bwidth), (uint64_t)8) + 2;
                     std::string ppsum_str = std::vformat("{:^"+std::to_string(twidth)+"}", std::make_format_args(psum_str));
                     std::string mw_str = std::vformat("{:^"+std::to_string(twidth)+"}", std::make_format_args(w_str));
                     top_row += "| " + mw_str + " |" + std::string(ala_str.length()+2, '-');
@@ -3,7 +3,14 @@
 
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <format>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include "Checkpoint.hh"
+#include "SystolicArray.hh"
 #include "WsMac.hh"
 
 /*- Vector Processing Unit -- HSA Dataflow Style *-/
@@ -35,112 +42,173 @@
  * Then results are collected at the end, and they
  * all come in at the same time (hence the benefit
  * over using MMM mode for vect mult)
+ *
+ * VpuHsaDataflow is the dataflow policy of the
+ * SystolicArray (see SystolicArray.hh).
  */
-template <typename mac_t, uint64_t N>
-class VpuHsa
+template <typename mac_t, uint64_t N, uint64_t C, typename pe_t>
+class VpuHsaDataflow : public DataflowBase
 {
-private:
-    uint64_t counter;
-    bool enabled[N][N];
+protected:
+    typedef std::pair<mac_t, mac_t> output_t;
+    static constexpr uint64_t enabled_cols = N;
+
     mac_t top_values[N]; // only used for debug, represent nothing (Cin==0 for top)
     mac_t left_values[N]; // only used for debug, represent broadcast
 
     mac_t acts_sram[N], weights_sram[N][N];
     mac_t init_acts_sram[N], init_weights_sram[N][N];
-    WsMac<mac_t> mac_units[N][N]; 
     mac_t down_latches[N][N];  // for top-down streaming of psums
-       
-public:
-    VpuHsa(mac_t acts_sram_p[N], mac_t weights_sram_p[N][N])
+
+    static std::string checkpoint_tag()
     {
-        for (uint64_t i = 0; i < N; i++)
-            init_acts_sram[i] = acts_sram_p[i];
-        /* Weights needs to be transposed for this dataflow style */
-        for (uint64_t i = 0; i < N; i++)
-            for (uint64_t j = 0; j < N; j++)
-                init_weights_sram[i][j] =  weights_sram_p[j][i];
-        reset();
+        return "vpuhsa";
     }
 
-    void reset()
+    /* One row per cycle */
+    static constexpr uint64_t latency(bool)
+    {
+        return N;
+    }
+
+    /* We operate a row at a time, so in cycle 1, row 1
+     * enabled, cycle 2 row 2 enabled... */
+    static constexpr PeWindow pe_window(uint64_t i, uint64_t, bool)
+    {
+        return {i, i+1};
+    }
+
+    void reset_state(bool)
     {
         for (uint64_t i = 0; i < N; i++)
             acts_sram[i] =  init_acts_sram[i];
         for (uint64_t i = 0; i < N; i++)
             memcpy(weights_sram[i], init_weights_sram[i], N*sizeof(mac_t));  
-        counter = 0;
+        for (uint64_t i = 0; i < N; i++)
+            for (uint64_t j = 0; j < N; j++)
+                down_latches[i][j] = mac_t::ZERO;
         for (uint64_t i = 0; i < N; i++)
             top_values[i] = mac_t::ZERO;
         for (uint64_t j = 0; j < N; j++) 
             left_values[j] = acts_sram[j];
     }
 
-    void clock()
+    /* Rows are all or nothing, the enabled one sets
+     * its left value again */
+    void begin_cycle(auto)
     {
-        std::pair<mac_t, mac_t> outputs[N][N];
         for (uint64_t i = 0; i < N; i++)
-            for (uint64_t j = 0; j < N; j++)
-            {
-                /* We operate a row at a time, so in cycle 1, row 1 enabled
-                 * cycle 2 row 2 enabled... Thus enabled iff counter==i
-                 * */
-                bool enable = counter==i;
-                enabled[i][j] = enable;
-                if (!enable)
-                {
-                    left_values[i] = mac_t::ZERO;
-                    continue;
-                }
-
-                /* The same activation input (a[i])
-                 * should be broadcast to all the
-                 * macs
-                 * */
-                mac_t input_broad_a, input_top_cin;
-                    
-                input_top_cin = i == 0 ? mac_t::ZERO : down_latches[i-1][j];
-                input_broad_a = acts_sram[i];
-
-                /* Weight-stationary */
-                mac_t input_weight =  weights_sram[i][j];
-
-                /* I don't simulate the weight initialisation
-                 * into each PE (which should occur over multiple
-                 * cycles, and ideally be pipelined with the own
-                 * VPU operation - which is way easier in MVM
-                 * mode than MMM)
-                 **/
-                outputs[i][j] = mac_units[i][j].clock(
-                    input_broad_a,
-                    input_weight,
-                    input_top_cin,
-                    enable,
-                    true
-                );
-
-                /* Top values always gets 0, cin starts at 0*/
-                top_values[j] = mac_t::ZERO;
-                left_values[i] = acts_sram[i];  
-            }
-
-        /* Update latch values, after so no weirdness 
-         * Could probably figure out a loop order to
-         * do this above, but this works fine.
-         * Only right to latch if enabled */
+            left_values[i] = mac_t::ZERO;
+    }
+
+    /* Body of clock() for an enabled PE, returns
+     * what it latches */
+    output_t eval_pe(pe_t& pe, auto i, auto j, auto)
+    {
+        /* The same activation input (a[i])
+         * should be broadcast to all the
+         * macs
+         * */
+        mac_t input_broad_a, input_top_cin;
+            
+        input_top_cin = i == 0 ? mac_t::ZERO : down_latches[i-1][j];
+        input_broad_a = acts_sram[i];
+
+        /* Weight-stationary */
+        mac_t input_weight =  weights_sram[i][j];
+
+        /* I don't simulate the weight initialisation
+         * into each PE (which should occur over multiple
+         * cycles, and ideally be pipelined with the own
+         * VPU operation - which is way easier in MVM
+         * mode than MMM)
+         **/
+        std::pair<mac_t, mac_t> out = pe.clock(
+            input_broad_a,
+            input_weight,
+            input_top_cin,
+            true,
+            true
+        );
+
+        /* Top values always gets 0, cin starts at 0*/
+        top_values[j] = mac_t::ZERO;
+        left_values[i] = acts_sram[i];  
+        return out;
+    }
+
+    void latch_pe(auto i, auto j, const output_t& out, auto, uint64_t)
+    {
+        /* Don't need to use first (acts)
+         * as that value of acts is
+         * used all at once
+         **/
+        down_latches[i][j] = out.second;
+        /* Last row => Output generated,
+         * no need for separate structure
+         * as it will be in down_latches */
+    }
+
+    void save_operands(CheckpointWriter& ck) const
+    {
+        ck.put(top_values);
+        ck.put(left_values);
+        ck.put(acts_sram);
+        ck.put(weights_sram);
+        ck.put(init_acts_sram);
+        ck.put(init_weights_sram);
+    }
+
+    void load_operands(CheckpointReader& ck)
+    {
+        ck.get(top_values);
+        ck.get(left_values);
+        ck.get(acts_sram);
+        ck.get(weights_sram);
+        ck.get(init_acts_sram);
+        ck.get(init_weights_sram);
+    }
+
+    void save_latches(CheckpointWriter& ck) const
+    {
+        ck.put(down_latches);
+    }
+
+    void load_latches(CheckpointReader& ck)
+    {
+        ck.get(down_latches);
+    }
+};
+
+template <typename mac_t, uint64_t N>
+class VpuHsa : public SystolicArray<mac_t, N, N, VpuHsaDataflow, WsMac<mac_t>>
+{
+private:
+    typedef SystolicArray<mac_t, N, N, VpuHsaDataflow, WsMac<mac_t>> base_t;
+    using base_t::top_values;
+    using base_t::left_values;
+    using base_t::weights_sram;
+    using base_t::init_acts_sram;
+    using base_t::init_weights_sram;
+    using base_t::down_latches;
+
+public:
+    VpuHsa(mac_t acts_sram_p[N], mac_t weights_sram_p[N][N])
+    {
+        for (uint64_t i = 0; i < N; i++)
+            init_acts_sram[i] = acts_sram_p[i];
+        /* Weights needs to be transposed for this dataflow style */
         for (uint64_t i = 0; i < N; i++)
             for (uint64_t j = 0; j < N; j++)
-                if (enabled[i][j])
-                {
-                    /* Don't need to use first (acts)
-                     * as that value of acts is
-                     * used all at once
-                     **/
-                    down_latches[i][j] = outputs[i][j].second;
-                    /* Last row => Output generated,
-                     * no need for separate structure
-                     * as it will be in down_latches */
-                }
-        counter++;
+                init_weights_sram[i][j] =  weights_sram_p[j][i];
+        this->reset();
+    }
+
+    /* out = weights * acts, only meaningful once ready() */
+    void get_result(mac_t out[N])
+    {
+        for (uint64_t j = 0; j < N; j++)
+            out[j] = down_latches[N-1][j];
     }
 
     std::string to_string()
@@ -155,56 +223,17 @@ public:
          * -----------------------
          * |    pla    ||    pla |
          * ======================= 
-         * Could figure out the prealloc size... but I don't want to.
-         * So I use cpp string (and inefficiently)
          * */
-        std::string top_rows[N], bot_rows[N];
-        std::string toptop_row;
-        uint64_t max_row_width = 0;
-        for (uint64_t i = 0; i < N; i++)
-        {
-            std::string top_row, bot_row;
-            for (uint64_t j = 0; j < N; j++)
-            {
-                mac_t pla;//, ala;
-                pla = down_latches[i][j];
-                // ala = right_latches[i][j];
-                std::string w_str, ala_str, pla_str;
-                /* Quick and dirty */
-                // ala_str = std::to_string(ala.value);
-                ala_str = "";
-                pla_str = std::to_string(pla.value);
-                w_str = !enabled[i][j] ? "Disabled" : "W="+std::to_string(weights_sram[i][j].value);
-                uint64_t wwidth = w_str.length();
-                uint64_t bwidth = pla_str.length();
-                uint64_t twidth = std::max(std::max(wwidth, bwidth), 8LLU) + 2;
-                std::string pw_str = std::vformat("{:^"+std::to_string(twidth)+"}", std::make_format_args(w_str));
-                std::string ppla_str = std::vformat("{:^"+std::to_string(twidth)+"}", std::make_format_args(pla_str));
-                top_row += "| " + pw_str + " | " + ala_str + " ";
-                bot_row += "| " + ppla_str + " |" + std::string(ala_str.length()+2, '-');
-                if (i == 0)
-                {
-                    std::string toptop_str = std::to_string(top_values[j].value) + "↓";
-                    std::string ptoptop_str = std::vformat("{:^"+std::to_string(twidth)+"}", std::make_format_args(toptop_str));
-                    toptop_row += "  " + ptoptop_str + "   " + std::string(ala_str.length(), ' ') + " ";
-                }
-            }
-            top_rows[i] = top_row;
-            bot_rows[i] = bot_row;
-            max_row_width = top_row.length() > max_row_width ? top_row.length() : max_row_width;
-        }
-        std::string ret;
-        uint64_t max_l_width = 0;
-        for (uint64_t i = 0; i < N; i++)
-            max_l_width = std::max(max_l_width, (uint64_t)std::to_string(left_values[i].value).length());
-        max_l_width += 5;
-        std::string lsep = std::string(max_l_width, ' ');
-        std::string sep = lsep+std::string(max_row_width+1, '=');
-        ret += lsep+toptop_row + "\n" + sep + "\n";
-        for (uint64_t i = 0; i < N; i++)
-            ret += " " + std::to_string(left_values[i].value) + " -> " + top_rows[i] + "|\n" + \
-                    lsep + bot_rows[i] + "|\n" + sep + "\n";
-        return ret;
+        return this->grid_string(
+            [&](uint64_t i, uint64_t j) {
+                return PeText{
+                    !this->enabled(i, j) ? "Disabled" : "W="+std::to_string(weights_sram[i][j].value),
+                    "",
+                    std::to_string(down_latches[i][j].value)
+                };
+            },
+            [&](uint64_t j) { return std::to_string(top_values[j].value); },
+            [&](uint64_t i) { return std::to_string(left_values[i].value); });
     }
     //void print_result_values()
     //{
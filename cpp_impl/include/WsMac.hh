@@ -4,6 +4,8 @@
 #include <cstdint>
 #include <utility>
 
+#include "Checkpoint.hh"
+
 /*- WsMac unit -*/
 /*
  * Functionally similar to MAC
@@ -53,5 +55,13 @@ public:
     {
         weight.value = w.value;
     }
+    void save_state(CheckpointWriter& ck) const
+    {
+        ck.put(weight);
+    }
+    void load_state(CheckpointReader& ck)
+    {
+        ck.get(weight);
+    }
 };
 #endif 
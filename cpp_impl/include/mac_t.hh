@@ -2,6 +2,7 @@
 #define __MAC_T_HH__
                   
 #include <cstdint>
+#include <ostream>
 #include <utility>
 
 /*- mac type parent -*/
@@ -14,6 +15,7 @@ template <uint8_t BitWidth>
 struct mac_t_p
 {
     uint64_t value : BitWidth;
+    static constexpr uint8_t BITS = BitWidth;
 
     static inline const mac_t_p<BitWidth> ZERO = {0};
     friend std::ostream& operator<<(std::ostream& os, const mac_t_p<BitWidth>& v)
@@ -0,0 +1,78 @@
+#include <algorithm>
+
+#include "EventKernel.hh"
+
+EventKernel::EventKernel(const std::vector<PeWindow>& windows, uint64_t now)
+    : t(now), windows(windows)
+{
+    uint64_t horizon = now;
+    for (const PeWindow& w : windows)
+        if (w.first < w.last)
+            horizon = std::max(horizon, w.last);
+    uint64_t size = 1;
+    while (size <= horizon - now)
+        size <<= 1;
+    mask = size - 1;
+    wheel.assign(size, {});
+
+    for (uint32_t pe = 0; pe < windows.size(); pe++)
+    {
+        const PeWindow& w = windows[pe];
+        if (w.first >= w.last)
+            continue;
+        if (w.first <= now && now < w.last)
+            active_pes.push_back(pe);
+        if (w.last == now)
+            retired_pes.push_back(pe);
+        if (w.first > now)
+            schedule(w.first, pe);
+        if (w.last > now)
+            schedule(w.last, pe);
+    }
+}
+
+void EventKernel::schedule(uint64_t at, uint32_t pe)
+{
+    wheel[at & mask].push_back(pe);
+    pending++;
+}
+
+void EventKernel::fire(uint64_t at)
+{
+    std::vector<uint32_t>& slot = wheel[at & mask];
+    for (uint32_t pe : slot)
+    {
+        if (windows[pe].first == at)
+            active_pes.insert(std::lower_bound(active_pes.begin(), active_pes.end(), pe), pe);
+        else
+        {
+            active_pes.erase(std::lower_bound(active_pes.begin(), active_pes.end(), pe));
+            retired_pes.push_back(pe);
+        }
+    }
+    pending -= slot.size();
+    slot.clear();
+    std::sort(retired_pes.begin(), retired_pes.end());
+}
+
+uint64_t EventKernel::next_event() const
+{
+    if (!pending)
+        return ~0ULL;
+    for (uint64_t at = t + 1; ; at++)
+        if (!wheel[at & mask].empty())
+            return at;
+}
+
+void EventKernel::advance(uint64_t to)
+{
+    retired_pes.clear();
+    /* Callers never jump over a cycle with events (see
+     * next_event()), so only to's retirements are kept */
+    for (uint64_t at = t + 1; pending && at <= to; at++)
+    {
+        retired_pes.clear();
+        fire(at);
+    }
+    t = to;
+}
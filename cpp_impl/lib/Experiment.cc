@@ -0,0 +1,237 @@
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+#include "Experiment.hh"
+#include "Npy.hh"
+
+namespace
+{
+
+std::string substitute_name(std::string path, const std::string& name)
+{
+    for (uint64_t p = path.find("{name}"); p != std::string::npos; p = path.find("{name}"))
+        path.replace(p, 6, name);
+    return path;
+}
+
+/* Operands given as data have to be exactly rows x cols */
+void check_shape(const std::string& what, uint64_t got_rows, uint64_t got_cols,
+                 uint64_t rows, uint64_t cols)
+{
+    if (got_rows != rows || got_cols != cols)
+        throw std::runtime_error(std::format("{}: expected {}x{}, got {}x{}",
+                    what, rows, cols, got_rows, got_cols));
+}
+
+Matrix<wide_t> load_operand(const Json& spec, uint64_t rows, uint64_t cols, std::mt19937_64& rng)
+{
+    Matrix<wide_t> ret(rows, cols);
+    if (spec.is_array())
+    {
+        /* [[...], ...] is a matrix, [...] a column vector */
+        bool nested = !spec.arr.empty() && spec.arr[0].is_array();
+        check_shape(spec.key, spec.arr.size(), nested ? spec.arr[0].arr.size() : 1, rows, cols);
+        for (uint64_t i = 0; i < rows; i++)
+        {
+            if (nested)
+                check_shape(std::format("{}[{}]", spec.key, i), 1,
+                            spec.arr[i].is_array() ? spec.arr[i].arr.size() : 0, 1, cols);
+            for (uint64_t j = 0; j < cols; j++)
+            {
+                const Json& v = nested ? spec.arr[i].arr[j] : spec.arr[i];
+                ret.at(i, j).value = (uint64_t)(int64_t)v.as_number();
+            }
+        }
+        return ret;
+    }
+
+    std::string s = spec.as_string("random");
+    if (s == "random")
+        for (wide_t& v : ret.data)
+            v.value = rng();
+    else if (s == "ones")
+        for (wide_t& v : ret.data)
+            v.value = 1;
+    else if (s == "zeros")
+        ;
+    else
+    {
+        /* 1-d arrays are column vectors, same as inline */
+        NpyArray arr = load_npy(s);
+        if (arr.shape.size() == 1)
+            arr.shape.push_back(1);
+        ret = to_matrix<wide_t>(arr);
+        check_shape(spec.key + " (" + s + ")", ret.rows, ret.cols, rows, cols);
+    }
+    return ret;
+}
+
+/* Result as rows of space separated values */
+std::string result_string(const Matrix<wide_t>& m, const char *row_sep)
+{
+    std::string ret;
+    for (uint64_t i = 0; i < m.rows; i++)
+    {
+        for (uint64_t j = 0; j < m.cols; j++)
+            ret += (j ? " " : "") + std::to_string(m.at(i, j).value);
+        if (i + 1 < m.rows) ret += row_sep;
+    }
+    return ret;
+}
+
+void write_csv(const std::string& path, const ExperimentConfig& cfg, bool mvm, const UnitResult& res)
+{
+    bool fresh = path == "-" || !std::filesystem::exists(path) || std::filesystem::file_size(path) == 0;
+    std::ofstream file;
+    if (path != "-")
+    {
+        file.open(path, std::ios::app);
+        if (!file)
+            throw std::runtime_error("experiment: unable to open " + path);
+    }
+    std::ostream& out = path == "-" ? std::cout : file;
+    if (fresh)
+        out << "name,unit,n,bits,mode,cycles,latency,ready,result" << std::endl;
+    out << std::format("{},{},{},{},{},{},{},{},{}", cfg.name, cfg.unit, cfg.n, cfg.bits,
+            mvm ? "mvm" : "mmm", res.cycles, res.latency, res.ready ? 1 : 0,
+            result_string(res.result, ";")) << std::endl;
+}
+
+}
+
+ExperimentConfig parse_experiment(const Json& j, const ExperimentConfig& base)
+{
+    ExperimentConfig cfg = base;
+    if (!j.is_object()) return cfg;
+    if (j.has("name"))    cfg.name = j["name"].as_string();
+    if (j.has("unit"))    cfg.unit = j["unit"].as_string();
+    if (j.has("n"))       cfg.n = j["n"].as_uint();
+    if (j.has("cols"))    cfg.cols = j["cols"].as_uint();
+    if (j.has("bits"))    cfg.bits = j["bits"].as_uint();
+    if (j.has("mode"))    cfg.mode = j["mode"].as_string();
+    if (j.has("acts"))    cfg.acts = j["acts"];
+    if (j.has("weights")) cfg.weights = j["weights"];
+    if (j.has("cycles"))  cfg.cycles = j["cycles"].as_uint();
+    if (j.has("seed"))    cfg.seed = j["seed"].as_uint();
+    if (j.has("restore")) cfg.restore = j["restore"].as_string();
+    if (j.has("checkpoint"))    cfg.checkpoint = j["checkpoint"].as_string();
+    if (j.has("checkpoint_at")) cfg.checkpoint_at = j["checkpoint_at"].as_uint();
+    if (j.has("memory"))  cfg.memory = parse_memory_config(j["memory"]);
+    if (j.has("kernel"))  cfg.kernel = j["kernel"].as_string();
+    if (j.has("outputs"))
+    {
+        cfg.outputs.clear();
+        if (j["outputs"].is_array())
+            for (const Json& o : j["outputs"].arr)
+                cfg.outputs.push_back(o.as_string());
+        else
+            cfg.outputs.push_back(j["outputs"].as_string());
+    }
+    return cfg;
+}
+
+std::vector<ExperimentConfig> load_experiments(const Json& config, const Json& overrides)
+{
+    ExperimentConfig defaults;
+    defaults.outputs.push_back("stdout");
+    defaults = parse_experiment(config["defaults"], defaults);
+
+    std::vector<ExperimentConfig> ret;
+    if (config.has("experiments"))
+        for (const Json& e : config["experiments"].arr)
+            ret.push_back(parse_experiment(overrides, parse_experiment(e, defaults)));
+    else
+        ret.push_back(parse_experiment(overrides, parse_experiment(config, defaults)));
+
+    for (uint64_t i = 0; i < ret.size(); i++)
+        if (ret[i].name.empty())
+            ret[i].name = std::format("{}_n{}_b{}_{}", ret[i].unit, ret[i].n, ret[i].bits, i);
+    return ret;
+}
+
+UnitRun make_run(const ExperimentConfig& cfg)
+{
+    if (cfg.mode != "mmm" && cfg.mode != "mvm")
+        throw std::runtime_error("experiment " + cfg.name + ": mode must be mmm or mvm");
+    if (cfg.kernel != "cycle" && cfg.kernel != "event")
+        throw std::runtime_error("experiment " + cfg.name + ": kernel must be cycle or event");
+    UnitRun run;
+    run.unit = cfg.unit;
+    run.MVM_enable = cfg.mode == "mvm";
+    run.cycles = cfg.cycles;
+    run.restore_path = substitute_name(cfg.restore, cfg.name);
+    run.checkpoint_path = substitute_name(cfg.checkpoint, cfg.name);
+    run.checkpoint_at = cfg.checkpoint_at;
+    run.memory = cfg.memory;
+    run.event_driven = cfg.kernel == "event";
+    bool mvm = unit_is_MVM(cfg.unit, run.MVM_enable);
+    uint64_t cols = cfg.cols ? cfg.cols : cfg.n;
+    std::mt19937_64 rng(cfg.seed);
+    run.acts = load_operand(cfg.acts, cols, mvm ? 1 : cfg.n, rng);
+    run.weights = load_operand(cfg.weights, cfg.n, cols, rng);
+    return run;
+}
+
+UnitResult run_experiment(const ExperimentConfig& cfg)
+{
+    uint64_t cols = cfg.cols ? cfg.cols : cfg.n;
+    unit_fn fn = find_unit(cfg.unit, cfg.n, cols, cfg.bits);
+    if (!fn)
+        throw std::runtime_error(std::format("experiment {}: no {} with n={} cols={} bits={} "
+                    "(see --list)", cfg.name, cfg.unit, cfg.n, cols, cfg.bits));
+
+    UnitRun run = make_run(cfg);
+    bool mvm = unit_is_MVM(cfg.unit, run.MVM_enable);
+
+    /* Trace has to be hooked up before running, rest after */
+    std::unique_ptr<std::ofstream> trace_file;
+    for (const std::string& o : cfg.outputs)
+        if (o.rfind("trace:", 0) == 0)
+        {
+            std::string path = substitute_name(o.substr(6), cfg.name);
+            if (path == "-")
+                run.trace = &std::cout;
+            else
+            {
+                trace_file = std::make_unique<std::ofstream>(path);
+                if (!*trace_file)
+                    throw std::runtime_error("experiment: unable to open " + path);
+                run.trace = trace_file.get();
+            }
+        }
+
+    UnitResult res = fn(run);
+
+    for (const std::string& o : cfg.outputs)
+    {
+        uint64_t colon = o.find(':');
+        std::string kind = o.substr(0, colon);
+        std::string path = colon == std::string::npos ? "-" : substitute_name(o.substr(colon + 1), cfg.name);
+        if (kind == "stdout")
+        {
+            std::cout << std::format("{}: {} {}x{} {}b {} -> {} cycles ({})", cfg.name, cfg.unit,
+                    cfg.n, cols, cfg.bits, mvm ? "mvm" : "mmm", res.cycles,
+                    res.ready ? "ready" : "not ready") << std::endl;
+            if (cfg.memory)
+                std::cout << std::format("  memory {}: {} stall cycles ({} backing, {} bank), "
+                        "{} words, {} reads, fill {} cycles, {} bound", memory_label(*cfg.memory),
+                        res.stall_cycles, res.memory.backing_stalls, res.memory.bank_stalls,
+                        res.memory.words, res.memory.reads, res.memory.fill_cycles,
+                        res.memory.bound) << std::endl;
+            std::cout << result_string(res.result, "\n") << std::endl;
+        }
+        else if (kind == "csv")
+            write_csv(path, cfg, mvm, res);
+        else if (kind == "npy")
+            save_npy(path, res.result);
+        else if (kind != "trace")
+            throw std::runtime_error("experiment " + cfg.name + ": unknown output " + o);
+    }
+    return res;
+}
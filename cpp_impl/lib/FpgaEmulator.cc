@@ -0,0 +1,391 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "FpgaEmulator.hh"
+#include "BulkFrame.hh"
+
+FpgaEmulator::FpgaEmulator(const EmulatorConfig& cfg_p)
+    : cfg(cfg_p), master(-1), slave(-1)
+{
+    if (cfg.unit != "hsa" && cfg.unit != "spvpu")
+        throw std::runtime_error("fpga_emu: unit must be hsa or spvpu");
+    if (cfg.unit == "spvpu")
+        cfg.vector_mode = true;
+    fn = find_unit(cfg.unit, cfg.n, 16);
+    if (!fn)
+        throw std::runtime_error(std::format("fpga_emu: no {} with n={} (see main --list)", cfg.unit, cfg.n));
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+        throw std::runtime_error(std::string("fpga_emu: unable to open a pty: ") + strerror(errno));
+    slave_name = ptsname(master);
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+    /* Raw line discipline, and keep a slave fd open so the
+     * master doesn't see a hangup between host sessions */
+    slave = open(slave_name.c_str(), O_RDWR | O_NOCTTY);
+    termios tio;
+    if (slave < 0 || tcgetattr(slave, &tio) != 0)
+        throw std::runtime_error("fpga_emu: unable to open " + slave_name);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+
+    rx_due = tx_due = next_word = steady::now();
+    operating_mode = 0;
+    internal_reset();
+}
+
+FpgaEmulator::~FpgaEmulator()
+{
+    if (slave >= 0) close(slave);
+    if (master >= 0) close(master);
+}
+
+double FpgaEmulator::byte_time() const
+{
+    return 11.0 / (double)cfg.baudrate;
+}
+
+/* sys_reset || internal_reset, opmode is left to the caller */
+void FpgaEmulator::internal_reset()
+{
+    rx_frame = 0;
+    rx_bytes = 0;
+    drop_byte = false;
+    drop_after = false;
+    misal_fsm = false;
+    got_magic = false;
+    send_aligner = true;
+    uint64_t n = cfg.n;
+    weights_sram = Matrix<wide_t>(n, n);
+    acts_sram = Matrix<wide_t>(n, cfg.vector_mode ? 1 : n);
+    weights_filled.assign(n*n, false);
+    acts_filled.assign(acts_sram.data.size(), false);
+    result_ix = 0;
+    bulk_mode = false;
+    bulk_results = false;
+    bulk_rx.clear();
+}
+
+/* SerialReceiver */
+void FpgaEmulator::on_byte(uint8_t b)
+{
+    if (drop_after)
+    {
+        drop_after = false;
+        rx_bytes = 0;
+        on_frame(rx_frame);
+        return;
+    }
+    rx_frame = (rx_frame & ~(0xffu << (8*rx_bytes))) | (uint32_t)b << (8*rx_bytes);
+    if (++rx_bytes == 4)
+    {
+        if (drop_byte)
+            drop_after = true;
+        else
+        {
+            rx_bytes = 0;
+            on_frame(rx_frame);
+        }
+    }
+}
+
+void FpgaEmulator::on_frame(uint32_t frame)
+{
+    frames_in++;
+    if (operating_mode == 1 && bulk_mode && !bulk_rx.empty())
+    {
+        on_bulk_word(frame);
+        return;
+    }
+    if (frame == 0xFFFFFFFF || (cfg.unit == "hsa" && (frame == 0xFEFEFEFE || frame == 0xFDFDFDFD)))
+    {
+        if (frame != 0xFFFFFFFF)
+            cfg.vector_mode = frame == 0xFDFDFDFD;
+        if (cfg.verbose)
+            std::cerr << std::format("fpga_emu: {}\n", frame == 0xFFFFFFFF ? "reset" :
+                    cfg.vector_mode ? "switched to MVM" : "switched to MMM");
+        operating_mode = 0;
+        internal_reset();
+        return;
+    }
+
+    switch (operating_mode)
+    {
+    case 0:
+        if (!misal_fsm)
+        {
+            /* Keep dropping a byte a frame until the
+             * frame needing that one last drop shows up */
+            if (frame == 0xADBEEFDE)
+            {
+                drop_byte = false;
+                misal_fsm = true;
+            }
+            else
+                drop_byte = true;
+        }
+        else if (frame == 0xDEADBEEF)
+        {
+            send_word(0x0C0C0C0C);
+            operating_mode = 1;
+            got_magic = false;
+        }
+        else
+            misal_fsm = false;
+        break;
+
+    case 1:
+        if (bulk_mode)
+            on_bulk_word(frame);
+        else if (!got_magic && cfg.bulk && frame == BULK_HELLO)
+        {
+            send_word(BULK_ACK);
+            bulk_mode = true;
+        }
+        else if (!got_magic)
+            got_magic = frame == 0xDA221D06;
+        else if (!(frame >> 31))
+        {
+            uint64_t x = (frame >> 23) & 0x7f, y = (frame >> 16) & 0x7f;
+            bool weight = (frame >> 30) & 1;
+            Matrix<wide_t>& sram = weight ? weights_sram : acts_sram;
+            std::vector<bool>& filled = weight ? weights_filled : acts_filled;
+            /* acts: for now vector, so row = y */
+            if (!weight && cfg.vector_mode) x = 0;
+            if (y < sram.rows && x < sram.cols)
+            {
+                sram.at(y, x).value = frame & 0xffff;
+                filled[y*sram.cols + x] = true;
+            }
+            if (std::all_of(weights_filled.begin(), weights_filled.end(), [](bool f) { return f; }) &&
+                std::all_of(acts_filled.begin(), acts_filled.end(), [](bool f) { return f; }))
+            {
+                send_word(0x1C1C1C1C);
+                operating_mode = 2;
+                compute();
+            }
+        }
+        break;
+
+    case 3:
+        /* Acks are 4x the same byte, alignment doesn't matter */
+        if (frame == 0x0C0C0C0C)
+            send_aligner = false;
+        else if (frame == 0x1C1C1C1C)
+        {
+            if (cfg.verbose)
+                std::cerr << std::format("fpga_emu: request {} done\n", requests);
+            operating_mode = 0;
+            internal_reset();
+        }
+        break;
+    }
+}
+
+/* Frames were assembled little endian, so the bytes come
+ * back out in wire order */
+void FpgaEmulator::on_bulk_word(uint32_t frame)
+{
+    /* Words before the start of a frame are leftovers */
+    if (bulk_rx.empty() && (frame & 0xff) != BULK_START)
+        return;
+    for (int i = 0; i < 4; i++)
+        bulk_rx.push_back((uint8_t)(frame >> (8*i)));
+
+    BulkHeader h;
+    uint64_t used;
+    BulkStatus st = bulk_decode(bulk_rx.data(), bulk_rx.size(), h, elems, used);
+    if (st == BULK_SHORT)
+        return;
+    bulk_rx.clear();
+    if (st == BULK_BAD || h.kind != BULK_REQUEST || h.n != cfg.n ||
+            h.cols != (cfg.vector_mode ? 1 : cfg.n))
+    {
+        if (cfg.verbose)
+            std::cerr << "fpga_emu: bad bulk frame, NAK\n";
+        send_word(BULK_NAK);
+        return;
+    }
+
+    uint64_t nw = h.n*h.n;
+    for (uint64_t i = 0; i < nw; i++)
+        weights_sram.data[i].value = elems[i] & 0xffff;
+    for (uint64_t i = 0; i < acts_sram.data.size(); i++)
+        acts_sram.data[i].value = elems[nw + i] & 0xffff;
+    tile_id = h.tile_id;
+    send_word(0x1C1C1C1C);
+    operating_mode = 2;
+    compute();
+}
+
+void FpgaEmulator::compute()
+{
+    UnitRun run;
+    run.unit = cfg.unit;
+    run.MVM_enable = cfg.vector_mode;
+    if (cfg.vector_mode)
+    {
+        run.acts = acts_sram;
+        run.weights = weights_sram;
+        result = fn(run).result;
+    }
+    else
+    {
+        /* unit does A * W, we want W * A^T = (A * W^T)^T */
+        run.acts = acts_sram;
+        run.weights = weights_sram.transposed();
+        result = fn(run).result.transposed();
+    }
+    for (wide_t& v : result.data)
+        v.value &= 0xffff;
+    bulk_results = bulk_mode && bulk_result_pays(result.rows, result.cols);
+    if (bulk_results)
+    {
+        BulkHeader h;
+        h.kind = BULK_RESULT;
+        h.vector_mode = cfg.vector_mode;
+        h.n = result.rows;
+        h.cols = result.cols;
+        h.tile_id = tile_id;
+        h.codec = cfg.compress ? BULK_RLE_VALUES : 0;
+        elems.resize(result.data.size());
+        for (uint64_t i = 0; i < elems.size(); i++)
+            elems[i] = result.data[i].value;
+        bulk_tx.resize(bulk_frame_bytes(h));
+        bulk_tx.resize(bulk_encode(h, elems.data(), bulk_tx.data()));
+    }
+
+    requests++;
+    operating_mode = 3;
+    next_word = steady::now() + std::chrono::duration_cast<steady::duration>(
+            std::chrono::duration<double>((double)cfg.word_ticks / cfg.clk_uart));
+    if (cfg.verbose)
+        std::cerr << std::format("fpga_emu: request {} computed ({} {}x{})\n", requests,
+                cfg.unit, cfg.n, cfg.vector_mode ? 1 : cfg.n);
+}
+
+/* SerialTransmitter shifts the frame out MSB first */
+void FpgaEmulator::send_word(uint32_t word)
+{
+    for (int i = 3; i >= 0; i--)
+        tx_queue.push_back((uint8_t)(word >> (8*i)));
+    frames_out++;
+}
+
+/* opmode 11, one frame per transmission counter period */
+void FpgaEmulator::transmit(steady::time_point now)
+{
+    if (operating_mode != 3) return;
+    steady::duration period = std::chrono::duration_cast<steady::duration>(
+            std::chrono::duration<double>((double)cfg.word_ticks / cfg.clk_uart));
+    /* Periods we slept through aren't made up in a burst */
+    next_word = std::max(next_word, now - period);
+    while (now >= next_word)
+    {
+        if (send_aligner)
+            send_word(0xDEADBEEF);
+        else if (bulk_results)
+        {
+            /* The whole frame per period, once the last copy is out */
+            if (!tx_queue.empty())
+            {
+                next_word = std::max(next_word, tx_due + std::chrono::duration_cast<steady::duration>(
+                        std::chrono::duration<double>(tx_queue.size()*byte_time())));
+                break;
+            }
+            tx_queue.insert(tx_queue.end(), bulk_tx.begin(), bulk_tx.end());
+            frames_out++;
+        }
+        else
+        {
+            uint64_t y = result_ix / result.cols, x = result_ix % result.cols;
+            send_word((uint32_t)(x & 0x7f) << 23 | (uint32_t)(y & 0x7f) << 16 |
+                    (uint32_t)result.at(y, x).value);
+            result_ix = (result_ix + 1) % result.data.size();
+        }
+        next_word += period;
+    }
+}
+
+void FpgaEmulator::step(double timeout_s)
+{
+    steady::time_point now = steady::now();
+    steady::duration bt = std::chrono::duration_cast<steady::duration>(std::chrono::duration<double>(byte_time()));
+
+    /* Sleep until the next thing due, at most timeout_s */
+    steady::time_point wake = now + std::chrono::duration_cast<steady::duration>(
+            std::chrono::duration<double>(timeout_s));
+    if (operating_mode == 3)
+        wake = std::min(wake, next_word);
+    if (cfg.throttle)
+    {
+        if (!rx_queue.empty()) wake = std::min(wake, rx_due);
+        if (!tx_queue.empty()) wake = std::min(wake, tx_due);
+    }
+    else if (!rx_queue.empty())
+        wake = now;
+    int wait_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count();
+    pollfd p = {master, (short)(POLLIN | (tx_queue.empty() ? 0 : POLLOUT)), 0};
+    poll(&p, 1, std::max(wait_ms, 0));
+    now = steady::now();
+
+    if (p.revents & POLLIN)
+    {
+        uint8_t buf[4096];
+        ssize_t n;
+        while ((n = read(master, buf, sizeof(buf))) > 0)
+        {
+            if (rx_queue.empty())
+                rx_due = std::max(rx_due, now + bt);
+            rx_queue.insert(rx_queue.end(), buf, buf + n);
+        }
+    }
+
+    /* A throttled byte is only seen once it would have
+     * made it down the wire */
+    while (!rx_queue.empty() && (!cfg.throttle || now >= rx_due))
+    {
+        uint8_t b = rx_queue.front();
+        rx_queue.pop_front();
+        on_byte(b);
+        rx_due += bt;
+    }
+
+    transmit(now);
+
+    if (!tx_queue.empty())
+    {
+        uint64_t n = tx_queue.size();
+        if (cfg.throttle)
+        {
+            tx_due = std::max(tx_due, now - bt);
+            n = now < tx_due ? 0 : std::min<uint64_t>(n, (now - tx_due) / bt + 1);
+        }
+        uint8_t buf[4096];
+        n = std::min<uint64_t>(n, sizeof(buf));
+        std::copy(tx_queue.begin(), tx_queue.begin() + n, buf);
+        ssize_t w = n ? write(master, buf, n) : 0;
+        if (w > 0)
+        {
+            tx_queue.erase(tx_queue.begin(), tx_queue.begin() + w);
+            tx_due += w * bt;
+        }
+    }
+}
+
+void FpgaEmulator::serve(const volatile std::sig_atomic_t *stop)
+{
+    while (!stop || !*stop)
+        step(0.1);
+}
@@ -0,0 +1,304 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+#include "Fuzz.hh"
+
+namespace
+{
+
+struct FuzzTarget
+{
+    bool MVM_enable;
+    uint64_t n, bits;
+    std::vector<std::string> units;
+    std::vector<unit_fn> fns;
+};
+
+const char *const patterns[] = {"random", "random", "zeros", "ones", "max", "small", "sparse", "onehot"};
+
+uint64_t bit_mask(uint64_t bits)
+{
+    return bits >= 64 ? ~0ULL : (1ULL << bits) - 1;
+}
+
+std::vector<FuzzTarget> fuzz_targets(const FuzzConfig& cfg)
+{
+    std::vector<FuzzTarget> ret;
+    for (const std::string& mode : cfg.modes)
+        for (uint64_t n : cfg.n)
+            for (uint64_t bits : cfg.bits)
+            {
+                FuzzTarget t = {mode == "mvm", n, bits, {}, {}};
+                for (const std::string& unit : cfg.units)
+                {
+                    unit_fn fn = find_unit(unit, n, bits);
+                    /* fixed mode units only in their own mode */
+                    if (!fn || unit_is_MVM(unit, t.MVM_enable) != t.MVM_enable) continue;
+                    t.units.push_back(unit);
+                    t.fns.push_back(fn);
+                }
+                if (!t.units.empty())
+                    ret.push_back(t);
+            }
+    return ret;
+}
+
+void fill(Matrix<wide_t>& m, const std::string& pattern, uint64_t mask, std::mt19937_64& rng)
+{
+    for (wide_t& v : m.data)
+    {
+        if (pattern == "random")        v.value = rng() & mask;
+        else if (pattern == "ones")     v.value = 1;
+        else if (pattern == "max")      v.value = mask;
+        else if (pattern == "small")    v.value = rng() & 3;
+        else if (pattern == "sparse")   v.value = rng() % 8 ? 0 : rng() & mask;
+        else                            v.value = 0;
+    }
+    if (pattern == "onehot")
+        m.data[rng() % m.data.size()].value = mask;
+}
+
+FuzzCase make_case(const std::vector<FuzzTarget>& targets, uint64_t seed, uint64_t id)
+{
+    const FuzzTarget& t = targets[id % targets.size()];
+    std::mt19937_64 rng(seed ^ (id * 0x9e3779b97f4a7c15ULL));
+    FuzzCase c;
+    c.id = id;
+    c.MVM_enable = t.MVM_enable;
+    c.n = t.n;
+    c.bits = t.bits;
+    c.acts_pattern = patterns[rng() % std::size(patterns)];
+    c.weights_pattern = patterns[rng() % std::size(patterns)];
+    c.acts = Matrix<wide_t>(t.n, t.MVM_enable ? 1 : t.n);
+    c.weights = Matrix<wide_t>(t.n, t.n);
+    fill(c.acts, c.acts_pattern, bit_mask(t.bits), rng);
+    fill(c.weights, c.weights_pattern, bit_mask(t.bits), rng);
+    return c;
+}
+
+bool check_with(unit_fn fn, const FuzzCase& c, const std::string& unit, const Matrix<wide_t>& expected,
+        Matrix<wide_t>& got)
+{
+    UnitRun run;
+    run.unit = unit;
+    run.MVM_enable = c.MVM_enable;
+    run.acts = c.acts;
+    run.weights = c.weights;
+    UnitResult res = fn(run);
+    run.event_driven = true;
+    UnitResult event = fn(run);
+    got = std::move(res.result);
+    if (event.result != got || event.cycles != res.cycles)
+    {
+        got = std::move(event.result);
+        return false;
+    }
+    return res.ready && got == expected;
+}
+
+bool fails(const FuzzCase& c, const std::string& unit)
+{
+    Matrix<wide_t> got;
+    return !fuzz_check(c, unit, fuzz_reference(c), got);
+}
+
+FuzzCase truncated(const FuzzCase& c, uint64_t n)
+{
+    FuzzCase ret = c;
+    ret.n = n;
+    ret.acts = Matrix<wide_t>(n, c.MVM_enable ? 1 : n);
+    ret.weights = Matrix<wide_t>(n, n);
+    for (uint64_t i = 0; i < n; i++)
+        for (uint64_t j = 0; j < n; j++)
+        {
+            ret.weights.at(i, j) = c.weights.at(i, j);
+            if (j < ret.acts.cols)
+                ret.acts.at(i, j) = c.acts.at(i, j);
+        }
+    return ret;
+}
+
+std::string inline_matrix(const Matrix<wide_t>& m)
+{
+    /* Experiment.hh operand syntax, [...] being a column vector */
+    std::string ret = "[";
+    for (uint64_t i = 0; i < m.rows; i++)
+    {
+        if (i) ret += ",";
+        if (m.cols == 1)
+        {
+            ret += std::to_string(m.at(i, 0).value);
+            continue;
+        }
+        ret += "[";
+        for (uint64_t j = 0; j < m.cols; j++)
+            ret += (j ? "," : "") + std::to_string(m.at(i, j).value);
+        ret += "]";
+    }
+    return ret + "]";
+}
+
+}
+
+FuzzCase make_fuzz_case(const FuzzConfig& cfg, uint64_t id)
+{
+    std::vector<FuzzTarget> targets = fuzz_targets(cfg);
+    if (targets.empty())
+        throw std::runtime_error("fuzz: no pre-instantiated unit matches the config");
+    return make_case(targets, cfg.seed, id);
+}
+
+Matrix<wide_t> fuzz_reference(const FuzzCase& c)
+{
+    Matrix<wide_t> ret = c.MVM_enable ? reference_matmul(c.weights, c.acts)
+                                      : reference_matmul(c.acts, c.weights);
+    uint64_t mask = bit_mask(c.bits);
+    for (wide_t& v : ret.data)
+        v.value &= mask;
+    return ret;
+}
+
+bool fuzz_check(const FuzzCase& c, const std::string& unit, const Matrix<wide_t>& expected, Matrix<wide_t>& got)
+{
+    unit_fn fn = find_unit(unit, c.n, c.bits);
+    if (!fn)
+        throw std::runtime_error("fuzz: " + unit + " n=" + std::to_string(c.n) + " bits="
+                + std::to_string(c.bits) + " is not pre-instantiated");
+    return check_with(fn, c, unit, expected, got);
+}
+
+FuzzCase shrink_fuzz_case(const FuzzCase& c, const std::string& unit, uint64_t& steps)
+{
+    FuzzCase cur = c;
+    steps = 0;
+
+    std::vector<uint64_t> sizes;
+    for (const UnitKey& k : available_units())
+        if (k.unit == unit && k.bits == c.bits && k.C == k.N && k.N < c.n)
+            sizes.push_back(k.N);
+    std::sort(sizes.begin(), sizes.end());
+    for (uint64_t n : sizes)
+    {
+        FuzzCase t = truncated(cur, n);
+        if (fails(t, unit))
+        {
+            cur = t;
+            steps++;
+            break;
+        }
+    }
+
+    bool progress = true;
+    while (progress)
+    {
+        progress = false;
+        for (Matrix<wide_t> *m : {&cur.acts, &cur.weights})
+            for (wide_t& v : m->data)
+            {
+                uint64_t orig = v.value;
+                uint64_t cands[] = {0, 1, orig / 2};
+                for (uint64_t cand : cands)
+                {
+                    if (cand >= orig) continue;
+                    v.value = cand;
+                    if (fails(cur, unit))
+                    {
+                        progress = true;
+                        steps++;
+                        break;
+                    }
+                    v.value = orig;
+                }
+            }
+    }
+    return cur;
+}
+
+FuzzReport run_fuzz(const FuzzConfig& cfg)
+{
+    std::vector<FuzzTarget> targets = fuzz_targets(cfg);
+    if (targets.empty())
+        throw std::runtime_error("fuzz: no pre-instantiated unit matches the config");
+
+    FuzzReport report;
+    uint64_t threads = cfg.threads ? cfg.threads : std::max(1u, std::thread::hardware_concurrency());
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(cfg.seconds));
+
+    /* Cases are handed out in batches so the counter isn't
+     * contended, and the clock is only read per batch */
+    const uint64_t BATCH = 256;
+    std::atomic<uint64_t> next(0), cases(0), unit_runs(0);
+    std::atomic<bool> stop(false);
+    std::mutex lock;
+    auto worker = [&]()
+    {
+        Matrix<wide_t> got;
+        uint64_t my_cases = 0, my_runs = 0;
+        while (!stop.load(std::memory_order_relaxed))
+        {
+            uint64_t first = next.fetch_add(BATCH);
+            if (first >= cfg.cases) break;
+            if (cfg.seconds > 0 && std::chrono::steady_clock::now() >= deadline) break;
+            uint64_t last = std::min(first + BATCH, cfg.cases);
+            for (uint64_t id = first; id < last && !stop.load(std::memory_order_relaxed); id++)
+            {
+                const FuzzTarget& t = targets[id % targets.size()];
+                FuzzCase c = make_case(targets, cfg.seed, id);
+                Matrix<wide_t> expected = fuzz_reference(c);
+                my_cases++;
+                for (uint64_t u = 0; u < t.units.size(); u++)
+                {
+                    my_runs++;
+                    if (check_with(t.fns[u], c, t.units[u], expected, got))
+                        continue;
+                    std::lock_guard<std::mutex> guard(lock);
+                    if (report.failures.size() >= cfg.max_failures)
+                        break;
+                    FuzzFailure f;
+                    f.unit = t.units[u];
+                    f.original = c;
+                    report.failures.push_back(std::move(f));
+                    if (report.failures.size() >= cfg.max_failures)
+                        stop = true;
+                    break;
+                }
+            }
+        }
+        cases += my_cases;
+        unit_runs += my_runs;
+    };
+    std::vector<std::thread> pool;
+    for (uint64_t t = 0; t < threads; t++)
+        pool.emplace_back(worker);
+    for (std::thread& t : pool)
+        t.join();
+    report.cases = cases;
+    report.unit_runs = unit_runs;
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    /* Threads race, lowest ids first keeps reports stable */
+    std::sort(report.failures.begin(), report.failures.end(), [](const FuzzFailure& a, const FuzzFailure& b) {
+        return a.original.id < b.original.id;
+    });
+    for (FuzzFailure& f : report.failures)
+    {
+        f.shrunk = cfg.shrink ? shrink_fuzz_case(f.original, f.unit, f.shrink_steps) : f.original;
+        f.expected = fuzz_reference(f.shrunk);
+        fuzz_check(f.shrunk, f.unit, f.expected, f.got);
+    }
+    return report;
+}
+
+std::string fuzz_repro(const FuzzCase& c, const std::string& unit)
+{
+    return "main --unit " + unit + " --n " + std::to_string(c.n) + " --bits " + std::to_string(c.bits)
+         + " --mode " + (c.MVM_enable ? "mvm" : "mmm") + " --acts '" + inline_matrix(c.acts)
+         + "' --weights '" + inline_matrix(c.weights) + "' --out stdout";
+}
@@ -0,0 +1,479 @@
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <deque>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <vector>
+
+#include "BulkFrame.hh"
+#include "LinkModel.hh"
+#include "UartHost.hh"
+#include "UnitRunner.hh"
+
+namespace
+{
+
+/* Receiver aligned from the start: DEADBEEF turns on
+ * drop_byte, 5 bytes a frame then get to ADBEEFDE on the
+ * 5th frame, and the 7th word is a clean DEADBEEF */
+constexpr uint64_t ALIGN_WORDS = 7;
+
+struct Shape
+{
+    uint64_t cols;
+    uint64_t results;
+    uint64_t payload;       // host -> board, after the 1st ack
+    uint64_t result_bytes;  // one copy of the results
+    bool bulk_results;      // results as one bulk frame, not dataframes
+    double byte_time;
+    double word_period;
+};
+
+Shape link_shape(const LinkConfig& cfg, const LinkRequest& req)
+{
+    Shape s;
+    bool mvm = unit_is_MVM(req.unit, req.vector_mode);
+    s.cols = mvm ? 1 : req.n;
+    s.results = req.n * s.cols;
+    if (cfg.bulk)
+    {
+        BulkHeader h;
+        h.kind = BULK_REQUEST;
+        h.vector_mode = mvm;
+        h.n = req.n;
+        h.cols = s.cols;
+        s.payload = bulk_frame_bytes(h);
+        h.kind = BULK_RESULT;
+        s.bulk_results = bulk_result_pays(req.n, s.cols);
+        s.result_bytes = s.bulk_results ? bulk_frame_bytes(h) : 4 * s.results;
+    }
+    else
+    {
+        s.payload = 4 + 4 * (req.n * req.n + req.n * s.cols);
+        s.bulk_results = false;
+        s.result_bytes = 4 * s.results;
+    }
+    s.byte_time = (double)cfg.bits_per_byte / (double)cfg.baudrate;
+    s.word_period = (double)cfg.word_ticks / cfg.clk_uart;
+    return s;
+}
+
+/* Same MAC count as the sweep, spvpu only has N x N/2 PEs */
+double request_macs(const LinkRequest& req)
+{
+    uint64_t N = req.n;
+    if (req.unit == "spvpu")
+        return (double)(N * N / 2);
+    return unit_is_MVM(req.unit, req.vector_mode) ? (double)(N * N) : (double)(N * N * N);
+}
+
+void fill_roofline(const LinkConfig& cfg, const LinkRequest& req, LinkBreakdown& b)
+{
+    b.macs = request_macs(req);
+    double link = (double)cfg.baudrate / (double)cfg.bits_per_byte;
+    b.peak_macs_per_s = b.compute > 0 ? b.macs / b.compute : INFINITY;
+    b.intensity = b.macs / (double)(b.tx_bytes + b.rx_bytes);
+    b.link_bound = b.intensity * link < b.peak_macs_per_s;
+    b.bound_macs_per_s = std::min(b.peak_macs_per_s, b.intensity * link);
+}
+
+/*- Event driven link *-/
+ * Both wire directions are serialisers (a byte can't
+ * start before the previous one is out), the board side
+ * is the wrapper FSM fed byte by byte like FpgaEmulator,
+ * the host side is UartHost::run_batch() reduced to what
+ * it waits for.
+ */
+class LinkSim
+{
+private:
+    enum Word { W_ACK1, W_BULK_ACK, W_ACK2, W_SYNC, W_RESULT, W_RESULT_FRAME };
+    enum HostState { H_IDLE, H_ACK1, H_BULK_ACK, H_ACK2, H_SYNC, H_RESULTS, H_REACTING };
+
+    struct Event
+    {
+        double t;
+        uint64_t seq;
+        std::function<void()> fn;
+        bool operator>(const Event& o) const { return t != o.t ? t > o.t : seq > o.seq; }
+    };
+
+    const LinkConfig& cfg;
+    Shape s;
+    uint64_t cycles;
+
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+    uint64_t seq = 0;
+    double now = 0;
+    double h2b_free = 0, b2h_free = 0;
+
+    /* Board */
+    uint32_t rx_frame = 0;
+    uint64_t rx_bytes = 0;
+    bool drop_byte = false, drop_after = false, misal_fsm = false;
+    uint64_t mode = 0;
+    bool got_magic = false, bulk_mode = false, got_ack1 = false;
+    uint64_t words_in = 0;
+    uint64_t tick_gen = 0;
+
+    /* Host */
+    HostState state = H_IDLE;
+    uint64_t current = 0, total, results_in = 0, burst_token = 0;
+    std::deque<std::pair<Word, double>> host_rx;    // arrived, not looked at yet
+
+    struct Times { double start, ack1, payload, computed, results; };
+    std::vector<Times> times;
+    std::vector<LinkBreakdown> out;
+
+    void at(double t, std::function<void()> fn)
+    {
+        events.push({t, seq++, std::move(fn)});
+    }
+
+    /* Host writes words little endian */
+    void host_send(uint32_t word, uint64_t count = 1)
+    {
+        for (uint64_t c = 0; c < count; c++)
+            for (int i = 0; i < 4; i++)
+                host_send_byte((uint8_t)(word >> (8*i)));
+    }
+
+    void host_send_byte(uint8_t b)
+    {
+        h2b_free = std::max(now, h2b_free) + s.byte_time;
+        out[current].tx_bytes++;
+        at(h2b_free, [this, b] { board_byte(b); });
+    }
+
+    void board_send(Word w, uint64_t bytes = 4)
+    {
+        b2h_free = std::max(now, b2h_free) + bytes * s.byte_time;
+        if (current < out.size())
+            out[current].rx_bytes += bytes;
+        at(b2h_free, [this, w] { host_word(w); });
+    }
+
+    /* SerialReceiver, as FpgaEmulator::on_byte */
+    void board_byte(uint8_t b)
+    {
+        if (drop_after)
+        {
+            drop_after = false;
+            rx_bytes = 0;
+            board_frame(rx_frame);
+            return;
+        }
+        rx_frame = (rx_frame & ~(0xffu << (8*rx_bytes))) | (uint32_t)b << (8*rx_bytes);
+        if (++rx_bytes == 4)
+        {
+            if (drop_byte)
+                drop_after = true;
+            else
+            {
+                rx_bytes = 0;
+                board_frame(rx_frame);
+            }
+        }
+    }
+
+    void board_reset()
+    {
+        rx_frame = 0;
+        rx_bytes = 0;
+        drop_byte = drop_after = misal_fsm = false;
+        got_magic = bulk_mode = got_ack1 = false;
+        words_in = 0;
+        mode = 0;
+        tick_gen++;
+    }
+
+    void board_frame(uint32_t frame)
+    {
+        switch (mode)
+        {
+        case 0:
+            if (!misal_fsm)
+            {
+                if (frame == 0xADBEEFDE)
+                {
+                    drop_byte = false;
+                    misal_fsm = true;
+                }
+                else
+                    drop_byte = true;
+            }
+            else if (frame == UartHost::SYNC)
+            {
+                board_send(W_ACK1);
+                mode = 1;
+            }
+            else
+                misal_fsm = false;
+            break;
+
+        case 1:
+            if (bulk_mode)
+                words_in++;
+            else if (!got_magic && cfg.bulk && frame == BULK_HELLO)
+            {
+                board_send(W_BULK_ACK);
+                bulk_mode = true;
+            }
+            else if (!got_magic)
+                got_magic = frame == UartHost::MAGIC;
+            else if (!(frame >> 31))
+                words_in++;
+            if (words_in * 4 == s.payload - (bulk_mode ? 0 : 4))
+            {
+                board_send(W_ACK2);
+                times[current].payload = now;
+                mode = 2;
+                at(now + (double)cycles / cfg.clk100, [this] { board_computed(); });
+            }
+            break;
+
+        case 3:
+            if (frame == UartHost::ACK1)
+                got_ack1 = true;
+            else if (frame == UartHost::ACK2)
+                board_reset();
+            break;
+        }
+    }
+
+    void board_computed()
+    {
+        times[current].computed = now;
+        mode = 3;
+        uint64_t gen = tick_gen;
+        at(now + s.word_period, [this, gen] { board_tick(gen); });
+    }
+
+    /* Transmission counter */
+    void board_tick(uint64_t gen)
+    {
+        if (gen != tick_gen)
+            return;
+        if (!got_ack1)
+            board_send(W_SYNC);
+        else if (!bulk_mode || !s.bulk_results)
+            board_send(W_RESULT);
+        else if (b2h_free <= now)
+            board_send(W_RESULT_FRAME, s.result_bytes);
+        at(now + s.word_period, [this, gen] { board_tick(gen); });
+    }
+
+    void host_word(Word w)
+    {
+        host_rx.push_back({w, now});
+        host_poll();
+    }
+
+    /* Like find_word(): words before the one waited for are
+     * dropped, and the host reacts host_latency after it
+     * arrived, or right away if it was already buffered */
+    void host_poll()
+    {
+        HostState want[] = {H_ACK1, H_BULK_ACK, H_ACK2, H_SYNC, H_RESULTS, H_RESULTS};
+        while (!host_rx.empty() && state != H_IDLE && state != H_REACTING)
+        {
+            auto [w, t] = host_rx.front();
+            host_rx.pop_front();
+            if (state != want[w])
+                continue;
+            if (w == W_RESULT && ++results_in < s.results)
+                continue;
+            state = H_REACTING;
+            at(std::max(now, t + cfg.host_latency), [this, w] { host_react(w); });
+        }
+    }
+
+    void host_sync_burst()
+    {
+        host_send(UartHost::SYNC, cfg.sync_words);
+        uint64_t token = ++burst_token;
+        double wait = 2 * 4 * cfg.sync_words * s.byte_time + cfg.resend_margin;
+        at(h2b_free + wait, [this, token] {
+            if (state != H_ACK1 || token != burst_token)
+                return;
+            out[current].sync_resends++;
+            host_sync_burst();
+        });
+    }
+
+    void host_start()
+    {
+        times.push_back({now, 0, 0, 0, 0});
+        out.emplace_back();
+        state = H_ACK1;
+        host_sync_burst();
+    }
+
+    void host_react(Word w)
+    {
+        switch (w)
+        {
+        case W_ACK1:
+            times[current].ack1 = now;
+            if (cfg.bulk)
+            {
+                state = H_BULK_ACK;
+                host_send(BULK_HELLO);
+                break;
+            }
+            state = H_ACK2;
+            host_send(UartHost::MAGIC);
+            for (uint64_t i = 4; i < s.payload; i += 4)
+                host_send(0);
+            break;
+        case W_BULK_ACK:
+            state = H_ACK2;
+            host_send_byte(BULK_START);
+            for (uint64_t i = 1; i < s.payload; i++)
+                host_send_byte(0);
+            break;
+        case W_ACK2:
+            state = H_SYNC;
+            break;
+        case W_SYNC:
+            state = H_RESULTS;
+            results_in = 0;
+            host_send(UartHost::ACK1, cfg.ack_repeats);
+            break;
+        case W_RESULT:
+        case W_RESULT_FRAME:
+            times[current].results = now;
+            host_send(UartHost::ACK2, cfg.ack_repeats);
+            /* The rest is the board looping, dropped */
+            host_rx.clear();
+            state = H_IDLE;
+            if (++current < total)
+                host_start();
+            break;
+        }
+        host_poll();
+    }
+public:
+    LinkSim(const LinkConfig& cfg_p, const LinkRequest& req_p, uint64_t requests)
+        : cfg(cfg_p), s(link_shape(cfg_p, req_p)),
+          cycles(link_compute_cycles(req_p))
+    {
+        total = requests;
+    }
+
+    std::vector<LinkBreakdown> run()
+    {
+        host_start();
+        /* Way past anything sane, the board never acked */
+        double limit = 60;
+        while (current < total && !events.empty())
+        {
+            Event e = events.top();
+            events.pop();
+            now = e.t;
+            if (now > limit)
+                throw std::runtime_error(std::format("link model: request {} never completed", current));
+            e.fn();
+        }
+
+        for (uint64_t i = 0; i < total; i++)
+        {
+            LinkBreakdown& b = out[i];
+            const Times& t = times[i];
+            b.compute_cycles = cycles;
+            b.sync = t.ack1 - t.start;
+            b.payload = t.payload - t.ack1;
+            b.compute = t.computed - t.payload;
+            b.readback = t.results - t.computed;
+            b.latency = t.results - t.start;
+            b.period = i + 1 < total ? times[i+1].start - t.start : b.latency;
+        }
+        return out;
+    }
+};
+
+}
+
+uint64_t link_compute_cycles(const LinkRequest& req)
+{
+    unit_fn fn = find_unit(req.unit, req.n, 16);
+    if (!fn)
+        throw std::runtime_error(std::format("link model: no {} with n={} at 16 bits (see main --list)",
+                req.unit, req.n));
+    bool mvm = unit_is_MVM(req.unit, req.vector_mode);
+    UnitRun run;
+    run.unit = req.unit;
+    run.MVM_enable = req.vector_mode;
+    run.acts = Matrix<wide_t>(req.n, mvm ? 1 : req.n);
+    run.weights = Matrix<wide_t>(req.n, req.n);
+    return fn(run).cycles;
+}
+
+LinkBreakdown estimate_link(const LinkConfig& cfg, const LinkRequest& req)
+{
+    Shape s = link_shape(cfg, req);
+    double bt = s.byte_time, P = s.word_period, L = cfg.host_latency;
+    LinkBreakdown b;
+    b.compute_cycles = link_compute_cycles(req);
+
+    /* Ack goes out on the ALIGN_WORDS-th word, the payload
+     * queues behind the rest of the burst */
+    b.sync = (4 * ALIGN_WORDS + 4) * bt + L;
+    double burst_end = 4 * cfg.sync_words * bt;
+    b.payload = std::max(b.sync, burst_end) - b.sync + s.payload * bt;
+    if (cfg.bulk)
+        b.payload += 8 * bt + L;
+
+    b.compute = (double)b.compute_cycles / cfg.clk100;
+
+    /* First sync a period after computing, the 0C lands
+     * 2 words + L later, results start on the next tick */
+    double got_ack = P + 8 * bt + L;
+    double first = P * std::ceil(got_ack / P);
+    if (s.bulk_results)
+        b.readback = first + s.result_bytes * bt + L;
+    else
+        b.readback = first + std::max((s.results - 1) * P + 4 * bt, s.results * 4 * bt) + L;
+
+    b.latency = b.sync + b.payload + b.compute + b.readback;
+    /* The next burst queues behind this one's 1C acks */
+    b.period = b.latency + 4 * cfg.ack_repeats * bt;
+
+    uint64_t syncs = (uint64_t)(got_ack / P);
+    b.tx_bytes = 4 * cfg.sync_words + s.payload + 8 * cfg.ack_repeats + (cfg.bulk ? 4 : 0);
+    b.rx_bytes = 4 + 4 + 4 * syncs + s.result_bytes + (cfg.bulk ? 4 : 0);
+    fill_roofline(cfg, req, b);
+    return b;
+}
+
+LinkBreakdown simulate_link(const LinkConfig& cfg, const LinkRequest& req, uint64_t requests)
+{
+    if (requests == 0)
+        throw std::runtime_error("link model: need at least one request");
+    LinkSim sim(cfg, req, requests);
+    std::vector<LinkBreakdown> all = sim.run();
+
+    LinkBreakdown avg;
+    avg.compute_cycles = all[0].compute_cycles;
+    for (const LinkBreakdown& b : all)
+    {
+        avg.sync += b.sync / requests;
+        avg.payload += b.payload / requests;
+        avg.compute += b.compute / requests;
+        avg.readback += b.readback / requests;
+        avg.latency += b.latency / requests;
+        avg.tx_bytes += b.tx_bytes;
+        avg.rx_bytes += b.rx_bytes;
+        avg.sync_resends += b.sync_resends;
+    }
+    avg.tx_bytes /= requests;
+    avg.rx_bytes /= requests;
+    /* Start to start, so only between requests */
+    avg.period = requests > 1 ? 0 : all[0].latency;
+    for (uint64_t i = 0; i + 1 < requests; i++)
+        avg.period += all[i].period / (requests - 1);
+    fill_roofline(cfg, req, avg);
+    return avg;
+}
@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <map>
+#include <numeric>
+#include <set>
+#include <stdexcept>
+
+#include "MemoryModel.hh"
+
+namespace
+{
+
+/* Lanes and words of each operand, see operand_reads()
+ * for what a lane is in each unit */
+void operand_shape(const std::string& unit, uint64_t R, uint64_t C, bool MVM_enable,
+        uint64_t& acts_lanes, uint64_t& acts_words, uint64_t& weights_lanes, uint64_t& weights_words)
+{
+    bool vector_unit = unit == "vpu" || unit == "vpuhsa" || unit == "spvpu" || (unit == "hsa" && MVM_enable);
+    acts_lanes = vector_unit ? 1 : R;
+    acts_words = vector_unit ? C : R * C;
+    weights_lanes = R;
+    /* spvpu only keeps the merged half of the columns */
+    weights_words = unit == "spvpu" ? R * (C / 2) : R * C;
+}
+
+/* acts get the lower half of the banks, weights the rest */
+uint64_t acts_banks(const MemoryConfig& cfg)
+{
+    return cfg.banks > 1 ? cfg.banks / 2 : 1;
+}
+
+uint64_t weights_banks(const MemoryConfig& cfg)
+{
+    return cfg.banks > 1 ? cfg.banks - cfg.banks / 2 : 1;
+}
+
+/* Deepest bank the tile needs */
+uint64_t bank_depth(const MemoryConfig& cfg, uint64_t acts_words, uint64_t weights_words)
+{
+    uint64_t a = (acts_words + acts_banks(cfg) - 1) / acts_banks(cfg);
+    uint64_t w = (weights_words + weights_banks(cfg) - 1) / weights_banks(cfg);
+    /* a single bank holds both */
+    return cfg.banks > 1 ? std::max(a, w) : a + w;
+}
+
+}
+
+MemoryConfig parse_memory_config(const Json& j)
+{
+    MemoryConfig cfg;
+    cfg.banks = j["banks"].as_uint(cfg.banks);
+    cfg.ports = j["ports"].as_uint(cfg.ports);
+    cfg.width = j["width"].as_uint(cfg.width);
+    cfg.bank_words = j["bank_words"].as_uint(cfg.bank_words);
+    cfg.backing_words = j["backing_words"].as_number(cfg.backing_words);
+    cfg.backing_latency = j["backing_latency"].as_uint(cfg.backing_latency);
+    if (!cfg.banks || !cfg.ports || !cfg.width)
+        throw std::runtime_error("memory: banks, ports and width must be positive");
+    if (cfg.backing_words < 0)
+        throw std::runtime_error("memory: backing_words can't be negative");
+    return cfg;
+}
+
+std::string memory_label(const MemoryConfig& cfg)
+{
+    std::string ret = std::format("{}b{}p{}w", cfg.banks, cfg.ports, cfg.width);
+    if (cfg.backing_words > 0)
+        ret += std::format(" bw{}", cfg.backing_words);
+    if (cfg.backing_latency)
+        ret += std::format(" lat{}", cfg.backing_latency);
+    return ret;
+}
+
+bool memory_fits(const MemoryConfig& cfg, const std::string& unit, uint64_t R, uint64_t C, bool MVM_enable)
+{
+    uint64_t acts_lanes, acts_words, weights_lanes, weights_words;
+    operand_shape(unit, R, C, MVM_enable, acts_lanes, acts_words, weights_lanes, weights_words);
+    return bank_depth(cfg, acts_words, weights_words) <= cfg.bank_words;
+}
+
+std::vector<OperandRead> operand_reads(const std::string& unit, uint64_t R, uint64_t C,
+        bool MVM_enable, uint64_t t)
+{
+    std::vector<OperandRead> ret;
+    if (unit == "mpu")
+    {
+        /* Both operands stream in from the edges, row i
+         * (col j) reading one word while enabled */
+        for (uint64_t i = 0; i < R; i++)
+            if (i <= t && t < i + C)
+                ret.push_back({false, i, t - i});
+        for (uint64_t j = 0; j < C; j++)
+            if (j <= t && t < j + R)
+                ret.push_back({true, j, t - j});
+    }
+    else if (unit == "mpuhsa" || (unit == "hsa" && !MVM_enable))
+    {
+        /* Acts stream in along the rows, PE (i, j) picks
+         * its weight up on its first enabled cycle (i+j) */
+        for (uint64_t i = 0; i < R; i++)
+        {
+            if (i <= t && t < i + C)
+                ret.push_back({false, i, t - i});
+            if (i <= t && t - i < C)
+                ret.push_back({true, i, t - i});
+        }
+    }
+    else if (unit == "hsa" || unit == "vpuhsa")
+    {
+        /* One act broadcast, one weight col (hsa) or row
+         * (vpuhsa) a cycle */
+        if (t < C)
+        {
+            ret.push_back({false, 0, t});
+            for (uint64_t i = 0; i < R; i++)
+                ret.push_back({true, i, t});
+        }
+    }
+    else if (unit == "vpu")
+    {
+        /* Acts enter at row 0, the enabled PEs are the
+         * anti-diagonal i+j == t */
+        if (t < C)
+            ret.push_back({false, 0, t});
+        for (uint64_t i = 0; i < R; i++)
+            if (i <= t && t - i < C)
+                ret.push_back({true, i, t - i});
+    }
+    else if (unit == "spvpu")
+    {
+        /* Double pumped: two acts per packed column */
+        if (t < C / 2)
+        {
+            ret.push_back({false, 0, 2*t});
+            ret.push_back({false, 0, 2*t + 1});
+            for (uint64_t i = 0; i < R; i++)
+                ret.push_back({true, i, t});
+        }
+    }
+    else
+        throw std::runtime_error("memory: no operand model for unit " + unit);
+    return ret;
+}
+
+MemoryModel::MemoryModel(const MemoryConfig& cfg, const std::string& unit, uint64_t R, uint64_t C,
+        bool MVM_enable, uint64_t latency)
+    : cfg(cfg), unit(unit), R(R), C(C), MVM_enable(MVM_enable)
+{
+    operand_shape(unit, R, C, MVM_enable, acts_lanes, acts_words, weights_lanes, weights_words);
+    s.words = acts_words + weights_words;
+    uint64_t depth = bank_depth(cfg, acts_words, weights_words);
+    if (depth > cfg.bank_words)
+        throw std::runtime_error(std::format("memory: {} needs {} words a bank, banks hold {}",
+                    unit, depth, cfg.bank_words));
+
+    /* Fill order: by first use, then address (words never
+     * read last) */
+    std::vector<uint64_t> first_use(s.words, ~0ULL);
+    for (uint64_t t = 0; t < latency; t++)
+        for (const OperandRead& r : operand_reads(unit, R, C, MVM_enable, t))
+        {
+            uint64_t a = address(r);
+            first_use[a] = std::min(first_use[a], t);
+        }
+    std::vector<uint64_t> order(s.words);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint64_t a, uint64_t b) {
+        return first_use[a] < first_use[b];
+    });
+
+    arrival.assign(s.words, 0);
+    if (cfg.backing_words > 0)
+    {
+        for (uint64_t k = 0; k < order.size(); k++)
+            arrival[order[k]] = cfg.backing_latency +
+                (uint64_t)std::ceil((double)(k + 1) / cfg.backing_words);
+        s.fill_cycles = s.words ? arrival[order.back()] : 0;
+    }
+}
+
+uint64_t MemoryModel::address(const OperandRead& r) const
+{
+    if (r.weights)
+        return acts_words + r.seq * weights_lanes + r.lane;
+    return r.seq * acts_lanes + r.lane;
+}
+
+uint64_t MemoryModel::stall(uint64_t t)
+{
+    std::vector<OperandRead> reads = operand_reads(unit, R, C, MVM_enable, t);
+
+    uint64_t ready = now;
+    std::map<uint64_t, std::set<uint64_t>> lines;      // bank -> lines read
+    for (const OperandRead& r : reads)
+    {
+        uint64_t a = address(r);
+        ready = std::max(ready, arrival[a]);
+        /* Interleaved within the operand's own banks (a
+         * single bank is shared, the weights sitting after
+         * the acts) */
+        uint64_t local = r.weights && cfg.banks > 1 ? a - acts_words : a;
+        uint64_t banks = r.weights ? weights_banks(cfg) : acts_banks(cfg);
+        uint64_t base = r.weights && cfg.banks > 1 ? acts_banks(cfg) : 0;
+        lines[base + local % banks].insert(local / banks / cfg.width);
+    }
+    uint64_t bank_cycles = 1;
+    for (const auto& [bank, l] : lines)
+        bank_cycles = std::max<uint64_t>(bank_cycles, (l.size() + cfg.ports - 1) / cfg.ports);
+
+    uint64_t backing = ready - now;
+    uint64_t conflict = bank_cycles - 1;
+    s.reads += reads.size();
+    s.backing_stalls += backing;
+    s.bank_stalls += conflict;
+    if (s.backing_stalls || s.bank_stalls)
+        s.bound = s.backing_stalls >= s.bank_stalls ? "backing" : "bank";
+    now = ready + bank_cycles;
+    return backing + conflict;
+}
@@ -0,0 +1,438 @@
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "Pipeline.hh"
+#include "Sweep.hh"
+#include "UnitRunner.hh"
+
+namespace
+{
+
+template <typename T, typename F>
+std::vector<T> list_of(const Json& j, F conv, const std::vector<T>& dflt)
+{
+    if (j.is_null()) return dflt;
+    std::vector<T> ret;
+    if (j.is_array())
+        for (const Json& v : j.arr)
+            ret.push_back(conv(v));
+    else
+        ret.push_back(conv(j));
+    return ret;
+}
+
+bool parse_csv_line(const std::string& line, SweepResult& r)
+{
+    std::stringstream ss(line);
+    /* memory,stalls,bound are missing from older csvs */
+    std::string f[14] = {"", "", "", "", "", "", "", "", "", "", "", "-", "0", "compute"};
+    for (int i = 0; i < 14; i++)
+    {
+        std::string field;
+        if (std::getline(ss, field, ','))
+            f[i] = field;
+        else if (i < 11)
+            return false;
+    }
+    try
+    {
+        r.point.id = std::stoull(f[0]);
+        r.point.unit = f[1];
+        r.point.mode = f[2];
+        r.point.n = std::stoull(f[3]);
+        r.point.cols = std::stoull(f[4]);
+        r.point.op_bits = std::stoull(f[5]);
+        r.point.acc_bits = std::stoull(f[6]);
+        r.cycles = std::stoull(f[7]);
+        r.pes = r.point.unit == "spvpu" ? r.point.n * r.point.n / 2 : r.point.n * r.point.cols;
+        r.utilization = std::stod(f[8]);
+        r.macs = r.utilization * r.pes * r.cycles;
+        r.energy = std::stod(f[9]);
+        r.error = std::stod(f[10]);
+        r.point.memory_label = f[11];
+        r.stalls = std::stoull(f[12]);
+        r.bound = f[13];
+    }
+    catch (const std::exception&)
+    {
+        return false;
+    }
+    normalise_result(r);
+    return true;
+}
+
+/* One trial of a point */
+struct SweepTile
+{
+    uint64_t point, trial;              // point: index into the points being run
+    unit_fn fn;
+    UnitRun run;
+};
+
+struct SimulatedTile
+{
+    SweepTile tile;
+    UnitResult result;
+};
+
+/* What's left of a trial once checked */
+struct CheckedTile
+{
+    uint64_t point, trial;
+    uint64_t cycles, stalls;
+    std::string bound;
+    std::vector<double> errors;         // per result entry, |sim - exact| / |exact|
+};
+
+std::mt19937_64 point_rng(const SweepPoint& p, uint64_t seed)
+{
+    return std::mt19937_64(seed ^ (p.id * 0x9e3779b97f4a7c15ULL));
+}
+
+/* Trials draw their operands one after the other from
+ * the point's rng */
+SweepTile make_tile(const SweepPoint& p, uint64_t point, uint64_t trial, bool event_driven,
+        std::mt19937_64& rng)
+{
+    bool mvm = unit_is_MVM(p.unit, p.mode == "mvm");
+    uint64_t op_mask = p.op_bits >= 64 ? ~0ULL : (1ULL << p.op_bits) - 1;
+    SweepTile t;
+    t.point = point;
+    t.trial = trial;
+    t.fn = find_unit(p.unit, p.n, p.cols, p.acc_bits);
+    t.run.unit = p.unit;
+    t.run.MVM_enable = p.mode == "mvm";
+    t.run.memory = p.memory;
+    t.run.event_driven = event_driven;
+    /* Rectangular shapes, see UnitRunner.hh */
+    t.run.acts = Matrix<wide_t>(p.cols, mvm ? 1 : p.n);
+    t.run.weights = Matrix<wide_t>(p.n, p.cols);
+    for (wide_t& v : t.run.acts.data) v.value = rng() & op_mask;
+    for (wide_t& v : t.run.weights.data) v.value = rng() & op_mask;
+    return t;
+}
+
+CheckedTile check_tile(const SimulatedTile& s)
+{
+    const UnitRun& run = s.tile.run;
+    CheckedTile c = {s.tile.point, s.tile.trial, s.result.cycles, s.result.stall_cycles,
+        s.result.memory.bound, {}};
+
+    /* Exact dense reference (no pruning, no overflow) */
+    Matrix<wide_t> exact = unit_is_MVM(run.unit, run.MVM_enable) ? reference_matmul(run.weights, run.acts)
+                                                                 : reference_matmul(run.acts, run.weights);
+    c.errors.resize(exact.data.size());
+    for (uint64_t i = 0; i < exact.data.size(); i++)
+    {
+        double e = (double)exact.data[i].value;
+        double v = (double)s.result.result.data[i].value;
+        c.errors[i] = e == 0 ? (v != 0) : std::fabs(v - e) / e;
+    }
+    return c;
+}
+
+/* trials in trial order. Cycles and stalls are the last
+ * trial's (they only depend on the shape) */
+SweepResult finish_point(const SweepPoint& p, const std::vector<CheckedTile>& trials)
+{
+    bool mvm = unit_is_MVM(p.unit, p.mode == "mvm");
+    uint64_t N = p.n, C = p.cols;
+    SweepResult r;
+    r.point = p;
+    r.pes = p.unit == "spvpu" ? N * N / 2 : N * C;
+    r.cycles = trials.back().cycles;
+    r.stalls = trials.back().stalls;
+    r.bound = trials.back().bound;
+
+    /* Summed in the same order whichever thread checked
+     * which trial, so the error is reproducible */
+    double err_sum = 0;
+    uint64_t err_count = 0;
+    for (const CheckedTile& t : trials)
+        for (double e : t.errors)
+        {
+            err_sum += e;
+            err_count++;
+        }
+
+    /* MACs actually done: every PE fires once per streamed
+     * vector (C of them for MMM), and spvpu only has (and
+     * fires) N x N/2 of them */
+    r.macs = p.unit == "spvpu" ? (double)(N * N / 2) : (double)(mvm ? N * C : N * C * C);
+    r.utilization = (double)r.macs / (double)(r.pes * r.cycles);
+    r.energy = estimate_energy(p, r.macs, r.pes, r.cycles);
+    r.error = err_count ? err_sum / (double)err_count : 0.0;
+    normalise_result(r);
+    return r;
+}
+
+}
+
+SweepConfig parse_sweep_config(const Json& j)
+{
+    SweepConfig cfg;
+    auto to_uint = [](const Json& v) { return v.as_uint(); };
+    auto to_str = [](const Json& v) { return v.as_string(); };
+    cfg.n = list_of<uint64_t>(j["n"], to_uint, cfg.n);
+    cfg.cols = list_of<uint64_t>(j["cols"], to_uint, cfg.cols);
+    cfg.op_bits = list_of<uint64_t>(j["op_bits"], to_uint, cfg.op_bits);
+    cfg.acc_bits = list_of<uint64_t>(j["acc_bits"], to_uint, cfg.acc_bits);
+    cfg.units = list_of<std::string>(j["unit"], to_str, cfg.units);
+    cfg.modes = list_of<std::string>(j["mode"], to_str, cfg.modes);
+    cfg.memories = list_of<MemoryConfig>(j["memory"], parse_memory_config, cfg.memories);
+    cfg.trials = j["trials"].as_uint(cfg.trials);
+    cfg.seed = j["seed"].as_uint(cfg.seed);
+    cfg.threads = j["threads"].as_uint(cfg.threads);
+    cfg.output = j["output"].as_string(cfg.output);
+    cfg.pareto_output = j["pareto"].as_string(cfg.pareto_output);
+    cfg.resume = j["resume"].as_bool(cfg.resume);
+    std::string kernel = j["kernel"].as_string("cycle");
+    if (kernel != "cycle" && kernel != "event")
+        throw std::runtime_error("sweep: kernel must be cycle or event");
+    cfg.event_driven = kernel == "event";
+    return cfg;
+}
+
+std::vector<SweepPoint> expand_grid(const SweepConfig& cfg)
+{
+    std::vector<SweepPoint> ret;
+    /* ids are the position in the full grid, so they stay
+     * stable across runs (needed for resume) */
+    uint64_t id = 0;
+    for (const std::string& unit : cfg.units)
+        for (const std::string& mode : cfg.modes)
+            for (uint64_t n : cfg.n)
+                for (uint64_t c : cfg.cols.empty() ? std::vector<uint64_t>{n} : cfg.cols)
+                    for (uint64_t op : cfg.op_bits)
+                        for (uint64_t acc : cfg.acc_bits)
+                            for (uint64_t m = 0; m < std::max<uint64_t>(1, cfg.memories.size()); m++)
+                            {
+                                uint64_t this_id = id++;
+                                bool mvm = unit_is_MVM(unit, mode == "mvm");
+                                /* fixed mode units only once, in their own mode */
+                                if (unit != "hsa" && mode != (mvm ? "mvm" : "mmm")) continue;
+                                if (op > acc || !find_unit(unit, n, c, acc)) continue;
+                                SweepPoint p;
+                                p.id = this_id;
+                                p.unit = unit;
+                                p.mode = mode;
+                                p.n = n;
+                                p.cols = c;
+                                p.op_bits = op;
+                                p.acc_bits = acc;
+                                if (!cfg.memories.empty())
+                                {
+                                    const MemoryConfig& mc = cfg.memories[m];
+                                    if (!memory_fits(mc, unit, n, c, mvm)) continue;
+                                    p.memory = mc;
+                                    p.memory_label = memory_label(mc);
+                                }
+                                ret.push_back(p);
+                            }
+    return ret;
+}
+
+double estimate_energy(const SweepPoint& p, double macs, uint64_t pes, uint64_t cycles)
+{
+    double e_mac = (double)(p.op_bits * p.op_bits + p.acc_bits);
+    double e_leak = 0.05 * (8 * 8 + 8);
+    return macs * e_mac + (double)(pes * cycles) * e_leak;
+}
+
+SweepResult evaluate_point(const SweepPoint& p, uint64_t trials, uint64_t seed, bool event_driven)
+{
+    if (trials == 0)
+        throw std::runtime_error("sweep: trials must be at least 1");
+    std::mt19937_64 rng = point_rng(p, seed);
+    std::vector<CheckedTile> checked;
+    for (uint64_t t = 0; t < trials; t++)
+    {
+        SimulatedTile s;
+        s.tile = make_tile(p, 0, t, event_driven, rng);
+        s.result = s.tile.fn(s.tile.run);
+        checked.push_back(check_tile(s));
+    }
+    return finish_point(p, checked);
+}
+
+std::vector<SweepResult> pareto_frontier(const std::vector<SweepResult>& results)
+{
+    std::vector<SweepResult> ret;
+    for (const SweepResult& a : results)
+    {
+        bool dominated = false;
+        for (const SweepResult& b : results)
+        {
+            /* Per MAC, a bigger array's tile being more work */
+            bool no_worse = b.cycles_per_mac <= a.cycles_per_mac && b.energy_per_mac <= a.energy_per_mac
+                && b.error <= a.error;
+            bool better = b.cycles_per_mac < a.cycles_per_mac || b.energy_per_mac < a.energy_per_mac
+                || b.error < a.error;
+            if (no_worse && better)
+            {
+                dominated = true;
+                break;
+            }
+        }
+        if (!dominated)
+            ret.push_back(a);
+    }
+    return ret;
+}
+
+void normalise_result(SweepResult& r)
+{
+    r.cycles_per_mac = r.macs ? (double)r.cycles / r.macs : 0.0;
+    r.energy_per_mac = r.macs ? r.energy / r.macs : 0.0;
+}
+
+/* The per MAC columns come last, older csvs (without
+ * them) still resume, they're derived from the rest */
+std::string sweep_csv_header()
+{
+    return "id,unit,mode,n,cols,op_bits,acc_bits,cycles,utilization,energy,error,memory,stalls,bound,"
+           "cycles_per_mac,energy_per_mac";
+}
+
+std::string sweep_csv_line(const SweepResult& r)
+{
+    return std::format("{},{},{},{},{},{},{},{},{:.6f},{:.1f},{:.6g},{},{},{},{:.6g},{:.6g}", r.point.id,
+            r.point.unit, r.point.mode, r.point.n, r.point.cols, r.point.op_bits, r.point.acc_bits,
+            r.cycles, r.utilization, r.energy, r.error, r.point.memory_label, r.stalls, r.bound,
+            r.cycles_per_mac, r.energy_per_mac);
+}
+
+std::vector<SweepResult> run_sweep(const SweepConfig& cfg)
+{
+    std::vector<SweepPoint> points = expand_grid(cfg);
+    std::vector<SweepResult> results;
+
+    /* Pick up whatever a previous (interrupted) run got through */
+    std::set<uint64_t> done;
+    bool fresh = !std::filesystem::exists(cfg.output) || std::filesystem::file_size(cfg.output) == 0;
+    if (cfg.resume && !fresh)
+    {
+        std::ifstream in(cfg.output);
+        std::string line;
+        while (std::getline(in, line))
+        {
+            SweepResult r;
+            if (parse_csv_line(line, r))
+            {
+                done.insert(r.point.id);
+                results.push_back(r);
+            }
+        }
+    }
+
+    std::ofstream out(cfg.output, cfg.resume ? std::ios::app : std::ios::trunc);
+    if (!out)
+        throw std::runtime_error("sweep: unable to open " + cfg.output);
+    if (fresh || !cfg.resume)
+        out << sweep_csv_header() << std::endl;
+    else
+    {
+        /* A crash mid-line leaves a partial record (dropped by
+         * the parse above), start clean after it */
+        std::ifstream in(cfg.output, std::ios::binary);
+        in.seekg(-1, std::ios::end);
+        if (in.get() != '\n')
+            out << std::endl;
+    }
+
+    std::vector<SweepPoint> todo;
+    for (const SweepPoint& p : points)
+        if (!done.count(p.id))
+            todo.push_back(p);
+
+    if (todo.empty())
+        return results;
+    if (cfg.trials == 0)
+        throw std::runtime_error("sweep: trials must be at least 1");
+
+    /* Pipelined, one tile being one trial of a point:
+     *   loader      : draws the tiles' operands, point by point
+     *   workers     : simulate them (the `threads` of the config)
+     *   verifiers   : check them against the exact reference
+     *   this thread : collects each point's trials, finishing it
+     *                 once all are in
+     *   writer      : appends finished points to the csv
+     * The queues in between only hold a few tiles per worker,
+     * so the loader never gets far ahead and the workers stall
+     * rather than pile up results if verifying falls behind. */
+    uint64_t threads = cfg.threads ? cfg.threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min<uint64_t>(threads, todo.size() * cfg.trials);
+    uint64_t verifiers = std::max<uint64_t>(1, threads / 4);
+    uint64_t depth = 4 * threads;
+    MpmcQueue<SweepTile> tiles(depth);
+    MpmcQueue<SimulatedTile> simulated(depth, threads);
+    MpmcQueue<CheckedTile> checked(depth, verifiers);
+    SpscQueue<SweepResult> finished(depth);
+
+    std::vector<std::thread> stages;
+    stages.emplace_back([&]()
+    {
+        for (uint64_t i = 0; i < todo.size(); i++)
+        {
+            std::mt19937_64 rng = point_rng(todo[i], cfg.seed);
+            for (uint64_t t = 0; t < cfg.trials; t++)
+                tiles.push(make_tile(todo[i], i, t, cfg.event_driven, rng));
+        }
+        tiles.close();
+    });
+    for (uint64_t w = 0; w < threads; w++)
+        stages.emplace_back([&]()
+        {
+            SimulatedTile s;
+            while (tiles.pop(s.tile))
+            {
+                s.result = s.tile.fn(s.tile.run);
+                simulated.push(std::move(s));
+            }
+            simulated.close();
+        });
+    for (uint64_t v = 0; v < verifiers; v++)
+        stages.emplace_back([&]()
+        {
+            SimulatedTile s;
+            while (simulated.pop(s))
+                checked.push(check_tile(s));
+            checked.close();
+        });
+    stages.emplace_back([&]()
+    {
+        SweepResult r;
+        while (finished.pop(r))
+            out << sweep_csv_line(r) << std::endl;      // endl flushes, partial results survive
+    });
+
+    std::vector<std::vector<CheckedTile>> pending(todo.size());
+    CheckedTile c;
+    while (checked.pop(c))
+    {
+        std::vector<CheckedTile>& trials = pending[c.point];
+        trials.push_back(std::move(c));
+        if (trials.size() < cfg.trials)
+            continue;
+        std::sort(trials.begin(), trials.end(), [](const CheckedTile& a, const CheckedTile& b) {
+            return a.trial < b.trial;
+        });
+        SweepResult r = finish_point(todo[trials[0].point], trials);
+        trials = {};
+        results.push_back(r);
+        finished.push(r);
+    }
+    finished.close();
+    for (std::thread& t : stages)
+        t.join();
+    return results;
+}
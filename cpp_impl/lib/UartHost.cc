@@ -0,0 +1,442 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "UartHost.hh"
+
+namespace
+{
+
+typedef std::chrono::steady_clock steady;
+
+double seconds_since(steady::time_point t)
+{
+    return std::chrono::duration<double>(steady::now() - t).count();
+}
+
+speed_t to_speed(uint64_t baudrate)
+{
+#if defined(__APPLE__)
+    /* speed_t is the plain baud rate there */
+    return (speed_t)baudrate;
+#else
+    switch (baudrate)
+    {
+        case 9600:    return B9600;
+        case 19200:   return B19200;
+        case 38400:   return B38400;
+        case 57600:   return B57600;
+        case 115200:  return B115200;
+        case 230400:  return B230400;
+        case 460800:  return B460800;
+        case 921600:  return B921600;
+        case 1000000: return B1000000;
+        case 2000000: return B2000000;
+        default:
+            throw std::runtime_error(std::format("uart: unsupported baud rate {}", baudrate));
+    }
+#endif
+}
+
+/* Little endian, i.e. the order the receiver shifts them in */
+uint8_t *put_word(uint8_t *out, uint32_t word)
+{
+    for (int i = 0; i < 4; i++)
+        *out++ = (uint8_t)(word >> (8*i));
+    return out;
+}
+
+}
+
+UartHost::UartHost(const std::string& port_p, uint64_t N_p, uint64_t baudrate_p)
+    : port(port_p), N(N_p), baudrate(baudrate_p), rx_buf(1 << 16), rx_begin(0), rx_end(0),
+      bulk_state(-1)
+{
+    if (N == 0 || N > 128)
+        throw std::runtime_error("uart: N must fit the 7 bit frame index");
+    /* magic + every weight and act frame, or a bulk MMM
+     * request at the widest bits */
+    BulkHeader h;
+    h.n = h.cols = N;
+    h.bits = 64;
+    for (int s = 0; s < 2; s++)
+    {
+        tx_buf[s].resize(std::max(4 + 2*4*N*N, bulk_frame_bytes(h)));
+        tx_len[s] = 0;
+    }
+    elems.reserve(2*N*N);
+
+    fd = open(port.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0)
+        throw std::runtime_error("uart: unable to open " + port + ": " + strerror(errno));
+
+    /* 8E1, raw, reads return whatever is there */
+    termios tio;
+    if (tcgetattr(fd, &tio) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("uart: " + port + " is not a tty");
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag &= ~(CSIZE | CSTOPB | PARODD);
+    tio.c_cflag |= CS8 | PARENB | CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    speed_t speed = to_speed(baudrate);
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if (tcsetattr(fd, TCSANOW, &tio) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("uart: unable to configure " + port + ": " + strerror(errno));
+    }
+    reset();
+}
+
+UartHost::~UartHost()
+{
+    if (fd >= 0)
+        close(fd);
+}
+
+void UartHost::reset(bool fpga)
+{
+    tcflush(fd, TCIOFLUSH);
+    rx_begin = rx_end = 0;
+    if (fpga)
+    {
+        uint8_t buf[5*4];
+        for (int i = 0; i < 5; i++)
+            put_word(buf + 4*i, RESET);
+        write_all(buf, sizeof(buf));
+    }
+}
+
+void UartHost::switch_mode(bool vector_mode)
+{
+    uint8_t buf[4];
+    put_word(buf, vector_mode ? TO_VECTOR : TO_MATRIX);
+    write_all(buf, sizeof(buf));
+}
+
+uint32_t UartHost::build_dataframe(bool msb, bool weight, uint64_t x_ix, uint64_t y_ix, uint64_t data)
+{
+    return (uint32_t)msb << 31 | (uint32_t)weight << 30 | (uint32_t)(x_ix & 0x7f) << 23 |
+           (uint32_t)(y_ix & 0x7f) << 16 | (uint32_t)(data & 0xffff);
+}
+
+double UartHost::wire_time(uint64_t bytes)
+{
+    /* start + 8 data + parity + stop */
+    return (double)(bytes * 11) / (double)baudrate;
+}
+
+/* Keeps reading while blocked on writing, the fpga
+ * may well be talking back mid-payload */
+void UartHost::write_all(const uint8_t *buf, uint64_t len)
+{
+    while (len)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n > 0)
+        {
+            buf += n;
+            len -= n;
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            throw std::runtime_error("uart: write failed on " + port + ": " + strerror(errno));
+        pollfd p = {fd, POLLOUT | POLLIN, 0};
+        poll(&p, 1, 100);
+        if (p.revents & POLLIN)
+            fill_rx(0);
+    }
+}
+
+/* Reads one chunk (waiting up to timeout_s for it), false
+ * if nothing came. Callers scan it before reading more, so
+ * a fast board can't push unscanned bytes out: room is
+ * only made by dropping what's before rx_begin, or by
+ * growing the buffer if that's nothing */
+bool UartHost::fill_rx(double timeout_s)
+{
+    pollfd p = {fd, POLLIN, 0};
+    if (poll(&p, 1, (int)(timeout_s * 1000)) <= 0)
+        return false;
+    if (rx_end == rx_buf.size())
+    {
+        if (rx_begin == 0)
+            rx_buf.resize(2 * rx_buf.size());
+        std::copy(rx_buf.begin() + rx_begin, rx_buf.begin() + rx_end, rx_buf.begin());
+        rx_end -= rx_begin;
+        rx_begin = 0;
+    }
+    ssize_t n = read(fd, rx_buf.data() + rx_end, rx_buf.size() - rx_end);
+    if (n <= 0)
+        return false;
+    rx_end += n;
+    return true;
+}
+
+/* Scans the byte stream for any of words (bytes in the
+ * order they arrive, MSB first) and consumes up to and
+ * including the first one found, so misalignment is fixed
+ * on the way. Returns its index, -1 on timeout. */
+int UartHost::find_words(const uint32_t *words, int count, double timeout_s)
+{
+    steady::time_point start = steady::now();
+    while (true)
+    {
+        int which;
+        uint64_t at = scan_words(rx_buf.data() + rx_begin, rx_end - rx_begin, words, count, which);
+        if (at < rx_end - rx_begin)
+        {
+            rx_begin += at + 4;
+            return which;
+        }
+        /* Keep a possible partial match */
+        rx_begin = std::max(rx_begin, rx_end >= 3 ? rx_end - 3 : 0);
+        double left = timeout_s - seconds_since(start);
+        if (left <= 0 || (!fill_rx(left) && seconds_since(start) >= timeout_s))
+            return -1;
+    }
+}
+
+bool UartHost::find_word(uint32_t word, double timeout_s)
+{
+    return find_words(&word, 1, timeout_s) == 0;
+}
+
+uint64_t UartHost::pack(const UartRequest& req, uint8_t *out)
+{
+    uint8_t *p = put_word(out, MAGIC);
+    for (uint64_t y = 0; y < N; y++)
+        for (uint64_t x = 0; x < N; x++)
+            p = put_word(p, build_dataframe(0, 1, x, y, req.weights.at(x, y).value));
+    for (uint64_t y = 0; y < N; y++)
+    {
+        if (req.vector_mode)
+            p = put_word(p, build_dataframe(0, 0, 0, y, req.acts.at(y, 0).value));
+        else
+            for (uint64_t x = 0; x < N; x++)
+                p = put_word(p, build_dataframe(0, 0, x, y, req.acts.at(x, y).value));
+    }
+    return p - out;
+}
+
+BulkHeader UartHost::bulk_header(const UartRequest& req) const
+{
+    BulkHeader h;
+    h.kind = BULK_REQUEST;
+    h.vector_mode = req.vector_mode;
+    h.bits = bits;
+    h.n = N;
+    h.cols = req.vector_mode ? 1 : N;
+    h.tile_id = req.tile_id;
+    h.codec = compress ? BULK_PAIR_WEIGHTS | BULK_RLE_VALUES : 0;
+    return h;
+}
+
+uint64_t UartHost::pack_bulk(const UartRequest& req, uint8_t *out)
+{
+    BulkHeader h = bulk_header(req);
+    /* Same sram indexing as the dataframes: [y][x] = at(x, y) */
+    elems.clear();
+    for (uint64_t y = 0; y < N; y++)
+        for (uint64_t x = 0; x < N; x++)
+            elems.push_back(req.weights.at(x, y).value);
+    for (uint64_t y = 0; y < N; y++)
+        for (uint64_t x = 0; x < h.cols; x++)
+            elems.push_back(req.vector_mode ? req.acts.at(y, 0).value : req.acts.at(x, y).value);
+    return bulk_encode(h, elems.data(), out);
+}
+
+/* Alignment handshake, then payload until the 2nd ack */
+bool UartHost::send_payload(const UartRequest& req, uint64_t slot, UartResponse& resp)
+{
+    /* A receiver that starts aligned needs 4 frames of
+     * dropping to cycle round to ADBEEFDE, 2 more to ack */
+    uint8_t sync[8*4];
+    for (int i = 0; i < 8; i++)
+        put_word(sync + 4*i, SYNC);
+
+    steady::time_point start = steady::now();
+    while (true)
+    {
+        write_all(sync, sizeof(sync));
+        if (find_word(ACK1, wire_time(2*sizeof(sync)) + resend_margin))
+            break;
+        if (seconds_since(start) > timeout)
+        {
+            if (verbose) std::cerr << "uart: no 1st ack, giving up" << std::endl;
+            return false;
+        }
+    }
+
+    resp.bulk = false;
+    if (bulk && bulk_state != 0)
+    {
+        uint8_t hello[4];
+        put_word(hello, BULK_HELLO);
+        write_all(hello, sizeof(hello));
+        if (find_word(BULK_ACK, wire_time(2*sizeof(hello)) + resend_margin))
+        {
+            if (bulk_state < 0 && verbose) std::cerr << "uart: board speaks bulk frames" << std::endl;
+            bulk_state = 1;
+            resp.bulk = true;
+        }
+        else
+        {
+            /* Board is still waiting for its magic, carry on
+             * the legacy way. A board that never answered
+             * won't start to, so stop asking. */
+            if (verbose) std::cerr << "uart: no bulk ack, falling back to dataframes" << std::endl;
+            if (bulk_state < 0)
+                bulk_state = 0;
+            tx_len[slot] = pack(req, tx_buf[slot].data());
+        }
+    }
+    resp.tx_bytes = tx_len[slot];
+    resp.tx_raw_bytes = resp.bulk ? bulk_frame_bytes(bulk_header(req)) : tx_len[slot];
+    if (verbose) std::cerr << "uart: aligned, sending " << tx_len[slot] << " bytes" << std::endl;
+
+    double wait = wire_time(tx_len[slot]) + resend_margin;
+    uint32_t answers[2] = {ACK2, BULK_NAK};
+    for (resp.resends = 0; resp.resends <= max_resends; resp.resends++)
+    {
+        write_all(tx_buf[slot].data(), tx_len[slot]);
+        int got = find_words(answers, resp.bulk ? 2 : 1, wait);
+        if (got == 0)
+            return true;
+        if (verbose) std::cerr << "uart: " << (got < 0 ? "timeout" : "bad checksum") << ", resending payload" << std::endl;
+    }
+    return false;
+}
+
+bool UartHost::read_results(const UartRequest& req, UartResponse& resp)
+{
+    uint64_t cols = req.vector_mode ? 1 : N;
+    resp.result = Matrix<wide_t>(N, cols);
+
+    /* Results follow the fpga's own sync, which also tells
+     * us where words start */
+    steady::time_point acked = steady::now();
+    if (!find_word(SYNC, timeout))
+        return false;
+    resp.fpga_seconds = seconds_since(acked);
+
+    uint8_t ack[5*4];
+    for (int i = 0; i < 5; i++)
+        put_word(ack + 4*i, ACK1);
+    write_all(ack, sizeof(ack));
+
+    /* Small tiles come back as dataframes either way */
+    bool bulk_results = resp.bulk && bulk_result_pays(N, cols);
+    if (bulk_results && !read_bulk_results(req, resp))
+        return false;
+    if (!bulk_results)
+        resp.rx_bytes = resp.rx_raw_bytes = 4*N*cols;
+
+    /* Words are aligned to the sync from here on */
+    decoder.start(resp.result);
+    steady::time_point last = steady::now();
+    while (!bulk_results && !decoder.done())
+    {
+        uint64_t missing = decoder.missing();
+        rx_begin += decoder.feed(rx_buf.data() + rx_begin, rx_end - rx_begin);
+        if (decoder.missing() < missing)
+            last = steady::now();
+        if (decoder.done()) break;
+        if (!fill_rx(timeout) && seconds_since(last) > timeout)
+            return false;
+    }
+
+    /* 5 of them as for the 1st one, a single 1C only
+     * registers if the board's receiver is word aligned */
+    for (int i = 0; i < 5; i++)
+        put_word(ack + 4*i, ACK2);
+    write_all(ack, sizeof(ack));
+    /* The rest is the fpga looping over results until it
+     * sees the ack, nothing to keep */
+    rx_begin = rx_end = 0;
+    return true;
+}
+
+/* The board loops over one bulk result frame, which is
+ * word aligned after the sync. A copy with a bad checksum
+ * (or some other tile's) is just skipped. */
+bool UartHost::read_bulk_results(const UartRequest& req, UartResponse& resp)
+{
+    uint64_t cols = req.vector_mode ? 1 : N;
+    steady::time_point last = steady::now();
+    while (true)
+    {
+        while (rx_begin + 4 <= rx_end)
+        {
+            BulkHeader h;
+            uint64_t used;
+            BulkStatus st = bulk_decode(rx_buf.data() + rx_begin, rx_end - rx_begin, h, elems, used);
+            if (st == BULK_SHORT)
+                break;
+            if (st == BULK_BAD || h.kind != BULK_RESULT || h.tile_id != req.tile_id ||
+                    h.n != N || h.cols != cols)
+            {
+                rx_begin += 4;
+                continue;
+            }
+            for (uint64_t i = 0; i < N*cols; i++)
+                resp.result.data[i].value = elems[i];
+            rx_begin += used;
+            resp.rx_bytes = used;
+            resp.rx_raw_bytes = bulk_frame_bytes(h);
+            return true;
+        }
+        if (fill_rx(timeout))
+            last = steady::now();
+        else if (seconds_since(last) > timeout)
+            return false;
+    }
+}
+
+UartResponse UartHost::run(const UartRequest& req)
+{
+    return run_batch({req})[0];
+}
+
+std::vector<UartResponse> UartHost::run_batch(const std::vector<UartRequest>& reqs)
+{
+    std::vector<UartResponse> ret(reqs.size());
+    if (reqs.empty()) return ret;
+
+    auto pack_any = [&](const UartRequest& req, uint8_t *out) {
+        return bulk && bulk_state != 0 ? pack_bulk(req, out) : pack(req, out);
+    };
+    tx_len[0] = pack_any(reqs[0], tx_buf[0].data());
+    for (uint64_t i = 0; i < reqs.size(); i++)
+    {
+        steady::time_point start = steady::now();
+        uint64_t slot = i % 2;
+        UartResponse& resp = ret[i];
+        resp.ok = send_payload(reqs[i], slot, resp);
+
+        /* fpga is computing now, get the next one ready */
+        if (i + 1 < reqs.size())
+            tx_len[1 - slot] = pack_any(reqs[i+1], tx_buf[1 - slot].data());
+
+        if (resp.ok)
+            resp.ok = read_results(reqs[i], resp);
+        resp.host_seconds = seconds_since(start);
+        /* Don't leave the board stuck mid-request */
+        if (!resp.ok)
+            reset(true);
+    }
+    return ret;
+}
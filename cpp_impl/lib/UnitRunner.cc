@@ -0,0 +1,338 @@
+#include <algorithm>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "UnitRunner.hh"
+#include "Checkpoint.hh"
+#include "EventKernel.hh"
+#include "Mpu.hh"
+#include "MpuHsa.hh"
+#include "VpuHsa.hh"
+#include "Vpu.hh"
+#include "Hsa.hh"
+#include "SpVpu.hh"
+
+/* Pre-instantiated sizes. Adding one here is the only
+ * thing needed to make it selectable from configs. */
+#define UNIT_RUNNER_SIZES(X, bits) X(bits, 2) X(bits, 4) X(bits, 8) X(bits, 16)
+#define UNIT_RUNNER_BITS(X) UNIT_RUNNER_SIZES(X, 8) UNIT_RUNNER_SIZES(X, 16) UNIT_RUNNER_SIZES(X, 32)
+/* Rectangular RxC shapes, only for hsa and mpuhsa */
+#define UNIT_RUNNER_RECT_SHAPES(X, bits) X(bits, 2, 4) X(bits, 4, 2) X(bits, 4, 8) X(bits, 8, 4) \
+    X(bits, 4, 16) X(bits, 16, 4) X(bits, 8, 16) X(bits, 16, 8)
+#define UNIT_RUNNER_RECT(X) UNIT_RUNNER_RECT_SHAPES(X, 8) UNIT_RUNNER_RECT_SHAPES(X, 16) \
+    UNIT_RUNNER_RECT_SHAPES(X, 32)
+
+namespace
+{
+
+/* Zero padded copy of the top-left NxM of m */
+template <typename mac_t, uint64_t N, uint64_t M = N>
+void load_tile(const Matrix<wide_t>& m, mac_t out[N][M])
+{
+    for (uint64_t i = 0; i < N; i++)
+        for (uint64_t j = 0; j < M; j++)
+            out[i][j].value = i < m.rows && j < m.cols ? m.at(i, j).value : 0;
+}
+
+template <typename mac_t, uint64_t N>
+void load_vector(const Matrix<wide_t>& m, mac_t out[N])
+{
+    for (uint64_t i = 0; i < N; i++)
+        out[i].value = i < m.rows && m.cols ? m.at(i, 0).value : 0;
+}
+
+template <typename mac_t, uint64_t N, uint64_t M = N>
+Matrix<wide_t> from_tile(mac_t tile[][M])
+{
+    Matrix<wide_t> ret(N, M);
+    for (uint64_t i = 0; i < N; i++)
+        for (uint64_t j = 0; j < M; j++)
+            ret.at(i, j).value = tile[i][j].value;
+    return ret;
+}
+
+template <typename mac_t, uint64_t N>
+Matrix<wide_t> from_vector(mac_t vec[N])
+{
+    Matrix<wide_t> ret(N, 1);
+    for (uint64_t i = 0; i < N; i++)
+        ret.at(i, 0).value = vec[i].value;
+    return ret;
+}
+
+/* Clocks the unit for the budget (or its latency),
+ * dumping its state after every cycle if asked to.
+ * A restored unit carries on from its own counter, the
+ * budget being the total number of cycles. With a memory
+ * model, each clock() waits for its operands first (R, C
+ * being the array shape for it).
+ *
+ * Event driven runs (not when tracing, the dump wants
+ * every cycle) go through an EventKernel instead, built
+ * from windows(), stepping the unit with step(active,
+ * retired) and skipping the cycles where nothing is
+ * enabled.
+ *
+ * A checkpoint_at has to fall inside what is left of
+ * the run (after the restored counter, at most the
+ * budget), anything else throws rather than silently
+ * writing nothing. Without one the snapshot is taken at
+ * the end, even when there was nothing left to clock. */
+template <typename unit_t, typename clock_fn, typename str_fn, typename windows_fn, typename step_fn>
+void drive(const UnitRun& run, unit_t& unit, uint64_t latency, uint64_t R, uint64_t C,
+        UnitResult& res, clock_fn clk, str_fn str, windows_fn windows, step_fn step)
+{
+    uint64_t budget = run.cycles ? run.cycles : latency;
+    if (!run.restore_path.empty())
+        load_checkpoint(run.restore_path, unit);
+    std::optional<MemoryModel> mem;
+    if (run.memory)
+        mem.emplace(*run.memory, run.unit, R, C, unit_is_MVM(run.unit, run.MVM_enable), latency);
+    bool save_mid = !run.checkpoint_path.empty() && run.checkpoint_at;
+    uint64_t save_at = run.checkpoint_at;
+    if (save_mid && save_at > budget)
+        throw std::runtime_error(std::format("checkpoint_at {} is past the end of the run ({} cycles, "
+                    "raise cycles to get there)", save_at, budget));
+    if (save_mid && save_at <= unit.get_counter())
+        throw std::runtime_error(std::format("checkpoint_at {} is not after the restored unit's "
+                    "cycle {}", save_at, unit.get_counter()));
+    res.stall_cycles = 0;
+    if (run.event_driven && !run.trace)
+    {
+        EventKernel ev(windows(), unit.get_counter());
+        for (uint64_t c = unit.get_counter(); c < budget; )
+        {
+            if (ev.idle())
+            {
+                uint64_t to = std::min(ev.next_event(), budget);
+                if (save_mid && c < save_at)
+                    to = std::min(to, save_at);
+                unit.skip_cycles(to - c);
+                if (mem)
+                    mem->idle(to - c);
+                c = to;
+            }
+            else
+            {
+                res.stall_cycles += mem ? mem->stall(c) : 0;
+                step(ev.active(), ev.retired());
+                c++;
+            }
+            ev.advance(c);
+            if (save_mid && c == save_at)
+                save_checkpoint(run.checkpoint_path, unit);
+        }
+    }
+    else
+        for (uint64_t c = unit.get_counter(); c < budget; c++)
+        {
+            uint64_t stall = mem ? mem->stall(c) : 0;
+            res.stall_cycles += stall;
+            if (run.trace && stall)
+                *run.trace << "Stalled " << stall << " cycles on memory" << std::endl;
+            clk();
+            if (run.trace)
+                *run.trace << "Clock cycle #" << c+1 << std::endl << str() << std::endl;
+            if (save_mid && c+1 == save_at)
+                save_checkpoint(run.checkpoint_path, unit);
+        }
+    if (!run.checkpoint_path.empty() && !save_mid)
+        save_checkpoint(run.checkpoint_path, unit);
+    res.cycles = std::max(budget, unit.get_counter()) + res.stall_cycles;
+    res.latency = latency;
+    res.ready = unit.get_counter() >= latency;
+    if (mem)
+        res.memory = mem->stats();
+}
+
+template <typename mac_t, uint64_t N>
+UnitResult run_mpu(const UnitRun& run)
+{
+    mac_t A[N][N], W[N][N], out[N][N];
+    load_tile<mac_t, N>(run.acts, A);
+    load_tile<mac_t, N>(run.weights, W);
+    auto unit = std::make_unique<Mpu<mac_t, N>>(A, W);
+    UnitResult res;
+    drive(run, *unit, unit->latency(), N, N, res, [&]{ unit->clock(); }, [&]{ return unit->to_string(); },
+            []{ return Mpu<mac_t, N>::windows(); },
+            [&](const auto& active, const auto& retired){ unit->clock_pes(active, retired); });
+    unit->get_mac_values(out);
+    res.result = from_tile<mac_t, N>(out);
+    return res;
+}
+
+template <typename mac_t, uint64_t R, uint64_t C = R>
+UnitResult run_mpuhsa(const UnitRun& run)
+{
+    mac_t A[C][R], W[R][C], out[C][C];
+    load_tile<mac_t, C, R>(run.acts, A);
+    load_tile<mac_t, R, C>(run.weights, W);
+    auto unit = std::make_unique<MpuHsa<mac_t, R, C>>(A, W);
+    UnitResult res;
+    drive(run, *unit, unit->latency(), R, C, res, [&]{ unit->clock(); }, [&]{ return unit->to_string(); },
+            []{ return MpuHsa<mac_t, R, C>::windows(); },
+            [&](const auto& active, const auto& retired){ unit->clock_pes(active, retired); });
+    unit->get_result(out);
+    res.result = from_tile<mac_t, C>(out);
+    return res;
+}
+
+template <typename mac_t, uint64_t R, uint64_t C = R>
+UnitResult run_hsa(const UnitRun& run)
+{
+    /* MMM result is CxC, MVM one R long */
+    mac_t A[C][R], W[R][C], out[std::max(R, C)][C];
+    bool mvm = run.MVM_enable;
+    if (mvm)
+    {
+        /* MVM takes the vector from the last col of acts */
+        mac_t v[C];
+        load_vector<mac_t, C>(run.acts, v);
+        for (uint64_t i = 0; i < C; i++)
+            for (uint64_t j = 0; j < R; j++)
+                A[i][j] = j == R-1 ? v[i] : mac_t::ZERO;
+    }
+    else
+        load_tile<mac_t, C, R>(run.acts, A);
+    load_tile<mac_t, R, C>(run.weights, W);
+    auto unit = std::make_unique<Hsa<mac_t, R, C>>(A, W, mvm);
+    UnitResult res;
+    drive(run, *unit, unit->latency(mvm), R, C, res, [&]{ unit->clock(mvm); },
+            [&]{ return mvm ? unit->to_string_MVM() : unit->to_string_MMM(); },
+            [&]{ return Hsa<mac_t, R, C>::windows(mvm); },
+            [&](const auto& active, const auto& retired){ unit->clock_pes(active, retired, mvm); });
+    unit->get_result(out, mvm);
+    if (mvm)
+    {
+        mac_t v[R];
+        for (uint64_t i = 0; i < R; i++)
+            v[i] = out[i][0];
+        res.result = from_vector<mac_t, R>(v);
+    }
+    else
+        res.result = from_tile<mac_t, C>(out);
+    return res;
+}
+
+template <typename mac_t, uint64_t N>
+UnitResult run_vpu(const UnitRun& run)
+{
+    mac_t v[N], W[N][N];
+    load_vector<mac_t, N>(run.acts, v);
+    load_tile<mac_t, N>(run.weights, W);
+    auto unit = std::make_unique<Vpu<mac_t, N>>(v, W);
+    UnitResult res;
+    drive(run, *unit, unit->latency(), N, N, res, [&]{ unit->clock(); }, [&]{ return unit->to_string(); },
+            []{ return Vpu<mac_t, N>::windows(); },
+            [&](const auto& active, const auto& retired){ unit->clock_pes(active, retired); });
+    mac_t *out = unit->get_result();
+    res.result = from_vector<mac_t, N>(out);
+    free(out);
+    return res;
+}
+
+template <typename mac_t, uint64_t N>
+UnitResult run_vpuhsa(const UnitRun& run)
+{
+    mac_t v[N], W[N][N], out[N];
+    load_vector<mac_t, N>(run.acts, v);
+    load_tile<mac_t, N>(run.weights, W);
+    auto unit = std::make_unique<VpuHsa<mac_t, N>>(v, W);
+    UnitResult res;
+    drive(run, *unit, unit->latency(), N, N, res, [&]{ unit->clock(); }, [&]{ return unit->to_string(); },
+            []{ return VpuHsa<mac_t, N>::windows(); },
+            [&](const auto& active, const auto& retired){ unit->clock_pes(active, retired); });
+    unit->get_result(out);
+    res.result = from_vector<mac_t, N>(out);
+    return res;
+}
+
+template <typename mac_t, uint64_t N>
+UnitResult run_spvpu(const UnitRun& run)
+{
+    mac_t v[N], W[N][N], packed[N][N], out[N];
+    uint64_t tags[N][N] = {};
+    load_vector<mac_t, N>(run.acts, v);
+    load_tile<mac_t, N>(run.weights, W);
+    /* Column merging, done in sw ahead of time on the FPGA too */
+    for (uint64_t i = 0; i < N; i++)
+        for (uint64_t j = 0; j < N; j++)
+        {
+            packed[i][j] = mac_t::ZERO;
+            if (j >= N/2) continue;
+            bool odd = W[i][2*j+1].value > W[i][2*j].value;
+            packed[i][j] = W[i][2*j + odd];
+            tags[i][j] = 2*j + odd;
+        }
+    auto unit = std::make_unique<SpVpu<mac_t, N>>(v, packed, tags);
+    UnitResult res;
+    /* PEs are N x N/2 */
+    drive(run, *unit, unit->latency(), N, N, res, [&]{ unit->clock(); }, [&]{ return unit->to_string(); },
+            []{ return SpVpu<mac_t, N>::windows(); },
+            [&](const auto& active, const auto& retired){ unit->clock_pes(active, retired); });
+    unit->get_result(out);
+    res.result = from_vector<mac_t, N>(out);
+    return res;
+}
+
+struct Entry
+{
+    UnitKey key;
+    unit_fn fn;
+};
+
+const std::vector<Entry>& table()
+{
+    static const std::vector<Entry> entries = []{
+        std::vector<Entry> t;
+#define UNIT_RUNNER_ADD(bits, n) \
+        t.push_back({{"mpu",    n, bits, n}, &run_mpu<mac_t_p<bits>, n>});    \
+        t.push_back({{"mpuhsa", n, bits, n}, &run_mpuhsa<mac_t_p<bits>, n>}); \
+        t.push_back({{"hsa",    n, bits, n}, &run_hsa<mac_t_p<bits>, n>});    \
+        t.push_back({{"vpu",    n, bits, n}, &run_vpu<mac_t_p<bits>, n>});    \
+        t.push_back({{"vpuhsa", n, bits, n}, &run_vpuhsa<mac_t_p<bits>, n>}); \
+        t.push_back({{"spvpu",  n, bits, n}, &run_spvpu<mac_t_p<bits>, n>});
+        UNIT_RUNNER_BITS(UNIT_RUNNER_ADD)
+#undef UNIT_RUNNER_ADD
+#define UNIT_RUNNER_ADD_RECT(bits, r, c) \
+        t.push_back({{"mpuhsa", r, bits, c}, &run_mpuhsa<mac_t_p<bits>, r, c>}); \
+        t.push_back({{"hsa",    r, bits, c}, &run_hsa<mac_t_p<bits>, r, c>});
+        UNIT_RUNNER_RECT(UNIT_RUNNER_ADD_RECT)
+#undef UNIT_RUNNER_ADD_RECT
+        return t;
+    }();
+    return entries;
+}
+
+}
+
+unit_fn find_unit(const std::string& unit, uint64_t N, uint64_t bits)
+{
+    return find_unit(unit, N, N, bits);
+}
+
+unit_fn find_unit(const std::string& unit, uint64_t R, uint64_t C, uint64_t bits)
+{
+    for (const Entry& e : table())
+        if (e.key.unit == unit && e.key.N == R && e.key.C == C && e.key.bits == bits)
+            return e.fn;
+    return nullptr;
+}
+
+std::vector<UnitKey> available_units()
+{
+    std::vector<UnitKey> ret;
+    for (const Entry& e : table())
+        ret.push_back(e.key);
+    return ret;
+}
+
+bool unit_is_MVM(const std::string& unit, bool MVM_enable)
+{
+    if (unit == "hsa") return MVM_enable;
+    return unit == "vpu" || unit == "vpuhsa" || unit == "spvpu";
+}
@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <format>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "mac_t.hh"
+#include "BertLayer.hh"
+
+/* Capacity planning for one BERT-base encoder layer on
+ * an 8x8 Hsa (same as the HVPU_8x8 build), or an 8x8
+ * output stationary Mpu for comparison.
+ *
+ * usage: bert_layer [--seq L] [--x X.npy] [--ffn-acts A.npy]
+ *                   [--weights-dir DIR] [--act-scale S]
+ *                   [--analytic] [--dump DIR] [--seed S]
+ *                   [--threads T] [--chained | --resident | --stream | --os]
+ *
+ * --ffn-acts takes what get_bert_act.py saves (acts_BERT_i.npy),
+ * and sets L from it unless --seq is given. Weights are read
+ * from DIR/{query,key,value,attention_output,intermediate,output}.npy
+ * (e.g. copy pruned_BERT.npy to DIR/intermediate.npy), anything
+ * missing is random. --threads pipelines the tiles over
+ * T simulation workers (0 = all cores), the results and
+ * cycle counts don't change. --chained sums each output
+ * tile's K tiles in the array through its psum-in port,
+ * writing back once per output tile. --resident loads each
+ * weight block into the Hsa once and runs all its tiles
+ * against it (weight loads charged), --stream feeds each
+ * weight block every activation row back to back through
+ * an HsaStream instead of cutting tiles (see HsaGemm.hh).
+ * --os streams all of K through an Mpu per output tile
+ * instead, drains charged (see MpuGemm.hh).
+ */
+typedef mac_t_p<32> mac_t;
+static const uint64_t N = 8;
+
+int main(int argc, char **argv)
+{
+    uint64_t seq = 0, seed = 0, threads = 1;
+    double act_scale = 256.0;
+    bool simulate = true;
+    GemmFlow flow = GemmFlow::tiled;
+    std::string x_path, ffn_path, weights_dir, dump_dir;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_val = i + 1 < argc;
+        if (arg == "--seq" && has_val)              seq = std::stoull(argv[++i]);
+        else if (arg == "--x" && has_val)           x_path = argv[++i];
+        else if (arg == "--ffn-acts" && has_val)    ffn_path = argv[++i];
+        else if (arg == "--weights-dir" && has_val) weights_dir = argv[++i];
+        else if (arg == "--act-scale" && has_val)   act_scale = std::stod(argv[++i]);
+        else if (arg == "--dump" && has_val)        dump_dir = argv[++i];
+        else if (arg == "--seed" && has_val)        seed = std::stoull(argv[++i]);
+        else if (arg == "--threads" && has_val)     threads = std::stoull(argv[++i]);
+        else if (arg == "--analytic")               simulate = false;
+        else if (arg == "--chained")                flow = GemmFlow::chained;
+        else if (arg == "--resident")               flow = GemmFlow::resident;
+        else if (arg == "--stream")                 flow = GemmFlow::streamed;
+        else if (arg == "--os")                     flow = GemmFlow::output_stationary;
+        else
+        {
+            std::cerr << "unknown argument " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    BertLayerWeights<mac_t> weights = BertLayerWeights<mac_t>::random(768, 3072, seed);
+    if (!weights_dir.empty())
+        for (const std::string& name : weights.load(weights_dir))
+            std::cout << "loaded " << name << std::endl;
+
+    Matrix<mac_t> ffn_acts;
+    if (!ffn_path.empty())
+    {
+        ffn_acts = to_matrix<mac_t>(load_npy(ffn_path), act_scale);
+        if (seq == 0) seq = ffn_acts.rows;
+    }
+    if (seq == 0) seq = 128;
+
+    Matrix<mac_t> X;
+    std::mt19937_64 rng(seed + 1);
+    if (!x_path.empty())
+        X = to_matrix<mac_t>(load_npy(x_path), act_scale);
+    else
+        X = BertLayerWeights<mac_t>::random_matrix(seq, 768, rng);
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    BertLayer<mac_t, N> layer(weights);
+    BertLayerReport report = layer.run(X, ffn_path.empty() ? nullptr : &ffn_acts, simulate, threads,
+            flow);
+
+    const char *flow_name = flow == GemmFlow::chained ? ", K chained"
+                          : flow == GemmFlow::resident ? ", resident weights"
+                          : flow == GemmFlow::streamed ? ", streamed" : "";
+    std::cout << std::format("{}x{} {}, L = {}, {}{}\n", N, N,
+            flow == GemmFlow::output_stationary ? "Mpu" : "Hsa", X.rows,
+            simulate ? "simulated" : "analytic", flow_name);
+    std::cout << std::format("{:<18} {:<16} {:<4} {:>10} {:>10} {:>12} {:>14} {:>8}\n",
+            "gemm", "shape", "mode", "tiles", "wloads", "writebacks", "cycles", "util");
+    for (const GemmStats& s : report.gemms)
+    {
+        std::string shape = std::to_string(s.M) + "x" + std::to_string(s.K) + "x" + std::to_string(s.N);
+        std::cout << std::format("{:<18} {:<16} {:<4} {:>10} {:>10} {:>12} {:>14} {:>7.2f}%\n",
+                s.name, shape, s.MVM_enable ? "MVM" : "MMM", s.tiles, s.weight_loads, s.writebacks,
+                s.cycles, 100.0 * s.utilization);
+    }
+    std::cout << std::format("{:<18} {:<16} {:<4} {:>10} {:>10} {:>12} {:>14} {:>7.2f}%\n",
+            "layer", "", "", "", "", report.writebacks, report.cycles, 100.0 * report.utilization);
+
+    if (simulate && !dump_dir.empty())
+    {
+        save_npy(dump_dir + "/Q.npy", layer.Q);
+        save_npy(dump_dir + "/K.npy", layer.K);
+        save_npy(dump_dir + "/V.npy", layer.V);
+        save_npy(dump_dir + "/attention_output.npy", layer.attention_output);
+        save_npy(dump_dir + "/intermediate.npy", layer.intermediate);
+        save_npy(dump_dir + "/output.npy", layer.output);
+    }
+    return 0;
+}
@@ -0,0 +1,165 @@
+#include <format>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "HsaCluster.hh"
+#include "mac_t.hh"
+
+/* Multi-array cluster, see HsaCluster.hh.
+ *
+ * usage: cluster [--gemm MxKxN] [--shapes 16x16,8x8,...] [--arrays 1,4,16]
+ *                [--mode mmm|mvm] [--split mn|k|both] [--buffer W]
+ *                [--verify] [--seed S] [--per-array]
+ *
+ * One line per (shape, arrays, split), so one big array
+ * can be held against several small ones with the same
+ * PE count. --verify also runs every tile cycle by cycle
+ * (random 8 bit operands) and checks the product against
+ * reference_matmul.
+ */
+typedef mac_t_p<32> mac_t;
+
+typedef ClusterStats (*cluster_fn)(const ClusterConfig&, uint64_t, uint64_t, uint64_t, bool, uint64_t);
+
+template <uint64_t R, uint64_t C>
+ClusterStats run_shape(const ClusterConfig& cfg, uint64_t M, uint64_t K, uint64_t N, bool verify, uint64_t seed)
+{
+    std::string name = std::format("{}x{}", R, C);
+    if (!verify)
+        return HsaCluster<mac_t, R, C>::schedule(cfg, name, M, K, N);
+
+    std::mt19937_64 rng(seed);
+    Matrix<mac_t> A(M, K), W(K, N), out;
+    for (mac_t& v : A.data) v.value = rng() & 0xff;
+    for (mac_t& v : W.data) v.value = rng() & 0xff;
+    ClusterStats s = HsaCluster<mac_t, R, C>::run(cfg, name, A, W, out);
+    if (!(out == reference_matmul(A, W)))
+        throw std::runtime_error("cluster: " + name + " result differs from reference_matmul");
+    return s;
+}
+
+struct Shape
+{
+    uint64_t R, C;
+    cluster_fn fn;
+};
+
+const std::vector<Shape> shapes = {
+    {2, 2, &run_shape<2, 2>},     {4, 4, &run_shape<4, 4>},     {8, 8, &run_shape<8, 8>},
+    {16, 16, &run_shape<16, 16>}, {32, 32, &run_shape<32, 32>},
+    {4, 8, &run_shape<4, 8>},     {8, 4, &run_shape<8, 4>},     {8, 16, &run_shape<8, 16>},
+    {16, 8, &run_shape<16, 8>},   {16, 32, &run_shape<16, 32>}, {32, 16, &run_shape<32, 16>},
+};
+
+std::vector<std::string> split_list(const std::string& s, char sep)
+{
+    std::vector<std::string> v;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, sep))
+        v.push_back(item);
+    return v;
+}
+
+int main(int argc, char **argv)
+{
+    ClusterConfig cfg;
+    uint64_t M = 128, K = 768, N = 768, seed = 0;
+    std::vector<std::string> shape_list = {"16x16", "8x8", "4x4"};
+    std::vector<uint64_t> arrays = {1, 4, 16};
+    std::string split = "both";
+    bool verify = false, per_array = false;
+    try
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            bool has_val = i + 1 < argc;
+            if (arg == "--gemm" && has_val)
+            {
+                std::vector<std::string> d = split_list(argv[++i], 'x');
+                if (d.size() != 3)
+                    throw std::runtime_error("cluster: --gemm takes MxKxN");
+                M = std::stoull(d[0]);
+                K = std::stoull(d[1]);
+                N = std::stoull(d[2]);
+            }
+            else if (arg == "--shapes" && has_val)  shape_list = split_list(argv[++i], ',');
+            else if (arg == "--arrays" && has_val)
+            {
+                arrays.clear();
+                for (const std::string& a : split_list(argv[++i], ','))
+                    arrays.push_back(std::stoull(a));
+            }
+            else if (arg == "--mode" && has_val)    cfg.MVM_enable = std::string(argv[++i]) == "mvm";
+            else if (arg == "--split" && has_val)   split = argv[++i];
+            else if (arg == "--buffer" && has_val)  cfg.buffer_words = std::stod(argv[++i]);
+            else if (arg == "--seed" && has_val)    seed = std::stoull(argv[++i]);
+            else if (arg == "--verify")             verify = true;
+            else if (arg == "--per-array")          per_array = true;
+            else
+            {
+                std::cerr << "usage: cluster [--gemm MxKxN] [--shapes 16x16,8x8,...] [--arrays 1,4,16]\n"
+                             "               [--mode mmm|mvm] [--split mn|k|both] [--buffer W]\n"
+                             "               [--verify] [--seed S] [--per-array]" << std::endl;
+                return 1;
+            }
+        }
+
+        std::vector<bool> splits;
+        if (split != "k") splits.push_back(false);
+        if (split != "mn") splits.push_back(true);
+
+        std::cout << std::format("{}x{}x{} {}, shared buffer {} words/cycle\n", M, K, N,
+                cfg.MVM_enable ? "mvm" : "mmm", cfg.buffer_words);
+        std::cout << std::format("{:<6} {:>6} {:>6} {:<5} {:>7} {:>7} {:>10} {:>8} {:>8} {:>10} {:>7} {:>7} {:>12}\n",
+                "shape", "arrays", "PEs", "split", "tasks", "steals", "cycles", "util", "PE util", "MAC/cycle",
+                "balance", "stall%", "buffer words");
+        for (const std::string& sh : shape_list)
+        {
+            const Shape *shape = nullptr;
+            for (const Shape& s : shapes)
+                if (std::format("{}x{}", s.R, s.C) == sh)
+                    shape = &s;
+            if (!shape)
+                throw std::runtime_error("cluster: shape " + sh + " is not instantiated");
+            for (uint64_t a : arrays)
+                for (bool k : splits)
+                {
+                    cfg.arrays = a;
+                    cfg.split_k = k;
+                    ClusterStats s = shape->fn(cfg, M, K, N, verify, seed);
+                    uint64_t stall = 0, busy = 0;
+                    for (const ClusterArrayStats& as : s.per_array)
+                    {
+                        stall += as.stall;
+                        busy += as.compute + as.transfer + as.stall;
+                    }
+                    std::cout << std::format("{:<6} {:>6} {:>6} {:<5} {:>7} {:>7} {:>10} {:>8.3f} {:>8.3f} {:>10.1f} {:>7.3f} {:>7.1f} {:>12}\n",
+                            s.name, s.arrays, s.pes, k ? "k" : "mn", s.tasks, s.steals, s.makespan,
+                            s.utilization, s.pe_utilization, s.macs_per_cycle, s.balance,
+                            busy ? 100.0 * stall / busy : 0.0, s.buffer_words);
+                    if (per_array)
+                        for (uint64_t i = 0; i < s.per_array.size(); i++)
+                        {
+                            const ClusterArrayStats& as = s.per_array[i];
+                            std::cout << std::format("    array {:>3}: {} tasks ({} steals), {} tiles, "
+                                                     "compute {} transfer {} stall {}, done at {}\n",
+                                    i, as.tasks, as.stolen, as.tiles, as.compute, as.transfer,
+                                    as.stall, as.finish);
+                        }
+                }
+        }
+        if (verify)
+            std::cout << "(every configuration matched reference_matmul)\n";
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
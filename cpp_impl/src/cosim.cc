@@ -0,0 +1,380 @@
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "verilated.h"
+
+#include "Hsa.hh"
+#include "SpVpu.hh"
+#include "mac_t.hh"
+
+/* Verilated RTL models, one per SIZE in ECE552_COSIM_SIZES */
+#if __has_include("VHsaCosim2.h")
+#include "VHsaCosim2.h"
+#endif
+#if __has_include("VHsaCosim4.h")
+#include "VHsaCosim4.h"
+#endif
+#if __has_include("VHsaCosim8.h")
+#include "VHsaCosim8.h"
+#endif
+#if __has_include("VHsaCosim16.h")
+#include "VHsaCosim16.h"
+#endif
+#if __has_include("VHsaCosim32.h")
+#include "VHsaCosim32.h"
+#endif
+#if __has_include("VHsaCosim64.h")
+#include "VHsaCosim64.h"
+#endif
+#if __has_include("VSpVpuCosim4.h")
+#include "VSpVpuCosim4.h"
+#endif
+#if __has_include("VSpVpuCosim8.h")
+#include "VSpVpuCosim8.h"
+#endif
+#if __has_include("VSpVpuCosim16.h")
+#include "VSpVpuCosim16.h"
+#endif
+#if __has_include("VSpVpuCosim32.h")
+#include "VSpVpuCosim32.h"
+#endif
+#if __has_include("VSpVpuCosim64.h")
+#include "VSpVpuCosim64.h"
+#endif
+
+/* Lockstep co-simulation of Hsa.sv / SpVpu.sv against
+ * the C++ models (only built with -DECE552_COSIM=ON).
+ *
+ * usage: cosim [--unit hsa|spvpu] [--n N] [--mode mmm|mvm] [--runs K]
+ *              [--seed S] [--threads T] [--keep-going]
+ *
+ * Both sides get the same random operands (16 bit, the
+ * wrappers' BIT_WIDTH). The RTL is loaded a weight column
+ * per clock, then every compute cycle drives the inputs
+ * the wrapper would (cycle_ctr, act_col_ix, activations),
+ * clocks the RTL and the C++ model once, and compares
+ * every latch. A run stops at its first diverging latch
+ * unless --keep-going.
+ *
+ * Latch correspondence:
+ *   hsa mvm : left_latches[i][j] <-> right_latches[i][j]
+ *   hsa mmm : the RTL is the C++ array transposed (acts
+ *             flow down, psums right), so
+ *             left_latches[r][k] <-> down_latches[k][r],
+ *             top_latches[r][k]  <-> right_latches[k][r],
+ *             RTL weight (r, k) is C++ weight (k, r)
+ *   spvpu   : left_latches[i][j] <-> right_latches[i][j]
+ * Runs go one cycle past the C++ latency, the RTL windows
+ * being N+1 cycles long (<= i+j+SIZE). After the last
+ * cycle the result ports are compared too (not for hsa
+ * mmm, where the wrapper collects them over time).
+ *
+ * SpMac.sv selects its activation on the wix input, not
+ * the stored weight_ix, so the tags bus carries the tags
+ * of the column being computed.
+ */
+typedef mac_t_p<16> mac_t;
+
+struct CosimOptions
+{
+    bool MVM_enable = true;
+    uint64_t runs = 16;
+    uint64_t seed = 0;
+    bool keep_going = false;
+};
+
+struct CosimStats
+{
+    uint64_t runs = 0, diverged = 0, cycles = 0;
+};
+
+template <typename top_t>
+void tick(top_t& top)
+{
+    top.eval();
+    top.clk = 1;
+    top.eval();
+    top.clk = 0;
+    top.eval();
+}
+
+void report(uint64_t run, uint64_t cycle, const char *latch, uint64_t i, uint64_t j, uint64_t rtl, uint64_t cpp)
+{
+    std::cout << std::format("run {}: cycle {}: {}[{}][{}] rtl {} c++ {}\n", run, cycle, latch, i, j, rtl, cpp);
+}
+
+template <typename top_t, uint64_t N>
+CosimStats cosim_hsa(VerilatedContext *ctx, const CosimOptions& o)
+{
+    std::mt19937_64 rng(o.seed);
+    bool mvm = o.MVM_enable;
+    CosimStats st;
+    for (uint64_t run = 0; run < o.runs; run++)
+    {
+        mac_t acts[N][N], W[N][N];
+        for (uint64_t i = 0; i < N; i++)
+            for (uint64_t j = 0; j < N; j++)
+            {
+                acts[i][j].value = rng() & 0xff;
+                W[i][j].value = rng() & 0xff;
+            }
+        auto model = std::make_unique<Hsa<mac_t, N>>(acts, W, mvm);
+        auto top = std::make_unique<top_t>(ctx);
+
+        /* Weights in a column per clock (vector mode loading) */
+        top->en = 0;
+        top->wEn = 1;
+        top->hsa_mode = 0;
+        for (uint64_t j = 0; j < N; j++)
+        {
+            top->weight_col_ix = j;
+            for (uint64_t r = 0; r < N; r++)
+                top->weights[r] = mvm ? W[r][j].value : W[j][r].value;
+            tick(*top);
+        }
+        top->wEn = 0;
+        top->hsa_mode = !mvm;
+
+        mac_t right[N][N], down[N][N];
+        bool bad = false, stop = false;
+        auto diverged = [&](uint64_t c, const char *latch, uint64_t i, uint64_t j, uint64_t rtl, uint64_t cpp)
+        {
+            report(run, c, latch, i, j, rtl, cpp);
+            bad = true;
+            stop = !o.keep_going;
+        };
+        uint64_t cycles = model->latency(mvm) + 1;
+        for (uint64_t c = 0; c < cycles && !stop; c++)
+        {
+            top->cycle_ctr = c;
+            for (uint64_t k = 0; k < N; k++)
+                top->activation[k] = 0;
+            if (mvm)
+            {
+                /* Column c gets a[c] broadcast */
+                top->en = c < N;
+                top->act_col_ix = c < N ? c : 0;
+                if (c < N)
+                    top->activation[0] = acts[c][N-1].value;
+            }
+            else
+            {
+                /* Row k of the C++ array (RTL column k) takes
+                 * acts[N-1-t][k] in its t-th active cycle */
+                top->en = 1;
+                for (uint64_t k = 0; k < N; k++)
+                    if (c >= k && c - k < N)
+                        top->activation[k] = acts[N-1-(c-k)][k].value;
+            }
+            model->clock(mvm);
+            tick(*top);
+            st.cycles++;
+
+            model->get_latches(right, down);
+            for (uint64_t i = 0; i < N && !stop; i++)
+                for (uint64_t j = 0; j < N && !stop; j++)
+                {
+                    uint64_t psum = mvm ? right[i][j].value : down[j][i].value;
+                    if (top->psum_latches[i][j] != psum)
+                        diverged(c, "left_latches", i, j, top->psum_latches[i][j], psum);
+                    if (!mvm && top->act_latches[i][j] != right[j][i].value)
+                        diverged(c, "top_latches", i, j, top->act_latches[i][j], right[j][i].value);
+                }
+        }
+        if (mvm && !stop)
+        {
+            mac_t out[N][N];
+            model->get_result(out, true);
+            for (uint64_t i = 0; i < N; i++)
+                if (top->result[i] != out[i][0].value)
+                    diverged(cycles, "result", i, 0, top->result[i], out[i][0].value);
+        }
+        top->final();
+        st.runs++;
+        st.diverged += bad;
+    }
+    return st;
+}
+
+template <typename top_t, uint64_t N>
+CosimStats cosim_spvpu(VerilatedContext *ctx, const CosimOptions& o)
+{
+    constexpr uint64_t PN = N / 2;
+    std::mt19937_64 rng(o.seed);
+    CosimStats st;
+    for (uint64_t run = 0; run < o.runs; run++)
+    {
+        mac_t v[N], W[N][N], packed[N][N];
+        uint64_t tags[N][N] = {};
+        for (uint64_t i = 0; i < N; i++)
+        {
+            v[i].value = rng() & 0xff;
+            for (uint64_t j = 0; j < N; j++)
+                W[i][j].value = rng() & 0xff;
+        }
+        /* Same column merging as UnitRunner */
+        for (uint64_t i = 0; i < N; i++)
+            for (uint64_t j = 0; j < N; j++)
+            {
+                packed[i][j] = mac_t::ZERO;
+                if (j >= PN) continue;
+                bool odd = W[i][2*j+1].value > W[i][2*j].value;
+                packed[i][j] = W[i][2*j + odd];
+                tags[i][j] = 2*j + odd;
+            }
+        auto model = std::make_unique<SpVpu<mac_t, N>>(v, packed, tags);
+        auto top = std::make_unique<top_t>(ctx);
+
+        top->en = 0;
+        top->wEn = 1;
+        for (uint64_t j = 0; j < PN; j++)
+        {
+            top->weight_col_ix = j;
+            for (uint64_t i = 0; i < N; i++)
+            {
+                top->weights[i] = packed[i][j].value;
+                top->weight_parity_tags[i] = tags[i][j] & 1;
+            }
+            tick(*top);
+        }
+        top->wEn = 0;
+
+        mac_t right[N][N];
+        bool bad = false, stop = false;
+        auto diverged = [&](uint64_t c, const char *latch, uint64_t i, uint64_t j, uint64_t rtl, uint64_t cpp)
+        {
+            report(run, c, latch, i, j, rtl, cpp);
+            bad = true;
+            stop = !o.keep_going;
+        };
+        uint64_t cycles = model->latency() + 1;
+        for (uint64_t c = 0; c < cycles && !stop; c++)
+        {
+            top->en = c < PN;
+            top->act_col_ix = c < PN ? c : 0;
+            top->activation_even = c < PN ? v[2*c].value : 0;
+            top->activation_odd = c < PN ? v[2*c+1].value : 0;
+            for (uint64_t i = 0; i < N; i++)
+                top->weight_parity_tags[i] = c < PN ? tags[i][c] & 1 : 0;
+            model->clock();
+            tick(*top);
+            st.cycles++;
+
+            model->get_latches(right);
+            for (uint64_t i = 0; i < N && !stop; i++)
+                for (uint64_t j = 0; j < PN && !stop; j++)
+                    if (top->psum_latches[i][j] != right[i][j].value)
+                        diverged(c, "left_latches", i, j, top->psum_latches[i][j], right[i][j].value);
+        }
+        if (!stop)
+        {
+            mac_t out[N];
+            model->get_result(out);
+            for (uint64_t i = 0; i < N; i++)
+                if (top->result[i] != out[i].value)
+                    diverged(cycles, "result", i, 0, top->result[i], out[i].value);
+        }
+        top->final();
+        st.runs++;
+        st.diverged += bad;
+    }
+    return st;
+}
+
+typedef std::function<CosimStats(VerilatedContext *, const CosimOptions&)> cosim_fn;
+
+cosim_fn find_cosim(const std::string& unit, uint64_t N)
+{
+#define COSIM_HSA(n) if (unit == "hsa" && N == n) return &cosim_hsa<VHsaCosim##n, n>;
+#define COSIM_SPVPU(n) if (unit == "spvpu" && N == n) return &cosim_spvpu<VSpVpuCosim##n, n>;
+#if __has_include("VHsaCosim2.h")
+    COSIM_HSA(2)
+#endif
+#if __has_include("VHsaCosim4.h")
+    COSIM_HSA(4)
+#endif
+#if __has_include("VHsaCosim8.h")
+    COSIM_HSA(8)
+#endif
+#if __has_include("VHsaCosim16.h")
+    COSIM_HSA(16)
+#endif
+#if __has_include("VHsaCosim32.h")
+    COSIM_HSA(32)
+#endif
+#if __has_include("VHsaCosim64.h")
+    COSIM_HSA(64)
+#endif
+#if __has_include("VSpVpuCosim4.h")
+    COSIM_SPVPU(4)
+#endif
+#if __has_include("VSpVpuCosim8.h")
+    COSIM_SPVPU(8)
+#endif
+#if __has_include("VSpVpuCosim16.h")
+    COSIM_SPVPU(16)
+#endif
+#if __has_include("VSpVpuCosim32.h")
+    COSIM_SPVPU(32)
+#endif
+#if __has_include("VSpVpuCosim64.h")
+    COSIM_SPVPU(64)
+#endif
+#undef COSIM_HSA
+#undef COSIM_SPVPU
+    return nullptr;
+}
+
+int main(int argc, char **argv)
+{
+    std::string unit = "hsa";
+    uint64_t N = 8, threads = 1;
+    CosimOptions o;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_val = i + 1 < argc;
+        if (arg == "--unit" && has_val)             unit = argv[++i];
+        else if (arg == "--n" && has_val)           N = std::stoull(argv[++i]);
+        else if (arg == "--mode" && has_val)        o.MVM_enable = std::string(argv[++i]) == "mvm";
+        else if (arg == "--runs" && has_val)        o.runs = std::stoull(argv[++i]);
+        else if (arg == "--seed" && has_val)        o.seed = std::stoull(argv[++i]);
+        else if (arg == "--threads" && has_val)     threads = std::stoull(argv[++i]);
+        else if (arg == "--keep-going")             o.keep_going = true;
+        else
+        {
+            std::cerr << "usage: cosim [--unit hsa|spvpu] [--n N] [--mode mmm|mvm] [--runs K]\n"
+                         "             [--seed S] [--threads T] [--keep-going]" << std::endl;
+            return 1;
+        }
+    }
+
+    cosim_fn fn = find_cosim(unit, N);
+    if (!fn)
+    {
+        std::cerr << std::format("cosim: {} was not verilated with SIZE={} (see ECE552_COSIM_SIZES)", unit, N)
+                  << std::endl;
+        return 1;
+    }
+
+    /* Must be set before any model exists, and can't be
+     * more than the --threads the RTL was verilated with */
+    auto ctx = std::make_unique<VerilatedContext>();
+    ctx->commandArgs(argc, argv);
+    ctx->threads(threads);
+
+    auto start = std::chrono::steady_clock::now();
+    CosimStats st = fn(ctx.get(), o);
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << std::format("{} {} n={}: {}/{} runs diverged, {} cycles in {:.3f}s ({:.0f} cycles/s, {} threads)\n",
+            unit, unit == "hsa" ? (o.MVM_enable ? "mvm" : "mmm") : "mvm", N, st.diverged, st.runs,
+            st.cycles, secs, st.cycles / secs, ctx->threads());
+    return st.diverged ? 1 : 0;
+}
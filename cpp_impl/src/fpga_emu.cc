@@ -0,0 +1,80 @@
+#include <csignal>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+#include <unistd.h>
+
+#include "FpgaEmulator.hh"
+
+/* Emulated board on a pty, see FpgaEmulator.hh.
+ *
+ * usage: fpga_emu [--unit hsa|spvpu] [--n N] [--mode mmm|mvm]
+ *                 [--baud B] [--throttle] [--link PATH] [--legacy] [--raw] [--verbose]
+ *
+ * --legacy plays a board without bulk frame support,
+ * --raw sends bulk results without the payload codecs.
+ *
+ * Prints the pty path (and symlinks it to PATH if asked),
+ * then serves until interrupted, e.g.
+ *   fpga_emu --link /tmp/ttyFPGA --throttle &
+ *   uart_host /tmp/ttyFPGA --runs 100
+ */
+static volatile std::sig_atomic_t stop = 0;
+
+static void on_signal(int)
+{
+    stop = 1;
+}
+
+int main(int argc, char **argv)
+{
+    EmulatorConfig cfg;
+    std::string link;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_val = i + 1 < argc;
+        if (arg == "--unit" && has_val)         cfg.unit = argv[++i];
+        else if (arg == "--n" && has_val)       cfg.n = std::stoull(argv[++i]);
+        else if (arg == "--mode" && has_val)    cfg.vector_mode = std::string(argv[++i]) == "mvm";
+        else if (arg == "--baud" && has_val)    cfg.baudrate = std::stoull(argv[++i]);
+        else if (arg == "--link" && has_val)    link = argv[++i];
+        else if (arg == "--throttle")           cfg.throttle = true;
+        else if (arg == "--legacy")             cfg.bulk = false;
+        else if (arg == "--raw")                cfg.compress = false;
+        else if (arg == "--verbose")            cfg.verbose = true;
+        else
+        {
+            std::cerr << "usage: fpga_emu [--unit hsa|spvpu] [--n N] [--mode mmm|mvm]\n"
+                         "                [--baud B] [--throttle] [--link PATH] [--legacy] [--raw] [--verbose]" << std::endl;
+            return 1;
+        }
+    }
+
+    try
+    {
+        FpgaEmulator emu(cfg);
+        if (!link.empty())
+        {
+            unlink(link.c_str());
+            if (symlink(emu.port().c_str(), link.c_str()) != 0)
+                throw std::runtime_error("fpga_emu: unable to link " + link);
+        }
+        std::cout << emu.port() << std::endl;
+
+        std::signal(SIGINT, on_signal);
+        std::signal(SIGTERM, on_signal);
+        emu.serve(&stop);
+
+        if (!link.empty())
+            unlink(link.c_str());
+        std::cerr << "fpga_emu: served " << emu.requests << " requests" << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
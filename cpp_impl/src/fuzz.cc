@@ -0,0 +1,126 @@
+#include <format>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Fuzz.hh"
+
+/* Differential fuzzer, see Fuzz.hh.
+ *
+ * usage: fuzz [--cases C] [--seconds S] [--seed S] [--threads T]
+ *             [--units mpu,hsa,...] [--n 2,4,...] [--bits 8,16,...]
+ *             [--mode mmm|mvm|both] [--failures F] [--no-shrink] [--case ID]
+ *
+ * Prints throughput, then for every failing case its
+ * (seed, id), how it was shrunk, expected vs. got and a
+ * main command line replaying it. --case ID runs that one
+ * case only. Exits 1 if anything failed.
+ */
+template <typename T, typename F>
+std::vector<T> parse_list(const std::string& s, F conv)
+{
+    std::vector<T> v;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ','))
+        v.push_back(conv(item));
+    return v;
+}
+
+std::string rows(const Matrix<wide_t>& m)
+{
+    std::string ret;
+    for (uint64_t i = 0; i < m.rows; i++)
+    {
+        ret += "    ";
+        for (uint64_t j = 0; j < m.cols; j++)
+            ret += std::format("{:>11}", m.at(i, j).value);
+        ret += "\n";
+    }
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    FuzzConfig cfg;
+    std::string mode = "both";
+    bool one_case = false;
+    uint64_t case_id = 0;
+    auto to_uint = [](const std::string& s) { return (uint64_t)std::stoull(s); };
+    auto to_str = [](const std::string& s) { return s; };
+    try
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            bool has_val = i + 1 < argc;
+            if (arg == "--cases" && has_val)            cfg.cases = std::stoull(argv[++i]);
+            else if (arg == "--seconds" && has_val)     cfg.seconds = std::stod(argv[++i]);
+            else if (arg == "--seed" && has_val)        cfg.seed = std::stoull(argv[++i]);
+            else if (arg == "--threads" && has_val)     cfg.threads = std::stoull(argv[++i]);
+            else if (arg == "--units" && has_val)       cfg.units = parse_list<std::string>(argv[++i], to_str);
+            else if (arg == "--n" && has_val)           cfg.n = parse_list<uint64_t>(argv[++i], to_uint);
+            else if (arg == "--bits" && has_val)        cfg.bits = parse_list<uint64_t>(argv[++i], to_uint);
+            else if (arg == "--mode" && has_val)        mode = argv[++i];
+            else if (arg == "--failures" && has_val)    cfg.max_failures = std::stoull(argv[++i]);
+            else if (arg == "--no-shrink")              cfg.shrink = false;
+            else if (arg == "--case" && has_val)
+            {
+                one_case = true;
+                case_id = std::stoull(argv[++i]);
+            }
+            else
+            {
+                std::cerr << "usage: fuzz [--cases C] [--seconds S] [--seed S] [--threads T]\n"
+                             "            [--units mpu,hsa,...] [--n 2,4,...] [--bits 8,16,...]\n"
+                             "            [--mode mmm|mvm|both] [--failures F] [--no-shrink] [--case ID]"
+                          << std::endl;
+                return 1;
+            }
+        }
+        if (mode != "both")
+            cfg.modes = {mode};
+
+        if (one_case)
+        {
+            /* Same target and operands as case_id in a full run */
+            FuzzCase c = make_fuzz_case(cfg, case_id);
+            Matrix<wide_t> expected = fuzz_reference(c), got;
+            bool bad = false;
+            for (const std::string& unit : cfg.units)
+            {
+                if (unit_is_MVM(unit, c.MVM_enable) != c.MVM_enable) continue;
+                bool ok = fuzz_check(c, unit, expected, got);
+                bad |= !ok;
+                std::cout << std::format("case {}: {} n={} bits={} {}/{}: {} {}\n", c.id,
+                        c.MVM_enable ? "mvm" : "mmm", c.n, c.bits, c.acts_pattern,
+                        c.weights_pattern, unit, ok ? "ok" : "FAIL");
+            }
+            return bad ? 1 : 0;
+        }
+
+        FuzzReport r = run_fuzz(cfg);
+        std::cout << std::format("{} cases, {} unit runs in {:.2f}s ({:.0f} cases/min), {} failing\n",
+                r.cases, r.unit_runs, r.seconds, 60 * r.cases / r.seconds, r.failures.size());
+        for (const FuzzFailure& f : r.failures)
+        {
+            const FuzzCase& c = f.shrunk;
+            std::cout << std::format("\n{} disagrees with the reference: seed {} case {} ({} n={} bits={}, "
+                                     "acts {}, weights {})\n",
+                    f.unit, cfg.seed, c.id, c.MVM_enable ? "mvm" : "mmm", f.original.n, c.bits,
+                    c.acts_pattern, c.weights_pattern);
+            if (cfg.shrink)
+                std::cout << std::format("  shrunk in {} steps to n={}\n", f.shrink_steps, c.n);
+            std::cout << "  acts:\n" << rows(c.acts) << "  weights:\n" << rows(c.weights)
+                      << "  expected:\n" << rows(f.expected) << "  got:\n" << rows(f.got)
+                      << "  replay: " << fuzz_repro(c, f.unit) << std::endl;
+        }
+        return r.failures.empty() ? 0 : 1;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,96 @@
+#include <format>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "LinkModel.hh"
+#include "UnitRunner.hh"
+
+/* Host link timing model, see LinkModel.hh.
+ *
+ * usage: link_model [--unit U] [--n 2,4,8,16] [--mode mmm|mvm|both]
+ *                   [--baud B] [--bulk] [--latency S] [--requests K]
+ *
+ * One line per (n, mode) for both the closed form (est)
+ * and the event driven (sim) model: per phase latency in
+ * ms, the start to start period of back to back requests,
+ * bytes each way, and the roofline bound.
+ */
+std::vector<uint64_t> parse_list(const std::string& s)
+{
+    std::vector<uint64_t> v;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ','))
+        v.push_back(std::stoull(item));
+    return v;
+}
+
+int main(int argc, char **argv)
+{
+    LinkConfig cfg;
+    std::string unit = "hsa", mode = "both";
+    std::vector<uint64_t> ns = {2, 4, 8, 16};
+    uint64_t requests = 4;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_val = i + 1 < argc;
+        if (arg == "--unit" && has_val)             unit = argv[++i];
+        else if (arg == "--n" && has_val)           ns = parse_list(argv[++i]);
+        else if (arg == "--mode" && has_val)        mode = argv[++i];
+        else if (arg == "--baud" && has_val)        cfg.baudrate = std::stoull(argv[++i]);
+        else if (arg == "--latency" && has_val)     cfg.host_latency = std::stod(argv[++i]);
+        else if (arg == "--requests" && has_val)    requests = std::stoull(argv[++i]);
+        else if (arg == "--bulk")                   cfg.bulk = true;
+        else
+        {
+            std::cerr << "usage: link_model [--unit U] [--n 2,4,8,16] [--mode mmm|mvm|both]\n"
+                         "                  [--baud B] [--bulk] [--latency S] [--requests K]" << std::endl;
+            return 1;
+        }
+    }
+
+    /* Fixed mode units only get their own */
+    std::vector<bool> modes;
+    if (mode != "mmm") modes.push_back(true);
+    if (mode != "mvm") modes.push_back(false);
+    if (modes.size() == 2 && unit_is_MVM(unit, true) == unit_is_MVM(unit, false))
+        modes = {unit_is_MVM(unit, true)};
+
+    try
+    {
+        std::cout << std::format("{} @ {} baud ({}), host latency {} ms\n", unit, cfg.baudrate,
+                cfg.bulk ? "bulk frames" : "dataframes", 1e3 * cfg.host_latency);
+        std::cout << std::format("{:>4} {:<4} {:<3} {:>8} {:>8} {:>8} {:>8} {:>9} {:>9} {:>6} {:>6} {:>8} {:>11} {:<7}\n",
+                "n", "mode", "", "sync", "payload", "compute", "readback", "latency", "period",
+                "tx", "rx", "MAC/B", "MAC/s", "bound");
+        for (uint64_t n : ns)
+            for (bool mvm : modes)
+            {
+                LinkRequest req;
+                req.unit = unit;
+                req.n = n;
+                req.vector_mode = mvm;
+                LinkBreakdown est = estimate_link(cfg, req);
+                LinkBreakdown sim = simulate_link(cfg, req, requests);
+                for (const LinkBreakdown* b : {&est, &sim})
+                    std::cout << std::format("{:>4} {:<4} {:<3} {:>8.3f} {:>8.3f} {:>8.4f} {:>8.3f} {:>9.3f} {:>9.3f} {:>6} {:>6} {:>8.3f} {:>11.0f} {:<7}\n",
+                            n, mvm ? "mvm" : "mmm", b == &est ? "est" : "sim",
+                            1e3 * b->sync, 1e3 * b->payload, 1e3 * b->compute, 1e3 * b->readback,
+                            1e3 * b->latency, 1e3 * b->period, b->tx_bytes, b->rx_bytes,
+                            b->intensity, b->bound_macs_per_s, b->link_bound ? "link" : "compute");
+                if (sim.sync_resends)
+                    std::cout << std::format("     {} sync bursts resent per request\n",
+                            (double)sim.sync_resends / requests);
+            }
+        std::cout << "(times in ms, bytes per request)\n";
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -1,60 +1,126 @@
 #include <iostream>
+#include <string>
 
-#include "mac_t.hh"
-#include "Mpu.hh"
-#include "MpuHsa.hh"
-#include "VpuHsa.hh"
-#include "Vpu.hh"
-#include "Hsa.hh"
-#include "SpVpu.hh"
+#include "Experiment.hh"
+#include "Json.hh"
+#include "UnitRunner.hh"
 
-typedef mac_t_p<8> mac_t;
+/* Experiment runner, see Experiment.hh for the config format.
+ *
+ * usage: main [--config FILE] [--unit U] [--n N] [--cols C] [--bits B]
+ *             [--mode mmm|mvm] [--acts SPEC] [--weights SPEC]
+ *             [--cycles C] [--seed S] [--out SINK]... [--list]
+ *             [--checkpoint PATH [--checkpoint_at C]] [--restore PATH]
+ *             [--memory '{"banks": 4, "backing_words": 2, ...}']
+ *             [--kernel cycle|event]
+ *
+ * Options override the config file for every experiment in it,
+ * e.g. the old demo (2x2, 8 bit, hsa in MVM, printing every cycle):
+ *   main --unit hsa --n 2 --bits 8 --mode mvm \
+ *        --acts '[[3,4],[5,6]]' --weights '[[7,2],[1,1]]' --out trace:- --out stdout
+ */
+static void usage()
+{
+    std::cerr << "usage: main [--config FILE] [--unit U] [--n N] [--cols C] [--bits B] [--mode mmm|mvm]\n"
+                 "            [--acts SPEC] [--weights SPEC] [--cycles C] [--seed S]\n"
+                 "            [--out SINK]... [--list]\n"
+                 "            [--checkpoint PATH [--checkpoint_at C]] [--restore PATH]\n"
+                 "            [--memory JSON] [--kernel cycle|event]" << std::endl;
+}
 
 int main(int argc, char **argv)
 {
-    mac_t A[2][2] = {
-        {3, 4},
-        {5, 6}
-    };
-    mac_t B[2][2] = {
-        {7, 2},
-        {1, 1}
-    };
-    mac_t v[2] = {
-        9,
-        3
-    };
-    // Mpu<mac_t, 2> mpu = Mpu<mac_t, 2>(A, B);
-    MpuHsa<mac_t, 2> mpu = MpuHsa<mac_t, 2>(A, B);
-    VpuHsa<mac_t, 2> vpu = VpuHsa<mac_t, 2>(v, A);
-    Hsa<mac_t, 2> hsa = Hsa<mac_t, 2>(A, B, false);
-    SpVpu<mac_t, 2> hsa = SpVpu<mac_t, 2>(A, B, false);
+    Json config, overrides;
+    overrides.type = Json::OBJECT;
+    config.type = Json::OBJECT;
 
-    std::cout << "Init" << std::endl << vpu.to_string() << std::endl;
-    for (int i = 0; i < 5; i++)
+    for (int i = 1; i < argc; i++)
     {
-        vpu.clock();
-        std::cout << "Clock cycle #" << i+1 << std::endl << vpu.to_string() << std::endl;
+        std::string arg = argv[i];
+        if (arg == "--list")
+        {
+            for (const UnitKey& k : available_units())
+                std::cout << k.unit << " n=" << k.N << (k.C != k.N ? " cols=" + std::to_string(k.C) : "")
+                          << " bits=" << k.bits << std::endl;
+            return 0;
+        }
+        if (arg == "--help" || arg == "-h")
+        {
+            usage();
+            return 0;
+        }
+        if (i + 1 >= argc || arg.rfind("--", 0) != 0)
+        {
+            usage();
+            return 1;
+        }
+        std::string val = argv[++i];
+        std::string key = arg.substr(2);
+        if (key == "config")
+        {
+            config = Json::parse_file(val);
+            continue;
+        }
+        Json v;
+        if (key == "memory")
+            v = Json::parse(val);
+        else if (key == "acts" || key == "weights")
+        {
+            if (!val.empty() && val[0] == '[')
+                v = Json::parse(val);
+            else
+            {
+                v.type = Json::STRING;
+                v.str = val;
+            }
+        }
+        else if (key == "out")
+        {
+            key = "outputs";
+            v = overrides["outputs"];
+            v.type = Json::ARRAY;
+            Json s;
+            s.type = Json::STRING;
+            s.str = val;
+            v.arr.push_back(s);
+        }
+        else if (key == "unit" || key == "mode" || key == "n" || key == "cols" || key == "bits" ||
+                key == "cycles" || key == "seed" || key == "name" || key == "restore" ||
+                key == "checkpoint" || key == "checkpoint_at" || key == "kernel")
+        {
+            v.type = Json::STRING;
+            v.str = val;
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+        v.key = key;
+        overrides.obj[key] = v;
     }
-    // mac_t *res = vpu.get_result(); 
-    // std::cout << res[0] << "\n" << res[1] << "\n";
-    // free(res);
-
-    // std::cout << "Init" << std::endl << hsa.to_string_MMM() << std::endl;
-    // for (int i = 0; i < 5; i++)
-    // {
-    //     hsa.clock(false);
-    //     std::cout << "Clock cycle #" << i+1 << std::endl << hsa.to_string_MMM() << std::endl;
-    // }
-    // hsa.print_result_values();
-    // mpu.print_result_values();
-    // mpu.print_mac_values(); 
 
-    hsa.reset(true);
-    std::cout << "Init" << std::endl << hsa.to_string_MVM() << std::endl;
-    for (int i = 0; i < 5; i++)
+    int failures = 0;
+    try
+    {
+        for (const ExperimentConfig& cfg : load_experiments(config, overrides))
+        {
+            try
+            {
+                run_experiment(cfg);
+            }
+            catch (const std::exception& e)
+            {
+                /* Keep going, one bad entry shouldn't kill a batch */
+                std::cerr << e.what() << std::endl;
+                failures++;
+            }
+        }
+    }
+    catch (const std::exception& e)
     {
-        hsa.clock(true);
-        std::cout << "Clock cycle #" << i+1 << std::endl << hsa.to_string_MVM() << std::endl;
+        std::cerr << e.what() << std::endl;
+        return 1;
     }
+    return failures ? 1 : 0;
 }
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "Json.hh"
+#include "Sweep.hh"
+
+/* Design space sweep, see Sweep.hh.
+ *
+ * usage: sweep [--config GRID.json] [--threads T] [--out FILE]
+ *              [--pareto FILE] [--trials K] [--resume]
+ *
+ * e.g. GRID.json:
+ *   { "n": [2, 4, 8, 16], "cols": [4, 8, 16], "op_bits": [4, 8], "acc_bits": [8, 16, 32],
+ *     "unit": ["mpu", "mpuhsa", "hsa", "spvpu"], "mode": ["mmm", "mvm"],
+ *     "trials": 32, "output": "sweep.csv",
+ *     "memory": [{"banks": 16, "backing_words": 4}, {"banks": 4, "backing_words": 1}] }
+ *
+ * With memory configs, the bandwidth bound points are
+ * listed after the frontier.
+ */
+int main(int argc, char **argv)
+{
+    Json grid;
+    grid.type = Json::OBJECT;
+    SweepConfig cfg;
+    bool resume = false;
+    std::string threads, out, pareto, trials;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_val = i + 1 < argc;
+        if (arg == "--config" && has_val)       grid = Json::parse_file(argv[++i]);
+        else if (arg == "--threads" && has_val) threads = argv[++i];
+        else if (arg == "--out" && has_val)     out = argv[++i];
+        else if (arg == "--pareto" && has_val)  pareto = argv[++i];
+        else if (arg == "--trials" && has_val)  trials = argv[++i];
+        else if (arg == "--resume")             resume = true;
+        else
+        {
+            std::cerr << "usage: sweep [--config GRID.json] [--threads T] [--out FILE]\n"
+                         "             [--pareto FILE] [--trials K] [--resume]" << std::endl;
+            return 1;
+        }
+    }
+
+    try
+    {
+        cfg = parse_sweep_config(grid);
+        if (!threads.empty()) cfg.threads = std::stoull(threads);
+        if (!out.empty())     cfg.output = out;
+        if (!pareto.empty())  cfg.pareto_output = pareto;
+        if (!trials.empty())  cfg.trials = std::stoull(trials);
+        cfg.resume = cfg.resume || resume;
+
+        std::vector<SweepResult> results = run_sweep(cfg);
+        std::vector<SweepResult> front = pareto_frontier(results);
+        std::sort(front.begin(), front.end(), [](const SweepResult& a, const SweepResult& b) {
+            return a.cycles_per_mac != b.cycles_per_mac ? a.cycles_per_mac < b.cycles_per_mac
+                                                        : a.energy_per_mac < b.energy_per_mac;
+        });
+
+        std::cout << std::format("{} points, {} on the Pareto frontier (cycles and energy per MAC, "
+                                 "error)\n",
+                results.size(), front.size());
+        auto header = []()
+        {
+            std::cout << std::format("{:>6} {:<7} {:<4} {:>4} {:>4} {:>3} {:>3} {:>8} {:>8} {:>12} {:>9} "
+                                     "{:>9} {:>10} {:<18} {:>7} {:<7}\n", "id", "unit", "mode", "n", "cols",
+                    "op", "acc", "cycles", "util", "energy", "cyc/mac", "e/mac", "error", "memory", "stalls",
+                    "bound");
+        };
+        auto line = [](const SweepResult& r)
+        {
+            std::cout << std::format("{:>6} {:<7} {:<4} {:>4} {:>4} {:>3} {:>3} {:>8} {:>8.3f} {:>12.1f} {:>9.4f} "
+                                     "{:>9.2f} {:>10.4f} {:<18} {:>7} {:<7}\n", r.point.id, r.point.unit,
+                    r.point.mode, r.point.n, r.point.cols, r.point.op_bits, r.point.acc_bits, r.cycles,
+                    r.utilization, r.energy, r.cycles_per_mac, r.energy_per_mac, r.error,
+                    r.point.memory_label, r.stalls, r.bound);
+        };
+        header();
+        for (const SweepResult& r : front)
+            line(r);
+
+        if (!cfg.memories.empty())
+        {
+            std::vector<SweepResult> bound;
+            for (const SweepResult& r : results)
+                if (r.bound != "compute")
+                    bound.push_back(r);
+            std::sort(bound.begin(), bound.end(), [](const SweepResult& a, const SweepResult& b) {
+                return a.point.id < b.point.id;
+            });
+            std::cout << std::format("\n{} of {} points bandwidth bound (stalled on the sram banks or "
+                                     "the backing store)\n", bound.size(), results.size());
+            if (!bound.empty())
+                header();
+            for (const SweepResult& r : bound)
+                line(r);
+        }
+
+        if (!cfg.pareto_output.empty())
+        {
+            std::ofstream f(cfg.pareto_output);
+            f << sweep_csv_header() << std::endl;
+            for (const SweepResult& r : front)
+                f << sweep_csv_line(r) << std::endl;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
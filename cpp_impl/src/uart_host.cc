@@ -0,0 +1,132 @@
+#include <format>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Matrix.hh"
+#include "UartHost.hh"
+
+/* C++ counterpart of uart_comms/main.py: random tests
+ * against the board, checked against W^T * acts.
+ *
+ * usage: uart_host PORT [--n N] [--baud B] [--runs K]
+ *                  [--mode mmm|mvm] [--switch] [--seed S] [--legacy] [--raw]
+ *                  [--prune] [--act-zeros P] [--verbose]
+ *
+ * Bulk frames are negotiated unless --legacy is given,
+ * and compressed unless --raw is. --prune 2:4 prunes the
+ * weights the way SpVpu merges them (the larger of each
+ * column pair is kept), --act-zeros zeroes each act with
+ * probability P, to see what the codecs save.
+ *
+ * All runs go through a single run_batch(), so packing
+ * overlaps with the board computing.
+ */
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: uart_host PORT [--n N] [--baud B] [--runs K] [--mode mmm|mvm]\n"
+                     "                 [--switch] [--seed S] [--legacy] [--raw] [--prune]\n"
+                     "                 [--act-zeros P] [--verbose]" << std::endl;
+        return 1;
+    }
+    std::string port = argv[1];
+    uint64_t N = 8, baud = 921600, runs = 20, seed = 0;
+    bool vector_mode = true, do_switch = false, verbose = false, bulk = true;
+    bool compress = true, prune = false;
+    double act_zeros = 0;
+    for (int i = 2; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_val = i + 1 < argc;
+        if (arg == "--n" && has_val)            N = std::stoull(argv[++i]);
+        else if (arg == "--baud" && has_val)    baud = std::stoull(argv[++i]);
+        else if (arg == "--runs" && has_val)    runs = std::stoull(argv[++i]);
+        else if (arg == "--seed" && has_val)    seed = std::stoull(argv[++i]);
+        else if (arg == "--mode" && has_val)    vector_mode = std::string(argv[++i]) == "mvm";
+        else if (arg == "--switch")             do_switch = true;
+        else if (arg == "--legacy")             bulk = false;
+        else if (arg == "--raw")                compress = false;
+        else if (arg == "--prune")              prune = true;
+        else if (arg == "--act-zeros" && has_val) act_zeros = std::stod(argv[++i]);
+        else if (arg == "--verbose")            verbose = true;
+        else
+        {
+            std::cerr << "uart_host: unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    try
+    {
+        UartHost host(port, N, baud);
+        host.verbose = verbose;
+        host.bulk = bulk;
+        host.compress = compress;
+        if (do_switch)
+            host.switch_mode(vector_mode);
+
+        /* Same operand range as SAUnit.rand_test */
+        std::mt19937_64 rng(seed);
+        std::uniform_int_distribution<uint64_t> dist(0, 100);
+        std::bernoulli_distribution zero(act_zeros);
+        std::vector<UartRequest> reqs(runs);
+        std::vector<Matrix<wide_t>> expected(runs);
+        for (uint64_t r = 0; r < runs; r++)
+        {
+            UartRequest& req = reqs[r];
+            req.vector_mode = vector_mode;
+            req.tile_id = (uint32_t)r;
+            req.weights = Matrix<wide_t>(N, N);
+            req.acts = Matrix<wide_t>(N, vector_mode ? 1 : N);
+            for (wide_t& v : req.weights.data) v.value = dist(rng);
+            for (wide_t& v : req.acts.data) v.value = zero(rng) ? 0 : dist(rng);
+            /* weights.at(x, y) is sram [y][x], pairs run along x */
+            if (prune)
+                for (uint64_t y = 0; y < N; y++)
+                    for (uint64_t x = 0; x + 1 < N; x += 2)
+                    {
+                        wide_t& a = req.weights.at(x, y);
+                        wide_t& b = req.weights.at(x + 1, y);
+                        (b.value > a.value ? a : b).value = 0;
+                    }
+            expected[r] = reference_matmul(req.weights.transposed(), req.acts);
+            for (wide_t& v : expected[r].data) v.value &= 0xffff;
+        }
+
+        std::vector<UartResponse> resps = host.run_batch(reqs);
+        uint64_t correct = 0, bulk_runs = 0;
+        uint64_t tx = 0, tx_raw = 0, rx = 0, rx_raw = 0;
+        double fpga = 0, sys = 0;
+        for (uint64_t r = 0; r < runs; r++)
+        {
+            bool ok = resps[r].ok && resps[r].result == expected[r];
+            correct += ok;
+            bulk_runs += resps[r].bulk;
+            tx += resps[r].tx_bytes;
+            tx_raw += resps[r].tx_raw_bytes;
+            rx += resps[r].rx_bytes;
+            rx_raw += resps[r].rx_raw_bytes;
+            fpga += resps[r].fpga_seconds;
+            sys += resps[r].host_seconds;
+            std::cout << std::format("run {}: {} sys: {:.4f}s, fpga: {:.5f}s, resends: {}\n", r + 1,
+                    ok ? "OK" : (resps[r].ok ? "FAIL" : "TIMEOUT"), resps[r].host_seconds,
+                    resps[r].fpga_seconds, resps[r].resends);
+        }
+        std::cout << std::format("{}/{} correct, total sys: {:.3f}s, total fpga: {:.5f}s, bulk frames: {}/{}\n",
+                correct, runs, sys, fpga, bulk_runs, runs);
+        /* Wire time at 8E1, the results once each */
+        uint64_t saved = tx_raw + rx_raw - tx - rx;
+        std::cout << std::format("link: sent {} bytes ({} uncompressed), received {} ({}), "
+                "{:.1f}% saved, ~{:.2f} ms less wire time\n", tx, tx_raw, rx, rx_raw,
+                tx_raw + rx_raw ? 100.0 * saved / (tx_raw + rx_raw) : 0.0, 1e3 * 11.0 * saved / baud);
+        return correct == runs ? 0 : 1;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}